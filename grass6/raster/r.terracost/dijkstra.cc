@@ -22,6 +22,10 @@
 #include "pq.h"
 #include "formatNumber.h"
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 #define PQ_TIMER
 #define UPDATE_TIMER
 
@@ -143,6 +147,87 @@ sourceTileDijkstra(const Tile *tile, AMI_STREAM<ijCost> *s2bstr,
 
 
 
+/* number of boundary points whose distances each thread buffers
+   before writing them to b2bstr */
+#define B2B_BUFFER_POINTS 16
+
+/* as doubleWriteToDistStream, but to a buffer */
+static int
+doubleWriteToDistBuffer(const basicIJType& source, const basicIJType& dest, 
+			cost_type dist, distanceType *buf) {
+
+  buf[0] = distanceType(source, dest, dist);
+  if (source != dest) {
+    buf[1] = distanceType(dest, source, dist);
+    return 2;
+  }
+  return 1;
+}
+
+/* 
+ * save the result of the Dijkstra from boundary point (i,j) to buf.
+ * We only save 'forward' results; i.e. dist[i'][j'] where i'>=i and
+ * j'>=j -RW. Returns the number of items written.
+ */
+static int
+saveBoundaryDistances(const Tile *tile, const TileFactory *tf, 
+		      dimension_type i, dimension_type j, int isNullPoint,
+		      cost_type** dist, distanceType *buf) {
+  dimension_type tileSizeRows = tf->getRows();
+  dimension_type tileSizeCols = tf->getCols();
+  int n = 0;
+
+  ijCostSource startPoint = tile->getComplex(i,j);
+
+  /*  row 0 */
+  if (i == 0) {
+    for (int l = 0, m = j; m <tileSizeCols; m++) {
+      assert(tf->isBoundary(l, m));
+      cost_type d = ((dist[l][m] < cost_type_max) && !isNullPoint)? 
+	dist[l][m]: NODATA; 
+      n += doubleWriteToDistBuffer(startPoint, tile->getComplex(l,m), d, buf + n);
+    }
+  }
+  //column 0
+  for (int l=i+(j==tileSizeCols-1?1:0),m = 0; l<tileSizeRows-1; l++) {
+    if (l == 0) continue; 
+    assert(tf->isBoundary(l, m));
+    cost_type d = ((dist[l][m] < cost_type_max) && !isNullPoint)? 
+      dist[l][m]: NODATA; 
+    n += doubleWriteToDistBuffer(startPoint, tile->getComplex(l,m), d, buf + n);
+  }
+  //column tilesizeCols-1
+  for (int l = i, m = tileSizeCols-1; l < tileSizeRows-1; l++) {
+    if (l == 0) continue;
+    assert(tf->isBoundary(l, m));
+    cost_type d = ((dist[l][m] < cost_type_max) && !isNullPoint)? 
+      dist[l][m]: NODATA; 
+    n += doubleWriteToDistBuffer(startPoint, tile->getComplex(l,m), d, buf + n);
+  }
+  //row tileSizeRoows-1
+  for (int l = tileSizeRows-1, m = (i<(tileSizeRows-1)?0:j);
+       m < tileSizeCols; m++) {
+    assert(tf->isBoundary(l, m));
+    cost_type d = ((dist[l][m] < cost_type_max) && !isNullPoint)? 
+      dist[l][m]: NODATA; 
+    n += doubleWriteToDistBuffer(startPoint, tile->getComplex(l,m), d, buf + n);
+  }
+
+  return n;
+}
+
+/* append a thread's buffer to b2bstr */
+static void
+flushDistBuffer(distanceType *buf, int n, AMI_STREAM<distanceType> *b2bstr) {
+#pragma omp critical(b2bstr)
+  {
+    for (int k = 0; k < n; k++) {
+      writeToStreamWithDist(buf[k], b2bstr);
+    }
+  }
+}
+
+
 /* ---------------------------------------------------------------------- */
 /* compute SP from all bnd vertices of the tile and writes the outputs
    to b2bstr; while scanning the tile it sets sourceDist of the points
@@ -159,7 +244,6 @@ boundaryTileDijkstra(Tile *tile, AMI_STREAM<distanceType> *b2bstr,
   /* all these are inputs and must exist */
   assert(tile && b2bstr && tf && dist && spq && sourceDist);
 
-  costStructure tempCS;
   dimension_type tileSizeRows = tf->getRows();
   dimension_type tileSizeCols = tf->getCols();
 
@@ -184,7 +268,6 @@ boundaryTileDijkstra(Tile *tile, AMI_STREAM<distanceType> *b2bstr,
   int numBnd = 0;
   int numNull = 0;              // number of (unseen) nulls
   int realNull = 0;
-  int bndCount = 0;
   int bndShutoff = 0;
   int totalNumBnd = (tileSizeRows-1)*2 + (tileSizeCols-1)*2;
   int totalWrites = 0;
@@ -212,14 +295,20 @@ boundaryTileDijkstra(Tile *tile, AMI_STREAM<distanceType> *b2bstr,
   *stats << "  Num nulls on boundary: " << numNull << endl;
 #endif
 
+  /* collect the boundary points in scan order; the number of
+     boundary points each Dijkstra has to settle depends on the
+     points scanned before */
+  int maxBnd = (tileSizeRows + tileSizeCols) * 2;
+  dimension_type *bndI = new dimension_type[maxBnd];
+  dimension_type *bndJ = new dimension_type[maxBnd];
+  int *bndExpected = new int[maxBnd];
+  int *bndIsNull = new int[maxBnd];
+  int nBnd = 0;
+
   for (int i = 0; i<tileSizeRows; i++) {
     for (int j = 0; j < tileSizeCols; j++) {
-
       if (tf->isBoundary(i,j)) {
-
-#if 1
 		numBnd++;				// reporting only
-		assert(costpq->empty());
 		if (tile->get(i,j).isNull()) {
 		  realNull++;			// reporting only
 		  numNull--;			// numNullRemaining? -RW
@@ -227,108 +316,91 @@ boundaryTileDijkstra(Tile *tile, AMI_STREAM<distanceType> *b2bstr,
 		} else{
 		  isNullPoint = 0;
 		}
-	
 		totalNumBnd--;			// numBndRemaining? -RW
 		bndShutoff = totalNumBnd - numNull; // =num of points to process? -RW
-		dijkstraAbs(tile, i, j, costpq, dist, bndShutoff, &extracts, &updateCalls);
 
-#else
-		/* run dijkstra now */
-		bndCount = 0;
-		ijCostSource startPoint = tile->get(i,j);
-		numBnd++;
+		bndI[nBnd] = i;
+		bndJ[nBnd] = j;
+		bndExpected[nBnd] = bndShutoff;
+		bndIsNull[nBnd] = isNullPoint;
+		nBnd++;
+      }
+    }
+  }
+  assert(nBnd <= maxBnd);
+
+  /* the Dijkstras from the boundary points are independent; each
+     thread gets its own dist grid, pq and output buffer. Everything
+     is allocated here since the memory manager is not thread safe.
+     The order of the items in b2bstr does not matter, it is sorted
+     in step 2. */
+  int nthreads = opt->nthreads;
+  cost_type ***tdist = new cost_type**[nthreads];
+  pqheap_ijCost **tpq = new pqheap_ijCost*[nthreads];
+  distanceType **tbuf = new distanceType*[nthreads];
+  int bufSize = 2 * maxBnd * B2B_BUFFER_POINTS;
+
+  tdist[0] = dist;
+  tpq[0] = costpq;
+  for (int t = 0; t < nthreads; t++) {
+    if (t > 0) {
+      tdist[t] = new cost_type*[tileSizeRows];
+      for (int i = 0; i < tileSizeRows; i++) {
+		tdist[t][i] = new cost_type[tileSizeCols];
+      }
+      tpq[t] = new pqheap_ijCost(heap_size_estimate);
+    }
+    tbuf[t] = new distanceType[bufSize];
+  }
 
-		assert(costpq->empty());
-		if (startPoint.isNull()) {
-		  realNull++;
-		  numNull--;			// numNullRemaining? -RW
-		  isNullPoint = 1;
-		  //continue; 
-		} else{
-		  assert(!startPoint.isNull());
-		  isNullPoint = 0;
-		  //initialize dist grid
-		  for (int l=0; l<tileSizeRows; l++) {
-			for (int m=0; m<tileSizeCols; m++) {
-			  dist[l][m] = cost_type_max;
-			}
-		  }
-		  dist[i][j] = 0;
-		  costpq->insert(costStructure(0.0, i, j));	// start point
-		}
-	
-		totalNumBnd--;			// numBndRemaining? -RW
-		bndShutoff = totalNumBnd - numNull; // =num of points to process? -RW
-	
-		while (!costpq->empty() && bndCount <= bndShutoff) {
-		  costpq->extract_min(&tempCS);
-		  assert(tempCS.getPriority() >= 0);
-		  extracts++;
-		  if (dist[tempCS.getI()][tempCS.getJ()] >= tempCS.getPriority()) {
-			updateCalls++;
-			dist[tempCS.getI()][tempCS.getJ()] = tempCS.getPriority();
-			updateNeighbors(tile, tempCS, costpq, dist);
-			if (tf->isBoundary(tempCS.getI(),tempCS.getJ()) 
-				&& tempCS.getI() >= i && tempCS.getJ() >=j) {
-			  bndCount++;
-			}
-		  }
-		} //	while (!costpq->empty())
-		/* dijkstra done; save boundaries to stream */
+#pragma omp parallel reduction(+:extracts,updateCalls,totalWrites)
+  {
+    int t = 0;
+#if defined(_OPENMP)
+    t = omp_get_thread_num();
 #endif
+    int nbuf = 0;
+
+#pragma omp for schedule(dynamic)
+    for (int b = 0; b < nBnd; b++) {
+      assert(tpq[t]->empty());
+      dijkstraAbs(tile, bndI[b], bndJ[b], tpq[t], tdist[t], bndExpected[b],
+				  &extracts, &updateCalls);
+      int writes = saveBoundaryDistances(tile, tf, bndI[b], bndJ[b],
+										 bndIsNull[b], tdist[t],
+										 tbuf[t] + nbuf);
+      totalWrites += writes;
+      nbuf += writes;
+      tpq[t]->clear();
+      if (nbuf + 2 * maxBnd > bufSize) {
+		flushDistBuffer(tbuf[t], nbuf, b2bstr);
+		nbuf = 0;
+      }
+    }
+    flushDistBuffer(tbuf[t], nbuf, b2bstr);
+  }
 
-		/*
-		 * save the result to file. We only save 'forward' results;
-		 * i.e. dist[i'][j'] where i'>=i and j'>=j -RW
-		 */
-
-		ijCostSource startPoint = tile->getComplex(i,j);
-
-		/*  row 0 */
-		if (i == 0) {
-		  for (int l = 0, m = j; m <tileSizeCols; m++) {
-			assert(tf->isBoundary(l, m));
-			cost_type d = ((dist[l][m] < cost_type_max) && !isNullPoint)? 
-			  dist[l][m]: NODATA; 
-			totalWrites += doubleWriteToDistStream(startPoint, tile->getComplex(l,m),
-												   d, b2bstr);
-		  }
-		}
-		//column 0
-		for (int l=i+(j==tileSizeCols-1?1:0),m = 0; l<tileSizeRows-1; l++) {
-		  if (l == 0) continue; 
-		  assert(tf->isBoundary(l, m));
-		  cost_type d = ((dist[l][m] < cost_type_max) && !isNullPoint)? 
-			dist[l][m]: NODATA; 
-		  totalWrites += doubleWriteToDistStream(startPoint, tile->getComplex(l,m), 
-												 d,b2bstr);
-		}
-		//column tilesizeCols-1
-		for (int l = i, m = tileSizeCols-1; l < tileSizeRows-1; l++) {
-		  if (l == 0) continue;
-		  assert(tf->isBoundary(l, m));
-		  cost_type d = ((dist[l][m] < cost_type_max) && !isNullPoint)? 
-			dist[l][m]: NODATA; 
-		  totalWrites += doubleWriteToDistStream(startPoint, tile->getComplex(l,m),
-												 d,b2bstr);
-		}
-		//row tileSizeRoows-1
-		for (int l = tileSizeRows-1, m = (i<(tileSizeRows-1)?0:j);
-			 m < tileSizeCols; m++) {
-		  assert(tf->isBoundary(l, m));
-		  cost_type d = ((dist[l][m] < cost_type_max) && !isNullPoint)? 
-			dist[l][m]: NODATA; 
-		  totalWrites += doubleWriteToDistStream(startPoint, tile->getComplex(l,m),
-												 d,b2bstr);
-		}
-
-		costpq->clear();  
-      } //if  (tf->isBoundary(i,j))
-
-
-      /* check for sources for next stage.
-       * if the point is not a bnd vertex check if it is a source and
-       * if so insert it in spq */
+  for (int t = 0; t < nthreads; t++) {
+    if (t > 0) {
+      for (int i = 0; i < tileSizeRows; i++) {
+		delete [] tdist[t][i];
+      }
+      delete [] tdist[t];
+      delete tpq[t];
+    }
+    delete [] tbuf[t];
+  }
+  delete [] tdist;
+  delete [] tpq;
+  delete [] tbuf;
+  delete [] bndI;
+  delete [] bndJ;
+  delete [] bndExpected;
+  delete [] bndIsNull;
+
+  /* check for sources for next stage: insert them in spq */
+  for (int i = 0; i<tileSizeRows; i++) {
+    for (int j = 0; j < tileSizeCols; j++) {
       if (tile->get(i,j).isSource()) {
 		DEBUG { cerr << "Source found: " << tile->getComplex(i,j) << "\n";cerr.flush(); }
 		spq->insert( costStructure(0.0, i, j));
@@ -558,6 +630,26 @@ interTileDijkstra(AMI_STREAM<ijCost> *s2bstr,
   SettleLookup settled(nrowsPad, ncolsPad, tf);
   
   AMI_err ae, ae1;
+
+  /* keep the sorted b2bstr in memory if it fits, such that the
+     neighbors of a settled boundary point are looked up directly
+     instead of seeking in the stream; this is done before creating
+     the pq, which adapts to the remaining memory */
+  distanceType *b2bmem = NULL;
+  off_t b2blen = b2bstr->stream_len();
+  if ((size_t)b2blen * sizeof(distanceType) < 
+      MM_manager.memory_available() / 2) {
+    distanceType *dt;
+    b2bmem = new distanceType[b2blen];
+    ae = b2bstr->seek(0);
+    assert(ae == AMI_ERROR_NO_ERROR);
+    for (off_t k = 0; k < b2blen; k++) {
+      ae = b2bstr->read_item(&dt);
+      assert(ae == AMI_ERROR_NO_ERROR);
+      b2bmem[k] = *dt;
+    }
+    cerr << "interTileDijkstra::b2bstr in memory (" << b2blen << " items)\n";
+  }
   ae = s2bstr->seek(0);
   cerr << "s2sstr len: " << s2bstr->stream_len() << endl;cerr.flush();
   
@@ -595,7 +687,7 @@ interTileDijkstra(AMI_STREAM<ijCost> *s2bstr,
     //assert (cp.getDist() != NODATA  && tI != NODATA && tJ != NODATA);
     assert (cp.getDist() != NODATA  && tI != dim_undef && tJ != dim_undef);
     if (!settled.isSettled(tI, tJ, tf)) {
-      updateInterNeighbors(cs, settled, itpq, b2bstr, tf, phase2Bnd);
+      updateInterNeighbors(cs, settled, itpq, b2bstr, b2bmem, tf, phase2Bnd);
       settled.settlePoint(tI, tJ, tf);
       extractedPoint = ijCost(tI, tJ, cp.getDist());
       
@@ -616,6 +708,9 @@ interTileDijkstra(AMI_STREAM<ijCost> *s2bstr,
   cerr << "Total inserts: " << c << ".\n";
   cerr << "Total settles: " << d << ".\n";
   delete itpq;
+  if (b2bmem) {
+    delete [] b2bmem;
+  }
   cerr << "interTileDijkstra::done\n";
 }
 
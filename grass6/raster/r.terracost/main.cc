@@ -21,6 +21,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <pwd.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
   
 extern "C" {
 #include <grass/gis.h>
@@ -120,6 +123,15 @@ parse_args(int argc, char *argv[]) {
   mem->answer      = G_store("400"); /* 400MB default value */
   mem->description = _("Main memory size (in MB)");
 
+  /* number of threads */
+  struct Option *threads;
+  threads = G_define_option() ;
+  threads->key         = "threads";
+  threads->type        = TYPE_INTEGER;
+  threads->required    = NO;
+  threads->answer      = G_store("1");
+  threads->description = _("Number of threads for parallel computing");
+
   /* temporary STREAM path */
   struct Option *streamdir;
   streamdir = G_define_option() ;
@@ -298,6 +310,18 @@ parse_args(int argc, char *argv[]) {
   opt->out_grid = output_cost->answer;
   opt->source_grid = source_grid->answer;
   opt->mem = atoi(mem->answer);
+  opt->nthreads = atoi(threads->answer);
+  if (opt->nthreads < 1) {
+    G_fatal_error (_("threads must be >= 1"));
+  }
+#if defined(_OPENMP)
+  omp_set_num_threads(opt->nthreads);
+#else
+  if (opt->nthreads > 1) {
+    G_warning (_("r.terracost was compiled without OpenMP support, using one thread"));
+  }
+  opt->nthreads = 1;
+#endif
   opt->streamdir= streamdir->answer;
   opt->vtmpdir= vtmpdir->answer;
   opt->verbose= (!quiet->answer);
@@ -397,6 +421,8 @@ void record_args(int argc, char **argv) {
   formatNumber(tmp, mm_size);
   sprintf(buf,"memory size: %s bytes", tmp);
   stats->comment(buf);
+  sprintf(buf,"threads: %d", opt->nthreads);
+  stats->comment(buf);
 }
 
 
@@ -37,6 +37,7 @@ typedef struct {
   char* source_grid; //name or source raster
 
   int   mem;           /* main memory, in MB */
+  int   nthreads;      /* number of threads for the tile Dijkstras */
   char* streamdir;     /* location of temposary STREAMs */
   char *vtmpdir;				/* location of intermediate streams */
 
@@ -272,6 +272,8 @@ public:
 	costStructure *ptr;
 
 	fprintf(stderr, "pqueue: doubling pq from %d elts\n", max_elts);
+	/* the pq may grow in the threads of boundaryTileDijkstra */
+#pragma omp critical(mm_manager)
 	MM_manager.register_allocation(sizeof(costStructure) * max_elts);
 
 	ptr = (costStructure *)realloc(elements, sizeof(costStructure) * max_elts * 2);
@@ -136,7 +136,8 @@ void normalUpdateNeighbors(costStructure costStr,
 void
 updateInterNeighbors(costStructureOld cs, const SettleLookup & settled,
 					 EMPQueueAdaptive<costStructureOld, costPriorityOld> *pq, 
-					 AMI_STREAM<distanceType> *b2bstr, const TileFactory *tf,
+					 AMI_STREAM<distanceType> *b2bstr, 
+					 const distanceType *b2bmem, const TileFactory *tf,
 					 const BoundaryType<cost_type> *phase2Bnd ) {
   
   AMI_err ae;
@@ -161,9 +162,13 @@ updateInterNeighbors(costStructureOld cs, const SettleLookup & settled,
 //     }
 //     assert (marker < b2bstr->stream_len());
 
-  ae = b2bstr->seek(marker);
-  
-  
+  /* b2bmem is the in-memory copy of b2bstr, if any */
+  if (b2bmem) {
+    ae = AMI_ERROR_NO_ERROR;
+  } else {
+    ae = b2bstr->seek(marker);
+  }
+
 
   for (int a = 0; a<numNeighbors && ae == AMI_ERROR_NO_ERROR; a++) {
 //     if (a+marker >= b2bstr->stream_len()) {
@@ -173,8 +178,12 @@ updateInterNeighbors(costStructureOld cs, const SettleLookup & settled,
 // 	b2bstr->stream_len() << "\n";cout.flush();
 //     }
 //     assert (a+marker < b2bstr->stream_len());
-    ae = b2bstr->read_item(&dType);
-    assert(ae == AMI_ERROR_NO_ERROR);
+    if (b2bmem) {
+      dType = (distanceType *)&b2bmem[marker + a];
+    } else {
+      ae = b2bstr->read_item(&dType);
+      assert(ae == AMI_ERROR_NO_ERROR);
+    }
     neighborI = dType->getToI();
     neighborJ = dType->getToJ();
 
@@ -73,6 +73,7 @@ void normalUpdateNeighbors(costStructure costStr,
 void updateInterNeighbors(costStructureOld cs, const SettleLookup & ar,
 						  EMPQueueAdaptive<costStructureOld, costPriorityOld> *pq, 
 						  AMI_STREAM<distanceType> *b2bstr, 
+						  const distanceType *b2bmem,
 						  const TileFactory *tf,
 						  const BoundaryType<cost_type> *phase2Bnd );
 
@@ -380,6 +380,168 @@ init_event_list_in_memory(AEvent * eventList, char *rastName,
 
 
 
+/*  ************************************************************ */
+/* read the elevation raster into memory, one row of surface_type per
+   raster row; NULL cells stay NULL. Used by the batch mode, where the
+   events of all viewpoints are computed from the same grid. */
+surface_type **read_elevation_grid(char *rastName, GridHeader * hd)
+{
+    G_message(_("Reading elevation raster ..."));
+    assert(rastName && hd);
+
+    char *mapset;
+
+    mapset = G_find_cell(rastName, "");
+    if (mapset == NULL)
+	G_fatal_error(_("Raster map [%s] not found"), rastName);
+
+    int infd;
+
+    if ((infd = G_open_cell_old(rastName, mapset)) < 0)
+	G_fatal_error(_("Cannot open raster file [%s]"), rastName);
+
+    surface_type **elev;
+    dimensionType i;
+
+    elev = (surface_type **)G_malloc(hd->nrows * sizeof(surface_type *));
+    elev[0] = (surface_type *)G_malloc((size_t)hd->nrows * hd->ncols *
+                                       sizeof(surface_type));
+    for (i = 0; i < hd->nrows; i++) {
+	G_percent(i, hd->nrows, 2);
+	elev[i] = elev[0] + (size_t)i * hd->ncols;
+	G_get_raster_row(infd, elev[i], i, G_SURFACE_TYPE);
+    }
+    G_percent(hd->nrows, hd->nrows, 2);
+
+    G_close_cell(infd);
+
+    return elev;
+}
+
+
+/*  ************************************************************ */
+/* same as init_event_list_in_memory, but the events are computed
+   from the elevation grid in memory and nothing is written to a
+   visibility grid. The viewpoint elevation must be valid. Only rows
+   and columns within maxDist of the viewpoint are scanned if the
+   distance is planimetric. data must hold 3 rows, nullrow is a row of
+   NULL values. Does not print messages and can be called from several
+   threads at once, as long as the projection is not lat/lon. */
+size_t
+init_event_list_from_grid(AEvent * eventList, surface_type **elev,
+			  G_SURFACE_T *nullrow, Viewpoint * vp,
+			  GridHeader * hd, ViewOptions viewOptions,
+			  surface_type **data)
+{
+    assert(eventList && elev && nullrow && vp && hd && data);
+
+    int nrows = hd->nrows;
+    int ncols = hd->ncols;
+    int row0 = 0, row1 = nrows, col0 = 0, col1 = ncols;
+
+    if ((int)viewOptions.maxDist != INFINITY_DISTANCE &&
+	G_projection() != PROJECTION_LL) {
+	int dr = (int)(viewOptions.maxDist / hd->ns_res) + 1;
+	int dc = (int)(viewOptions.maxDist / hd->ew_res) + 1;
+
+	row0 = (vp->row - dr > 0 ? vp->row - dr : 0);
+	row1 = (vp->row + dr + 1 < nrows ? vp->row + dr + 1 : nrows);
+	col0 = (vp->col - dc > 0 ? vp->col - dc : 0);
+	col1 = (vp->col + dc + 1 < ncols ? vp->col + dc + 1 : ncols);
+    }
+
+    G_set_null_value(data[0], ncols, G_SURFACE_TYPE);
+    G_set_null_value(data[1], ncols, G_SURFACE_TYPE);
+    G_set_null_value(data[2], ncols, G_SURFACE_TYPE);
+
+    vp->elev = elev[vp->row][vp->col] + viewOptions.obsElev;
+    if (viewOptions.tgtElev > 0)
+	vp->target_offset = viewOptions.tgtElev;
+    else
+	vp->target_offset = 0.;
+
+    G_SURFACE_T *inrast[3];
+    size_t nevents = 0;
+    int i, j;
+    double ax, ay;
+    AEvent e;
+
+    e.angle = -1;
+    for (i = row0; i < row1; i++) {
+	inrast[0] = (i > 0 ? elev[i - 1] : nullrow);
+	inrast[1] = elev[i];
+	inrast[2] = (i < nrows - 1 ? elev[i + 1] : nullrow);
+
+	for (j = col0; j < col1; j++) {
+	    e.row = i;
+	    e.col = j;
+
+	    /*don't insert NODATA cells and the viewpoint */
+	    if (G_is_null_value(&(inrast[1][j]), G_SURFACE_TYPE))
+		continue;
+
+	    e.elev[1] = adjust_for_curvature(*vp, i, j, inrast[1][j],
+					     viewOptions, hd);
+
+	    if (i == vp->row) {
+		data[0][j] = e.elev[1];
+		data[1][j] = e.elev[1];
+		data[2][j] = e.elev[1];
+	    }
+
+	    if (i == vp->row && j == vp->col)
+		continue;
+
+	    if (is_point_outside_max_dist(*vp, *hd, i, j, viewOptions.maxDist))
+		continue;
+
+	    e.eventType = ENTERING_EVENT;
+	    e.elev[0] = calculate_event_elevation(e, nrows, ncols,
+	                               vp->row, vp->col, inrast, G_SURFACE_TYPE);
+	    if (viewOptions.doCurv) {
+		calculate_event_position(e, vp->row, vp->col, &ay, &ax);
+		e.elev[0] = adjust_for_curvature(*vp, ay, ax, e.elev[0], viewOptions, hd);
+	    }
+
+	    e.eventType = EXITING_EVENT;
+	    e.elev[2] = calculate_event_elevation(e, nrows, ncols,
+	                               vp->row, vp->col, inrast, G_SURFACE_TYPE);
+	    if (viewOptions.doCurv) {
+		calculate_event_position(e, vp->row, vp->col, &ay, &ax);
+		e.elev[2] = adjust_for_curvature(*vp, ay, ax, e.elev[2], viewOptions, hd);
+	    }
+
+	    if (i == vp->row) {
+		data[0][j] = e.elev[0];
+		data[1][j] = e.elev[1];
+		data[2][j] = e.elev[2];
+	    }
+
+	    e.eventType = ENTERING_EVENT;
+	    calculate_event_position(e, vp->row, vp->col, &ay, &ax);
+	    e.angle = calculate_angle(ax, ay, vp->col, vp->row);
+	    eventList[nevents] = e;
+	    nevents++;
+
+	    e.eventType = CENTER_EVENT;
+	    calculate_event_position(e, vp->row, vp->col, &ay, &ax);
+	    e.angle = calculate_angle(ax, ay, vp->col, vp->row);
+	    eventList[nevents] = e;
+	    nevents++;
+
+	    e.eventType = EXITING_EVENT;
+	    calculate_event_position(e, vp->row, vp->col, &ay, &ax);
+	    e.angle = calculate_angle(ax, ay, vp->col, vp->row);
+	    eventList[nevents] = e;
+	    nevents++;
+	}
+    }
+
+    return nevents;
+}
+
+
+
 
 
 /* ************************************************************ */
@@ -609,6 +771,43 @@ AMI_STREAM < AEvent > *init_event_list(char *rastName, Viewpoint * vp,
 
 
 
+/* ************************************************************ */
+/*  saves the cumulative visibility counts of the batch mode into a
+   CELL raster; cells that are NULL in the elevation grid are NULL. */
+void
+save_count_grid_to_GRASS(CELL *count, surface_type **elev, GridHeader *hd,
+			 char *filename)
+{
+    G_important_message(_("Writing output raster map..."));
+    assert(count && elev && hd && filename);
+
+    int outfd;
+
+    outfd = G_open_raster_new(filename, CELL_TYPE);
+
+    CELL *outrast;
+
+    outrast = G_allocate_c_raster_buf();
+
+    dimensionType i, j;
+
+    for (i = 0; i < hd->nrows; i++) {
+	for (j = 0; j < hd->ncols; j++) {
+	    if (G_is_null_value(&(elev[i][j]), G_SURFACE_TYPE))
+		G_set_c_null_value(&outrast[j], 1);
+	    else
+		outrast[j] = count[(size_t)i * hd->ncols + j];
+	}
+	G_put_raster_row(outfd, outrast, CELL_TYPE);
+    }
+
+    G_free(outrast);
+    G_close_cell(outfd);
+    return;
+}
+
+
+
 /* ************************************************************ */
 /*  saves the grid into a GRASS raster.  Loops through all elements x
    in row-column order and writes fun(x) to file. */
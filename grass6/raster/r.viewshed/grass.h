@@ -92,6 +92,21 @@ init_event_list_in_memory(AEvent * eventList, char *rastName,
 
 
 
+/* ************************************************************ */
+/* read the elevation raster into memory, NULL cells stay NULL */
+surface_type **read_elevation_grid(char *rastName, GridHeader * hd);
+
+/* ************************************************************ */
+/* same as init_event_list_in_memory, but the events are computed from
+   the elevation grid in memory and no visibility grid is touched. data
+   must hold 3 rows, nullrow is a row of NULL values. Used by the batch
+   mode, it can be called from several threads at once. */
+size_t
+init_event_list_from_grid(AEvent * eventList, surface_type **elev,
+			  G_SURFACE_T *nullrow, Viewpoint * vp,
+			  GridHeader * hd, ViewOptions viewOptions,
+			  surface_type **data);
+
 /* ************************************************************ */
 /* input: an arcascii file, a grid header and a viewpoint; action:
    figure out all events in the input file, and write them to the
@@ -108,6 +123,13 @@ AMI_STREAM < AEvent > *init_event_list(char *rastName, Viewpoint * vp,
 					     IOVisibilityGrid * visgrid);
 
 
+/* ************************************************************ */
+/*  saves the cumulative visibility counts of the batch mode into a
+   CELL raster, NULL where the elevation is NULL */
+void
+save_count_grid_to_GRASS(CELL *count, surface_type **elev, GridHeader *hd,
+			 char *filename);
+
 /* ************************************************************ */
 /*  saves the grid into a GRASS raster.  Loops through all elements x
    in row-column order and writes fun(x) to file. */
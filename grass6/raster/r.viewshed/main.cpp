@@ -41,6 +41,10 @@
 #include <ctype.h>
 #include <unistd.h>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 extern "C"
 {
 #include <grass/config.h>
@@ -93,8 +97,8 @@ void print_timings_internal(Rtimer sweepTime, Rtimer outputTime,
 void print_timings_external_memory(Rtimer totalTime, Rtimer viewshedTime,
 				   Rtimer outputTime, Rtimer sortOutputTime);
 
-void parse_args(int argc, char *argv[], int *vpRow, int *vpCol,
-		ViewOptions * viewOptions, long long *memSizeBytes,
+void parse_args(int argc, char *argv[], int **vpRows, int **vpCols,
+		int *nvps, ViewOptions * viewOptions, long long *memSizeBytes,
 		Cell_head * window);
 
 
@@ -131,12 +135,14 @@ int main(int argc, char *argv[])
        used.  The program uses this value to decied in which mode to
        run --- in internal memory, or external memory.  */
 
-    int vpRow, vpCol;
+    int *vpRows, *vpCols, nvps;
 
-    /* the coordinates of the viewpoint in the raster; right now the
+    /* the coordinates of the viewpoint(s) in the raster; right now the
        algorithm assumes that the viewpoint is inside the grid, though
        this is not necessary; some changes will be needed to make it
-       work with a viewpoint outside the terrain */
+       work with a viewpoint outside the terrain. With more than one
+       viewpoint, the module runs in batch mode and outputs the
+       cumulative viewshed */
 
     ViewOptions viewOptions;
 
@@ -149,16 +155,17 @@ int main(int argc, char *argv[])
     viewOptions.doCurv = FALSE;
     viewOptions.doRefr = FALSE;
     viewOptions.refr_coef = 1.0/7.0;
+    viewOptions.nthreads = 1;
 
-    parse_args(argc, argv, &vpRow, &vpCol, &viewOptions, &memSizeBytes,
-	       &region);
+    parse_args(argc, argv, &vpRows, &vpCols, &nvps, &viewOptions,
+	       &memSizeBytes, &region);
 
     /* set viewpoint with the coordinates specified by user. The
        height of the viewpoint is not known at this point---it will be
        set during the execution of the algorithm */
     Viewpoint vp;
 
-    set_viewpoint_coord(&vp, vpRow, vpCol);
+    set_viewpoint_coord(&vp, vpRows[0], vpCols[0]);
 
 
     /* ************************************************************ */
@@ -173,12 +180,36 @@ int main(int argc, char *argv[])
     /* LT: there is no need to exit if viewpoint is outside grid,
        the algorithm will work correctly in theory. But this
        requires some changes. To do. */
-    if (!(vp.row < hd->nrows && vp.col < hd->ncols)) {
+    if (nvps == 1 && !(vp.row < hd->nrows && vp.col < hd->ncols)) {
 	G_warning(_("Viewpoint outside grid"));
 	G_warning(_("viewpont: (row=%d, col=%d)"), vp.row, vp.col);
 	G_fatal_error(_("grid: (rows=%d, cols=%d)"), hd->nrows, hd->ncols);
     }
 
+    /* in batch mode, viewpoints outside the grid are skipped */
+    Viewpoint *vps = NULL;
+
+    if (nvps > 1) {
+	int k, n = 0;
+
+	vps = (Viewpoint *) G_malloc(nvps * sizeof(Viewpoint));
+	for (k = 0; k < nvps; k++) {
+	    if (vpRows[k] < 0 || vpRows[k] >= hd->nrows ||
+		vpCols[k] < 0 || vpCols[k] >= hd->ncols) {
+		G_warning(_("Viewpoint (row=%d, col=%d) outside grid, skipped"),
+			  vpRows[k], vpCols[k]);
+		continue;
+	    }
+	    set_viewpoint_coord(&vps[n], vpRows[k], vpCols[k]);
+	    n++;
+	}
+	if (n == 0)
+	    G_fatal_error(_("No viewpoint inside the grid"));
+	nvps = n;
+    }
+    G_free(vpRows);
+    G_free(vpCols);
+
 
     /* set curvature params */
     viewOptions.cellsize = region.ew_res;
@@ -194,6 +225,11 @@ int main(int argc, char *argv[])
 
     G_begin_distance_calculations();
 
+    /* geodesic distances are computed with static state */
+    if (viewOptions.nthreads > 1 && G_projection() == PROJECTION_LL) {
+	G_warning(_("Lat/lon location, using one thread"));
+	viewOptions.nthreads = 1;
+    }
 
 
 
@@ -229,10 +265,61 @@ int main(int argc, char *argv[])
 #endif
 
 
+    /* ************************************************************ */
+    /* batch mode: cumulative viewshed of many viewpoints in memory */
+    /* ************************************************************ */
+    if (nvps > 1) {
+	Rtimer totalTime, outputTime, sweepTime;
+
+	/* all event lists must fit, use less threads if necessary */
+	while (viewOptions.nthreads > 1 &&
+	       get_viewshed_batch_memory_usage(hd, viewOptions,
+					       viewOptions.nthreads) > memSizeBytes)
+	    viewOptions.nthreads--;
+
+	long long batchSizeBytes =
+	    get_viewshed_batch_memory_usage(hd, viewOptions, viewOptions.nthreads);
+
+	G_verbose_message(_("Batch mode memory usage is %lld B (%d MB) with %d threads"),
+			  batchSizeBytes, (int)(batchSizeBytes >> 20),
+			  viewOptions.nthreads);
+	if (batchSizeBytes > memSizeBytes)
+	    G_fatal_error(_("Batch mode runs in memory and needs %d MB, "
+			    "increase the memory option or set max_dist"),
+			  (int)(batchSizeBytes >> 20) + 1);
+#if defined(_OPENMP)
+	omp_set_num_threads(viewOptions.nthreads);
+#endif
+
+	rt_start(totalTime);
+
+	rt_start(sweepTime);
+	surface_type **elev = read_elevation_grid(viewOptions.inputfname, hd);
+	CELL *count = viewshed_batch(elev, hd, vps, nvps, viewOptions);
+
+	rt_stop(sweepTime);
+
+	rt_start(outputTime);
+	save_count_grid_to_GRASS(count, elev, hd, viewOptions.outputfname);
+	rt_stop(outputTime);
+
+	rt_stop(totalTime);
+
+	print_timings_internal(sweepTime, outputTime, totalTime);
+
+	G_free(count);
+	G_free(elev[0]);
+	G_free(elev);
+	G_free(vps);
+    }
+
+
+
+
     /* ************************************************************ */
     /* compute viewshed in memory */
     /* ************************************************************ */
-    if (IN_MEMORY) {
+    else if (IN_MEMORY) {
 	/*//////////////////////////////////////////////////// */
 	/*/viewshed in internal  memory */
 	/*//////////////////////////////////////////////////// */
@@ -426,12 +513,12 @@ int main(int argc, char *argv[])
 /* ------------------------------------------------------------ */
 /* parse arguments */
 void
-parse_args(int argc, char *argv[], int *vpRow, int *vpCol,
-	   ViewOptions * viewOptions, long long *memSizeBytes,
+parse_args(int argc, char *argv[], int **vpRows, int **vpCols,
+	   int *nvps, ViewOptions * viewOptions, long long *memSizeBytes,
 	   Cell_head * window)
 {
 
-    assert(vpRow && vpCol && memSizeBytes && window);
+    assert(vpRows && vpCols && nvps && memSizeBytes && window);
 
     /* the input */
     struct Option *inputOpt;
@@ -488,11 +575,25 @@ parse_args(int argc, char *argv[], int *vpRow, int *vpCol,
     viewLocOpt = G_define_option();
     viewLocOpt->key = "coordinate";
     viewLocOpt->type = TYPE_STRING;
-    viewLocOpt->required = YES;
+    viewLocOpt->required = NO;
+    viewLocOpt->multiple = YES;
     viewLocOpt->key_desc = "east,north";
-    viewLocOpt->description = _("Coordinates of viewing position");
+    viewLocOpt->label = _("Coordinates of viewing position");
+    viewLocOpt->description =
+	_("With more than one position the output is the number of "
+	  "positions a cell is visible from");
     viewLocOpt->guisection = _("Input_options");
 
+    /* file with viewpoint coordinates */
+    struct Option *viewFileOpt;
+
+    viewFileOpt = G_define_standard_option(G_OPT_F_INPUT);
+    viewFileOpt->key = "coordinate_file";
+    viewFileOpt->required = NO;
+    viewFileOpt->description =
+	_("File with coordinates of viewing positions, one 'east north' pair per line");
+    viewFileOpt->guisection = _("Input_options");
+
     /* observer elevation */
     struct Option *obsElevOpt;
 
@@ -587,6 +688,16 @@ parse_args(int argc, char *argv[], int *vpRow, int *vpCol,
     streamdirOpt->description=
        _("Directory to hold temporary files (they can be large)");
 
+    /* number of threads for the batch mode */
+    struct Option *threadsOpt;
+
+    threadsOpt = G_define_option();
+    threadsOpt->key = "threads";
+    threadsOpt->type = TYPE_INTEGER;
+    threadsOpt->required = NO;
+    threadsOpt->answer = "1";
+    threadsOpt->description = _("Number of threads for parallel computing");
+
     /*fill the options and flags with G_parser */
     if (G_parser(argc, argv))
 	exit(EXIT_FAILURE);
@@ -631,14 +742,80 @@ parse_args(int argc, char *argv[], int *vpRow, int *vpCol,
     *memSizeBytes = (long long)memSizeMB;
     *memSizeBytes = (*memSizeBytes) << 20;
 
+    viewOptions->nthreads = atoi(threadsOpt->answer);
+    if (viewOptions->nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than zero"), threadsOpt->key);
+#if !defined(_OPENMP)
+    if (viewOptions->nthreads > 1) {
+	G_warning(_("r.viewshed was compiled without OpenMP support, using one thread"));
+	viewOptions->nthreads = 1;
+    }
+#endif
+
     G_get_set_window(window);
 
+    /*collect the viewpoints, as easting northing pairs */
+    int n = 0, nalloc = 0;
+    double *coords = NULL;
+
+    if (viewLocOpt->answers) {
+	for (int k = 0; viewLocOpt->answers[k]; k += 2) {
+	    if (!viewLocOpt->answers[k + 1])
+		G_fatal_error(_("Odd number of values for <%s>"), viewLocOpt->key);
+	    if (n == nalloc) {
+		nalloc += 64;
+		coords = (double *)G_realloc(coords, 2 * nalloc * sizeof(double));
+	    }
+	    coords[2 * n] = atof(viewLocOpt->answers[k]);
+	    coords[2 * n + 1] = atof(viewLocOpt->answers[k + 1]);
+	    n++;
+	}
+    }
+
+    if (viewFileOpt->answer) {
+	FILE *fp;
+	char buf[1024];
+	double east, north;
+
+	if (!(fp = fopen(viewFileOpt->answer, "r")))
+	    G_fatal_error(_("Unable to open file <%s>"), viewFileOpt->answer);
+
+	while (G_getl2(buf, sizeof(buf) - 1, fp)) {
+	    G_strchg(buf, ',', ' ');
+	    if (sscanf(buf, "%lf %lf", &east, &north) != 2)
+		continue;
+	    if (n == nalloc) {
+		nalloc += 1024;
+		coords = (double *)G_realloc(coords, 2 * nalloc * sizeof(double));
+	    }
+	    coords[2 * n] = east;
+	    coords[2 * n + 1] = north;
+	    n++;
+	}
+	fclose(fp);
+    }
+
+    if (n == 0)
+	G_fatal_error(_("No viewing position given, use <%s> or <%s>"),
+		      viewLocOpt->key, viewFileOpt->key);
+
     /*The algorithm runs with the viewpoint row and col, so we need to
         convert the lat-lon coordinates to row and column format */
-    *vpRow = (int)G_northing_to_row(atof(viewLocOpt->answers[1]), window);
-    *vpCol = (int)G_easting_to_col(atof(viewLocOpt->answers[0]), window);
-    G_debug(3, "viewpoint converted from current projection: (%.3f, %.3f)  to col, row (%d, %d)",
-        atof(viewLocOpt->answers[0]), atof(viewLocOpt->answers[1]), *vpCol, *vpRow);
+    *nvps = n;
+    *vpRows = (int *)G_malloc(n * sizeof(int));
+    *vpCols = (int *)G_malloc(n * sizeof(int));
+    for (int k = 0; k < n; k++) {
+	(*vpRows)[k] = (int)G_northing_to_row(coords[2 * k + 1], window);
+	(*vpCols)[k] = (int)G_easting_to_col(coords[2 * k], window);
+	G_debug(3, "viewpoint converted from current projection: (%.3f, %.3f)  to col, row (%d, %d)",
+	    coords[2 * k], coords[2 * k + 1], (*vpCols)[k], (*vpRows)[k]);
+    }
+    G_free(coords);
+
+    if (n > 1 && viewOptions->outputMode != OUTPUT_ANGLE)
+	G_warning(_("Output format flags are ignored with several viewing "
+		    "positions, the output is the number of positions a cell "
+		    "is visible from"));
 
     return;
 }
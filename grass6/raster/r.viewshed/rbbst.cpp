@@ -81,7 +81,12 @@ extern "C"
 
 
 
-TreeNode *NIL;
+/* the sentinel is written to during rotations and deletions, each
+   thread sweeping its own tree needs its own sentinel */
+TreeNode *NIL = NULL;
+#if defined(_OPENMP)
+#pragma omp threadprivate(NIL)
+#endif
 
 #define EPSILON 0.0000001
 
@@ -154,6 +159,10 @@ double find_max_gradient_within_key(RBTree * rbt, double key, double angle, doub
    //Private below this line */
 void init_nil_node()
 {
+    /* allocated once per thread and shared by all its trees */
+    if (NIL != NULL)
+	return;
+
     NIL = (TreeNode *) G_malloc(sizeof(TreeNode));
     NIL->color = RB_BLACK;
     NIL->value.angle[0] = 0;
@@ -51,6 +51,10 @@ extern "C"
 #include "statusstructure.h"
 #include "grass.h"
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 
 #define VIEWSHEDDEBUG if(0)
 #define INMEMORY_DEBUG if(0)
@@ -445,6 +449,263 @@ MemoryVisibilityGrid *viewshed_in_memory(char *inputfname, GridHeader * hd,
 
 
 
+/* ------------------------------------------------------------ */
+/* return the max number of events of one viewpoint in batch mode:
+   the cells within max_dist of the viewpoint if it is planimetric,
+   the whole grid otherwise */
+static long long get_batch_max_events(GridHeader * hd,
+				      ViewOptions viewOptions)
+{
+    long long nrows = hd->nrows, ncols = hd->ncols;
+
+    if ((int)viewOptions.maxDist != INFINITY_DISTANCE &&
+	G_projection() != PROJECTION_LL) {
+	long long r = 2 * ((long long)(viewOptions.maxDist / hd->ns_res) + 1) + 1;
+	long long c = 2 * ((long long)(viewOptions.maxDist / hd->ew_res) + 1) + 1;
+
+	if (r < nrows)
+	    nrows = r;
+	if (c < ncols)
+	    ncols = c;
+    }
+
+    return nrows * ncols * 3;
+}
+
+
+/* ------------------------------------------------------------ */
+/* return the memory usage (in bytes) of the batch mode with the given
+   number of threads: the elevation grid, the counts and one event
+   list per thread */
+long long get_viewshed_batch_memory_usage(GridHeader * hd,
+					  ViewOptions viewOptions,
+					  int nthreads)
+{
+    long long totalcells = (long long)hd->nrows * (long long)hd->ncols;
+    long long gridMemUsage = totalcells * (sizeof(surface_type) + sizeof(CELL));
+    long long eventListMemUsage = get_batch_max_events(hd, viewOptions) *
+	sizeof(AEvent);
+
+    return gridMemUsage + nthreads * eventListMemUsage;
+}
+
+
+/* ------------------------------------------------------------ */
+/* sweep the sorted events of one viewpoint and increment count for
+   every visible cell; same as the sweep in viewshed_in_memory */
+static long sweep_count_visible(AEvent * eventList, size_t nevents,
+				surface_type **data, Viewpoint * vp,
+				GridHeader * hd, ViewOptions viewOptions,
+				CELL * count)
+{
+    StatusList *status_struct = create_status_struct();
+    StatusNode sn;
+    long nvis = 0;
+
+    /*Put cells that are initially on the sweepline into status structure */
+    for (dimensionType i = vp->col + 1; i < hd->ncols; i++) {
+	AEvent e;
+	double ax, ay;
+
+	sn.col = i;
+	sn.row = vp->row;
+	e.col = i;
+	e.row = vp->row;
+	e.elev[0] = data[0][i];
+	e.elev[1] = data[1][i];
+	e.elev[2] = data[2][i];
+
+	if (!G_is_null_value(&(data[1][i]), G_SURFACE_TYPE) &&
+	    !is_point_outside_max_dist(*vp, *hd, sn.row, sn.col,
+				       viewOptions.maxDist)) {
+	    e.eventType = ENTERING_EVENT;
+	    calculate_event_position(e, vp->row, vp->col, &ay, &ax);
+	    sn.angle[0] = calculate_angle(ax, ay, vp->col, vp->row);
+	    calculate_event_gradient(&sn, 0, ay, ax, e.elev[0], vp, *hd);
+
+	    e.eventType = CENTER_EVENT;
+	    calculate_event_position(e, vp->row, vp->col, &ay, &ax);
+	    sn.angle[1] = calculate_angle(ax, ay, vp->col, vp->row);
+	    calculate_dist_n_gradient(&sn, e.elev[1], vp, *hd);
+
+	    e.eventType = EXITING_EVENT;
+	    calculate_event_position(e, vp->row, vp->col, &ay, &ax);
+	    sn.angle[2] = calculate_angle(ax, ay, vp->col, vp->row);
+	    calculate_event_gradient(&sn, 2, ay, ax, e.elev[2], vp, *hd);
+
+	    if (sn.angle[0] > sn.angle[1])
+		sn.angle[0] -= 2 * M_PI;
+
+	    insert_into_status_struct(sn, status_struct);
+	}
+    }
+
+    /*the viewpoint sees itself */
+#pragma omp atomic
+    count[(size_t)vp->row * hd->ncols + vp->col]++;
+
+    for (size_t i = 0; i < nevents; i++) {
+	AEvent *e = &(eventList[i]);
+	double ax, ay;
+
+	sn.col = e->col;
+	sn.row = e->row;
+	calculate_dist_n_gradient(&sn, e->elev[1] + vp->target_offset, vp, *hd);
+
+	switch (e->eventType) {
+	case ENTERING_EVENT:
+	    sn.angle[0] = e->angle;
+	    calculate_event_position(*e, vp->row, vp->col, &ay, &ax);
+	    calculate_event_gradient(&sn, 0, ay, ax, e->elev[0], vp, *hd);
+
+	    e->eventType = CENTER_EVENT;
+	    calculate_event_position(*e, vp->row, vp->col, &ay, &ax);
+	    sn.angle[1] = calculate_angle(ax, ay, vp->col, vp->row);
+	    calculate_dist_n_gradient(&sn, e->elev[1], vp, *hd);
+
+	    e->eventType = EXITING_EVENT;
+	    calculate_event_position(*e, vp->row, vp->col, &ay, &ax);
+	    sn.angle[2] = calculate_angle(ax, ay, vp->col, vp->row);
+	    calculate_event_gradient(&sn, 2, ay, ax, e->elev[2], vp, *hd);
+
+	    e->eventType = ENTERING_EVENT;
+
+	    if (e->angle < M_PI) {
+		if (sn.angle[0] > sn.angle[1])
+		    sn.angle[0] -= 2 * M_PI;
+	    }
+	    else {
+		if (sn.angle[0] > sn.angle[1]) {
+		    sn.angle[1] += 2 * M_PI;
+		    sn.angle[2] += 2 * M_PI;
+		}
+	    }
+
+	    insert_into_status_struct(sn, status_struct);
+	    break;
+
+	case EXITING_EVENT:
+	    delete_from_status_struct(status_struct, sn.dist2vp);
+	    break;
+
+	case CENTER_EVENT:
+	    if (find_max_gradient_in_status_struct(status_struct, sn.dist2vp,
+		                                   e->angle, sn.gradient[1])
+		<= sn.gradient[1]) {
+#pragma omp atomic
+		count[(size_t)sn.row * hd->ncols + sn.col]++;
+		nvis++;
+	    }
+	    break;
+	}
+    }
+
+    delete_status_structure(status_struct);
+
+    return nvis;
+}
+
+
+/*///////////////////////////////////////////////////////////
+   ------------------------------------------------------------
+   Batch mode: run Viewshed's sweep for all the given viewpoints on
+   the elevation grid in memory (see read_elevation_grid).  The DEM is
+   read only once and the viewpoints are swept in parallel, each
+   thread with its own event list and status structure.  Returns for
+   each cell (row-major) the number of viewpoints it is visible from.
+   Viewpoints on NULL cells are skipped.
+ */
+CELL *viewshed_batch(surface_type **elev, GridHeader * hd,
+		     Viewpoint * vps, int nvps, ViewOptions viewOptions)
+{
+    assert(elev && hd && vps);
+
+    int nthreads = viewOptions.nthreads;
+    size_t maxevents = (size_t)get_batch_max_events(hd, viewOptions);
+
+    G_debug(1, "batch mode: %d viewpoints, %d threads, %lu events per viewpoint",
+	    nvps, nthreads, (long unsigned int)maxevents);
+
+    CELL *count = (CELL *)G_calloc((size_t)hd->nrows * hd->ncols, sizeof(CELL));
+
+    G_SURFACE_T *nullrow = (G_SURFACE_T *)G_malloc(hd->ncols * sizeof(G_SURFACE_T));
+
+    G_set_null_value(nullrow, hd->ncols, G_SURFACE_TYPE);
+
+    /*per thread event list and rows through the viewpoint */
+    AEvent **eventLists = (AEvent **)G_malloc(nthreads * sizeof(AEvent *));
+    surface_type ***datas = (surface_type ***)G_malloc(nthreads * sizeof(surface_type **));
+
+    for (int t = 0; t < nthreads; t++) {
+	eventLists[t] = (AEvent *)G_malloc(maxevents * sizeof(AEvent));
+	datas[t] = (surface_type **)G_malloc(3 * sizeof(surface_type *));
+	datas[t][0] = (surface_type *)G_malloc(3 * hd->ncols * sizeof(surface_type));
+	datas[t][1] = datas[t][0] + hd->ncols;
+	datas[t][2] = datas[t][1] + hd->ncols;
+    }
+
+    /* NULL viewpoints are reported here, the threads don't print */
+    char *skip = (char *)G_calloc(nvps, sizeof(char));
+
+    for (int k = 0; k < nvps; k++) {
+	if (G_is_null_value(&(elev[vps[k].row][vps[k].col]), G_SURFACE_TYPE)) {
+	    G_warning(_("Viewpoint (row=%d, col=%d) is NODATA, skipped"),
+		      vps[k].row, vps[k].col);
+	    skip[k] = 1;
+	}
+    }
+
+    G_important_message(_("Computing visibility for %d viewpoints..."), nvps);
+
+    int ndone = 0;
+    long long nvis = 0;
+
+#pragma omp parallel for schedule(dynamic) reduction(+:nvis)
+    for (int k = 0; k < nvps; k++) {
+	int t = 0;
+
+#if defined(_OPENMP)
+	t = omp_get_thread_num();
+#endif
+	if (!skip[k]) {
+	    Viewpoint vp = vps[k];
+	    size_t nevents;
+	    RadialCompare cmpObj;
+
+	    nevents = init_event_list_from_grid(eventLists[t], elev, nullrow,
+						&vp, hd, viewOptions, datas[t]);
+	    assert(nevents <= maxevents);
+	    quicksort(eventLists[t], nevents, cmpObj);
+	    nvis += sweep_count_visible(eventLists[t], nevents, datas[t], &vp,
+					hd, viewOptions, count);
+	}
+
+#pragma omp critical(batch_percent)
+	{
+	    ndone++;
+	    G_percent(ndone, nvps, 1);
+	}
+    }
+
+    G_verbose_message(_("Sweeping done, %lld visible cells in total."), nvis);
+
+    /*cleanup */
+    for (int t = 0; t < nthreads; t++) {
+	G_free(eventLists[t]);
+	G_free(datas[t][0]);
+	G_free(datas[t]);
+    }
+    G_free(eventLists);
+    G_free(datas);
+    G_free(nullrow);
+    G_free(skip);
+
+    return count;
+}
+
+
+
+
 /*///////////////////////////////////////////////////////////
    ------------------------------------------------------------ 
    run Viewshed's algorithm on the grid stored in the given file, and
@@ -96,6 +96,25 @@ IOVisibilityGrid *viewshed_external(char *inputfname,
 
 
 
+/* ------------------------------------------------------------ */
+/*return the memory usage in bytes of the batch mode with the given
+   number of threads */
+long long get_viewshed_batch_memory_usage(GridHeader * hd,
+					  ViewOptions viewOptions,
+					  int nthreads);
+
+
+
+/* ------------------------------------------------------------ */
+/* batch mode: compute the viewsheds of all viewpoints on the elevation
+   grid elev (read with read_elevation_grid), in parallel with
+   viewOptions.nthreads threads.  Returns for each cell (row-major) the
+   number of viewpoints it is visible from (cumulative viewshed). */
+CELL *viewshed_batch(surface_type **elev, GridHeader * hd,
+		     Viewpoint * vps, int nvps, ViewOptions viewOptions);
+
+
+
 void print_viewshed_timings(Rtimer initEventTime, Rtimer sortEventTime,
 			    Rtimer sweepTime);
 
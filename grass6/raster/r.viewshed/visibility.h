@@ -129,6 +129,7 @@ typedef struct viewOptions_
     double ellps_a;		/* the parameter of the ellipsoid */
     float cellsize;		/* the cell resolution */
     char streamdir[GPATH_MAX];	/* directory for tmp files */
+    int nthreads;		/* number of threads in batch mode */
 } ViewOptions;
 
 
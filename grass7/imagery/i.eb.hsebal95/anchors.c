@@ -0,0 +1,206 @@
+/* NDVI maximum, temperature histogram and wet/dry pixel search in one
+ * pass over the input maps.  Rows are summarized independently and the
+ * summaries merged in row order, so the pixels found are the same as
+ * with a scan of the whole map in row order. */
+
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include "local_proto.h"
+
+static void clear_pixel(struct pixel *p, double t0dem)
+{
+    p->row = p->col = -1;
+    p->tempk = p->dem = p->Rn = p->g0 = p->ndvi = p->h0 = 0.0;
+    p->t0dem = t0dem;
+}
+
+static void clear_row(struct anchors *a)
+{
+    int i;
+
+    a->ndvi_max = 0.0;
+    if (a->histogram)
+	for (i = 0; i < TEMP_BINS; i++)
+	    a->histogram[i] = 0;
+    clear_pixel(&a->wet, 400.0);
+    clear_pixel(&a->dry, 200.0);
+    if (a->use_bins)
+	for (i = 0; i < ANCHOR_BINS; i++) {
+	    clear_pixel(&a->bin_wet[i], 0.0);
+	    clear_pixel(&a->bin_dry[i], 0.0);
+	}
+}
+
+/* histogram: count the temperatures, search: find the wet and dry
+ * pixels, use_bins: also keep the candidates of the -t flag */
+void anchors_init(struct anchors *a, int histogram, int search, int use_bins)
+{
+    a->search = search;
+    a->use_bins = search && use_bins;
+    a->histogram = histogram ? G_malloc(TEMP_BINS * sizeof(int)) : NULL;
+    a->bin_wet = a->bin_dry = NULL;
+    if (a->use_bins) {
+	a->bin_wet = G_malloc(ANCHOR_BINS * sizeof(struct pixel));
+	a->bin_dry = G_malloc(ANCHOR_BINS * sizeof(struct pixel));
+    }
+    clear_row(a);
+}
+
+void anchors_free(struct anchors *a)
+{
+    if (a->histogram)
+	G_free(a->histogram);
+    if (a->use_bins) {
+	G_free(a->bin_wet);
+	G_free(a->bin_dry);
+    }
+}
+
+static void set_pixel(struct pixel *p, int row, int col, double tempk,
+		      double t0dem, double dem, double Rn, double g0,
+		      double ndvi)
+{
+    p->row = row;
+    p->col = col;
+    p->tempk = tempk;
+    p->t0dem = t0dem;
+    p->dem = dem;
+    p->Rn = Rn;
+    p->g0 = g0;
+    p->ndvi = ndvi;
+    p->h0 = Rn - g0;
+}
+
+/* summarizes one row in a, the maps not needed may be NULL */
+void anchors_row(struct anchors *a, int row, int ncols, DCELL * ndvi,
+		 DCELL * tempk, DCELL * albedo, DCELL * dem, DCELL * Rn,
+		 DCELL * g0)
+{
+    int col, bin;
+    double t0dem, h0;
+
+    clear_row(a);
+
+    for (col = 0; col < ncols; col++) {
+	if (!Rast_is_d_null_value(&ndvi[col]) &&
+	    ndvi[col] > a->ndvi_max && ndvi[col] < 0.999)
+	    a->ndvi_max = ndvi[col];
+
+	if (a->histogram && !Rast_is_d_null_value(&tempk[col])) {
+	    bin = (int)tempk[col];
+	    if (bin > 0 && bin < TEMP_BINS)
+		a->histogram[bin]++;
+	}
+
+	if (!a->search)
+	    continue;
+	if (Rast_is_d_null_value(&albedo[col]) ||
+	    Rast_is_d_null_value(&tempk[col]) ||
+	    Rast_is_d_null_value(&dem[col]) ||
+	    Rast_is_d_null_value(&Rn[col]) ||
+	    Rast_is_d_null_value(&g0[col]) || Rast_is_d_null_value(&ndvi[col]))
+	    continue;
+
+	t0dem = tempk[col] + 0.00627 * dem[col];
+	if (t0dem <= 250.0 || tempk[col] <= 250.0)
+	    continue;
+
+	if (t0dem < a->wet.t0dem && albedo[col] < 0.15)
+	    set_pixel(&a->wet, row, col, tempk[col], t0dem, dem[col],
+		      Rn[col], g0[col], ndvi[col]);
+	if (t0dem > a->dry.t0dem)
+	    set_pixel(&a->dry, row, col, tempk[col], t0dem, dem[col],
+		      Rn[col], g0[col], ndvi[col]);
+
+	if (!a->use_bins || tempk[col] >= ANCHOR_BINS)
+	    continue;
+	bin = (int)tempk[col];
+	set_pixel(&a->bin_wet[bin], row, col, tempk[col], t0dem, dem[col],
+		  Rn[col], g0[col], ndvi[col]);
+	h0 = Rn[col] - g0[col];
+	if (h0 > 100.0 && g0[col] > 10.0 && Rn[col] > 100.0 &&
+	    albedo[col] > 0.3 &&
+	    (a->bin_dry[bin].row < 0 || h0 > a->bin_dry[bin].h0))
+	    set_pixel(&a->bin_dry[bin], row, col, tempk[col], t0dem,
+		      dem[col], Rn[col], g0[col], ndvi[col]);
+    }
+}
+
+/* merges the summary r of the next row into a */
+void anchors_merge(struct anchors *a, const struct anchors *r)
+{
+    int i;
+
+    if (r->ndvi_max > a->ndvi_max)
+	a->ndvi_max = r->ndvi_max;
+    if (a->histogram)
+	for (i = 0; i < TEMP_BINS; i++)
+	    a->histogram[i] += r->histogram[i];
+    if (!a->search)
+	return;
+    if (r->wet.row >= 0 && r->wet.t0dem < a->wet.t0dem)
+	a->wet = r->wet;
+    if (r->dry.row >= 0 && r->dry.t0dem > a->dry.t0dem)
+	a->dry = r->dry;
+    if (a->use_bins)
+	for (i = 0; i < ANCHOR_BINS; i++) {
+	    if (r->bin_wet[i].row >= 0)
+		a->bin_wet[i] = r->bin_wet[i];
+	    if (r->bin_dry[i].row >= 0)
+		a->bin_dry[i] = r->bin_dry[i];
+	}
+}
+
+static int later(const struct pixel *p, const struct pixel *q)
+{
+    return p->row > q->row || (p->row == q->row && p->col >= q->col);
+}
+
+/* the wet and dry pixels; with use_peaks the last pixel near the first
+ * or third histogram peak is taken if it comes after the coldest or
+ * hottest one in row order */
+void anchors_select(const struct anchors *a, int use_peaks, int i_peak1,
+		    int i_peak3, struct pixel *wet, struct pixel *dry)
+{
+    const struct pixel *p, *best;
+    int i;
+
+    *wet = a->wet;
+    *dry = a->dry;
+    if (!use_peaks || !a->use_bins)
+	return;
+
+    /* tempk in [peak1 - 5, peak1 + 1) */
+    best = NULL;
+    for (i = i_peak1 - 5; i <= i_peak1; i++) {
+	if (i < 0 || i >= ANCHOR_BINS)
+	    continue;
+	p = &a->bin_wet[i];
+	if (p->row >= 0 && (!best || later(p, best)))
+	    best = p;
+    }
+    if (best && (wet->row < 0 || later(best, wet)))
+	*wet = *best;
+
+    /* tempk in [peak3, peak3 + 7), the largest h0 of the last row with
+     * candidates, the first one if there are several */
+    best = NULL;
+    for (i = i_peak3; i < i_peak3 + PEAK3_SPAN; i++) {
+	if (i < 0 || i >= ANCHOR_BINS)
+	    continue;
+	p = &a->bin_dry[i];
+	if (p->row < 0)
+	    continue;
+	if (!best || p->row > best->row ||
+	    (p->row == best->row &&
+	     (p->h0 > best->h0 || (p->h0 == best->h0 && p->col < best->col))))
+	    best = p;
+    }
+    if (best && (dry->row < 0 || later(best, dry))) {
+	/* t0dem stays the one of the hottest pixel */
+	double t0dem = dry->t0dem;
+
+	*dry = *best;
+	dry->t0dem = t0dem;
+    }
+}
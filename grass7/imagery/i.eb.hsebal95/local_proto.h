@@ -0,0 +1,40 @@
+/* wet and dry anchor pixels, see anchors.c */
+
+/* temperature histogram in 1 K bins */
+#define TEMP_BINS 400
+/* width of the dry pixel window above the third histogram peak */
+#define PEAK3_SPAN 7
+#define ANCHOR_BINS (TEMP_BINS + PEAK3_SPAN)
+
+struct pixel
+{
+    int row, col;		/* row is -1 if there is no such pixel */
+    double tempk, t0dem, dem, Rn, g0, ndvi, h0;
+};
+
+struct anchors
+{
+    int search;			/* search the wet and dry pixels */
+    int use_bins;		/* keep the candidates of the -t flag */
+    double ndvi_max;
+    int *histogram;		/* TEMP_BINS counts, NULL if not needed */
+    struct pixel wet;		/* coldest t0dem with albedo < 0.15 */
+    struct pixel dry;		/* hottest t0dem */
+    /* per 1 K bin: the last pixel, and the pixel of the largest h0
+     * in the last row that had -t dry candidates */
+    struct pixel *bin_wet, *bin_dry;
+};
+
+void anchors_init(struct anchors *, int, int, int);
+void anchors_free(struct anchors *);
+void anchors_row(struct anchors *, int, int, DCELL *, DCELL *, DCELL *,
+		 DCELL *, DCELL *, DCELL *);
+void anchors_merge(struct anchors *, const struct anchors *);
+void anchors_select(const struct anchors *, int, int, int,
+		    struct pixel *, struct pixel *);
+
+/* sensi_h.c */
+double sensi_h(int iteration, double tempk_water, double tempk_desert,
+	       double t0_dem, double tempk, double ndvi, double ndvi_max,
+	       double dem, double rnet_desert, double g0_desert,
+	       double t0_dem_desert, double u2m, double dem_desert);
@@ -22,34 +22,104 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <math.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include <grass/gis.h>
 #include <grass/raster.h>
 #include <grass/glocale.h>
+#include "local_proto.h"
 
-double sensi_h(int iteration, double tempk_water, double tempk_desert,
-	       double t0_dem, double tempk, double ndvi, double ndvi_max,
-	       double dem, double rnet_desert, double g0_desert,
-	       double t0_dem_desert, double u2m, double dem_desert);
+/* input and output rows of one thread */
+struct rows
+{
+    DCELL *T, *ndvi, *dem, *u2m, *Rn, *g0, *albedo, *out;
+};
+
+/* values of the wet and dry pixels, the same for all pixels */
+struct sebal
+{
+    int iteration, zero;
+    double tempk_wet, tempk_dry, ndvi_max;
+    double Rn_dry, g0_dry, t0dem_dry, dem_dry;
+};
+
+static void alloc_rows(struct rows *r)
+{
+    r->T = Rast_allocate_d_buf();
+    r->ndvi = Rast_allocate_d_buf();
+    r->dem = Rast_allocate_d_buf();
+    r->u2m = Rast_allocate_d_buf();
+    r->Rn = Rast_allocate_d_buf();
+    r->g0 = Rast_allocate_d_buf();
+    r->albedo = Rast_allocate_d_buf();
+    r->out = Rast_allocate_d_buf();
+}
+
+static void free_rows(struct rows *r)
+{
+    G_free(r->T);
+    G_free(r->ndvi);
+    G_free(r->dem);
+    G_free(r->u2m);
+    G_free(r->Rn);
+    G_free(r->g0);
+    G_free(r->albedo);
+    G_free(r->out);
+}
+
+/* sensible heat flux of one row */
+static void h0_row(const struct sebal *s, struct rows *r, int ncols)
+{
+    int col;
+    DCELL d_t0dem;
+    DCELL d;			/* Output pixel */
+
+    for (col = 0; col < ncols; col++) {
+	if (Rast_is_d_null_value(&r->T[col]) ||
+	    Rast_is_d_null_value(&r->dem[col]) ||
+	    Rast_is_d_null_value(&r->u2m[col]) ||
+	    Rast_is_d_null_value(&r->ndvi[col]) ||
+	    Rast_is_d_null_value(&r->Rn[col]) ||
+	    Rast_is_d_null_value(&r->g0[col]) ||
+	    r->g0[col] < 0.0 || r->Rn[col] < 0.0 ||
+	    r->dem[col] <= -100.0 || r->dem[col] > 9000.0 ||
+	    r->T[col] < 200.0) {
+	    Rast_set_d_null_value(&r->out[col], 1);
+	    continue;
+	}
+	/* Calculate T0dem */
+	d_t0dem = r->T[col] + 0.00627 * r->dem[col];
+	/* Calculate sensible heat flux */
+	d = sensi_h(s->iteration,
+		    s->tempk_wet,
+		    s->tempk_dry,
+		    d_t0dem,
+		    r->T[col],
+		    r->ndvi[col],
+		    s->ndvi_max,
+		    r->dem[col],
+		    s->Rn_dry, s->g0_dry, s->t0dem_dry, r->u2m[col], s->dem_dry);
+	if (s->zero && d < 0.0) {
+	    d = 0.0;
+	}
+	r->out[col] = d;
+    }
+}
 
 int main(int argc, char *argv[])
 {
     struct Cell_head cellhd;
-    char *mapset;		/* mapset name */
     /* buffer for in out raster */
-    void *inrast_T, *inrast_ndvi, *inrast_dem, *inrast_u2m;
-    void *inrast_Rn, *inrast_g0, *inrast_albedo;
-    DCELL *outrast;
+    struct rows *in;
     int nrows, ncols;
-    int row, col;
-    int row_wet, col_wet;
-    int row_dry, col_dry;
+    int row, col, row0, nchunk, t;
+    int nthreads, search;
     double m_row_wet, m_col_wet;
     double m_row_dry, m_col_dry;
     int infd_T, infd_ndvi, infd_dem, infd_u2m;
     int infd_Rn, infd_g0, infd_albedo;
     int outfd;
-    char *mapset_T, *mapset_ndvi, *mapset_dem, *mapset_u2m;
-    char *mapset_Rn, *mapset_g0, *mapset_albedo;
     char *T, *ndvi, *dem, *u2m, *Rn, *g0, *albedo;
     char *h0;
     struct History history;
@@ -59,29 +129,25 @@ int main(int argc, char *argv[])
     struct Option *output;
     struct Option *input_row_wet, *input_col_wet;
     struct Option *input_row_dry, *input_col_dry;
-    struct Option *input_iter;
-    struct Flag *flag1, *flag2, *flag3, *day, *zero;
-    /*******************************/
-    RASTER_MAP_TYPE data_type_T;
-    RASTER_MAP_TYPE data_type_ndvi;
-    RASTER_MAP_TYPE data_type_dem;
-    RASTER_MAP_TYPE data_type_u2m;
-    RASTER_MAP_TYPE data_type_Rn;
-    RASTER_MAP_TYPE data_type_g0;
-    RASTER_MAP_TYPE data_type_albedo;
-    RASTER_MAP_TYPE data_type_output = DCELL_TYPE;
+    struct Option *input_iter, *input_threads;
+    struct Flag *flag1, *flag2, *flag3, *zero;
     /*******************************/
     int iteration = 10;		/*SEBAL95 loop number */
     /********************************/
     /* Stats for dry/wet pixels     */
-    double t0dem_min = 400.0, t0dem_max = 200.0;
-    double tempk_min = 400.0, tempk_max = 200.0;
+    struct anchors anc, *rowanc;
+    struct pixel wet, dry;
+    struct sebal sebal;
+    DCELL d_tempk_wet = 0.0;
+    DCELL d_tempk_dry = 0.0;
+    DCELL d_Rn_dry = 0.0;
+    DCELL d_g0_dry = 0.0;
+    DCELL d_t0dem_dry = 0.0;
+    DCELL d_dem_dry = 0.0;
+    DCELL d_ndvi_max;
     /********************************/
-    double xp, yp;
-    double xmin, ymin;
-    double xmax, ymax;
+    double xmin, ymax;
     double stepx, stepy;
-    double latitude, longitude;
     /********************************/
     G_gisinit(argv[0]);
 
@@ -168,6 +234,13 @@ int main(int argc, char *argv[])
     output = G_define_standard_option(G_OPT_R_OUTPUT);
     output->description = _("Name of output sensible heat flux layer [W/m2]");
 
+    input_threads = G_define_option();
+    input_threads->key = "threads";
+    input_threads->type = TYPE_INTEGER;
+    input_threads->required = NO;
+    input_threads->description = _("Number of threads for parallel computing");
+    input_threads->answer = "1";
+
     /* Define the different flags */
     flag1 = G_define_flag();
     flag1->key = 't';
@@ -189,6 +262,18 @@ int main(int argc, char *argv[])
     if (G_parser(argc, argv))
 	exit(EXIT_FAILURE);
 
+    nthreads = atoi(input_threads->answer);
+    if (nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than 0"), input_threads->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+    nthreads = 1;
+#endif
+
     /* get entered parameters */
     T = input_T->answer;
     dem = input_dem->answer;
@@ -219,14 +304,6 @@ int main(int argc, char *argv[])
 	    G_message("Dry Pixel=> row:%.0f col:%.0f", m_row_dry, m_col_dry);
 	}
     }
-    /* determine the input map type (CELL/FCELL/DCELL) */
-    data_type_T = Rast_map_type(T, "");
-    data_type_dem = Rast_map_type(dem, "");
-    data_type_u2m = Rast_map_type(u2m, "");
-    data_type_ndvi = Rast_map_type(ndvi, "");
-    data_type_Rn = Rast_map_type(Rn, "");
-    data_type_g0 = Rast_map_type(g0, "");
-    data_type_albedo = Rast_map_type(albedo, "");
 
     infd_T = Rast_open_old(T, "");
     infd_dem = Rast_open_old(dem, "");
@@ -236,22 +313,8 @@ int main(int argc, char *argv[])
     infd_g0 = Rast_open_old(g0, "");
     infd_albedo = Rast_open_old(albedo, "");
 
-    Rast_get_cellhd(T, "", &cellhd);
-    Rast_get_cellhd(dem, "", &cellhd);
-    Rast_get_cellhd(u2m, "", &cellhd);
-    Rast_get_cellhd(ndvi, "", &cellhd);
-    Rast_get_cellhd(Rn, "", &cellhd);
-    Rast_get_cellhd(g0, "", &cellhd);
     Rast_get_cellhd(albedo, "", &cellhd);
 
-    /* Allocate input buffer */
-    inrast_T = Rast_allocate_buf(data_type_T);
-    inrast_dem = Rast_allocate_buf(data_type_dem);
-    inrast_u2m = Rast_allocate_buf(data_type_u2m);
-    inrast_ndvi = Rast_allocate_buf(data_type_ndvi);
-    inrast_Rn = Rast_allocate_buf(data_type_Rn);
-    inrast_g0 = Rast_allocate_buf(data_type_g0);
-    inrast_albedo = Rast_allocate_buf(data_type_albedo);
     /***************************************************/
     /* Setup pixel location variables */
     /***************************************************/
@@ -259,65 +322,67 @@ int main(int argc, char *argv[])
     stepy = cellhd.ns_res;
 
     xmin = cellhd.west;
-    xmax = cellhd.east;
-    ymin = cellhd.south;
     ymax = cellhd.north;
 
     nrows = Rast_window_rows();
     ncols = Rast_window_cols();
     /***************************************************/
-    /* Allocate output buffer */
+    /* Allocate input and output buffers, all maps are read as DCELL */
     /***************************************************/
-    outrast = Rast_allocate_d_buf();
+    in = G_malloc(nthreads * sizeof(struct rows));
+    for (t = 0; t < nthreads; t++)
+	alloc_rows(&in[t]);
     outfd = Rast_open_new(h0, DCELL_TYPE);
-    DCELL d_ndvi;		/* Input raster */
-    DCELL d_ndvi_max = 0.0;	/* Generated here */
-
-    /* THREAD 1 */
-    /* NDVI Max */
-    for (row = 0; row < nrows; row++) {
-	G_percent(row, nrows, 2);
-	Rast_get_d_row(infd_ndvi, inrast_ndvi, row);
-	for (col = 0; col < ncols; col++) {
-	    switch (data_type_ndvi) {
-	    case CELL_TYPE:
-		d_ndvi = (double)((CELL *) inrast_ndvi)[col];
-		break;
-	    case FCELL_TYPE:
-		d_ndvi = (double)((FCELL *) inrast_ndvi)[col];
-		break;
-	    case DCELL_TYPE:
-		d_ndvi = (double)((DCELL *) inrast_ndvi)[col];
-		break;
-	    }
-	    if (Rast_is_d_null_value(&d_ndvi)) {
-		/* do nothing */
-	    }
-	    else if ((d_ndvi) > d_ndvi_max && (d_ndvi) < 0.999) {
-		d_ndvi_max = d_ndvi;
+
+    /* NDVI Max, the temperature histogram (-t) and the wet and dry
+     * pixels (-a) are found in one pass over the maps; a chunk of rows
+     * is read and summarized in parallel, one row per thread, and the
+     * summaries are merged in row order */
+    search = flag2->answer;
+    anchors_init(&anc, flag1->answer, search, flag1->answer);
+    rowanc = G_malloc(nthreads * sizeof(struct anchors));
+    for (t = 0; t < nthreads; t++)
+	anchors_init(&rowanc[t], flag1->answer, search, flag1->answer);
+
+    for (row0 = 0; row0 < nrows; row0 += nthreads) {
+	G_percent(row0, nrows, 2);
+	nchunk = nrows - row0 < nthreads ? nrows - row0 : nthreads;
+
+	for (t = 0; t < nchunk; t++) {
+	    row = row0 + t;
+	    Rast_get_d_row(infd_ndvi, in[t].ndvi, row);
+	    if (flag1->answer || search)
+		Rast_get_d_row(infd_T, in[t].T, row);
+	    if (search) {
+		Rast_get_d_row(infd_albedo, in[t].albedo, row);
+		Rast_get_d_row(infd_dem, in[t].dem, row);
+		Rast_get_d_row(infd_Rn, in[t].Rn, row);
+		Rast_get_d_row(infd_g0, in[t].g0, row);
 	    }
 	}
+
+#pragma omp parallel for schedule(static, 1)
+	for (t = 0; t < nchunk; t++)
+	    anchors_row(&rowanc[t], row0 + t, ncols, in[t].ndvi, in[t].T,
+			in[t].albedo, in[t].dem, in[t].Rn, in[t].g0);
+
+	for (t = 0; t < nchunk; t++)
+	    anchors_merge(&anc, &rowanc[t]);
     }
+    G_percent(nrows, nrows, 2);
+
+    for (t = 0; t < nthreads; t++)
+	anchors_free(&rowanc[t]);
+    G_free(rowanc);
+
+    d_ndvi_max = anc.ndvi_max;
     G_message("ndvi_max=%f\n", d_ndvi_max);
-    /* Pick up wet and dry pixel values */
-    DCELL d_Rn;			/* Input raster */
-    DCELL d_g0;			/* Input raster */
-    DCELL d_tempk_wet;
-    DCELL d_tempk_dry;
-    DCELL d_Rn_dry;
-    DCELL d_g0_dry;
-    DCELL d_t0dem_dry;
-    DCELL d_dem_dry;
-    DCELL d_dT_dry;
-    DCELL d_ndvi_dry;
-    DCELL d_dT;
 
     /*START Temperature minimum search */
-    /* THREAD 1 */
     /*This is correcting for un-Earthly temperatures */
     /*It finds when histogram is actually starting to pull up... */
     int peak1, peak2, peak3;
-    int i_peak1, i_peak2, i_peak3;
+    int i_peak1 = 0, i_peak2, i_peak3 = 0;
     int bottom1a, bottom1b;
     int bottom2a, bottom2b;
     int bottom3a, bottom3b;
@@ -326,49 +391,12 @@ int main(int argc, char *argv[])
     int i_bottom3a, i_bottom3b;
     if (flag1->answer) {
 	int i = 0;
-	int histogram[400];
-	for (i = 0; i < 400; i++) {
-	    histogram[i] = 0;
-	}
-	DCELL d_T;
-	/****************************/
-	/* Process pixels histogram */
-	for (row = 0; row < nrows; row++) {
-	    G_percent(row, nrows, 2);
-	    /* read input map */
-	    Rast_get_row(infd_T, inrast_T, row, data_type_T);
-	    /*process the data */
-	    for (col = 0; col < ncols; col++) {
-		switch (data_type_T) {
-		case CELL_TYPE:
-		    d_T = (double)((CELL *) inrast_T)[col];
-		    break;
-		case FCELL_TYPE:
-		    d_T = (double)((FCELL *) inrast_T)[col];
-		    break;
-		case DCELL_TYPE:
-		    d_T = (double)((DCELL *) inrast_T)[col];
-		    break;
-		}
-		if (Rast_is_d_null_value(&d_T)) {
-		    /*Do nothing */
-		}
-		else {
-		    int temp;
-
-		    temp = (int)d_T;
-		    if (temp > 0) {
-			histogram[temp] = histogram[temp] + 1.0;
-		    }
-		}
-	    }
-	}
 	int sum = 0;
 
 	double average = 0.0;
 
 	for (i = 0; i < 400; i++) {
-	    sum += histogram[i];
+	    sum += anc.histogram[i];
 	}
 	average = (double)sum / 400.0;
 	G_message
@@ -394,71 +422,71 @@ int main(int argc, char *argv[])
 	for (i = 0; i < 400; i++) {
 	    /* Search for highest peak of dataset (2) */
 	    /* Highest Peak */
-	    if (histogram[i] > peak2) {
-		peak2 = histogram[i];
+	    if (anc.histogram[i] > peak2) {
+		peak2 = anc.histogram[i];
 		i_peak2 = i;
 	    }
 	}
 	int stop = 0;
 
 	for (i = i_peak2; i > 5; i--) {
-	    if (((histogram[i] + histogram[i - 1] + histogram[i - 2] +
-		  histogram[i - 3] + histogram[i - 4]) / 5) < histogram[i] &&
+	    if (((anc.histogram[i] + anc.histogram[i - 1] + anc.histogram[i - 2] +
+		  anc.histogram[i - 3] + anc.histogram[i - 4]) / 5) < anc.histogram[i] &&
 		stop == 0) {
-		bottom2a = histogram[i];
+		bottom2a = anc.histogram[i];
 		i_bottom2a = i;
 	    }
-	    else if (((histogram[i] + histogram[i - 1] + histogram[i - 2] +
-		       histogram[i - 3] + histogram[i - 4]) / 5) >
-		     histogram[i] && stop == 0) {
+	    else if (((anc.histogram[i] + anc.histogram[i - 1] + anc.histogram[i - 2] +
+		       anc.histogram[i - 3] + anc.histogram[i - 4]) / 5) >
+		     anc.histogram[i] && stop == 0) {
 		/*Search for peaks of datasets (1) */
-		peak1 = histogram[i];
+		peak1 = anc.histogram[i];
 		i_peak1 = i;
 		stop = 1;
 	    }
 	}
 	stop = 0;
 	for (i = i_peak2; i < 395; i++) {
-	    if (((histogram[i] + histogram[i + 1] + histogram[i + 2] +
-		  histogram[i + 3] + histogram[i + 4]) / 5) < histogram[i] &&
+	    if (((anc.histogram[i] + anc.histogram[i + 1] + anc.histogram[i + 2] +
+		  anc.histogram[i + 3] + anc.histogram[i + 4]) / 5) < anc.histogram[i] &&
 		stop == 0) {
-		bottom2b = histogram[i];
+		bottom2b = anc.histogram[i];
 		i_bottom2b = i;
 	    }
-	    else if (((histogram[i] + histogram[i + 1] + histogram[i + 2] +
-		       histogram[i + 3] + histogram[i + 4]) / 5) >
-		     histogram[i] && stop == 0) {
+	    else if (((anc.histogram[i] + anc.histogram[i + 1] + anc.histogram[i + 2] +
+		       anc.histogram[i + 3] + anc.histogram[i + 4]) / 5) >
+		     anc.histogram[i] && stop == 0) {
 		/*Search for peaks of datasets (3) */
-		peak3 = histogram[i];
+		peak3 = anc.histogram[i];
 		i_peak3 = i;
 		stop = 1;
 	    }
 	}
 	/* First histogram lower bound */
 	for (i = 250; i < i_peak1; i++) {
-	    if (histogram[i] < bottom1a) {
-		bottom1a = histogram[i];
+	    if (anc.histogram[i] < bottom1a) {
+		bottom1a = anc.histogram[i];
 		i_bottom1a = i;
 	    }
 	}
 	/* First histogram higher bound */
 	for (i = i_peak2; i > i_peak1; i--) {
-	    if (histogram[i] <= bottom1b) {
-		bottom1b = histogram[i];
+	    if (anc.histogram[i] <= bottom1b) {
+		bottom1b = anc.histogram[i];
 		i_bottom1b = i;
 	    }
 	}
 	/* Third histogram lower bound */
 	for (i = i_peak2; i < i_peak3; i++) {
-	    if (histogram[i] < bottom3a) {
-		bottom3a = histogram[i];
+	    if (anc.histogram[i] < bottom3a) {
+		bottom3a = anc.histogram[i];
 		i_bottom3a = i;
 	    }
 	}
 	/* Third histogram higher bound */
 	for (i = 399; i > i_peak3; i--) {
-	    if (histogram[i] < bottom3b) {
-		bottom3b = histogram[i];
+	    if (anc.histogram[i] < bottom3b) {
+		bottom3b = anc.histogram[i];
 		i_bottom3b = i;
 	    }
 	}
@@ -479,165 +507,22 @@ int main(int argc, char *argv[])
     /*Process wet pixel values */
     /* FLAG2 */
     if (flag2->answer) {
-	/* THREAD 3 */
-	/* Process tempk min / max pixels */
-	/* Internal use only */
-	DCELL d_Rn_wet;
-	DCELL d_g0_wet;
-	/*********************/
-	for (row = 0; row < nrows; row++) {
-	    DCELL d_albedo;
-	    DCELL d_tempk;
-	    DCELL d_dem;
-	    DCELL d_t0dem;
-	    DCELL d_h0 = 100.0;	/*for flag 1 */
-	    DCELL d_h0_max = 100.0;	/*for flag 1 */
-	    G_percent(row, nrows, 2);
-	    Rast_get_row(infd_albedo, inrast_albedo, row, data_type_albedo);
-	    Rast_get_row(infd_T, inrast_T, row, data_type_T);
-	    Rast_get_row(infd_dem, inrast_dem, row, data_type_dem);
-	    Rast_get_row(infd_Rn, inrast_Rn, row, data_type_Rn);
-	    Rast_get_row(infd_g0, inrast_g0, row, data_type_g0);
-	    Rast_get_d_row(infd_ndvi, inrast_ndvi, row);
-	    /*process the data */
-	    for (col = 0; col < ncols; col++) {
-		switch (data_type_albedo) {
-		case CELL_TYPE:
-		    d_albedo = (double)((CELL *) inrast_albedo)[col];
-		    break;
-		case FCELL_TYPE:
-		    d_albedo = (double)((FCELL *) inrast_albedo)[col];
-		    break;
-		case DCELL_TYPE:
-		    d_albedo = (double)((DCELL *) inrast_albedo)[col];
-		    break;
-		}
-		switch (data_type_T) {
-		case CELL_TYPE:
-		    d_tempk = (double)((CELL *) inrast_T)[col];
-		    break;
-		case FCELL_TYPE:
-		    d_tempk = (double)((FCELL *) inrast_T)[col];
-		    break;
-		case DCELL_TYPE:
-		    d_tempk = (double)((DCELL *) inrast_T)[col];
-		    break;
-		}
-		switch (data_type_dem) {
-		case CELL_TYPE:
-		    d_dem = (double)((CELL *) inrast_dem)[col];
-		    break;
-		case FCELL_TYPE:
-		    d_dem = (double)((FCELL *) inrast_dem)[col];
-		    break;
-		case DCELL_TYPE:
-		    d_dem = (double)((DCELL *) inrast_dem)[col];
-		    break;
-		}
-		switch (data_type_Rn) {
-		case CELL_TYPE:
-		    d_Rn = (double)((CELL *) inrast_Rn)[col];
-		    break;
-		case FCELL_TYPE:
-		    d_Rn = (double)((FCELL *) inrast_Rn)[col];
-		    break;
-		case DCELL_TYPE:
-		    d_Rn = (double)((DCELL *) inrast_Rn)[col];
-		    break;
-		}
-		switch (data_type_g0) {
-		case CELL_TYPE:
-		    d_g0 = (double)((CELL *) inrast_g0)[col];
-		    break;
-		case FCELL_TYPE:
-		    d_g0 = (double)((FCELL *) inrast_g0)[col];
-		    break;
-		case DCELL_TYPE:
-		    d_g0 = (double)((DCELL *) inrast_g0)[col];
-		    break;
-		}
-		switch (data_type_ndvi) {
-		case CELL_TYPE:
-		    d_ndvi = (double)((CELL *) inrast_ndvi)[col];
-		    break;
-		case FCELL_TYPE:
-		    d_ndvi = (double)((FCELL *) inrast_ndvi)[col];
-		    break;
-		case DCELL_TYPE:
-		    d_ndvi = (double)((DCELL *) inrast_ndvi)[col];
-		    break;
-		}
-		if (Rast_is_d_null_value(&d_albedo) ||
-		    Rast_is_d_null_value(&d_tempk) ||
-		    Rast_is_d_null_value(&d_dem) ||
-		    Rast_is_d_null_value(&d_Rn) ||
-		    Rast_is_d_null_value(&d_g0) || Rast_is_d_null_value(&d_ndvi)) {
-		    /* do nothing */
-		}
-		else {
-		    d_t0dem = d_tempk + 0.00627 * d_dem;
-		    if (d_t0dem <= 250.0 || d_tempk <= 250.0) {
-			/* do nothing */
-		    }
-		    else {
-			d_h0 = d_Rn - d_g0;
-			if (d_t0dem < t0dem_min && d_albedo < 0.15) {
-			    t0dem_min = d_t0dem;
-			    tempk_min = d_tempk;
-			    d_tempk_wet = d_tempk;
-			    d_Rn_wet = d_Rn;
-			    d_g0_wet = d_g0;
-			    col_wet = col;
-			    row_wet = row;
-			}
-			if (flag1->answer &&
-			    d_tempk >= (double)i_peak1 - 5.0 &&
-			    d_tempk < (double)i_peak1 + 1.0) {
-			    tempk_min = d_tempk;
-			    d_tempk_wet = d_tempk;
-			    d_Rn_wet = d_Rn;
-			    d_g0_wet = d_g0;
-			    col_wet = col;
-			    row_wet = row;
-			}
-			if (d_t0dem > t0dem_max) {
-			    t0dem_max = d_t0dem;
-			    d_t0dem_dry = d_t0dem;
-			    tempk_max = d_tempk;
-			    d_tempk_dry = d_tempk;
-			    d_Rn_dry = d_Rn;
-			    d_g0_dry = d_g0;
-			    d_dem_dry = d_dem;
-			    col_dry = col;
-			    row_dry = row;
-			    d_ndvi_dry = d_ndvi;
-			}
-			if (flag1->answer &&
-			    d_tempk >= (double)i_peak3 - 0.0 &&
-			    d_tempk < (double)i_peak3 + 7.0 &&
-			    d_h0 > 100.0 && d_h0 > d_h0_max &&
-			    d_g0 > 10.0 && d_Rn > 100.0 && d_albedo > 0.3) {
-			    tempk_max = d_tempk;
-			    d_tempk_dry = d_tempk;
-			    d_Rn_dry = d_Rn;
-			    d_g0_dry = d_g0;
-			    d_h0_max = d_h0;
-			    d_dem_dry = d_dem;
-			    col_dry = col;
-			    row_dry = row;
-			    d_ndvi_dry = d_ndvi;
-			}
-		    }
-		}
-	    }
-	}
-	G_message("tempk_min=%f\ntempk_max=%f\n", tempk_min, tempk_max);
-	G_message("row_wet=%d\tcol_wet=%d\n", row_wet, col_wet);
-	G_message("row_dry=%d\tcol_dry=%d\n", row_dry, col_dry);
+	anchors_select(&anc, flag1->answer, i_peak1, i_peak3, &wet, &dry);
+	d_tempk_wet = wet.tempk;
+	d_tempk_dry = dry.tempk;
+	d_Rn_dry = dry.Rn;
+	d_g0_dry = dry.g0;
+	d_t0dem_dry = dry.t0dem;
+	d_dem_dry = dry.dem;
+	G_message("tempk_min=%f\ntempk_max=%f\n",
+		  wet.row >= 0 ? wet.tempk : 400.0,
+		  dry.row >= 0 ? dry.tempk : 200.0);
+	G_message("row_wet=%d\tcol_wet=%d\n", wet.row, wet.col);
+	G_message("row_dry=%d\tcol_dry=%d\n", dry.row, dry.col);
 	G_message("tempk_wet=%f\n", d_tempk_wet);
-	G_message("g0_wet=%f\n", d_g0_wet);
-	G_message("Rn_wet=%f\n", d_Rn_wet);
-	G_message("LE_wet=%f\n", d_Rn_wet - d_g0_wet);
+	G_message("g0_wet=%f\n", wet.g0);
+	G_message("Rn_wet=%f\n", wet.Rn);
+	G_message("LE_wet=%f\n", wet.Rn - wet.g0);
 	G_message("tempk_dry=%f\n", d_tempk_dry);
 	G_message("dem_dry=%f\n", d_dem_dry);
 	G_message("t0dem_dry=%f\n", d_t0dem_dry);
@@ -645,6 +530,7 @@ int main(int argc, char *argv[])
 	G_message("g0_dry=%f\n", d_g0_dry);
 	G_message("h0_dry=%f\n", d_Rn_dry - d_g0_dry);
     }				/* END OF FLAG2 */
+    anchors_free(&anc);
 
     /* MANUAL WET/DRY PIXELS */
     if (input_row_wet->answer && input_row_dry->answer &&
@@ -661,63 +547,15 @@ int main(int argc, char *argv[])
 	row = (int)m_row_dry;
 	col = (int)m_col_dry;
 	G_message("Dry Pixel | row:%i col:%i", row, col);
-	DCELL d_tempk;
-	DCELL d_dem;
-	DCELL d_t0dem;
-	Rast_get_row(infd_T, inrast_T, row, data_type_T);
-	Rast_get_row(infd_dem, inrast_dem, row, data_type_dem);
-	Rast_get_row(infd_Rn, inrast_Rn, row, data_type_Rn);
-	Rast_get_row(infd_g0, inrast_g0, row, data_type_g0);
-	switch (data_type_T) {
-	case CELL_TYPE:
-	    d_tempk = (double)((CELL *) inrast_T)[col];
-	    break;
-	case FCELL_TYPE:
-	    d_tempk = (double)((FCELL *) inrast_T)[col];
-	    break;
-	case DCELL_TYPE:
-	    d_tempk = (double)((DCELL *) inrast_T)[col];
-	    break;
-	}
-	switch (data_type_dem) {
-	case CELL_TYPE:
-	    d_dem = (double)((CELL *) inrast_dem)[col];
-	    break;
-	case FCELL_TYPE:
-	    d_dem = (double)((FCELL *) inrast_dem)[col];
-	    break;
-	case DCELL_TYPE:
-	    d_dem = (double)((DCELL *) inrast_dem)[col];
-	    break;
-	}
-	switch (data_type_Rn) {
-	case CELL_TYPE:
-	    d_Rn = (double)((CELL *) inrast_Rn)[col];
-	    break;
-	case FCELL_TYPE:
-	    d_Rn = (double)((FCELL *) inrast_Rn)[col];
-	    break;
-	case DCELL_TYPE:
-	    d_Rn = (double)((DCELL *) inrast_Rn)[col];
-	    break;
-	}
-	switch (data_type_g0) {
-	case CELL_TYPE:
-	    d_g0 = (double)((CELL *) inrast_g0)[col];
-	    break;
-	case FCELL_TYPE:
-	    d_g0 = (double)((FCELL *) inrast_g0)[col];
-	    break;
-	case DCELL_TYPE:
-	    d_g0 = (double)((DCELL *) inrast_g0)[col];
-	    break;
-	}
-	d_t0dem = d_tempk + 0.00627 * d_dem;
-	d_t0dem_dry = d_t0dem;
-	d_tempk_dry = d_tempk;
-	d_Rn_dry = d_Rn;
-	d_g0_dry = d_g0;
-	d_dem_dry = d_dem;
+	Rast_get_d_row(infd_T, in[0].T, row);
+	Rast_get_d_row(infd_dem, in[0].dem, row);
+	Rast_get_d_row(infd_Rn, in[0].Rn, row);
+	Rast_get_d_row(infd_g0, in[0].g0, row);
+	d_tempk_dry = in[0].T[col];
+	d_dem_dry = in[0].dem[col];
+	d_t0dem_dry = d_tempk_dry + 0.00627 * d_dem_dry;
+	d_Rn_dry = in[0].Rn[col];
+	d_g0_dry = in[0].g0[col];
 	/*WET PIXEL */
 	if (flag3->answer) {
 	    /*Calculate coordinates of row/col from projected ones */
@@ -730,19 +568,8 @@ int main(int argc, char *argv[])
 	row = m_row_wet;
 	col = m_col_wet;
 	G_message("Wet Pixel | row:%i col:%i", row, col);
-	Rast_get_row(infd_T, inrast_T, row, data_type_T);
-	switch (data_type_T) {
-	case CELL_TYPE:
-	    d_tempk = (double)((CELL *) inrast_T)[col];
-	    break;
-	case FCELL_TYPE:
-	    d_tempk = (double)((FCELL *) inrast_T)[col];
-	    break;
-	case DCELL_TYPE:
-	    d_tempk = (double)((DCELL *) inrast_T)[col];
-	    break;
-	}
-	d_tempk_wet = d_tempk;
+	Rast_get_d_row(infd_T, in[0].T, row);
+	d_tempk_wet = in[0].T[col];
 	G_message("Manual Pixels\n");
 	G_message("***************************\n");
 	G_message("row_wet=%d\tcol_wet=%d\n", (int)m_row_wet, (int)m_col_wet);
@@ -757,162 +584,53 @@ int main(int argc, char *argv[])
     }
     /* END OF MANUAL WET/DRY PIXELS */
 
-    for (row = 0; row < nrows; row++) {
-	DCELL d_albedo;
-	DCELL d_tempk;
-	DCELL d_dem;
-	DCELL d_u2m;
-	DCELL d_t0dem;
-	DCELL d;		/* Output pixel */
-	G_percent(row, nrows, 2);
+    sebal.iteration = iteration;
+    sebal.zero = zero->answer;
+    sebal.tempk_wet = d_tempk_wet;
+    sebal.tempk_dry = d_tempk_dry;
+    sebal.ndvi_max = d_ndvi_max;
+    sebal.Rn_dry = d_Rn_dry;
+    sebal.g0_dry = d_g0_dry;
+    sebal.t0dem_dry = d_t0dem_dry;
+    sebal.dem_dry = d_dem_dry;
+
+    /* the SEBAL iteration of a chunk of rows in parallel, one row per
+     * thread */
+    for (row0 = 0; row0 < nrows; row0 += nthreads) {
+	G_percent(row0, nrows, 2);
+	nchunk = nrows - row0 < nthreads ? nrows - row0 : nthreads;
+
 	/* read a line input maps into buffers */
-	Rast_get_row(infd_albedo, inrast_albedo, row, data_type_albedo);
-	Rast_get_row(infd_T, inrast_T, row, data_type_T);
-	Rast_get_row(infd_dem, inrast_dem, row, data_type_dem);
-	Rast_get_row(infd_u2m, inrast_u2m, row, data_type_u2m);
-	Rast_get_row(infd_ndvi, inrast_ndvi, row, data_type_ndvi);
-	Rast_get_row(infd_Rn, inrast_Rn, row, data_type_Rn);
-	Rast_get_row(infd_g0, inrast_g0, row, data_type_g0);
-	/* read every cell in the line buffers */
-	for (col = 0; col < ncols; col++) {
-	    switch (data_type_albedo) {
-	    case CELL_TYPE:
-		d_albedo = (double)((CELL *) inrast_albedo)[col];
-		break;
-	    case FCELL_TYPE:
-		d_albedo = (double)((FCELL *) inrast_albedo)[col];
-		break;
-	    case DCELL_TYPE:
-		d_albedo = (double)((DCELL *) inrast_albedo)[col];
-		break;
-	    }
-	    switch (data_type_T) {
-	    case CELL_TYPE:
-		d_tempk = (double)((CELL *) inrast_T)[col];
-		break;
-	    case FCELL_TYPE:
-		d_tempk = (double)((FCELL *) inrast_T)[col];
-		break;
-	    case DCELL_TYPE:
-		d_tempk = (double)((DCELL *) inrast_T)[col];
-		break;
-	    }
-	    switch (data_type_dem) {
-	    case CELL_TYPE:
-		d_dem = (double)((CELL *) inrast_dem)[col];
-		break;
-	    case FCELL_TYPE:
-		d_dem = (double)((FCELL *) inrast_dem)[col];
-		break;
-	    case DCELL_TYPE:
-		d_dem = (double)((DCELL *) inrast_dem)[col];
-		break;
-	    }
-	    switch (data_type_u2m) {
-	    case CELL_TYPE:
-		d_u2m = (double)((CELL *) inrast_u2m)[col];
-		break;
-	    case FCELL_TYPE:
-		d_u2m = (double)((FCELL *) inrast_u2m)[col];
-		break;
-	    case DCELL_TYPE:
-		d_u2m = (double)((DCELL *) inrast_u2m)[col];
-		break;
-	    }
-	    switch (data_type_ndvi) {
-	    case CELL_TYPE:
-		d_ndvi = (double)((CELL *) inrast_ndvi)[col];
-		break;
-	    case FCELL_TYPE:
-		d_ndvi = (double)((FCELL *) inrast_ndvi)[col];
-		break;
-	    case DCELL_TYPE:
-		d_ndvi = (double)((DCELL *) inrast_ndvi)[col];
-		break;
-	    }
-	    switch (data_type_Rn) {
-	    case CELL_TYPE:
-		d_Rn = (double)((CELL *) inrast_Rn)[col];
-		break;
-	    case FCELL_TYPE:
-		d_Rn = (double)((FCELL *) inrast_Rn)[col];
-		break;
-	    case DCELL_TYPE:
-		d_Rn = (double)((DCELL *) inrast_Rn)[col];
-		break;
-	    }
-	    switch (data_type_g0) {
-	    case CELL_TYPE:
-		d_g0 = (double)((CELL *) inrast_g0)[col];
-		break;
-	    case FCELL_TYPE:
-		d_g0 = (double)((FCELL *) inrast_g0)[col];
-		break;
-	    case DCELL_TYPE:
-		d_g0 = (double)((DCELL *) inrast_g0)[col];
-		break;
-	    }
-	    if (Rast_is_d_null_value(&d_tempk) ||
-		Rast_is_d_null_value(&d_dem) ||
-		Rast_is_d_null_value(&d_u2m) ||
-		Rast_is_d_null_value(&d_ndvi) ||
-		Rast_is_d_null_value(&d_Rn) ||
-		Rast_is_d_null_value(&d_g0) ||
-		d_g0 < 0.0 || d_Rn < 0.0 ||
-		d_dem <= -100.0 || d_dem > 9000.0 || d_tempk < 200.0) {
-		Rast_set_d_null_value(&outrast[col], 1);
-	    }
-	    else {
-		/* Albedo < 0 */
-		if (d_albedo < 0.001) {
-		    d_albedo = 0.001;
-		}
-		/* Calculate T0dem */
-		d_t0dem = (double)d_tempk + 0.00627 * (double)d_dem;
-		/*      G_message("**InLoop d_t0dem=%5.3f",d_t0dem);
-		   G_message(" d_dem=%5.3f",d_dem);
-		   G_message(" d_tempk=%5.3f",d_tempk);
-		   G_message(" d_albedo=%5.3f",d_albedo);
-		   G_message(" d_Rn=%5.3f",d_Rn);
-		   G_message(" d_g0=%5.3f",d_g0);
-		   G_message(" d_ndvi=%5.3f",d_ndvi);
-		   G_message(" d_u_hu=%5.3f",d_u_hu);
-		 *//* Calculate sensible heat flux */
-		d = sensi_h(iteration,
-			    d_tempk_wet,
-			    d_tempk_dry,
-			    d_t0dem,
-			    d_tempk,
-			    d_ndvi,
-			    d_ndvi_max,
-			    d_dem,
-			    d_Rn_dry,
-			    d_g0_dry, d_t0dem_dry, d_u2m, d_dem_dry);
-		/*              G_message(" d_h0=%5.3f",d); */
-		if (zero->answer && d < 0.0) {
-		    d = 0.0;
-		}
-		outrast[col] = d;
-	    }
+	for (t = 0; t < nchunk; t++) {
+	    row = row0 + t;
+	    Rast_get_d_row(infd_T, in[t].T, row);
+	    Rast_get_d_row(infd_dem, in[t].dem, row);
+	    Rast_get_d_row(infd_u2m, in[t].u2m, row);
+	    Rast_get_d_row(infd_ndvi, in[t].ndvi, row);
+	    Rast_get_d_row(infd_Rn, in[t].Rn, row);
+	    Rast_get_d_row(infd_g0, in[t].g0, row);
 	}
-	Rast_put_d_row(outfd, outrast);
+
+#pragma omp parallel for schedule(static, 1)
+	for (t = 0; t < nchunk; t++)
+	    h0_row(&sebal, &in[t], ncols);
+
+	for (t = 0; t < nchunk; t++)
+	    Rast_put_d_row(outfd, in[t].out);
     }
-    G_free(inrast_T);
+    G_percent(nrows, nrows, 2);
+
+    for (t = 0; t < nthreads; t++)
+	free_rows(&in[t]);
+    G_free(in);
     Rast_close(infd_T);
-    G_free(inrast_dem);
     Rast_close(infd_dem);
-    G_free(inrast_u2m);
     Rast_close(infd_u2m);
-    G_free(inrast_ndvi);
     Rast_close(infd_ndvi);
-    G_free(inrast_Rn);
     Rast_close(infd_Rn);
-    G_free(inrast_g0);
     Rast_close(infd_g0);
-    G_free(inrast_albedo);
     Rast_close(infd_albedo);
 
-    G_free(outrast);
     Rast_close(outfd);
     /* add command line incantation to history file */
     Rast_short_history(h0, "raster", &history);
@@ -39,69 +39,52 @@
 
 #include "canny.h"
 
+#include <string.h>
 #include <math.h>
 
-void computeXGradients(DCELL * diffKernel, DCELL * yConv, DCELL * xGradient,
-		       int rows, int cols, int kernelWidth)
+/* x gradient of a row from the row convolved in y direction */
+void computeXGradientsRow(DCELL * diffKernel, DCELL * yConv,
+			  DCELL * xGradient, int cols, int kernelWidth)
 {
     int initX = kernelWidth - 1;
 
     int maxX = cols - (kernelWidth - 1);
 
-    int initY = cols * (kernelWidth - 1);
-
-    size_t maxY = (size_t) cols * (rows - (kernelWidth - 1));
-
     int x;
 
-    size_t y;
-
     int i;
 
-    for (x = initX; x < maxX; x++) {
-	for (y = initY; y < maxY; y += cols) {
-	    double sum = 0.;
+    for (x = 0; x < cols; x++)
+	xGradient[x] = 0.0;
 
-	    size_t index = x + y;
-
-	    for (i = 1; i < kernelWidth; i++) {
-		sum += diffKernel[i] * (yConv[index - i] - yConv[index + i]);
-	    }
-	    xGradient[index] = sum;
-	}
+    for (i = 1; i < kernelWidth; i++) {
+	for (x = initX; x < maxX; x++)
+	    xGradient[x] += diffKernel[i] * (yConv[x - i] - yConv[x + i]);
     }
 }
 
-
-void computeYGradients(DCELL * diffKernel, DCELL * xConv, DCELL * yGradient,
-		       int rows, int cols, int kernelWidth)
+/* y gradient of a row from the rows convolved in x direction, xConv
+ * points to the row, the rows around it are stored contiguously */
+void computeYGradientsRow(DCELL * diffKernel, DCELL * xConv,
+			  DCELL * yGradient, int cols, int kernelWidth)
 {
-    int initY = cols * (kernelWidth - 1);
-
-    size_t maxY = (size_t) cols * (rows - (kernelWidth - 1));
-
     int x;
 
-    size_t y;
-
     int i;
 
-    for (x = kernelWidth; x < cols - kernelWidth; x++) {
-	for (y = initY; y < maxY; y += cols) {
-	    double sum = 0.0;
+    size_t yOffset = cols;
 
-	    size_t index = x + y;
+    for (x = 0; x < cols; x++)
+	yGradient[x] = 0.0;
 
-	    int yOffset = cols;
+    for (i = 1; i < kernelWidth; i++) {
+	DCELL *above = xConv - yOffset;
 
-	    for (i = 1; i < kernelWidth; i++) {
-		sum +=
-		    diffKernel[i] * (xConv[index - yOffset] -
-				     xConv[index + yOffset]);
-		yOffset += cols;
-	    }
-	    yGradient[index] = sum;
-	}
+	DCELL *below = xConv + yOffset;
+
+	for (x = kernelWidth; x < cols - kernelWidth; x++)
+	    yGradient[x] += diffKernel[i] * (above[x] - below[x]);
+	yOffset += cols;
     }
 }
 
@@ -189,158 +172,179 @@ static int isLocalMax(double xGrad, double yGrad, double gradMag,
     return 0;
 }
 
-void nonmaxSuppresion(DCELL * xGradient, DCELL * yGradient, CELL * magnitude,
-		      CELL *angle,
-		      int rows, int cols, int kernelWidth,
-		      int magnitudeScale, int magnitudeLimit)
+/* magnitude of the local maxima of a row, xGradient and yGradient point
+ * to the row, the rows above and below are stored contiguously */
+void nonmaxSuppresionRow(DCELL * xGradient, DCELL * yGradient,
+			 CELL * magnitude, CELL * angle, int cols,
+			 int kernelWidth, int magnitudeScale,
+			 int magnitudeLimit)
 {
     int initX = kernelWidth;
 
     int maxX = cols - kernelWidth;
 
-    int initY = cols * kernelWidth;
-
-    size_t maxY = cols * (rows - kernelWidth);
-
     int x;
 
-    size_t y;
-
     int MAGNITUDE_MAX = magnitudeScale * magnitudeLimit;
 
-    for (x = initX; x < maxX; x++) {
-	for (y = initY; y < maxY; y += cols) {
-	    size_t index = x + y;
-
-	    int indexN = index - cols;
-
-	    int indexS = index + cols;
+    DCELL *xN = xGradient - cols, *xC = xGradient, *xS = xGradient + cols;
 
-	    int indexW = index - 1;
+    DCELL *yN = yGradient - cols, *yC = yGradient, *yS = yGradient + cols;
 
-	    int indexE = index + 1;
+    for (x = 0; x < cols; x++)
+	magnitude[x] = 0;
 
-	    int indexNW = indexN - 1;
-
-	    int indexNE = indexN + 1;
-
-	    int indexSW = indexS - 1;
-
-	    int indexSE = indexS + 1;
-
-	    double xGrad = xGradient[index];
+    for (x = initX; x < maxX; x++) {
+	double xGrad = xC[x];
 
-	    double yGrad = yGradient[index];
+	double yGrad = yC[x];
 
-	    double gradMag = custom_hypot(xGrad, yGrad);
+	double gradMag = custom_hypot(xGrad, yGrad);
 
-	    /* perform non-maximal supression */
-	    double nMag = custom_hypot(xGradient[indexN], yGradient[indexN]);
+	/* perform non-maximal supression */
+	double nMag = custom_hypot(xN[x], yN[x]);
 
-	    double sMag = custom_hypot(xGradient[indexS], yGradient[indexS]);
+	double sMag = custom_hypot(xS[x], yS[x]);
 
-	    double wMag = custom_hypot(xGradient[indexW], yGradient[indexW]);
+	double wMag = custom_hypot(xC[x - 1], yC[x - 1]);
 
-	    double eMag = custom_hypot(xGradient[indexE], yGradient[indexE]);
+	double eMag = custom_hypot(xC[x + 1], yC[x + 1]);
 
-	    double neMag =
-		custom_hypot(xGradient[indexNE], yGradient[indexNE]);
+	double neMag = custom_hypot(xN[x + 1], yN[x + 1]);
 
-	    double seMag =
-		custom_hypot(xGradient[indexSE], yGradient[indexSE]);
+	double seMag = custom_hypot(xS[x + 1], yS[x + 1]);
 
-	    double swMag =
-		custom_hypot(xGradient[indexSW], yGradient[indexSW]);
+	double swMag = custom_hypot(xS[x - 1], yS[x - 1]);
 
-	    double nwMag =
-		custom_hypot(xGradient[indexNW], yGradient[indexNW]);
+	double nwMag = custom_hypot(xN[x - 1], yN[x - 1]);
 
-	    if (isLocalMax(xGrad, yGrad, gradMag, neMag, seMag, swMag, nwMag,
-			   nMag, eMag, sMag, wMag)) {
-		magnitude[index] =
-		    gradMag >=
-		    magnitudeLimit ? MAGNITUDE_MAX : (int)(magnitudeScale *
-							   gradMag + 0.5);
-		/*
-		   NOTE: The orientation of the edge is not employed by this
-		   implementation. It is a simple matter to compute it at
-		   this point as: Math.atan2(yGrad, xGrad);
-		 */
-		if (angle != NULL)
-		{
-		    // angle of gradient (mathematical axes)
-		    angle[index] = (int) (-atan2(yGrad, xGrad) * 180 / M_PI + 0.5);
-		}
-	    }
-	    else {
-		magnitude[index] = 0;
+	if (isLocalMax(xGrad, yGrad, gradMag, neMag, seMag, swMag, nwMag,
+		       nMag, eMag, sMag, wMag)) {
+	    magnitude[x] =
+		gradMag >=
+		magnitudeLimit ? MAGNITUDE_MAX : (int)(magnitudeScale *
+						       gradMag + 0.5);
+	    if (angle != NULL) {
+		// angle of gradient (mathematical axes)
+		angle[x] = (int)(-atan2(yGrad, xGrad) * 180 / M_PI + 0.5);
 	    }
 	}
     }
 }
 
-static void follow(CELL * edges, CELL * magnitude, int x1, int y1, int i1,
-		   int threshold, int rows, int cols)
+/*
+ * Hysteresis: the edge candidates (magnitude at least the low threshold)
+ * are labelled row by row as 8-connected components with a union-find
+ * structure, a component is marked if any of its cells reaches the high
+ * threshold. Only the labels of the previous row are kept, the labels of
+ * all rows are written by the caller and resolved by hysteresisIsEdge()
+ * once all rows are done.
+ */
+void hysteresisInit(struct hysteresis *h, int cols, int low, int high)
 {
-    int x0 = x1 == 0 ? x1 : x1 - 1;
-
-    int x2 = x1 == cols - 1 ? x1 : x1 + 1;
-
-    int y0 = y1 == 0 ? y1 : y1 - 1;
-
-    int y2 = y1 == rows - 1 ? y1 : y1 + 1;
-
-    int x;
-
-    int y;
+    h->cols = cols;
+    h->low = low;
+    h->high = high;
+    h->nlabels = 1;		/* 0 is no candidate */
+    h->nalloc = 1024;
+    h->parent = G_malloc(h->nalloc * sizeof(int));
+    h->strong = G_malloc(h->nalloc);
+    h->parent[0] = 0;
+    h->strong[0] = 0;
+    h->prev = G_calloc(cols, sizeof(int));
+}
 
-    edges[i1] = magnitude[i1];
-    for (x = x0; x <= x2; x++) {
-	for (y = y0; y <= y2; y++) {
-	    int i2 = x + y * cols;
+void hysteresisFree(struct hysteresis *h)
+{
+    G_free(h->parent);
+    G_free(h->strong);
+    G_free(h->prev);
+}
 
-	    if ((y != y1 || x != x1) && edges[i2] == 0
-		&& magnitude[i2] >= threshold) {
-		follow(edges, magnitude, x, y, i2, threshold, rows, cols);
-		return;
-	    }
-	}
+static int findRoot(struct hysteresis *h, int label)
+{
+    int root = label, next;
+
+    while (h->parent[root] != root)
+	root = h->parent[root];
+    /* path compression */
+    while (h->parent[label] != root) {
+	next = h->parent[label];
+	h->parent[label] = root;
+	label = next;
     }
+
+    return root;
 }
 
-/* edges.fill(0) */
-void performHysteresis(CELL * edges, CELL * magnitude, int low, int high,
-		       int rows, int cols)
+static int unionLabels(struct hysteresis *h, int a, int b)
 {
-    /*
-       NOTE: this implementation reuses the data array to store both
-       luminance data from the image, and edge intensity from the processing.
-       This is done for memory efficiency, other implementations may wish
-       to separate these functions.
-     */
+    a = findRoot(h, a);
+    b = findRoot(h, b);
+    if (a == b)
+	return a;
+    if (b < a) {
+	int t = a;
+
+	a = b;
+	b = t;
+    }
+    h->parent[b] = a;
+    h->strong[a] |= h->strong[b];
 
-    int x;
+    return a;
+}
 
-    int y;
+static int newLabel(struct hysteresis *h)
+{
+    if (h->nlabels == h->nalloc) {
+	h->nalloc *= 2;
+	h->parent = G_realloc(h->parent, h->nalloc * sizeof(int));
+	h->strong = G_realloc(h->strong, h->nalloc);
+    }
+    h->parent[h->nlabels] = h->nlabels;
+    h->strong[h->nlabels] = 0;
 
-    int offset = 0;
+    return h->nlabels++;
+}
 
-    for (y = 0; y < rows; y++) {
-	for (x = 0; x < cols; x++) {
-	    if (edges[offset] == 0 && magnitude[offset] >= high) {
-		follow(edges, magnitude, x, y, offset, low, rows, cols);
-	    }
-	    offset++;
+/* label the candidates of the next row */
+void hysteresisRow(struct hysteresis *h, CELL * magnitude, int *labels)
+{
+    int x, label, n;
+
+    for (x = 0; x < h->cols; x++) {
+	labels[x] = 0;
+	if (magnitude[x] <= 0 ||
+	    (magnitude[x] < h->low && magnitude[x] < h->high))
+	    continue;
+
+	/* neighbours already labelled: W, NW, N, NE */
+	label = 0;
+	if (x > 0 && labels[x - 1])
+	    label = labels[x - 1];
+	for (n = x - 1; n <= x + 1; n++) {
+	    if (n < 0 || n >= h->cols || !h->prev[n])
+		continue;
+	    if (label)
+		label = unionLabels(h, label, h->prev[n]);
+	    else
+		label = h->prev[n];
 	}
+	if (!label)
+	    label = newLabel(h);
+	if (magnitude[x] >= h->high)
+	    h->strong[findRoot(h, label)] = 1;
+	labels[x] = label;
     }
+
+    memcpy(h->prev, labels, h->cols * sizeof(int));
 }
 
-void thresholdEdges(CELL * edges, int rows, int cols)
+int hysteresisIsEdge(struct hysteresis *h, int label)
 {
-    int i;
-    size_t max = (size_t) rows * cols;
+    if (!label)
+	return 0;
 
-    for (i = 0; i < max; i++) {
-	edges[i] = edges[i] > 0 ? 1 : 0;
-    }
+    return h->strong[findRoot(h, label)];
 }
@@ -3,19 +3,30 @@
 
 #include <grass/gis.h>
 
-void computeXGradients(DCELL * diffKernel, DCELL * yConv, DCELL * xGradient,
-		       int rows, int cols, int kernelWidth);
+struct hysteresis
+{
+    int cols;
+    int low, high;
+    int *parent;		/* union-find of the labels */
+    char *strong;		/* the component of a root label is an edge */
+    int nlabels, nalloc;
+    int *prev;			/* labels of the previous row */
+};
 
-void computeYGradients(DCELL * diffKernel, DCELL * xConv, DCELL * yGradient,
-		       int rows, int cols, int kernelWidth);
+void computeXGradientsRow(DCELL * diffKernel, DCELL * yConv,
+			  DCELL * xGradient, int cols, int kernelWidth);
 
-void nonmaxSuppresion(DCELL * xGradient, DCELL * yGradient, CELL *magnitude,
-		      CELL *angle, int rows, int cols,
-		      int kernelWidth, int magnitudeScale, int magnitudeLimit);
+void computeYGradientsRow(DCELL * diffKernel, DCELL * xConv,
+			  DCELL * yGradient, int cols, int kernelWidth);
 
-void performHysteresis(CELL * edges, CELL *magnitude,
-		       int low, int high, int rows, int cols);
+void nonmaxSuppresionRow(DCELL * xGradient, DCELL * yGradient,
+			 CELL * magnitude, CELL * angle, int cols,
+			 int kernelWidth, int magnitudeScale,
+			 int magnitudeLimit);
 
-void thresholdEdges(CELL * edges, int rows, int cols);
+void hysteresisInit(struct hysteresis *h, int cols, int low, int high);
+void hysteresisRow(struct hysteresis *h, CELL * magnitude, int *labels);
+int hysteresisIsEdge(struct hysteresis *h, int label);
+void hysteresisFree(struct hysteresis *h);
 
 #endif /* CANNY_H */
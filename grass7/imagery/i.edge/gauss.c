@@ -33,45 +33,56 @@ void gaussKernel(DCELL * gaussKernel, DCELL * diffKernel,
     }
 }
 
-void gaussConvolution(DCELL * image, DCELL * kernel, DCELL * xConv,
-		      DCELL * yConv, int rows, int cols, int kernelWidth)
+/* The convolutions are separable: the rows are convolved in x direction,
+ * and a row is convolved in y direction from the rows around it. The
+ * loops over the columns are innermost, thus they can be vectorised. The
+ * sums are accumulated in the same order as in the 2-D formulation. */
+
+void gaussConvolutionRowX(DCELL * image, DCELL * kernel, DCELL * xConv,
+			  int cols, int kernelWidth)
 {
-    int x;
-    size_t y;
+    int x, i;
 
     int initX = kernelWidth - 1;
 
     int maxX = cols - (kernelWidth - 1);
 
-    int initY = cols * (kernelWidth - 1);
+    for (x = 0; x < cols; x++)
+	xConv[x] = 0.0;
+
+    for (x = initX; x < maxX; x++)
+	xConv[x] = image[x] * kernel[0];
+    for (i = 1; i < kernelWidth; i++) {
+	for (x = initX; x < maxX; x++)
+	    xConv[x] += kernel[i] * (image[x - i] + image[x + i]);
+    }
+}
+
+/* image points to the row to be convolved, the rows around it are
+ * stored contiguously */
+void gaussConvolutionRowY(DCELL * image, DCELL * kernel, DCELL * yConv,
+			  int cols, int kernelWidth)
+{
+    int x, i;
 
-    size_t maxY = (size_t) cols * (rows - (kernelWidth - 1));
+    int initX = kernelWidth - 1;
 
-    //perform convolution in x and y directions
-    for (x = initX; x < maxX; x++) {
-	for (y = initY; y < maxY; y += cols) {
-	    size_t index = x + y;
+    int maxX = cols - (kernelWidth - 1);
 
-	    double sumX = image[index] * kernel[0];
+    size_t yOffset = cols;
 
-	    double sumY = sumX;
+    for (x = 0; x < cols; x++)
+	yConv[x] = 0.0;
 
-	    int xOffset = 1;
+    for (x = initX; x < maxX; x++)
+	yConv[x] = image[x] * kernel[0];
+    for (i = 1; i < kernelWidth; i++) {
+	DCELL *above = image - yOffset;
 
-	    int yOffset = cols;
+	DCELL *below = image + yOffset;
 
-	    for (; xOffset < kernelWidth;) {
-		sumY +=
-		    kernel[xOffset] * (image[index - yOffset] +
-				       image[index + yOffset]);
-		sumX +=
-		    kernel[xOffset] * (image[index - xOffset] +
-				       image[index + xOffset]);
-		yOffset += cols;
-		xOffset++;
-	    }
-	    yConv[index] = sumY;
-	    xConv[index] = sumX;
-	}
+	for (x = initX; x < maxX; x++)
+	    yConv[x] += kernel[i] * (above[x] + below[x]);
+	yOffset += cols;
     }
 }
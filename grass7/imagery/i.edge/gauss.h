@@ -7,7 +7,9 @@ int getKernelWidth(const double sigma, double gaussianCutOff);
 
 void gaussKernel(DCELL * gaussKernel, DCELL * diffKernel,
 		 int kernelWidth, double kernelRadius);
-void gaussConvolution(DCELL * image, DCELL * kernel, DCELL * xConv,
-		      DCELL * yConv, int rows, int cols, int kernelWidth);
+void gaussConvolutionRowX(DCELL * image, DCELL * kernel, DCELL * xConv,
+			  int cols, int kernelWidth);
+void gaussConvolutionRowY(DCELL * image, DCELL * kernel, DCELL * yConv,
+			  int cols, int kernelWidth);
 
 #endif /* GAUSS_H */
@@ -26,97 +26,79 @@
 
 #include <math.h>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 #include "canny.h"
 #include "gauss.h"
 
-/** Loads map into memory.
+/* number of output rows computed at once */
+#define BAND_ROWS 64
 
-  \param[out] mat map in a matrix (row order), field have to be allocated
-  */
-static void readMap(const char *name, const char *mapset, int nrows,
-		    int ncols, DCELL * mat)
+/* the rows of the input map and of the map convolved in x direction
+ * needed by the current band, kept contiguously */
+struct band
 {
-
-    int r, c;
-
-    int map_fd;
-
-    int check_reading;
-
+    int fd;
+    int ncols;
+    int lo, hi;			/* rows in the buffers */
+    DCELL *image;
+    DCELL *xConv;
     DCELL *row_buffer;
+    int check_reading;
+};
 
-    DCELL cell_value;
-
-    row_buffer = Rast_allocate_d_input_buf();
-    check_reading = 0;
+/** Reads the rows [lo, hi) of the input map into the band, the rows
+  already in the band are moved, only the new rows are read and
+  convolved in x direction.
+  */
+static void readBand(struct band *b, int lo, int hi, DCELL * kernel,
+		     int kernelWidth, int nrows)
+{
+    int r, c, keep, first;
 
+    size_t ncols = b->ncols;
 
-    /* load map */
-    map_fd = Rast_open_old(name, mapset);
-    if (map_fd < 0) {
-	G_fatal_error(_("Error opening first raster map <%s>"), name);
+    keep = 0;
+    if (lo < b->hi && lo >= b->lo) {
+	keep = b->hi - lo;
+	memmove(b->image, b->image + (lo - b->lo) * ncols,
+		keep * ncols * sizeof(DCELL));
+	memmove(b->xConv, b->xConv + (lo - b->lo) * ncols,
+		keep * ncols * sizeof(DCELL));
     }
+    first = lo + keep;
+    b->lo = lo;
+    b->hi = hi;
 
-    G_debug(1, "fd %d %s %s", map_fd, name, mapset);
-
-    //    if ((first_map_R_type =
-    //         Rast_map_type(templName, mapset)) < 0)
-    //        G_fatal_error(_("Error getting first raster map type"));
-
-    for (r = 0; r < nrows; r++) {
-	Rast_get_row(map_fd, row_buffer, r, DCELL_TYPE);
-
-	for (c = 0; c < ncols; c++) {
-	    cell_value = row_buffer[c];
-	    size_t index = ((size_t) ncols * r) + c;
+    for (r = first; r < hi; r++) {
+	DCELL *mat = b->image + (r - lo) * ncols;
 
-	    if (!Rast_is_d_null_value(&cell_value))
-		mat[index] = cell_value;
+	Rast_get_row(b->fd, b->row_buffer, r, DCELL_TYPE);
+	for (c = 0; c < b->ncols; c++) {
+	    if (!Rast_is_d_null_value(&b->row_buffer[c]))
+		mat[c] = b->row_buffer[c];
 	    else
-		mat[index] = 0.0;
+		mat[c] = 0.0;
 
-	    if (mat[index])
-		check_reading = 1;
+	    if (mat[c])
+		b->check_reading = 1;
 	}
     }
-    G_free(row_buffer);
 
-    if (!check_reading)
-	G_fatal_error(_("Nothing read from map %d"), check_reading);
-
-    Rast_close(map_fd);
-}
+#pragma omp parallel for schedule(static) private(r)
+    for (r = first; r < hi; r++) {
+	DCELL *xConv = b->xConv + (r - lo) * ncols;
 
-/** Writes map from memory into the file.
-
-  \param[in] map map in a matrix (row order)
-  */
-static void writeMap(const char *name, int nrows, int ncols, CELL * map)
-{
-    unsigned char *outrast;	/* output buffer */
-
-    int outfd;
-
-    outfd = Rast_open_new(name, CELL_TYPE);	// FIXME: using both open old and open new
-    int r, c;
-
-    outrast = Rast_allocate_buf(CELL_TYPE);
-    for (r = 0; r < nrows; r++) {
-	for (c = 0; c < ncols; c++) {
-	    size_t index = (size_t) r * ncols + c;
-
-	    CELL value = map[index];
-
-	    ((CELL *) outrast)[c] = value;
-	}
-	Rast_put_row(outfd, outrast, CELL_TYPE);
+	if (r >= kernelWidth - 1 && r < nrows - (kernelWidth - 1))
+	    gaussConvolutionRowX(b->image + (r - lo) * ncols, kernel, xConv,
+				 b->ncols, kernelWidth);
+	else
+	    memset(xConv, 0, ncols * sizeof(DCELL));
     }
-    G_free(outrast);
-
-    Rast_close(outfd);
 }
 
-
 /**
 
   \todo Floats are used instead of doubles.
@@ -146,16 +128,26 @@ int main(int argc, char *argv[])
     int lowThreshold, highThreshold, low, high;
 
     int nrows, ncols;
-    size_t dim_2;
+
+    int r0, r1, glo, ghi, r, nthreads;
+
+    struct band band;
+
+    int outfd, anglefd;
+
+    char *labelsName;
+
+    FILE *labelsFile;
+
+    struct hysteresis hyst;
 
 //    struct History history; /* holds meta-data (title, comments,..) */
     struct GModule *module; /* GRASS module for parsing arguments */
 
     /* options */
     struct Option *input, *output, *angleOutput,
-	*lowThresholdOption, *highThresholdOption, *sigmaOption;
-
-    size_t r;
+	*lowThresholdOption, *highThresholdOption, *sigmaOption,
+	*threadsOption;
 
     /* initialize GIS environment */
     G_gisinit(argv[0]); /* reads grass env, stores program name to G_program_name() */
@@ -205,10 +197,28 @@ int main(int argc, char *argv[])
     sigmaOption->description = _("Kernel radius");
     sigmaOption->answer = "2";
 
+    threadsOption = G_define_option();
+    threadsOption->key = "threads";
+    threadsOption->type = TYPE_INTEGER;
+    threadsOption->required = NO;
+    threadsOption->description = _("Number of threads for parallel computing");
+    threadsOption->answer = "1";
+
     /* options and flags parser */
     if (G_parser(argc, argv))
 	exit(EXIT_FAILURE);
 
+    nthreads = atoi(threadsOption->answer);
+    if (nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than 0"), threadsOption->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+#endif
+
     lowThreshold = (int) (atof(lowThresholdOption->answer) + 0.5);
     highThreshold = (int) (atof(highThresholdOption->answer) + 0.5);
 
@@ -253,28 +263,6 @@ int main(int argc, char *argv[])
 
     ncols = Rast_window_cols();
 
-    dim_2 = (size_t) nrows * ncols;
-
-    DCELL *mat1;
-
-    /* Memory allocation for map_1: */
-    mat1 = (DCELL *) G_calloc((dim_2), sizeof(DCELL));
-
-
-    // FIXME: it is necessary?
-    for (r = 0; r < dim_2; r++) {
-	mat1[r] = 0.0;
-    }
-
-    //    if ((first_map_R_type =
-    //         Rast_map_type(templName, mapset)) < 0)
-    //        G_fatal_error(_("Error getting first raster map type"));
-
-
-    readMap(name, mapset, nrows, ncols, mat1);
-
-    /* **** */
-
     kernelWidth = getKernelWidth(kernelRadius, GAUSSIAN_CUT_OFF);
 
     DCELL *kernel;
@@ -285,68 +273,161 @@ int main(int argc, char *argv[])
     diffKernel = (DCELL *) G_calloc((kernelWidth), sizeof(DCELL));
     gaussKernel(kernel, diffKernel, kernelWidth, kernelRadius);
 
+    /*
+     * The output rows are computed in bands. A band of rows [r0, r1)
+     * needs the gradients of the rows [r0 - 1, r1 + 1) for the
+     * non-maximum suppression and those need the input rows
+     * [r0 - kernelWidth, r1 + kernelWidth). The rows of a band are
+     * processed in parallel, the hysteresis labels the edge candidates
+     * row by row, the labels are stored in a temporary file and the
+     * edges are written once all rows are labelled.
+     */
+    size_t bandCells = (size_t) (BAND_ROWS + 2 * kernelWidth) * ncols;
 
-    DCELL *yConv = (DCELL *) G_calloc((dim_2), sizeof(DCELL));
+    size_t gradCells = (size_t) (BAND_ROWS + 2) * ncols;
 
-    DCELL *xConv = (DCELL *) G_calloc((dim_2), sizeof(DCELL));
+    band.fd = Rast_open_old(name, mapset);
+    band.ncols = ncols;
+    band.lo = band.hi = 0;
+    band.image = (DCELL *) G_malloc(bandCells * sizeof(DCELL));
+    band.xConv = (DCELL *) G_malloc(bandCells * sizeof(DCELL));
+    band.row_buffer = Rast_allocate_d_input_buf();
+    band.check_reading = 0;
 
-    for (r = 0; r < dim_2; r++) {
-	yConv[r] = xConv[r] = 0;
-    }
-    gaussConvolution(mat1, kernel, xConv, yConv, nrows, ncols, kernelWidth);
+    DCELL *yConv = (DCELL *) G_malloc(gradCells * sizeof(DCELL));
 
+    DCELL *xGradient = (DCELL *) G_malloc(gradCells * sizeof(DCELL));
 
-    DCELL *yGradient = (DCELL *) G_calloc((dim_2), sizeof(DCELL));
+    DCELL *yGradient = (DCELL *) G_malloc(gradCells * sizeof(DCELL));
 
-    DCELL *xGradient = (DCELL *) G_calloc((dim_2), sizeof(DCELL));
-
-    for (r = 0; r < dim_2; r++) {
-	yGradient[r] = xGradient[r] = 0;
-    }
-
-
-    computeXGradients(diffKernel, yConv, xGradient, nrows, ncols,
-		      kernelWidth);
-    computeYGradients(diffKernel, xConv, yGradient, nrows, ncols,
-		      kernelWidth);
+    CELL *magnitude =
+	(CELL *) G_malloc((size_t) BAND_ROWS * ncols * sizeof(CELL));
+    CELL *angle = NULL;
 
+    int *labels = (int *)G_malloc((size_t) ncols * sizeof(int));
 
-    CELL *magnitude = (CELL *) G_calloc((dim_2), sizeof(CELL));
+    CELL *edges = Rast_allocate_c_buf();
 
-    CELL *angle = NULL;
-    if (anglesMapName != NULL)
-    {
-        angle = (CELL *) G_calloc((dim_2), sizeof(CELL));
-        Rast_set_null_value(angle, dim_2, CELL_TYPE);
+    anglefd = -1;
+    if (anglesMapName != NULL) {
+	angle = (CELL *) G_malloc((size_t) BAND_ROWS * ncols * sizeof(CELL));
+	anglefd = Rast_open_new(anglesMapName, CELL_TYPE);
     }
 
-    nonmaxSuppresion(xGradient, yGradient, magnitude, angle,
-		     nrows, ncols, kernelWidth,
-		     MAGNITUDE_SCALE, MAGNITUDE_LIMIT);
+    labelsName = G_tempfile();
+    labelsFile = fopen(labelsName, "w+b");
+    if (labelsFile == NULL)
+	G_fatal_error(_("Unable to open temporary file <%s>"), labelsName);
+
+    hysteresisInit(&hyst, ncols, low, high);
+
+    G_message(_("Computing gradients..."));
+    for (r0 = 0; r0 < nrows; r0 += BAND_ROWS) {
+	r1 = r0 + BAND_ROWS < nrows ? r0 + BAND_ROWS : nrows;
+	G_percent(r0, nrows, 2);
+
+	readBand(&band, r0 - kernelWidth > 0 ? r0 - kernelWidth : 0,
+		 r1 + kernelWidth < nrows ? r1 + kernelWidth : nrows,
+		 kernel, kernelWidth, nrows);
+
+	/* gradients of the rows [glo, ghi) */
+	glo = r0 - 1 > 0 ? r0 - 1 : 0;
+	ghi = r1 + 1 < nrows ? r1 + 1 : nrows;
+#pragma omp parallel for schedule(static) private(r)
+	for (r = glo; r < ghi; r++) {
+	    size_t g = (size_t) (r - glo) * ncols;
+
+	    size_t i = (size_t) (r - band.lo) * ncols;
+
+	    if (r >= kernelWidth - 1 && r < nrows - (kernelWidth - 1)) {
+		gaussConvolutionRowY(band.image + i, kernel, yConv + g,
+				     ncols, kernelWidth);
+		computeXGradientsRow(diffKernel, yConv + g, xGradient + g,
+				     ncols, kernelWidth);
+		computeYGradientsRow(diffKernel, band.xConv + i,
+				     yGradient + g, ncols, kernelWidth);
+	    }
+	    else {
+		memset(xGradient + g, 0, ncols * sizeof(DCELL));
+		memset(yGradient + g, 0, ncols * sizeof(DCELL));
+	    }
+	}
 
+	/* non-maximum suppression of the rows [r0, r1) */
+#pragma omp parallel for schedule(static) private(r)
+	for (r = r0; r < r1; r++) {
+	    size_t g = (size_t) (r - glo) * ncols;
 
-    CELL *edges = (CELL *) G_calloc((dim_2), sizeof(CELL));
+	    CELL *m = magnitude + (size_t) (r - r0) * ncols;
 
-    for (r = 0; r < dim_2; r++) {
-	edges[r] = 0;
-    }
+	    CELL *a = angle ? angle + (size_t) (r - r0) * ncols : NULL;
 
-    performHysteresis(edges, magnitude, low, high, nrows, ncols);
+	    if (a)
+		Rast_set_c_null_value(a, ncols);
+	    if (r >= kernelWidth && r < nrows - kernelWidth)
+		nonmaxSuppresionRow(xGradient + g, yGradient + g, m, a,
+				    ncols, kernelWidth, MAGNITUDE_SCALE,
+				    MAGNITUDE_LIMIT);
+	    else
+		memset(m, 0, ncols * sizeof(CELL));
+	}
 
-    thresholdEdges(edges, nrows, ncols);
+	for (r = r0; r < r1; r++) {
+	    if (angle)
+		Rast_put_c_row(anglefd, angle + (size_t) (r - r0) * ncols);
+	    hysteresisRow(&hyst, magnitude + (size_t) (r - r0) * ncols,
+			  labels);
+	    if (fwrite(labels, sizeof(int), ncols, labelsFile) !=
+		(size_t) ncols)
+		G_fatal_error(_("Unable to write to temporary file <%s>"),
+			      labelsName);
+	}
+    }
+    G_percent(1, 1, 1);
 
-    writeMap(result, nrows, ncols, edges);
+    if (!band.check_reading)
+	G_fatal_error(_("Nothing read from map %d"), band.check_reading);
 
+    Rast_close(band.fd);
     if (angle != NULL)
-    {
-        writeMap(anglesMapName, nrows, ncols, angle);
+	Rast_close(anglefd);
+
+    /* edges are the candidates connected to a strong one */
+    G_message(_("Writing edges..."));
+    rewind(labelsFile);
+    outfd = Rast_open_new(result, CELL_TYPE);
+    for (r = 0; r < nrows; r++) {
+	int c;
+
+	G_percent(r, nrows, 2);
+	if (fread(labels, sizeof(int), ncols, labelsFile) != (size_t) ncols)
+	    G_fatal_error(_("Unable to read from temporary file <%s>"),
+			  labelsName);
+	for (c = 0; c < ncols; c++)
+	    edges[c] = hysteresisIsEdge(&hyst, labels[c]);
+	Rast_put_c_row(outfd, edges);
     }
+    G_percent(1, 1, 1);
+    Rast_close(outfd);
 
-    /* **** */
+    fclose(labelsFile);
+    remove(labelsName);
 
     /* memory cleanup */
+    hysteresisFree(&hyst);
     G_free(kernel);
     G_free(diffKernel);
+    G_free(band.image);
+    G_free(band.xConv);
+    G_free(band.row_buffer);
+    G_free(yConv);
+    G_free(xGradient);
+    G_free(yGradient);
+    G_free(magnitude);
+    if (angle != NULL)
+	G_free(angle);
+    G_free(labels);
+    G_free(edges);
     G_free(name);
 
 
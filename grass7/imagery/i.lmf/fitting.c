@@ -1,88 +1,123 @@
 
 /*************************************************************
 ******Triangular Function Fitting********************
-*************************************************************/  
+*************************************************************/
 #include<stdio.h>
 #include<stdlib.h>
-    
-#define NMAX 200
-#define MAXF 50
-int invert_matrix(double a[][MAXF], int order);
+#include "local_proto.h"
 
-int fitting(int npoint, int nfunc, double *dat, int *idx1, double f[][MAXF],
-	      double *c, double *vfit)
+/* Inverted normal matrix of the observations flagged in idx1,
+ * returns 0 if there are fewer observations than functions */
+int normal_matrix(int npoint, int nn, const unsigned char *idx1,
+		  double f[][MAXF], double *tinv)
 {
-    int i, j, k, k1, k2, nn;
+    int i, j, k1, k2, nobs;
 
     double tf[MAXF][MAXF];
 
-    double tinv[MAXF][MAXF];
-
-    double vec[MAXF];
+    double a[MAXF][MAXF];
 
     double tfij;
 
-    double sum;
-
-    nn = nfunc * 2 + 2;
-    
-	/*Value Initialization */ 
-	for (i = 0; i < nn; i++) {
-	c[i] = 0.0;
-    }
-    for (i = 0; i < npoint; i++) {
-	vfit[i] = 0.0;
-    }
-    
-	/*Matrix Initialization */ 
-	for (i = 0; i < nn; i++) {
+    /*Matrix Initialization */
+    for (i = 0; i < nn; i++) {
 	for (j = 0; j < nn; j++) {
 	    tf[i][j] = 0.0;
 	    tf[j][i] = 0.0;
 	}
-	vec[i] = 0.0;
     }
-    
-	/*Making Matrix */ 
-	for (i = 0; i < npoint; i++) {
+
+    /*Making Matrix */
+    nobs = 0;
+    for (i = 0; i < npoint; i++) {
 	if (idx1[i] == 1) {
 	    for (k1 = 0; k1 < nn; k1++) {
 		for (k2 = 0; k2 < nn; k2++) {
 		    tf[k1][k2] = tf[k1][k2] + f[i][k2] * f[i][k1];
 		}
-		vec[k1] = vec[k1] + dat[i] * f[i][k1];
 	    }
+	    nobs++;
 	}
     }
-    
-	/*Matrix Copy and Inversion */ 
-	for (i = 0; i < nn; i++) {
+    if (nobs < nn)
+	return 0;
+
+    /*Matrix Copy and Inversion */
+    for (i = 0; i < nn; i++) {
 	for (j = i; j < nn; j++) {
 	    tfij = tf[i][j];
-	    tinv[i][j] = tfij;
-	    tinv[j][i] = tfij;
+	    a[i][j] = tfij;
+	    a[j][i] = tfij;
+	}
+    }
+    invert_matrix(a, nn);
+
+    for (i = 0; i < nn; i++)
+	for (j = 0; j < nn; j++)
+	    tinv[i * nn + j] = a[i][j];
+
+    return 1;
+}
+
+/* Fitting of npix pixels sharing the observations flagged in idx1,
+ * dat and vfit hold npoint rows of LMF_BLOCK pixels, vec and c nn rows.
+ * The pixels are innermost, the sums are accumulated in the same order
+ * for every pixel as for a single one. */
+void fitting(int npoint, int nn, const unsigned char *idx1,
+	     double f[][MAXF], const double *tinv, int npix,
+	     const double *dat, double *vec, double *c, double *vfit)
+{
+    int i, j, k, p;
+
+    /*Making Vector */
+    for (k = 0; k < nn; k++) {
+	for (p = 0; p < npix; p++)
+	    vec[k * LMF_BLOCK + p] = 0.0;
+    }
+    for (i = 0; i < npoint; i++) {
+	if (idx1[i] == 1) {
+	    const double *d = dat + i * LMF_BLOCK;
+
+	    for (k = 0; k < nn; k++) {
+		double *v = vec + k * LMF_BLOCK;
+
+		double fik = f[i][k];
+
+		for (p = 0; p < npix; p++)
+		    v[p] = v[p] + d[p] * fik;
+	    }
 	}
     }
-    invert_matrix(tinv, nn);
-    
-	/*Calculation of Coefficients */ 
-	for (i = 0; i < nn; i++) {
-	sum = 0.0;
+
+    /*Calculation of Coefficients */
+    for (i = 0; i < nn; i++) {
+	double *ci = c + i * LMF_BLOCK;
+
+	for (p = 0; p < npix; p++)
+	    ci[p] = 0.0;
 	for (j = 0; j < nn; j++) {
-	    sum = sum + tinv[i][j] * vec[j];
+	    const double *v = vec + j * LMF_BLOCK;
+
+	    double t = tinv[i * nn + j];
+
+	    for (p = 0; p < npix; p++)
+		ci[p] = ci[p] + t * v[p];
 	}
-	c[i] = sum;
     }
-    
-	/*Calculating theoretical value */ 
-	for (i = 0; i < npoint; i++) {
-	sum = 0.0;
+
+    /*Calculating theoretical value */
+    for (i = 0; i < npoint; i++) {
+	double *vf = vfit + i * LMF_BLOCK;
+
+	for (p = 0; p < npix; p++)
+	    vf[p] = 0.0;
 	for (k = 0; k < nn; k++) {
-	    sum = sum + c[k] * f[i][k];
+	    const double *ck = c + k * LMF_BLOCK;
+
+	    double fik = f[i][k];
+
+	    for (p = 0; p < npix; p++)
+		vf[p] = vf[p] + ck[p] * fik;
 	}
-	vfit[i] = sum;
     }
-    return;
 }
-
-
@@ -1,148 +1,192 @@
 
 /********************************************************************
-* LMF SUBROUTINE: Trying to process one pixel at a time         ****
-*                       in a single function                    ****
-********************************************************************
-********************************************************************
+* LMF SUBROUTINES: the design matrix depends only on the dates,     *
+*                  its normal matrix is inverted once per pattern   *
+*                  of valid observations and the pixels of a row    *
+*                  are fitted in blocks                             *
+*********************************************************************
+*********************************************************************
 * NBANDS = how many dates in this time-series                   ****
 * NPOINT = how many dates of this time-series cover one year    ****
 *               (NPOINT=46 for MODIS 8-days product)            ****
-********************************************************************/  
+********************************************************************/
 #include<stdio.h>
 #include<stdlib.h>
-    
-#define MAXB 200
-    /* NMAX=MAXB */ 
-#define NMAX 200
-#define MAXF 50
-    
-#define TRUE 1
-#define FALSE 0
-    
-#define PI 3.1415926535897932385
-int make_matrix(int n, int npoint, int nfunc, int *numk, double f[][MAXF]);
-
-int fitting(int npoint, int nfunc, double *dat, int *idx1, double f[][MAXF],
-	     double *c, double *vfit);
-int minmax(int n, int nwin, double *dat);
-
-int maxmin(int n, int nwin, double *dat);
-
-int lmf(int nbands, int npoint, double *inpix, double *outpix)
+#include<string.h>
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+#include "local_proto.h"
+
+void lmf_init(struct lmf_design *d, int nbands, int npoint)
 {
-    int i, j, k, idk, norder, nfunc;
+    int i, j;
 
-    int nwin, mmsw, nds, isum;
+    /*for Matrix Inversion */
+    int numk[MAXF] =
+	{ 1, 2, 3, 4, 6, 12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0
+    };
 
-    int fitsw, fitmd;
+    d->nbands = nbands;
+    d->npoint = npoint;
+    d->nn = NFIT * 2 + 2;
 
-    double tcld, thh, thl;
+    d->f = G_malloc(nbands * sizeof(*d->f));
+    for (i = 0; i < nbands; i++) {
+	for (j = 0; j < MAXF; j++) {
+	    d->f[i][j] = 0.0;
+	}
+    }
+    make_matrix(nbands, npoint, 6, numk, d->f);
 
-    double vaic, delta;
+    d->full.valid = G_malloc(nbands);
+    memset(d->full.valid, 1, nbands);
+    d->full.tinv = G_malloc(d->nn * d->nn * sizeof(double));
+    if (!normal_matrix(nbands, d->nn, d->full.valid, d->f, d->full.tinv))
+	G_fatal_error(_("Not enough input maps to fit %d functions"), d->nn);
+}
 
-    int idx1[NMAX];
+void lmf_free(struct lmf_design *d)
+{
+    G_free(d->f);
+    G_free(d->full.valid);
+    G_free(d->full.tinv);
+}
 
-    
-	/*for fitting */ 
-    double dat[NMAX];
+void lmf_work_init(struct lmf_work *w, const struct lmf_design *d)
+{
+    int i;
 
-    double f[NMAX][MAXF], c[MAXF];
+    w->nmasks = 0;
+    w->clock = 0;
+    for (i = 0; i < LMF_CACHE; i++) {
+	w->mask[i].valid = G_malloc(d->nbands);
+	w->mask[i].tinv = G_malloc(d->nn * d->nn * sizeof(double));
+    }
+    w->valid = G_malloc(d->nbands);
+    w->full = G_malloc(LMF_BLOCK * sizeof(int));
+    w->dat = G_malloc(d->nbands * LMF_BLOCK * sizeof(double));
+    w->vfit = G_malloc(d->nbands * LMF_BLOCK * sizeof(double));
+    w->vec = G_malloc(d->nn * LMF_BLOCK * sizeof(double));
+    w->c = G_malloc(d->nn * LMF_BLOCK * sizeof(double));
+}
+
+void lmf_work_free(struct lmf_work *w)
+{
+    int i;
+
+    for (i = 0; i < LMF_CACHE; i++) {
+	G_free(w->mask[i].valid);
+	G_free(w->mask[i].tinv);
+    }
+    G_free(w->valid);
+    G_free(w->full);
+    G_free(w->dat);
+    G_free(w->vfit);
+    G_free(w->vec);
+    G_free(w->c);
+}
 
-    double vfit[NMAX];
+/* inverted normal matrix for the observations in w->valid, there must
+ * be at least as many as functions, the least recently used mask is
+ * replaced */
+static const double *get_mask(const struct lmf_design *d,
+			      struct lmf_work *w)
+{
+    struct lmf_mask *m;
 
-    double ipoint[MAXB];
+    unsigned long hash = 5381;
 
-    
-	/*for iteration */ 
-    double dat0[NMAX], c0[MAXF];
+    int i, k;
 
-    double dat1[NMAX];
+    for (k = 0; k < d->nbands; k++)
+	hash = hash * 33 + w->valid[k];
 
-    
-	/*for Matrix Inversion */ 
-    int numk[MAXF] =
-	{ 1, 2, 3, 4, 6, 12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-0, 0 };
-    
-	/*Set Defaults */ 
-	nfunc = 6;
-    for (i = 0; i < NMAX; i++) {
-	for (j = 0; j < MAXF; j++) {
-	    f[i][j] = 0.0;
+    w->clock++;
+    for (i = 0; i < w->nmasks; i++) {
+	m = &w->mask[i];
+	if (m->hash == hash && memcmp(m->valid, w->valid, d->nbands) == 0) {
+	    m->used = w->clock;
+	    return m->tinv;
 	}
     }
-    make_matrix(nbands, npoint, nfunc, numk, f);
-    nwin = 3;
-    mmsw = 1;
-    
-	/*nds=npoint; */ 
-	nds = 2 * nfunc + 2;
-    
-	/*LMF Process */ 
-	/*Checking Pixel Value */ 
-	fitsw = 1;
-    
-	/*fitting method */ 
-	tcld = 0.15;
-    fitmd = 2;
-    
-	/*FITMD0---- */ 
-	if (fitmd == 0) {
-	thh = tcld * 2.0;
-	thl = -tcld;
-    }
-    
-	/*FITMD1---- */ 
-	if (fitmd == 1) {
-	thh = tcld;
-	thl = -tcld * 2.0;
-    }
-    
-	/*FITMD2---- */ 
-	if (fitmd == 2) {
-	thh = tcld;
-	thl = -tcld;
-    }
-    
-	/*initialize arrays */ 
-	for (k = 0; k < nbands; k++) {
-	dat0[k] = 0.0;
-	outpix[k] = 0.0;
-	ipoint[k] = 1;
-	idx1[k] = TRUE;
-    }
-    for (k = 0; k < nds; k++) {
-	c[k] = 0.0;
+
+    if (w->nmasks < LMF_CACHE)
+	m = &w->mask[w->nmasks++];
+    else {
+	m = &w->mask[0];
+	for (i = 1; i < LMF_CACHE; i++)
+	    if (w->mask[i].used < m->used)
+		m = &w->mask[i];
     }
-    for (k = 0; k < nbands; k++) {
-	if (inpix[k] > 0.375) {
-	    ipoint[k] = 0;
+    m->hash = hash;
+    m->used = w->clock;
+    memcpy(m->valid, w->valid, d->nbands);
+    normal_matrix(d->nbands, d->nn, m->valid, d->f, m->tinv);
+
+    return m->tinv;
+}
+
+/* fit one row, inrow and outrow are the rows of all bands, the
+ * observations which are null are not used for the fit, a pixel with
+ * fewer valid observations than functions is null */
+void lmf_row(const struct lmf_design *d, struct lmf_work *w, int ncols,
+	     DCELL ** inrow, DCELL ** outrow)
+{
+    int col0, col, ncol, nfull, k, p, nvalid;
+
+    const double *tinv;
+
+    for (col0 = 0; col0 < ncols; col0 += LMF_BLOCK) {
+	ncol = ncols - col0 < LMF_BLOCK ? ncols - col0 : LMF_BLOCK;
+
+	/* pixels with all observations are fitted together */
+	nfull = 0;
+	for (col = col0; col < col0 + ncol; col++) {
+	    for (k = 0; k < d->nbands; k++)
+		if (Rast_is_d_null_value(&inrow[k][col]))
+		    break;
+	    if (k == d->nbands)
+		w->full[nfull++] = col;
+	}
+	if (nfull) {
+	    for (k = 0; k < d->nbands; k++)
+		for (p = 0; p < nfull; p++)
+		    w->dat[k * LMF_BLOCK + p] = inrow[k][w->full[p]];
+	    fitting(d->nbands, d->nn, d->full.valid, d->f, d->full.tinv,
+		    nfull, w->dat, w->vec, w->c, w->vfit);
+	    for (k = 0; k < d->nbands; k++)
+		for (p = 0; p < nfull; p++)
+		    outrow[k][w->full[p]] = w->vfit[k * LMF_BLOCK + p];
 	}
-	if (k >= 2) {
-	    idk = (inpix[k] - inpix[k - 1]);
-	    if (idk > 0.125) {
-		ipoint[k] = 0;
+	if (nfull == ncol)
+	    continue;
+
+	/* the other pixels one by one */
+	p = 0;
+	for (col = col0; col < col0 + ncol; col++) {
+	    if (p < nfull && w->full[p] == col) {
+		p++;
+		continue;
+	    }
+	    nvalid = 0;
+	    for (k = 0; k < d->nbands; k++) {
+		w->valid[k] = !Rast_is_d_null_value(&inrow[k][col]);
+		w->dat[k * LMF_BLOCK] = w->valid[k] ? inrow[k][col] : 0.0;
+		nvalid += w->valid[k];
+	    }
+	    tinv = nvalid >= d->nn ? get_mask(d, w) : NULL;
+	    if (!tinv) {
+		for (k = 0; k < d->nbands; k++)
+		    Rast_set_d_null_value(&outrow[k][col], 1);
+		continue;
 	    }
+	    fitting(d->nbands, d->nn, w->valid, d->f, tinv, 1, w->dat,
+		    w->vec, w->c, w->vfit);
+	    for (k = 0; k < d->nbands; k++)
+		outrow[k][col] = w->vfit[k * LMF_BLOCK];
 	}
-	dat0[k] = inpix[k];
-	dat[k] = dat0[k];
     }
-    
-	/*Minimax Filter */ 
-	if (mmsw >= 1 && fitmd == 0) {
-	minmax(nbands, nwin, dat);
-    }
-    else if (mmsw >= 1 && fitmd == 1) {
-	maxmin(nbands, nwin, dat);
-    }
-    
-	/*Fitting */ 
-	fitting(nbands, 3, dat, idx1, f, c, vfit);
-    for (k = 0; k < nbands; k++) {
-	outpix[k] = vfit[k];
-    }
-    return;
 }
-
-
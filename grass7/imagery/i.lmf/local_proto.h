@@ -0,0 +1,63 @@
+#ifndef __LOCAL_PROTO_H__
+#define __LOCAL_PROTO_H__
+
+#include <grass/gis.h>
+
+#define MAXF 50
+
+/* number of harmonics of the fitted curve */
+#define NFIT 3
+
+/* number of pixels fitted at once */
+#define LMF_BLOCK 64
+
+/* number of observation masks cached per thread */
+#define LMF_CACHE 32
+
+/* inverted normal matrix of the design for one pattern of valid
+ * observations */
+struct lmf_mask
+{
+    unsigned long hash;
+    unsigned char *valid;	/* nbands flags */
+    double *tinv;		/* nn x nn */
+    unsigned long used;
+};
+
+/* the design matrix, it depends only on the dates */
+struct lmf_design
+{
+    int nbands, npoint, nn;
+    double (*f)[MAXF];
+    struct lmf_mask full;	/* all observations valid */
+};
+
+/* workspace of one thread */
+struct lmf_work
+{
+    int nmasks;
+    unsigned long clock;
+    struct lmf_mask mask[LMF_CACHE];
+    unsigned char *valid;
+    int *full;			/* columns of a block with all observations */
+    double *dat, *vec, *c, *vfit;
+};
+
+int make_matrix(int n, int npoint, int nfunc, int *numk, double f[][MAXF]);
+int invert_matrix(double a[][MAXF], int order);
+int normal_matrix(int npoint, int nn, const unsigned char *idx1,
+		  double f[][MAXF], double *tinv);
+void fitting(int npoint, int nn, const unsigned char *idx1,
+	     double f[][MAXF], const double *tinv, int npix,
+	     const double *dat, double *vec, double *c, double *vfit);
+int minmax(int n, int nwin, double *dat);
+int maxmin(int n, int nwin, double *dat);
+
+void lmf_init(struct lmf_design *d, int nbands, int npoint);
+void lmf_free(struct lmf_design *d);
+void lmf_work_init(struct lmf_work *w, const struct lmf_design *d);
+void lmf_work_free(struct lmf_work *w);
+void lmf_row(const struct lmf_design *d, struct lmf_work *w, int ncols,
+	     DCELL ** inrow, DCELL ** outrow);
+
+#endif /* __LOCAL_PROTO_H__ */
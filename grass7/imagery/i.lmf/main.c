@@ -35,40 +35,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include <grass/gis.h>
 #include <grass/raster.h>
 #include <grass/glocale.h>
+#include "local_proto.h"
 
 #define MAXFILES 366
 
-int lmf(int nbands, int npoint, double *inpix, double *outpix);
 int main(int argc, char *argv[])
 {
-    struct Cell_head cellhd;	/*region+header info */
-    char *mapset;		/*mapset name */
     int nrows, ncols;
-    int row, col;
+    int row0, nchunk;
     struct GModule *module;
-    struct Option *input, *ndate, *output;
-    struct History history;	/*metadata */
+    struct Option *input, *ndate, *output, *threads;
     char *name;			/*input raster name */
     char *result[MAXFILES];	/*output raster name */
     /*File Descriptors */
     int nfiles;
     int infd[MAXFILES];
     int outfd[MAXFILES];
-    char **names;
     char **ptr;
-    int ok;
-    int i = 0, j = 0;
-    void *inrast[MAXFILES];
-    DCELL *outrast[MAXFILES];
-    int data_format;		/* 0=double  1=float  2=32bit signed int  5=8bit unsigned int (ie text) */
-    RASTER_MAP_TYPE in_data_type[MAXFILES];	/* 0=numbers  1=text */
-    RASTER_MAP_TYPE out_data_type = DCELL_TYPE;
-    int ndates;
-    double inpix[MAXFILES] = { 0.0 };
-    double outpix[MAXFILES] = { 0.0 };
+    int i = 0, t;
+    int ndates, nthreads;
+    DCELL ***inrast, ***outrast;	/* [row of the chunk][band] */
+    struct lmf_design design;
+    struct lmf_work *work;
     /************************************/
 
     G_gisinit(argv[0]);
@@ -97,94 +91,112 @@ int main(int argc, char *argv[])
     output = G_define_standard_option(G_OPT_R_OUTPUT);
     output->description = _("Name of the output layer");
 
-    nfiles = 1;
+    threads = G_define_option();
+    threads->key = "threads";
+    threads->type = TYPE_INTEGER;
+    threads->required = NO;
+    threads->description = _("Number of threads for parallel computing");
+    threads->answer = "1";
+
     /********************/
     if (G_parser(argc, argv))
 	exit(-1);
 
-    ok = 1;
-    names = input->answers;
-    ptr = input->answers;
-
     ndates = atoi(ndate->answer);
 
-    for (; *ptr != NULL; ptr++) {
+    nthreads = atoi(threads->answer);
+    if (nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than 0"), threads->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+    nthreads = 1;
+#endif
+
+    nfiles = 0;
+    for (ptr = input->answers; *ptr != NULL; ptr++) {
 	if (nfiles >= MAXFILES)
 	    G_fatal_error(_("%s - too many ETa files. Only %d allowed"),
 			  G_program_name(), MAXFILES);
 	name = *ptr;
-	if (!ok) {
-	    continue;
-	}
-	infd[nfiles] = Rast_open_old(name, "");
-	if (infd[nfiles] < 0) {
-	    ok = 0;
-	    continue;
-	}
-	/* Allocate input buffer */
-	in_data_type[nfiles] = Rast_map_type(name, "");
 	infd[nfiles] = Rast_open_old(name, "");
-	Rast_get_cellhd(name, "", &cellhd);
-	inrast[nfiles] = Rast_allocate_buf(in_data_type[nfiles]);
 	nfiles++;
     }
-    nfiles--;
     if (nfiles <= 10) {
 	G_fatal_error(_("The min specified input map is ten"));
     }
 
+    /* the design matrix and its inverted normal matrix are shared by
+     * all pixels with all observations */
+    lmf_init(&design, nfiles, ndates);
+
     /***************************************************/
-    /* Allocate output buffer, use input map data_type */
+    /* Allocate buffers, one row of all maps per thread */
     nrows = Rast_window_rows();
     ncols = Rast_window_cols();
+    inrast = G_malloc(nthreads * sizeof(DCELL **));
+    outrast = G_malloc(nthreads * sizeof(DCELL **));
+    work = G_malloc(nthreads * sizeof(struct lmf_work));
+    for (t = 0; t < nthreads; t++) {
+	inrast[t] = G_malloc(nfiles * sizeof(DCELL *));
+	outrast[t] = G_malloc(nfiles * sizeof(DCELL *));
+	for (i = 0; i < nfiles; i++) {
+	    inrast[t][i] = Rast_allocate_d_buf();
+	    outrast[t][i] = Rast_allocate_d_buf();
+	}
+	lmf_work_init(&work[t], &design);
+    }
     for (i = 0; i < nfiles; i++) {
-	sprintf(result[i], output->answer, ".", i + 1);
-	outrast[i] = Rast_allocate_buf(out_data_type);
+	G_asprintf(&result[i], "%s.%d", output->answer, i + 1);
 	/* Create New raster files */
-	outfd[i] = Rast_open_new(result[i], 1);
+	outfd[i] = Rast_open_new(result[i], FCELL_TYPE);
     }
     /*******************/
-    /* Process pixels */
-    for (row = 0; row < nrows; row++) {
-	DCELL de;
-	DCELL d[MAXFILES];
-
-	G_percent(row, nrows, 2);
-	/* read input map */
-	for (i = 1; i <= nfiles; i++) {
-	    Rast_get_row(infd[i], inrast[i], row, in_data_type[i]);
-	}
+    /* Process pixels, a chunk of rows is read, fitted in parallel,
+     * one row per thread, and written */
+    for (row0 = 0; row0 < nrows; row0 += nthreads) {
+	G_percent(row0, nrows, 2);
+	nchunk = nrows - row0 < nthreads ? nrows - row0 : nthreads;
+
+	/* read input maps */
+	for (t = 0; t < nchunk; t++)
+	    for (i = 0; i < nfiles; i++)
+		Rast_get_d_row(infd[i], inrast[t][i], row0 + t);
+
 	/*process the data */
-	for (col = 0; col < ncols; col++) {
-	    for (i = 1; i <= nfiles; i++) {
-		switch (in_data_type[i]) {
-		case CELL_TYPE:
-		    inpix[i - 1] = (double)((CELL *) inrast[i])[col];
-		    break;
-		case FCELL_TYPE:
-		    inpix[i - 1] = (double)((FCELL *) inrast[i])[col];
-		    break;
-		case DCELL_TYPE:
-		    inpix[i - 1] = (double)((DCELL *) inrast[i])[col];
-		    break;
-		}
-	    }
-	    lmf(nfiles, ndates, inpix, outpix);
-	    /* Put the resulting temporal curve 
-	     * in the output layers */
-	    for (i = 0; i < nfiles; i++) {
-		outrast[i][col] = outpix[i];
-	    }
-	}
-	for (i = 0; i < nfiles; i++) {
-	    Rast_put_row(outfd[i], outrast[i], out_data_type);
-        }
+#pragma omp parallel for schedule(static, 1) private(t)
+	for (t = 0; t < nchunk; t++)
+	    lmf_row(&design, &work[t], ncols, inrast[t], outrast[t]);
+
+	/* Put the resulting temporal curve
+	 * in the output layers */
+	for (t = 0; t < nchunk; t++)
+	    for (i = 0; i < nfiles; i++)
+		Rast_put_d_row(outfd[i], outrast[t][i]);
     }
-    for (i = 1; i <= nfiles; i++) {
-	G_free(inrast[i]);
+    G_percent(1, 1, 1);
+
+    for (i = 0; i < nfiles; i++) {
 	Rast_close(infd[i]);
-	G_free(outrast[i]);
 	Rast_close(outfd[i]);
+	G_free(result[i]);
     }
+    for (t = 0; t < nthreads; t++) {
+	for (i = 0; i < nfiles; i++) {
+	    G_free(inrast[t][i]);
+	    G_free(outrast[t][i]);
+	}
+	G_free(inrast[t]);
+	G_free(outrast[t]);
+	lmf_work_free(&work[t]);
+    }
+    G_free(inrast);
+    G_free(outrast);
+    G_free(work);
+    lmf_free(&design);
+
     return 0;
 }
@@ -3,6 +3,9 @@
 #define SRC_ENV 0
 #define TGT_ENV 1
 
+/* maximum number of reduced levels for the coarse to fine search */
+#define PYRAMID_MAX 6
+
 typedef struct
 {
     char *name;
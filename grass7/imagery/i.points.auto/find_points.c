@@ -4,6 +4,9 @@
 #include <math.h>
 #include <string.h>
 #include <signal.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 #include <grass/config.h>
 #ifdef HAVE_FFTW3_H
@@ -319,53 +322,459 @@ void Extract_matrix_auto(void)
 }
 
 
+/* number of candidate windows correlated at once per thread */
+#define CORR_BATCH 16
+
+#define CORR_OK         0
+#define CORR_NO_DATA    1	/* first window is constant */
+#define CORR_NO_PRODUCT 2	/* power spectrum is zero */
+#define CORR_LOW        3	/* poor correlation at a coarse level */
+#define CORR_OUTSIDE    4	/* refined window outside of map 1 */
+
+/* the plans are created once and executed with the buffers of the
+ * threads, executing a plan is thread safe, planning is not */
+#ifdef HAVE_FFTW3_H
+#define CORR_PARALLEL 1
+typedef fftw_complex corr_complex;
+#else
+#define CORR_PARALLEL 0
+typedef double corr_complex[2];
+#endif
+
+struct corr_plan
+{
+    int dim;
+    long size;
+#ifdef HAVE_FFTW3_H
+    fftw_plan forward;		/* both windows at once */
+    fftw_plan backward;
+#endif
+};
+
+/* workspace of a thread */
+struct corr_work
+{
+    corr_complex *win;		/* the two windows, one after the other */
+    corr_complex *prod;
+};
+
+/* images reduced by 2 x 2 mean, level 0 is the original image */
+struct pyramid
+{
+    int levels;
+    int rows[PYRAMID_MAX + 1], cols[PYRAMID_MAX + 1];
+    DCELL *mat[PYRAMID_MAX + 1];
+};
+
+struct candidate
+{
+    int fft_r, fft_c;		/* center in map 2 */
+    int r1, c1;			/* estimated center in map 1 */
+    double north2, east2;
+    long x;			/* random number drawn for the window */
+    int status;
+    double cc;
+    int shift_r, shift_c;
+};
+
+static void corr_plan_init(struct corr_plan *p, int dim)
+{
+    p->dim = dim;
+    p->size = (long)dim * dim;
+#ifdef HAVE_FFTW3_H
+    {
+	int n[2];
+	fftw_complex *buf;
+
+	n[0] = n[1] = dim;
+	buf = fftw_malloc(3 * p->size * sizeof(fftw_complex));
+	p->forward = fftw_plan_many_dft(2, n, 2, buf, NULL, 1, p->size,
+					buf, NULL, 1, p->size,
+					FFTW_FORWARD, FFTW_ESTIMATE);
+	p->backward = fftw_plan_dft_2d(dim, dim, buf + 2 * p->size,
+				       buf + 2 * p->size, FFTW_BACKWARD,
+				       FFTW_ESTIMATE);
+	fftw_free(buf);
+    }
+#endif
+}
+
+static void corr_plan_free(struct corr_plan *p)
+{
+#ifdef HAVE_FFTW3_H
+    fftw_destroy_plan(p->forward);
+    fftw_destroy_plan(p->backward);
+#endif
+}
+
+static void corr_work_init(struct corr_work *w, const struct corr_plan *p)
+{
+#ifdef HAVE_FFTW3_H
+    /* fftw_malloc() gives the alignment the plans were created with */
+    w->win = fftw_malloc(3 * p->size * sizeof(fftw_complex));
+#else
+    w->win = G_malloc(3 * p->size * sizeof(corr_complex));
+#endif
+    w->prod = w->win + 2 * p->size;
+}
+
+static void corr_work_free(struct corr_work *w)
+{
+#ifdef HAVE_FFTW3_H
+    fftw_free(w->win);
+#else
+    G_free(w->win);
+#endif
+}
+
+static void pyramid_init(struct pyramid *p, DCELL *mat, int rows, int cols,
+			 int levels)
+{
+    int l, r, c;
+
+    p->levels = levels;
+    p->rows[0] = rows;
+    p->cols[0] = cols;
+    p->mat[0] = mat;
+    for (l = 1; l <= levels; l++) {
+	DCELL *src = p->mat[l - 1];
+	int scols = p->cols[l - 1];
+
+	p->rows[l] = p->rows[l - 1] / 2;
+	p->cols[l] = scols / 2;
+	p->mat[l] = G_malloc((size_t)p->rows[l] * p->cols[l] * sizeof(DCELL));
+	for (r = 0; r < p->rows[l]; r++) {
+	    DCELL *s0 = src + (size_t)2 * r * scols;
+	    DCELL *s1 = s0 + scols;
+	    DCELL *d = p->mat[l] + (size_t)r * p->cols[l];
+
+	    for (c = 0; c < p->cols[l]; c++)
+		d[c] = (s0[2 * c] + s0[2 * c + 1] +
+			s1[2 * c] + s1[2 * c + 1]) / 4.;
+	}
+    }
+}
+
+static void pyramid_free(struct pyramid *p)
+{
+    int l;
+
+    for (l = 1; l <= p->levels; l++)
+	G_free(p->mat[l]);
+}
+
+/* FFT correlation of the window of map 1 with top left corner r1, c1
+ * and the window of map 2 with top left corner r2, c2 */
+static int correlate(const struct corr_plan *p, struct corr_work *w,
+		     const DCELL *mat1, int cols1, int r1, int c1,
+		     const DCELL *mat2, int cols2, int r2, int c2,
+		     double *cc, int *shift_r, int *shift_c)
+{
+    int dim = p->dim;
+    int border = dim / 2;
+    corr_complex *first = w->win, *second = w->win + p->size;
+    corr_complex *prod = w->prod;
+    double mean_1, mean_2, v_product, norm;
+    int i, j, check_reading;
+    long l_i;
+
+    /* Get means for search window extends of map1 and map2 */
+    mean_1 = 0.0;
+    mean_2 = 0.0;
+    for (i = 0; i < dim; i++) {
+	const DCELL *row1 = mat1 + (size_t)(r1 + i) * cols1 + c1;
+	const DCELL *row2 = mat2 + (size_t)(r2 + i) * cols2 + c2;
+
+	for (j = 0; j < dim; j++) {
+	    mean_1 += row1[j];
+	    mean_2 += row2[j];
+	}
+    }
+    mean_1 = (mean_1 / p->size);
+    mean_2 = (mean_2 / p->size);
+
+    /* copy search window extends of map1 and map2 to fft arrays */
+    check_reading = 0;
+    for (i = 0; i < dim; i++) {
+	const DCELL *row1 = mat1 + (size_t)(r1 + i) * cols1 + c1;
+	const DCELL *row2 = mat2 + (size_t)(r2 + i) * cols2 + c2;
+
+	for (j = 0; j < dim; j++) {
+	    l_i = (long)i * dim + j;
+	    first[l_i][0] = row1[j] - mean_1;
+	    first[l_i][1] = 0.0;
+	    second[l_i][0] = row2[j] - mean_2;
+	    second[l_i][1] = 0.0;
+	    if (first[l_i][0])
+		check_reading = 1;
+	}
+    }
+    if (check_reading == 0)
+	return CORR_NO_DATA;
+
+    /* complex fft of the 2 real windows, the scaling of the forward
+     * transforms cancels with the division by the magnitude */
+#ifdef HAVE_FFTW3_H
+    fftw_execute_dft(p->forward, w->win, w->win);
+#else
+    fft2(-1, first, p->size, dim, dim);
+    fft2(-1, second, p->size, dim, dim);
+#endif
+
+    /* overlay the two signals: multiplication 
+       product of the first fft with the conjugate of the second one 
+
+       division by magnitude |F(map1) * F(map2)*| 
+     */
+    check_reading = 0;
+    v_product = 0.0;
+    for (l_i = 0; l_i < p->size; l_i++) {
+	double fft_prod_real, fft_prod_img;
+
+	fft_prod_real = (first[l_i][0] * second[l_i][0]) +
+	    (first[l_i][1] * second[l_i][1]);
+	fft_prod_img = (first[l_i][1] * second[l_i][0]) -
+	    (first[l_i][0] * second[l_i][1]);
+
+	prod[l_i][0] = fft_prod_real;
+	prod[l_i][1] = fft_prod_img;
+	v_product += sqrt(fft_prod_real * fft_prod_real +
+			  fft_prod_img * fft_prod_img);
+
+	if (fft_prod_real != 0.0 && fft_prod_img != 0.0)
+	    check_reading = 1;
+    }
+    if (check_reading == 0)
+	return CORR_NO_PRODUCT;
+    v_product /= dim;		/* fft_size; */
+
+    for (l_i = 0; l_i < p->size; l_i++) {
+	prod[l_i][0] /= v_product;
+	prod[l_i][1] /= v_product;
+    }
+
+    /* reverse fft to create a compound signal */
+    /* fft^{-1} of the product <==> cross-correlation at different lag
+       between the two orig. (complex) windows */
+#ifdef HAVE_FFTW3_H
+    fftw_execute_dft(p->backward, prod, prod);
+    norm = 1.0 / sqrt(p->size);
+#else
+    fft2(1, prod, p->size, dim, dim);
+    norm = 1.0;
+#endif
+
+    /* Search the lag corresponding to the maximum correlation */
+    /* actually the unity pulse */
+    *cc = 0.0;
+    *shift_r = *shift_c = 0;
+    for (i = 0; i < dim; i++) {
+	for (j = 0; j < dim; j++) {
+	    double v = prod[(long)i * dim + j][0] * norm;
+
+	    if (v > *cc) {
+		*cc = v;
+		*shift_r = i;
+		*shift_c = j;
+	    }
+	}
+    }
+
+    /* not yet understood layout of inverse fft
+     * if tmp_r < search_border, tmp_r = tmp_r + search_border
+     * if tmp_r >= search_border, tmp_r = tmp_r - search_border
+     * if tmp_c < search_border, tmp_c = tmp_c + search_border
+     * if tmp_c >= search_border, tmp_c = tmp_c - search_border
+     *
+     * now get shift: tmp_r = tmp_r - search_border
+     */
+    if (*shift_r < border)
+	*shift_r = *shift_r + border;
+    else
+	*shift_r = *shift_r - border;
+    *shift_r = *shift_r - border;
+
+    if (*shift_c < border)
+	*shift_c = *shift_c + border;
+    else
+	*shift_c = *shift_c - border;
+    *shift_c = *shift_c - border;
+
+    return CORR_OK;
+}
+
+/* correlate a candidate from the coarsest to the finest level, the shift
+ * found at a level moves the window of map 1 at the next finer level */
+static void correlate_candidate(const struct corr_plan *p,
+				struct corr_work *w,
+				const struct pyramid *pyr1,
+				const struct pyramid *pyr2,
+				double thresh, struct candidate *cd)
+{
+    int dim = p->dim;
+    int border = dim / 2;
+    int l, r1, c1, r2, c2, off_r, off_c, shift_r, shift_c;
+    double cc;
+
+    off_r = off_c = 0;
+    for (l = pyr1->levels; l >= 0; l--) {
+	r1 = (cd->r1 >> l) + off_r - border;
+	c1 = (cd->c1 >> l) + off_c - border;
+	r2 = (cd->fft_r >> l) - border;
+	c2 = (cd->fft_c >> l) - border;
+
+	shift_r = shift_c = 0;
+	if (r1 < 0 || r1 + dim > pyr1->rows[l] ||
+	    c1 < 0 || c1 + dim > pyr1->cols[l] ||
+	    r2 < 0 || r2 + dim > pyr2->rows[l] ||
+	    c2 < 0 || c2 + dim > pyr2->cols[l]) {
+	    if (l == 0) {
+		cd->status = CORR_OUTSIDE;
+		return;
+	    }
+	    /* the windows do not fit at this coarse level */
+	}
+	else {
+	    cd->status = correlate(p, w, pyr1->mat[l], pyr1->cols[l], r1, c1,
+				   pyr2->mat[l], pyr2->cols[l], r2, c2,
+				   &cc, &shift_r, &shift_c);
+	    if (cd->status != CORR_OK)
+		return;
+	    if (l > 0 && cc <= thresh) {
+		cd->status = CORR_LOW;
+		return;
+	    }
+	}
+	if (l > 0) {
+	    off_r = 2 * ((cd->r1 >> l) + off_r + shift_r) - (cd->r1 >> (l - 1));
+	    off_c = 2 * ((cd->c1 >> l) + off_c + shift_c) - (cd->c1 >> (l - 1));
+	}
+    }
+    cd->cc = cc;
+    cd->shift_r = off_r + shift_r;
+    cd->shift_c = off_c + shift_c;
+}
+
+/* correlate the candidates in parallel and take them in order: a
+ * candidate is taken if its random number is smaller than the number of
+ * points still needed, which decreases with each point found */
+static void correlate_batch(const struct corr_plan *p, struct corr_work *work,
+			    const struct pyramid *pyr1,
+			    const struct pyramid *pyr2, double thresh,
+			    struct candidate *batch, int nbatch, long *nt,
+			    struct Control_Points *fftPoints)
+{
+    int i, search_border = p->dim / 2;
+
+#pragma omp parallel for schedule(dynamic) if(CORR_PARALLEL)
+    for (i = 0; i < nbatch; i++) {
+	int tid = 0;
+
+#if defined(_OPENMP)
+	tid = omp_get_thread_num();
+#endif
+	correlate_candidate(p, &work[tid], pyr1, pyr2, thresh, &batch[i]);
+    }
+
+    for (i = 0; i < nbatch; i++) {
+	struct candidate *cd = &batch[i];
+	double north1, east1;
+
+	if (cd->x >= *nt)
+	    continue;
+
+	if (cd->status == CORR_NO_DATA) {
+	    G_warning(_("First matrix not copied"));
+	    continue;
+	}
+	if (cd->status == CORR_NO_PRODUCT) {
+	    G_debug(2, "FFT product error");
+	    continue;
+	}
+	if (cd->status == CORR_LOW || cd->status == CORR_OUTSIDE) {
+	    G_debug(2, "no correlation at a coarse level");
+	    continue;
+	}
+
+	/* cc was somewhere larger than thresh */
+	if (cd->cc > thresh) {
+	    G_debug(2, "correlation: %4e", cd->cc);
+	    G_debug(2, "row shift %d, col shift %d", cd->shift_r,
+		    cd->shift_c);
+
+	    /* Get coordinates of "ending" point in source map 1 */
+	    north1 = curr_window.north -
+		(cd->r1 + cd->shift_r + 0.5) * curr_window.ns_res;
+	    east1 = curr_window.west +
+		(cd->c1 + cd->shift_c + 0.5) * curr_window.ew_res;
+
+	    /* Fill the fftPoints array */
+	    fftPoints->e1[fftPoints->count] = east1;
+	    fftPoints->n1[fftPoints->count] = north1;
+	    fftPoints->e2[fftPoints->count] = cd->east2;
+	    fftPoints->n2[fftPoints->count] = cd->north2;
+	    fftPoints->count++;
+
+	    /* point with sufficiently good FFT correlation: decrease nt */
+	    (*nt)--;
+	}
+	else {
+	    G_debug(2, "correlation: %4e", cd->cc);
+	}
+    }
+}
+
 void Search_correlation_points_auto(DCELL *mat1_R, DCELL *mat2_R,
 				    int search_window_dim, int n_windows,
 				    double thresh)
 {
     int search_border;
     struct Control_Points fftPoints;
-    double *fft_first_s[2];
-    double *fft_second_s[2];
-    double *fft_prod_con_s[2];
-    int fft_rows, fft_cols;
-    long fft_size;
-    int fft_r, fft_c, i, j;
-    int squared_search_window_dim;
-    long l_i;
-    int r_start, c_start, r_start1, c_start1, r_end, c_end;
-    double *cc;
-    int fft_nr = 0;
+    struct corr_plan plan;
+    struct corr_work *work;
+    struct pyramid pyr1, pyr2;
+    struct candidate *batch;
+    int nbatch, maxbatch, nthreads, levels;
+    int fft_r, fft_c, i;
+    int r_start1, c_start1, r_end, c_end;
     double north1, east1, north2, east2;
-    int shift_r, shift_c;
-    double mean_1, mean_2;
-    double fft_prod_real, fft_prod_img;
-    double v_product;
-    int check_reading;
-    int dump_unity_pulse = 0;
-    long nc, nt;
+    long nc, nt, nt_batch, x;
 
     G_debug(1, "Search_correlation_points_auto()");
     G_debug(1, "search_window_dim %d", search_window_dim);
 
     /* Correlation parameters */
-    squared_search_window_dim = search_window_dim * search_window_dim;
     search_border = search_window_dim / 2;
 
-    fft_rows = search_window_dim;
-    fft_cols = search_window_dim;
-    fft_size = fft_rows * fft_cols;
+    /* the coarsest level must hold a window */
+    levels = pyramid_levels;
+    while (levels > 0 &&
+	   ((curr_window.rows >> levels) < search_window_dim ||
+	    (curr_window.cols >> levels) < search_window_dim ||
+	    (tgt_window.rows >> levels) < search_window_dim ||
+	    (tgt_window.cols >> levels) < search_window_dim))
+	levels--;
+    if (levels < pyramid_levels)
+	G_warning(_("Region too small for %d pyramid levels, using %d"),
+		  pyramid_levels, levels);
+    pyramid_init(&pyr1, mat1_R, curr_window.rows, curr_window.cols, levels);
+    pyramid_init(&pyr2, mat2_R, tgt_window.rows, tgt_window.cols, levels);
+
+    nthreads = 1;
+#if defined(_OPENMP)
+    if (CORR_PARALLEL)
+	nthreads = omp_get_max_threads();
+#endif
 
     /* Memory allocation */
     G_debug(1, "Memory allocation");
-    fft_first_s[0] = (double *)G_malloc(fft_size * sizeof(double));
-    fft_first_s[1] = (double *)G_malloc(fft_size * sizeof(double));
-    fft_second_s[0] = (double *)G_malloc(fft_size * sizeof(double));
-    fft_second_s[1] = (double *)G_malloc(fft_size * sizeof(double));
-    fft_prod_con_s[0] = (double *)G_malloc(fft_size * sizeof(double));
-    fft_prod_con_s[1] = (double *)G_malloc(fft_size * sizeof(double));
-
-    cc = (double *)G_malloc(n_windows * sizeof(double));
+    corr_plan_init(&plan, search_window_dim);
+    work = G_malloc(nthreads * sizeof(struct corr_work));
+    for (i = 0; i < nthreads; i++)
+	corr_work_init(&work[i], &plan);
+    maxbatch = CORR_BATCH * nthreads;
+    batch = G_malloc(maxbatch * sizeof(struct candidate));
+
     fftPoints.n1 = (double *)G_malloc(n_windows * sizeof(double));
     fftPoints.e1 = (double *)G_malloc(n_windows * sizeof(double));
     fftPoints.n2 = (double *)G_malloc(n_windows * sizeof(double));
@@ -383,21 +792,19 @@ void Search_correlation_points_auto(DCELL *mat1_R, DCELL *mat2_R,
     nc = curr_window.rows * curr_window.cols;
     nt = n_windows;
 
+    /* The candidates are collected with the number of points still needed
+     * when the batch was started, this number can only decrease, thus
+     * all windows the sequential search would take are in the batch */
     G_debug(1, "start loops");
+    nbatch = 0;
+    nt_batch = nt;
     for (fft_r = search_border; fft_r < r_end; fft_r++) {
-	r_start = fft_r - search_border;
-
-	G_percent(r_start, r_end - search_border, 2);
+	G_percent(fft_r - search_border, r_end - search_border, 2);
 
 	for (fft_c = search_border; fft_c < c_end; fft_c++) {
-	    c_start = fft_c - search_border;
-
 	    nc--;
 
 	    /* Coordinates of center point point for reference matrix 2 */
-
-	    G_debug(2, "get map2 center point");
-
 	    north2 = tgt_window.north - (fft_r + 0.5) * tgt_window.ns_res;
 	    east2 = tgt_window.west + (fft_c + 0.5) * tgt_window.ew_res;
 
@@ -409,234 +816,37 @@ void Search_correlation_points_auto(DCELL *mat1_R, DCELL *mat2_R,
 	    r_start1 = (curr_window.north - north1) / curr_window.ns_res;
 	    c_start1 = (east1 - curr_window.west) / curr_window.ew_res;
 
-	    r_start1 -= search_border;
-	    if (r_start1 < 0 || r_start1 + search_window_dim > curr_window.rows)
+	    if (r_start1 - search_border < 0 ||
+		r_start1 - search_border + search_window_dim > curr_window.rows)
 		continue;
-	    c_start1 -= search_border;
-	    if (c_start1 < 0 || c_start1 + search_window_dim > curr_window.cols)
+	    if (c_start1 - search_border < 0 ||
+		c_start1 - search_border + search_window_dim > curr_window.cols)
 		continue;
 
-	    if (make_rand() % nc >= nt)
+	    x = make_rand() % nc;
+	    if (x >= nt_batch)
 		continue;
 
-	    /* only decrement if point with ok FFT correlation found, see below */
-	    /* nt--; */
-
-	    /*  Initialize fft vectors */
-
-	    G_debug(2, "initialize fft vectors");
-	    for (l_i = 0; l_i < fft_size; l_i++) {
-		fft_first_s[0][l_i] = 0.0;
-		fft_first_s[1][l_i] = 0.0;
-		fft_second_s[0][l_i] = 0.0;
-		fft_second_s[1][l_i] = 0.0;
-		fft_prod_con_s[0][l_i] = 0.0;
-		fft_prod_con_s[1][l_i] = 0.0;
-	    }
-
-	    /* Get means for search window extends of map1 and map2 */
-
-	    mean_1 = 0.0;
-	    mean_2 = 0.0;
-	    for (i = 0; i < search_window_dim; i++) {
-		for (j = 0; j < search_window_dim; j++) {
-
-		    mean_1 +=
-			mat1_R[(r_start1 + i) * curr_window.cols + c_start1 + j];
-
-		    mean_2 +=
-			mat2_R[(r_start + i) * tgt_window.cols + c_start + j];
-		}
-	    }
-
-	    mean_1 = (mean_1 / squared_search_window_dim);
-	    mean_2 = (mean_2 / squared_search_window_dim);
-
-
-	    /* copy search window extends of map1 and map2 to fft arrays */
-	    check_reading = 0;
-
-	    for (i = 0; i < search_window_dim; i++) {
-
-		for (j = 0; j < search_window_dim; j++) {
-
-		    fft_first_s[0][i * search_window_dim + j] =
-			(mat1_R
-			 [(r_start1 + i) * curr_window.cols + c_start1 + j] - mean_1);
-
-		    fft_second_s[0][i * search_window_dim + j] =
-			(mat2_R
-			 [(r_start + i) * tgt_window.cols + c_start + j] - mean_2);
-
-		    if (fft_first_s[0][i * search_window_dim + j])
-			check_reading = 1;
-		}
-	    }
-
-	    if (check_reading == 0) {
-		G_warning(_("First matrix not copied"));
-		continue;
-	    }
-
-	    /* real to complex fft of the 2 real windows */
-	    fft(-1, fft_first_s, fft_size, fft_cols, fft_rows);
-	    fft(-1, fft_second_s, fft_size, fft_cols, fft_rows);
-
-
-	    /* overlay the two signals: multiplication 
-	       product of the first fft with the conjugate of the second one 
-
-	       division by magnitude |F(map1) * F(map2)*| 
-	     */
-
-	    G_debug(2, "compute power spectrum");
-	    check_reading = 0;
-	    v_product = 0.0;
-	    for (l_i = 0; l_i < fft_size; l_i++) {
-
-		fft_prod_real =
-		    (fft_first_s[0][l_i] * fft_second_s[0][l_i]) +
-		    (fft_first_s[1][l_i] * fft_second_s[1][l_i]);
-
-		fft_prod_img =
-		    (fft_first_s[1][l_i] * fft_second_s[0][l_i]) -
-		    (fft_first_s[0][l_i] * fft_second_s[1][l_i]);
-
-		v_product += sqrt(fft_prod_real * fft_prod_real + fft_prod_img * fft_prod_img);
-	    }
-	    v_product /= search_window_dim; /* fft_size; */
-
-	    for (l_i = 0; l_i < fft_size; l_i++) {
-		fft_prod_real =
-		    (fft_first_s[0][l_i] * fft_second_s[0][l_i]) +
-		    (fft_first_s[1][l_i] * fft_second_s[1][l_i]);
-
-		fft_prod_img =
-		    (fft_first_s[1][l_i] * fft_second_s[0][l_i]) -
-		    (fft_first_s[0][l_i] * fft_second_s[1][l_i]);
-
-		fft_prod_con_s[0][l_i] = (fft_prod_real / v_product);
-		fft_prod_con_s[1][l_i] = (fft_prod_img / v_product);
-
-		if (fft_prod_real != 0.0 && fft_prod_img != 0.0) {
-		    check_reading = 1;
-		}
-	    }
-
-	    if (check_reading == 0) {
-		G_debug(2, "FFT product error");
-		continue;
-	    }
-
-	    /* reverse fft to create a compound signal */
-	    /* fft^{-1} of the product <==> cross-correlation at different lag
-	       between the two orig. (complex) windows */
-	    fft(1, fft_prod_con_s, fft_size, fft_cols, fft_rows);
-
-	    /* Search the lag corresponding to the maximum correlation */
-	    /* actually the unity pulse */
-	    cc[fftPoints.count] = 0.0;
-	    shift_r = shift_c = 0;
-
-	    G_debug(2, "find unity pulse");
-
-	    for (i = 0; i < search_window_dim; i++) {
-		for (j = 0; j < search_window_dim; j++)
-		    if (fft_prod_con_s[0][(i * fft_cols) + j] >
-			cc[fftPoints.count]) {
-			cc[fftPoints.count] =
-			    fft_prod_con_s[0][(i * fft_cols) + j];
-			shift_r = i;
-			shift_c = j;
-		    }
-	    }
-
-	    /* cc was somewhere larger than thresh */
-	    if (cc[fftPoints.count] > thresh) {
-		G_debug(2, "correlation: %4e", cc[fftPoints.count]);
-
-		/* Get row and col of "ending" point in map 2 */
-
-		/* not yet understood layout of inverse fft
-		 * if tmp_r < search_border, tmp_r = tmp_r + search_border
-		 * if tmp_r >= search_border, tmp_r = tmp_r - search_border
-		 * if tmp_c < search_border, tmp_c = tmp_c + search_border
-		 * if tmp_c >= search_border, tmp_c = tmp_c - search_border
-		 *
-		 * now get shift: tmp_r = tmp_r - search_border
-		 * 
-		 * now add shift to r 
-		 */
-
-		/* indices are zero-based: the nth row is row n-1 */
-		if (shift_r < search_border)
-		    shift_r = shift_r + search_border;
-		else
-		    shift_r = shift_r - search_border;
-		shift_r = shift_r - search_border;
-
-		if (shift_c < search_border)
-		    shift_c = shift_c + search_border;
-		else
-		    shift_c = shift_c - search_border;
-		shift_c = shift_c - search_border;
-
-		G_debug(2, "row shift %d, col shift %d", shift_r, shift_c);
-
-		/* Get coordinates of "ending" point in source map 1 */
-		r_start1 += search_border;
-		north1 =
-		    curr_window.north - (r_start1 + shift_r + 0.5) * curr_window.ns_res;
-		c_start1 += search_border;
-		east1 =
-		    curr_window.west + (c_start1 + shift_c + 0.5) * curr_window.ew_res;
-
-		/* Fill the fftPoints array */
-		fftPoints.e1[fftPoints.count] = east1;
-		fftPoints.n1[fftPoints.count] = north1;
-		fftPoints.e2[fftPoints.count] = east2;
-		fftPoints.n2[fftPoints.count] = north2;
-		fftPoints.count++;
-
-		/* dump unity pulse */
-		if (dump_unity_pulse) {
-		    int rd, cd, fd;
-		    DCELL *dump, dnullval;
-		    char dumpfile[GNAME_MAX];
-
-		    sprintf(dumpfile, "unity_pulse_%d", fftPoints.count);
-		    fd = Rast_open_new(dumpfile, DCELL_TYPE);
-
-		    dump = Rast_allocate_d_input_buf();
-		    Rast_set_d_null_value(&dnullval, 1);
-
-		    r_start1 -= search_border;
-		    c_start1 -= search_border;
-
-		    for (rd = 0; rd < curr_window.rows; rd++) {
-			for (cd = 0; cd < curr_window.cols; cd++) {
-
-			    if (rd < r_start1 || rd >= r_start1 + search_window_dim)
-				dump[cd] = dnullval;
-			    else if (cd < c_start1 || cd >= c_start1 + search_window_dim)
-				dump[cd] = dnullval;
-			    else
-				dump[cd] = fft_prod_con_s[0][((rd - r_start1) * fft_cols) + (cd - c_start1)];
-			}
-			Rast_put_d_row(fd, dump);
-		    }
-		    Rast_close(fd);
-		    G_free(dump);
-		}
-		/* point with sufficiently good FFT correlation: decrease nt */
-		nt--;
-	    }
-	    else {
-		G_debug(2, "correlation: %4e", cc[fftPoints.count]);
+	    batch[nbatch].fft_r = fft_r;
+	    batch[nbatch].fft_c = fft_c;
+	    batch[nbatch].r1 = r_start1;
+	    batch[nbatch].c1 = c_start1;
+	    batch[nbatch].north2 = north2;
+	    batch[nbatch].east2 = east2;
+	    batch[nbatch].x = x;
+	    nbatch++;
+
+	    if (nbatch == maxbatch) {
+		correlate_batch(&plan, work, &pyr1, &pyr2, thresh, batch,
+				nbatch, &nt, &fftPoints);
+		nbatch = 0;
+		nt_batch = nt;
 	    }
-	    fft_nr++;
 	}
     }
+    if (nbatch > 0)
+	correlate_batch(&plan, work, &pyr1, &pyr2, thresh, batch, nbatch,
+			&nt, &fftPoints);
     G_percent(1, 1, 2); /* finish it */
 
 
@@ -665,12 +875,13 @@ void Search_correlation_points_auto(DCELL *mat1_R, DCELL *mat2_R,
     }
 
     /* free memory */
-    G_free(fft_first_s[0]);
-    G_free(fft_first_s[1]);
-    G_free(fft_second_s[0]);
-    G_free(fft_second_s[1]);
-    G_free(fft_prod_con_s[0]);
-    G_free(fft_prod_con_s[1]);
+    for (i = 0; i < nthreads; i++)
+	corr_work_free(&work[i]);
+    G_free(work);
+    corr_plan_free(&plan);
+    pyramid_free(&pyr1);
+    pyramid_free(&pyr2);
+    G_free(batch);
 
     G_free(fftPoints.n1);
     G_free(fftPoints.e1);
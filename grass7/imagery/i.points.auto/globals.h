@@ -18,6 +18,7 @@ GLOBAL int K;
 GLOBAL int transform_order;
 GLOBAL int n_new_points;
 GLOBAL int detail;
+GLOBAL int pyramid_levels;
 
 
 GLOBAL Group group;
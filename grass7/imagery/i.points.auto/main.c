@@ -18,6 +18,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include <grass/gis.h>
 #include "globals.h"
 #include "local_proto.h"
@@ -28,10 +31,11 @@
 int main(int argc, char *argv[])
 {
     struct Option *grp_opt, *order_opt, *src_img_opt, *tgt_img_opt,
-	*detail_opt, *n_points_opt, *threshold_opt;
+	*detail_opt, *n_points_opt, *threshold_opt, *levels_opt,
+	*threads_opt;
     struct Flag *c_flag;
     struct GModule *module;
-    int i, npoints;
+    int i, npoints, nthreads;
     struct Cell_head curr_window_org, tgt_window_org;
 
     G_gisinit(argv[0]);
@@ -83,6 +87,22 @@ int main(int argc, char *argv[])
     threshold_opt->description =
 	_("RMS error threshold. Recommended: source image resolution or smaller");
 
+    levels_opt = G_define_option();
+    levels_opt->required = NO;
+    levels_opt->key = "levels";
+    levels_opt->type = TYPE_INTEGER;
+    levels_opt->options = "0-6";
+    levels_opt->answer = "0";
+    levels_opt->description =
+	_("Number of reduced image levels for a coarse to fine search");
+
+    threads_opt = G_define_option();
+    threads_opt->required = NO;
+    threads_opt->key = "threads";
+    threads_opt->type = TYPE_INTEGER;
+    threads_opt->answer = "1";
+    threads_opt->description = _("Number of threads for parallel computing");
+
     c_flag = G_define_flag();
     c_flag->key = 'c';
     c_flag->description =
@@ -99,6 +119,8 @@ int main(int argc, char *argv[])
     transform_order = atoi(order_opt->answer);
     n_new_points = atoi(n_points_opt->answer);
     rms_threshold = atof(threshold_opt->answer);
+    pyramid_levels = atoi(levels_opt->answer);
+    nthreads = atoi(threads_opt->answer);
 
     if (!detail_opt->answer)
 	detail = 128;
@@ -120,6 +142,20 @@ int main(int argc, char *argv[])
     if (rms_threshold < 0.0)
 	G_fatal_error(_("RMS threshold must be >= 0"));
 
+    if (pyramid_levels < 0 || pyramid_levels > PYRAMID_MAX)
+	G_fatal_error(_("Number of levels must be between 0 and %d"),
+		      PYRAMID_MAX);
+
+    if (nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than 0"), threads_opt->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+#endif
+
     G_get_window(&curr_window_org);
     G_get_window(&curr_window);
 
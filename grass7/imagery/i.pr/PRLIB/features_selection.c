@@ -75,11 +75,9 @@ void compute_valoriDJ(svm, features, H_tot, H_tmp, valoriDJ)
 void free_svm(svm)
      SupportVectorMachine *svm;
 {
-    int j;
-
-    for (j = 0; j < svm->N; j++) {
-	G_free(svm->dense_points[j]);
-    }
+    /*the rows of compute_svm are one block */
+    G_free(svm->dense_points[0]);
+    G_free(svm->dense_points);
     G_free(svm->target);
     G_free(svm->Cw);
     G_free(svm->alph);
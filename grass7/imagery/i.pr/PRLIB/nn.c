@@ -10,6 +10,15 @@
 #include "global.h"
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+
+/* max number of examples in a leaf of the search tree */
+#define NN_LEAF_SIZE 16
+/* above this dimension a ball tree is used instead of a k-d tree */
+#define NN_KDTREE_MAX_DIM 12
+
+static int build_node();
+static void search_node();
 
 void compute_nn(NearestNeighbor * nn, int nsamples, int nvar, double **data,
 		int *data_class)
@@ -37,6 +46,296 @@ void compute_nn(NearestNeighbor * nn, int nsamples, int nvar, double **data,
 	}
 	nn->class[i] = data_class[i];
     }
+
+    build_nn_index(nn);
+}
+
+
+void build_nn_index(NearestNeighbor * nn)
+
+     /*
+        build the search tree of a nn model: the examples are recursively
+        split at the median of the variable of largest spread. The examples
+        are reordered such that each node holds a contiguous range of them.
+        For low dimensions the nodes are pruned by the splitting planes
+        (k-d tree), otherwise by the ball around their examples (ball tree)
+      */
+{
+    nn->index_type = nn->nvars <= NN_KDTREE_MAX_DIM ? NN_KDTREE : NN_BALLTREE;
+    nn->nnodes = 0;
+    nn->node = NULL;
+
+    if (nn->nsamples > 0) {
+	/* the leaves hold at least NN_LEAF_SIZE / 2 examples */
+	nn->node = (NN_node *) G_calloc(2 * nn->nsamples /
+					(NN_LEAF_SIZE / 2) + 1,
+					sizeof(NN_node));
+	build_node(nn, 0, nn->nsamples);
+	nn->node =
+	    (NN_node *) G_realloc(nn->node, nn->nnodes * sizeof(NN_node));
+    }
+
+    compute_nn_bounds(nn);
+}
+
+
+static void swap_examples(NearestNeighbor * nn, int i, int j)
+{
+    double *tmp;
+    int tmpc;
+
+    tmp = nn->data[i];
+    nn->data[i] = nn->data[j];
+    nn->data[j] = tmp;
+    tmpc = nn->class[i];
+    nn->class[i] = nn->class[j];
+    nn->class[j] = tmpc;
+}
+
+static int build_node(NearestNeighbor * nn, int start, int end)
+
+     /*
+        build the node of the examples start ... end - 1 and its children,
+        return its index
+      */
+{
+    int i, j, n, var, lo, hi, mid;
+    double min, max, spread, best, pivot;
+    NN_node *node;
+
+    n = nn->nnodes++;
+    node = &(nn->node[n]);
+    node->start = start;
+    node->end = end;
+    node->left = node->right = -1;
+    node->var = 0;
+    node->value = 0.0;
+    node->center = NULL;
+    node->radius = 0.0;
+
+    if (end - start <= NN_LEAF_SIZE)
+	return n;
+
+    /* variable of largest spread */
+    best = 0.0;
+    var = -1;
+    for (j = 0; j < nn->nvars; j++) {
+	min = max = nn->data[start][j];
+	for (i = start + 1; i < end; i++) {
+	    if (nn->data[i][j] < min)
+		min = nn->data[i][j];
+	    else if (nn->data[i][j] > max)
+		max = nn->data[i][j];
+	}
+	spread = max - min;
+	if (spread > best) {
+	    best = spread;
+	    var = j;
+	}
+    }
+    if (var < 0)
+	return n;
+
+    /* partial sort such that the median is at mid (quickselect) */
+    mid = (start + end) / 2;
+    lo = start;
+    hi = end - 1;
+    while (lo < hi) {
+	pivot = nn->data[(lo + hi) / 2][var];
+	i = lo;
+	j = hi;
+	while (i <= j) {
+	    while (nn->data[i][var] < pivot)
+		i++;
+	    while (nn->data[j][var] > pivot)
+		j--;
+	    if (i <= j) {
+		swap_examples(nn, i, j);
+		i++;
+		j--;
+	    }
+	}
+	if (mid <= j)
+	    hi = j;
+	else if (mid >= i)
+	    lo = i;
+	else
+	    break;
+    }
+
+    /* the examples before mid are <= value, the others >= value */
+    node->var = var;
+    node->value = nn->data[mid][var];
+    node->left = build_node(nn, start, mid);
+    node->right = build_node(nn, mid, end);
+
+    return n;
+}
+
+
+void compute_nn_bounds(NearestNeighbor * nn)
+
+     /*
+        compute the center and the radius of the nodes of a ball tree
+      */
+{
+    int n, i, j;
+    double d;
+    NN_node *node;
+
+    if (nn->index_type != NN_BALLTREE)
+	return;
+
+    for (n = 0; n < nn->nnodes; n++) {
+	node = &(nn->node[n]);
+	if (node->center == NULL)
+	    node->center = (double *)G_calloc(nn->nvars, sizeof(double));
+	for (j = 0; j < nn->nvars; j++) {
+	    node->center[j] = 0.0;
+	    for (i = node->start; i < node->end; i++)
+		node->center[j] += nn->data[i][j];
+	    node->center[j] /= node->end - node->start;
+	}
+	node->radius = 0.0;
+	for (i = node->start; i < node->end; i++) {
+	    d = squared_distance(node->center, nn->data[i], nn->nvars);
+	    if (d > node->radius)
+		node->radius = d;
+	}
+	node->radius = sqrt(node->radius);
+    }
+}
+
+
+/* candidates of a k-nn query, a max-heap on the distance */
+typedef struct
+{
+    double *dist;
+    int *index;
+    int n;
+    int k;
+} NN_heap;
+
+static void heap_insert(NN_heap * heap, double d, int index)
+{
+    int i, child;
+
+    if (heap->n < heap->k) {
+	/* sift up */
+	i = heap->n++;
+	while (i > 0 && heap->dist[(i - 1) / 2] < d) {
+	    heap->dist[i] = heap->dist[(i - 1) / 2];
+	    heap->index[i] = heap->index[(i - 1) / 2];
+	    i = (i - 1) / 2;
+	}
+    }
+    else {
+	if (d >= heap->dist[0])
+	    return;
+	/* replace the farthest candidate and sift down */
+	i = 0;
+	for (;;) {
+	    child = 2 * i + 1;
+	    if (child >= heap->n)
+		break;
+	    if (child + 1 < heap->n && heap->dist[child + 1] > heap->dist[child])
+		child++;
+	    if (heap->dist[child] <= d)
+		break;
+	    heap->dist[i] = heap->dist[child];
+	    heap->index[i] = heap->index[child];
+	    i = child;
+	}
+    }
+    heap->dist[i] = d;
+    heap->index[i] = index;
+}
+
+/* lower bound of the squared distance from x to the examples of a node
+   of a ball tree */
+static double ball_bound(NearestNeighbor * nn, NN_node * node, double *x)
+{
+    double d;
+
+    d = sqrt(squared_distance(x, node->center, nn->nvars)) - node->radius;
+
+    return d > 0.0 ? d * d : 0.0;
+}
+
+static void search_node(NearestNeighbor * nn, int n, double *x,
+			NN_heap * heap)
+{
+    int i, first, second;
+    double diff, bound_first, bound_second, tmp;
+    NN_node *node = &(nn->node[n]);
+
+    if (node->left < 0) {
+	for (i = node->start; i < node->end; i++)
+	    heap_insert(heap, squared_distance(x, nn->data[i], nn->nvars), i);
+	return;
+    }
+
+    if (nn->index_type == NN_KDTREE) {
+	/* the far child is beyond the splitting plane */
+	diff = x[node->var] - node->value;
+	if (diff <= 0.0) {
+	    first = node->left;
+	    second = node->right;
+	}
+	else {
+	    first = node->right;
+	    second = node->left;
+	}
+	bound_first = 0.0;
+	bound_second = diff * diff;
+    }
+    else {
+	first = node->left;
+	second = node->right;
+	bound_first = ball_bound(nn, &(nn->node[first]), x);
+	bound_second = ball_bound(nn, &(nn->node[second]), x);
+	if (bound_second < bound_first) {
+	    first = node->right;
+	    second = node->left;
+	    tmp = bound_first;
+	    bound_first = bound_second;
+	    bound_second = tmp;
+	}
+    }
+
+    if (heap->n < heap->k || bound_first < heap->dist[0])
+	search_node(nn, first, x, heap);
+    if (heap->n < heap->k || bound_second < heap->dist[0])
+	search_node(nn, second, x, heap);
+}
+
+
+int search_nn(NearestNeighbor * nn, double *x, int k, int *index)
+
+     /* 
+        exact k-nearest neighbor query: store in index the examples
+        nearest to the test point x and return their number (k, or the
+        number of examples if lower). The search tree is built if not
+        available.
+      */
+{
+    NN_heap heap;
+
+    if (nn->node == NULL)
+	build_nn_index(nn);
+    if (nn->nnodes == 0)
+	return 0;
+
+    heap.dist = (double *)G_calloc(k, sizeof(double));
+    heap.index = index;
+    heap.n = 0;
+    heap.k = k;
+
+    search_node(nn, 0, x, &heap);
+
+    G_free(heap.dist);
+
+    return heap.n;
 }
 
 
@@ -78,6 +377,19 @@ void write_nn(char *file, NearestNeighbor * nn, Features * features)
 	fprintf(fpout, "%d\n", nn->class[i]);
     }
 
+    fprintf(fpout, "index:\n");
+    if (nn->index_type == NN_KDTREE)
+	fprintf(fpout, "kd-tree\n");
+    else
+	fprintf(fpout, "ball-tree\n");
+    fprintf(fpout, "number of nodes:\n");
+    fprintf(fpout, "%d\n", nn->nnodes);
+    for (i = 0; i < nn->nnodes; i++) {
+	fprintf(fpout, "%d\t%d\t%d\t%d\t%d\t%f\n", nn->node[i].start,
+		nn->node[i].end, nn->node[i].left, nn->node[i].right,
+		nn->node[i].var, nn->node[i].value);
+    }
+
     if (features->f_pca[0]) {
 	fprintf(fpout, "#####################\n");
 	fprintf(fpout, "PRINC. COMP.:\n");
@@ -105,29 +417,22 @@ int predict_nn_multiclass(NearestNeighbor * nn, double *x, int k,
         shall contain all the possible classes to be predicted
       */
 {
-    int i, j;
-    double *dist;
+    int i, j, nfound;
     int *pres_class, *pred_class, *index;
     int max_class;
     int max;
 
-    dist = (double *)G_calloc(nn->nsamples, sizeof(double));
-    index = (int *)G_calloc(nn->nsamples, sizeof(int));
+    index = (int *)G_calloc(k, sizeof(int));
     pred_class = (int *)G_calloc(k, sizeof(int));
     pres_class = (int *)G_calloc(nclasses, sizeof(int));
 
+    nfound = search_nn(nn, x, k, index);
 
-    for (i = 0; i < nn->nsamples; i++) {
-	dist[i] = squared_distance(x, nn->data[i], nn->nvars);
-    }
-
-    indexx_1(nn->nsamples, dist, index);
-
-    for (i = 0; i < k; i++) {
+    for (i = 0; i < nfound; i++) {
 	pred_class[i] = nn->class[index[i]];
     }
 
-    for (j = 0; j < k; j++) {
+    for (j = 0; j < nfound; j++) {
 	for (i = 0; i < nclasses; i++) {
 	    if (pred_class[j] == classes[i]) {
 		pres_class[i] += 1;
@@ -146,7 +451,6 @@ int predict_nn_multiclass(NearestNeighbor * nn, double *x, int k,
 	}
     }
 
-    G_free(dist);
     G_free(index);
     G_free(pred_class);
     G_free(pres_class);
@@ -166,27 +470,20 @@ double predict_nn_2class(NearestNeighbor * nn, double *x, int k, int nclasses,
         classes to be predicted
       */
 {
-    int i, j;
-    double *dist;
+    int i, j, nfound;
     int *pres_class, *pred_class, *index;
 
-    dist = (double *)G_calloc(nn->nsamples, sizeof(double));
-    index = (int *)G_calloc(nn->nsamples, sizeof(int));
+    index = (int *)G_calloc(k, sizeof(int));
     pred_class = (int *)G_calloc(k, sizeof(int));
     pres_class = (int *)G_calloc(nclasses, sizeof(int));
 
+    nfound = search_nn(nn, x, k, index);
 
-    for (i = 0; i < nn->nsamples; i++) {
-	dist[i] = squared_distance(x, nn->data[i], nn->nvars);
-    }
-
-    indexx_1(nn->nsamples, dist, index);
-
-    for (i = 0; i < k; i++) {
+    for (i = 0; i < nfound; i++) {
 	pred_class[i] = nn->class[index[i]];
     }
 
-    for (j = 0; j < k; j++) {
+    for (j = 0; j < nfound; j++) {
 	for (i = 0; i < nclasses; i++) {
 	    if (pred_class[j] == classes[i]) {
 		pres_class[i] += 1;
@@ -196,7 +493,6 @@ double predict_nn_2class(NearestNeighbor * nn, double *x, int k, int nclasses,
     }
 
 
-    G_free(dist);
     G_free(index);
     G_free(pred_class);
 
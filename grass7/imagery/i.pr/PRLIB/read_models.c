@@ -397,6 +397,7 @@ static void read_nn(FILE * fp, NearestNeighbor ** nn)
 {
     char *line = NULL;
     int i, j;
+    long pos;
 
     line = GetLine(fp);
     line = GetLine(fp);
@@ -424,4 +425,31 @@ static void read_nn(FILE * fp, NearestNeighbor ** nn)
 	sscanf(line, "%d", &((*nn)->class[i]));
     }
 
+    /* search tree, built here for models written without it */
+    pos = ftell(fp);
+    line = GetLine(fp);
+    if (line == NULL || strcmp(line, "index:") != 0) {
+	fseek(fp, pos, SEEK_SET);
+	build_nn_index(*nn);
+	return;
+    }
+    line = GetLine(fp);
+    if (strcmp(line, "kd-tree") == 0)
+	(*nn)->index_type = NN_KDTREE;
+    else
+	(*nn)->index_type = NN_BALLTREE;
+    line = GetLine(fp);
+    line = GetLine(fp);
+    sscanf(line, "%d", &((*nn)->nnodes));
+
+    (*nn)->node = (NN_node *) G_calloc((*nn)->nnodes, sizeof(NN_node));
+    for (i = 0; i < (*nn)->nnodes; i++) {
+	line = GetLine(fp);
+	sscanf(line, "%d%d%d%d%d%lf", &((*nn)->node[i].start),
+	       &((*nn)->node[i].end), &((*nn)->node[i].left),
+	       &((*nn)->node[i].right), &((*nn)->node[i].var),
+	       &((*nn)->node[i].value));
+    }
+    compute_nn_bounds(*nn);
+
 }
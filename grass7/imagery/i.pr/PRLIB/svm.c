@@ -12,8 +12,19 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+/*memory for the kernel rows of one svm during training (MB) */
+static double svm_cache_size = 100.;
 
 static void svm_smo();
+static void kernel_cache_init();
+static void kernel_cache_free();
+static double *kernel_row();
+static void shrink_svm();
+static void unshrink_svm();
 static double learned_func_linear();
 static double learned_func_nonlinear();
 static double rbf_kernel();
@@ -43,9 +54,12 @@ void compute_svm(SupportVectorMachine * svm, int n, int d, double **x, int *y,
     svm->b = .0;
 
     if (svm_kernel != SVM_KERNEL_DIRECT) {
+	/*contiguous rows for the dot products */
 	svm->dense_points = (double **)G_calloc(n, sizeof(double *));
-	for (i = 0; i < n; i++)
-	    svm->dense_points[i] = (double *)G_calloc(d, sizeof(double));
+	svm->dense_points[0] = (double *)G_calloc((size_t)n * d,
+						  sizeof(double));
+	for (i = 1; i < n; i++)
+	    svm->dense_points[i] = svm->dense_points[i - 1] + d;
 
 	for (i = 0; i < n; i++)
 	    for (j = 0; j < d; j++)
@@ -84,8 +98,10 @@ void compute_svm(SupportVectorMachine * svm, int n, int d, double **x, int *y,
 	svm->orig_d = d;
 
 	svm->dense_points = (double **)G_calloc(n, sizeof(double *));
-	for (i = 0; i < n; i++)
-	    svm->dense_points[i] = (double *)G_calloc(svm->d, sizeof(double));
+	svm->dense_points[0] = (double *)G_calloc((size_t)n * svm->d,
+						  sizeof(double));
+	for (i = 1; i < n; i++)
+	    svm->dense_points[i] = svm->dense_points[i - 1] + svm->d;
 
 	svm->w = (double *)G_calloc(svm->d, sizeof(double));
 
@@ -174,6 +190,16 @@ void compute_svm(SupportVectorMachine * svm, int n, int d, double **x, int *y,
 }
 
 
+void set_svm_cache_size(double megabytes)
+
+     /*
+        set the memory used for the kernel rows of each svm during training
+      */
+{
+    svm_cache_size = megabytes;
+}
+
+
 static void svm_smo(SupportVectorMachine * SVM)
 {
     int i, k;
@@ -183,6 +209,11 @@ static void svm_smo(SupportVectorMachine * SVM)
 
     SVM->end_support_i = SVM->N;
 
+    /*same sequence for every model, independent of other threads */
+    SVM->rand_state[0] = 0x330E;
+    SVM->rand_state[1] = 0xABCD;
+    SVM->rand_state[2] = 0x1234;
+
     if (SVM->kernel_type == SVM_KERNEL_LINEAR) {
 	SVM->kernel_func = dot_product_func;
 	SVM->learned_func = learned_func_linear;
@@ -204,6 +235,14 @@ static void svm_smo(SupportVectorMachine * SVM)
 	SVM->learned_func = learned_func_linear;
     }
 
+    SVM->active = (int *)G_calloc(SVM->N, sizeof(int));
+    for (i = 0; i < SVM->N; i++)
+	SVM->active[i] = i;
+    SVM->nactive = SVM->N;
+
+    if (SVM->kernel_type != SVM_KERNEL_DIRECT)
+	kernel_cache_init(SVM);
+
     numChanged = 0;
     examineAll = 1;
 
@@ -211,16 +250,27 @@ static void svm_smo(SupportVectorMachine * SVM)
     while (SVM->convergence == 1 && (numChanged > 0 || examineAll)) {
 	numChanged = 0;
 	if (examineAll) {
-	    for (k = 0; k < SVM->N; k++)
-		numChanged += examineExample(k, SVM);
+	    for (k = 0; k < SVM->nactive; k++)
+		numChanged += examineExample(SVM->active[k], SVM);
 	}
 	else {
-	    for (k = 0; k < SVM->N; k++)
-		if (SVM->alph[k] > 0 && SVM->alph[k] < SVM->Cw[k])
-		    numChanged += examineExample(k, SVM);
+	    for (k = 0; k < SVM->nactive; k++) {
+		i = SVM->active[k];
+		if (SVM->alph[i] > 0 && SVM->alph[i] < SVM->Cw[i])
+		    numChanged += examineExample(i, SVM);
+	    }
+	}
+	if (examineAll == 1) {
+	    if (numChanged == 0 && SVM->nactive < SVM->N) {
+		/*converged on the active examples: check all of them */
+		unshrink_svm(SVM);
+		numChanged = 1;
+	    }
+	    else {
+		examineAll = 0;
+		shrink_svm(SVM);
+	    }
 	}
-	if (examineAll == 1)
-	    examineAll = 0;
 	else if (numChanged == 0)
 	    examineAll = 1;
 
@@ -230,6 +280,183 @@ static void svm_smo(SupportVectorMachine * SVM)
 	if (SVM->verbose == 1)
 	    fprintf(stderr, "%6d\b\b\b\b\b\b\b", nloops);
     }
+
+    if (SVM->kernel_type != SVM_KERNEL_DIRECT)
+	kernel_cache_free(SVM);
+    G_free(SVM->active);
+    SVM->active = NULL;
+    SVM->nactive = 0;
+}
+
+
+static void kernel_cache_init(SupportVectorMachine * SVM)
+
+     /*
+        LRU cache of kernel rows, the memory of svm_cache_size is shared
+        by the svm trained in parallel
+      */
+{
+    SVM_kernel_cache *c;
+    double bytes;
+    int i;
+
+    bytes = svm_cache_size * 1024. * 1024.;
+#if defined(_OPENMP)
+    if (omp_in_parallel())
+	bytes /= omp_get_num_threads();
+#endif
+
+    c = (SVM_kernel_cache *) G_calloc(1, sizeof(SVM_kernel_cache));
+    c->n = SVM->N;
+    c->nrows = bytes / ((double)SVM->N * sizeof(double));
+    if (c->nrows > SVM->N)
+	c->nrows = SVM->N;
+    /*takeStep needs two rows at the same time */
+    if (c->nrows < 2)
+	c->nrows = 2;
+
+    c->row = (double **)G_calloc(c->nrows, sizeof(double *));
+    c->owner = (int *)G_calloc(c->nrows, sizeof(int));
+    c->prev = (int *)G_calloc(c->nrows, sizeof(int));
+    c->next = (int *)G_calloc(c->nrows, sizeof(int));
+    for (i = 0; i < c->nrows; i++) {
+	c->owner[i] = -1;
+	c->prev[i] = i - 1;
+	c->next[i] = i + 1 < c->nrows ? i + 1 : -1;
+    }
+    c->head = 0;
+    c->tail = c->nrows - 1;
+
+    c->slot = (int *)G_calloc(SVM->N, sizeof(int));
+    for (i = 0; i < SVM->N; i++)
+	c->slot[i] = -1;
+
+    SVM->cache = c;
+}
+
+static void kernel_cache_free(SupportVectorMachine * SVM)
+{
+    SVM_kernel_cache *c = SVM->cache;
+    int i;
+
+    for (i = 0; i < c->nrows; i++)
+	if (c->row[i])
+	    G_free(c->row[i]);
+    G_free(c->row);
+    G_free(c->owner);
+    G_free(c->prev);
+    G_free(c->next);
+    G_free(c->slot);
+    G_free(c);
+    SVM->cache = NULL;
+}
+
+static void kernel_cache_flush(SupportVectorMachine * SVM)
+{
+    SVM_kernel_cache *c = SVM->cache;
+    int i;
+
+    for (i = 0; i < c->nrows; i++)
+	if (c->owner[i] >= 0) {
+	    c->slot[c->owner[i]] = -1;
+	    c->owner[i] = -1;
+	}
+}
+
+static double *kernel_row(int i1, SupportVectorMachine * SVM)
+
+     /*
+        kernel values of example i1 with all active examples, the row
+        becomes the most recently used one
+      */
+{
+    SVM_kernel_cache *c = SVM->cache;
+    int slot, k, i;
+    double *row;
+
+    slot = c->slot[i1];
+    if (slot < 0) {
+	/*reuse the least recently used slot */
+	slot = c->tail;
+	if (c->owner[slot] >= 0)
+	    c->slot[c->owner[slot]] = -1;
+	if (!c->row[slot])
+	    c->row[slot] = (double *)G_calloc(c->n, sizeof(double));
+	c->owner[slot] = i1;
+	c->slot[i1] = slot;
+
+	row = c->row[slot];
+	for (k = 0; k < SVM->nactive; k++) {
+	    i = SVM->active[k];
+	    row[i] = SVM->kernel_func(i1, i, SVM);
+	}
+    }
+
+    if (slot != c->head) {
+	/*unlink and put in front */
+	c->next[c->prev[slot]] = c->next[slot];
+	if (c->next[slot] >= 0)
+	    c->prev[c->next[slot]] = c->prev[slot];
+	else
+	    c->tail = c->prev[slot];
+	c->prev[slot] = -1;
+	c->next[slot] = c->head;
+	c->prev[c->head] = slot;
+	c->head = slot;
+    }
+
+    return c->row[slot];
+}
+
+static void shrink_svm(SupportVectorMachine * SVM)
+
+     /*
+        remove from the active set the examples at a bound which satisfy
+        the KKT conditions by more than the tolerance
+      */
+{
+    int k, i, n;
+    double r;
+
+    n = 0;
+    for (k = 0; k < SVM->nactive; k++) {
+	i = SVM->active[k];
+	r = SVM->target[i] * SVM->error_cache[i];
+	if ((SVM->alph[i] == 0 && r > SVM->tolerance) ||
+	    (SVM->alph[i] == SVM->Cw[i] && r < -SVM->tolerance))
+	    continue;
+	SVM->active[n++] = i;
+    }
+    SVM->nactive = n;
+}
+
+static void unshrink_svm(SupportVectorMachine * SVM)
+
+     /*
+        put back all examples, the errors of the shrunk ones were not
+        updated and are computed again
+      */
+{
+    char *is_active;
+    int k, i;
+
+    is_active = (char *)G_calloc(SVM->N, sizeof(char));
+    for (k = 0; k < SVM->nactive; k++)
+	is_active[SVM->active[k]] = 1;
+
+    for (i = 0; i < SVM->N; i++)
+	if (!is_active[i])
+	    SVM->error_cache[i] = SVM->learned_func(i, SVM) - SVM->target[i];
+
+    for (i = 0; i < SVM->N; i++)
+	SVM->active[i] = i;
+    SVM->nactive = SVM->N;
+
+    /*the cached rows lack the shrunk examples */
+    if (SVM->kernel_type != SVM_KERNEL_DIRECT)
+	kernel_cache_flush(SVM);
+
+    G_free(is_active);
 }
 
 
@@ -277,13 +504,22 @@ static double rbf_kernel(int i1, int i2, SupportVectorMachine * SVM)
 
 static double dot_product_func(int i1, int i2, SupportVectorMachine * SVM)
 {
-    double dot = 0.0;
+    const double *x1 = SVM->dense_points[i1];
+    const double *x2 = SVM->dense_points[i2];
+    double d0 = 0.0, d1 = 0.0, d2 = 0.0, d3 = 0.0;
     int i;
 
-    for (i = 0; i < SVM->d; i++)
-	dot += SVM->dense_points[i1][i] * SVM->dense_points[i2][i];
+    /*independent sums, the compiler can vectorize them */
+    for (i = 0; i + 3 < SVM->d; i += 4) {
+	d0 += x1[i] * x2[i];
+	d1 += x1[i + 1] * x2[i + 1];
+	d2 += x1[i + 2] * x2[i + 2];
+	d3 += x1[i + 3] * x2[i + 3];
+    }
+    for (; i < SVM->d; i++)
+	d0 += x1[i] * x2[i];
 
-    return dot;
+    return (d0 + d1) + (d2 + d3);
 }
 
 static int examineExample(int i1, SupportVectorMachine * SVM)
@@ -293,32 +529,32 @@ static int examineExample(int i1, SupportVectorMachine * SVM)
     y1 = SVM->target[i1];
     alph1 = SVM->alph[i1];
 
-    if (alph1 > 0 && alph1 < SVM->Cw[i1])
-	E1 = SVM->error_cache[i1];
-    else
-	E1 = SVM->learned_func(i1, SVM) - y1;
+    /*the error is kept up to date for all active examples */
+    E1 = SVM->error_cache[i1];
 
     r1 = y1 * E1;
 
     if ((r1 < -SVM->tolerance && alph1 < SVM->Cw[i1]) ||
 	(r1 > SVM->tolerance && alph1 > 0)) {
 	{
-	    int k, i2;
+	    int k, i, i2;
 	    double tmax;
 
-	    for (i2 = (-1), tmax = 0, k = 0; k < SVM->end_support_i; k++)
-		if (SVM->alph[k] > 0 && SVM->alph[k] < SVM->Cw[k]) {
+	    for (i2 = (-1), tmax = 0, k = 0; k < SVM->nactive; k++) {
+		i = SVM->active[k];
+		if (SVM->alph[i] > 0 && SVM->alph[i] < SVM->Cw[i]) {
 		    double E2, temp;
 
-		    E2 = SVM->error_cache[k];
+		    E2 = SVM->error_cache[i];
 
 		    temp = fabs(E1 - E2);
 
 		    if (temp > tmax) {
 			tmax = temp;
-			i2 = k;
+			i2 = i;
 		    }
 		}
+	    }
 
 	    if (i2 >= 0) {
 		if (takeStep(i1, i2, SVM))
@@ -328,9 +564,9 @@ static int examineExample(int i1, SupportVectorMachine * SVM)
 	{
 	    int k0, k, i2;
 
-	    for (k0 = (int)(drand48() * SVM->end_support_i), k = k0;
-		 k < SVM->end_support_i + k0; k++) {
-		i2 = k % SVM->end_support_i;
+	    for (k0 = (int)(erand48(SVM->rand_state) * SVM->nactive), k = k0;
+		 k < SVM->nactive + k0; k++) {
+		i2 = SVM->active[k % SVM->nactive];
 		if (SVM->alph[i2] > 0 && SVM->alph[i2] < SVM->Cw[i2]) {
 		    if (takeStep(i1, i2, SVM))
 			return 1;
@@ -340,9 +576,9 @@ static int examineExample(int i1, SupportVectorMachine * SVM)
 	{
 	    int k0, k, i2;
 
-	    for (k0 = (int)(drand48() * SVM->end_support_i), k = k0;
-		 k < SVM->end_support_i + k0; k++) {
-		i2 = k % SVM->end_support_i;
+	    for (k0 = (int)(erand48(SVM->rand_state) * SVM->nactive), k = k0;
+		 k < SVM->nactive + k0; k++) {
+		i2 = SVM->active[k % SVM->nactive];
 		if (takeStep(i1, i2, SVM))
 		    return 1;
 	    }
@@ -358,24 +594,18 @@ static int takeStep(int i1, int i2, SupportVectorMachine * SVM)
     double alph1, alph2;
     double a1, a2;
     double E1, E2, L, H, k11, k12, k22, eta, Lobj, Hobj;
+    double *row1 = NULL, *row2 = NULL;
 
     if (i1 == i2)
 	return 0;
 
     alph1 = SVM->alph[i1];
     y1 = SVM->target[i1];
-    if (alph1 > 0 && alph1 < SVM->Cw[i1])
-	E1 = SVM->error_cache[i1];
-    else
-	E1 = SVM->learned_func(i1, SVM) - y1;
-
+    E1 = SVM->error_cache[i1];
 
     alph2 = SVM->alph[i2];
     y2 = SVM->target[i2];
-    if (alph2 > 0 && alph2 < SVM->Cw[i2])
-	E2 = SVM->error_cache[i2];
-    else
-	E2 = SVM->learned_func(i2, SVM) - y2;
+    E2 = SVM->error_cache[i2];
 
     s = y1 * y2;
 
@@ -415,9 +645,11 @@ static int takeStep(int i1, int i2, SupportVectorMachine * SVM)
 	return 0;
 
     if (SVM->kernel_type != SVM_KERNEL_DIRECT) {
-	k11 = SVM->kernel_func(i1, i1, SVM);
-	k12 = SVM->kernel_func(i1, i2, SVM);
-	k22 = SVM->kernel_func(i2, i2, SVM);
+	row1 = kernel_row(i1, SVM);
+	row2 = kernel_row(i2, SVM);
+	k11 = row1[i1];
+	k12 = row1[i2];
+	k22 = row2[i2];
     }
     else {
 	k11 = SVM->H[i1][i1];
@@ -512,23 +744,24 @@ static int takeStep(int i1, int i2, SupportVectorMachine * SVM)
 
     {
 	double t1, t2;
-	int i;
+	int i, k;
 
 	t1 = y1 * (a1 - alph1);
 	t2 = y2 * (a2 - alph2);
 
 	if (SVM->kernel_type != SVM_KERNEL_DIRECT) {
-	    for (i = 0; i < SVM->end_support_i; i++)
+	    for (k = 0; k < SVM->nactive; k++) {
+		i = SVM->active[k];
 		SVM->error_cache[i] +=
-		    t1 * SVM->kernel_func(i1, i,
-					  SVM) + t2 * SVM->kernel_func(i2, i,
-								       SVM) -
-		    SVM->delta_b;
+		    t1 * row1[i] + t2 * row2[i] - SVM->delta_b;
+	    }
 	}
 	else {
-	    for (i = 0; i < SVM->end_support_i; i++)
+	    for (k = 0; k < SVM->nactive; k++) {
+		i = SVM->active[k];
 		SVM->error_cache[i] +=
 		    t1 * SVM->H[i1][i] + t2 * SVM->H[i2][i] - SVM->delta_b;
+	    }
 	}
 
     }
@@ -1190,6 +1423,48 @@ double predict_svm(SupportVectorMachine * svm, double *x)
     return y;
 }
 
+void predict_svm_block(SupportVectorMachine * svm, double **x, int n,
+		       double *y)
+
+     /* 
+        given a svm model, return in y the predicted margins of the n test
+        points x. The kernel is evaluated support vector by support vector
+        over the whole block, thus each support vector is read only once
+        per block
+      */
+{
+    int i, j, s;
+    double K, diff, coeff;
+    double *sv;
+
+    if (svm->kernel_type == SVM_KERNEL_GAUSSIAN) {
+	for (i = 0; i < n; i++)
+	    y[i] = -svm->b;
+	for (s = 0; s < svm->N; s++) {
+	    if (svm->alph[s] > 0) {
+		sv = svm->dense_points[s];
+		coeff = svm->alph[s] * svm->target[s];
+		for (i = 0; i < n; i++) {
+		    K = 0.0;
+		    for (j = 0; j < svm->d; j++) {
+			diff = sv[j] - x[i][j];
+			K += diff * diff;
+		    }
+		    y[i] += coeff * exp(-K / svm->two_sigma_squared);
+		}
+	    }
+	}
+    }
+    else if (svm->kernel_type == SVM_KERNEL_LINEAR) {
+	for (i = 0; i < n; i++)
+	    y[i] = dot_product(svm->w, x[i], svm->d) - svm->b;
+    }
+    else {
+	for (i = 0; i < n; i++)
+	    y[i] = predict_svm(svm, x[i]);
+    }
+}
+
 
 
 void compute_svm_bagging(BSupportVectorMachine * bsvm, int bagging,
@@ -1200,12 +1475,8 @@ void compute_svm_bagging(BSupportVectorMachine * bsvm, int bagging,
 {
     int i, b;
     int *bsamples;
-    double **xdata_training;
-    int *xclasses_training;
     double *prob;
-    int nk;
-    int *extracted;
-    int index;
+    char **extracted;
 
 
     bsvm->svm = (SupportVectorMachine *) G_calloc(bagging,
@@ -1219,36 +1490,38 @@ void compute_svm_bagging(BSupportVectorMachine * bsvm, int bagging,
     }
 
 
-    extracted = (int *)G_calloc(nsamples, sizeof(int));
     prob = (double *)G_calloc(nsamples, sizeof(double));
     bsamples = (int *)G_calloc(nsamples, sizeof(int));
-    xdata_training = (double **)G_calloc(nsamples, sizeof(double *));
-    xclasses_training = (int *)G_calloc(nsamples, sizeof(int));
 
     for (i = 0; i < nsamples; i++) {
 	prob[i] = 1.0 / nsamples;
     }
 
+    /*draw all bootstrap samples first, Bootsamples is not thread safe */
+    extracted = (char **)G_calloc(bsvm->nsvm, sizeof(char *));
     for (b = 0; b < bsvm->nsvm; b++) {
-	for (i = 0; i < nsamples; i++) {
-	    extracted[i] = 0;
-	}
+	extracted[b] = (char *)G_calloc(nsamples, sizeof(char));
 	Bootsamples(nsamples, prob, bsamples);
 	for (i = 0; i < nsamples; i++) {
-	    extracted[bsamples[i]] = 1;
-	}
-	nk = 0;
-	for (i = 0; i < nsamples; i++) {
-	    if (extracted[i]) {
-		nk += 1;
-	    }
+	    extracted[b][bsamples[i]] = 1;
 	}
+    }
 
-	index = 0;
+    /*the models are independent */
+#pragma omp parallel for schedule(dynamic) private(i)
+    for (b = 0; b < bsvm->nsvm; b++) {
+	double **xdata_training;
+	int *xclasses_training;
+	int nk;
+
+	xdata_training = (double **)G_calloc(nsamples, sizeof(double *));
+	xclasses_training = (int *)G_calloc(nsamples, sizeof(int));
+
+	nk = 0;
 	for (i = 0; i < nsamples; i++) {
-	    if (extracted[i]) {
-		xdata_training[index] = data[i];
-		xclasses_training[index++] = data_class[i];
+	    if (extracted[b][i]) {
+		xdata_training[nk] = data[i];
+		xclasses_training[nk++] = data_class[i];
 	    }
 	}
 
@@ -1256,13 +1529,15 @@ void compute_svm_bagging(BSupportVectorMachine * bsvm, int bagging,
 		    xclasses_training, svm_kernel, kp, C, tol,
 		    eps, maxloops, svm_verbose, svm_W);
 
+	G_free(xdata_training);
+	G_free(xclasses_training);
     }
 
+    for (b = 0; b < bsvm->nsvm; b++)
+	G_free(extracted[b]);
+    G_free(extracted);
     G_free(bsamples);
-    G_free(xclasses_training);
     G_free(prob);
-    G_free(extracted);
-    G_free(xdata_training);
 }
 
 
@@ -1406,6 +1681,7 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
     int nk;
     int *extracted;
     int index;
+    double *margin;
 
     if (weights_boosting == 1) {
 	bsvm->w_evolution = (double **)G_calloc(nsamples, sizeof(double *));
@@ -1427,6 +1703,7 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
     xdata_training = (double **)G_calloc(nsamples, sizeof(double *));
     xclasses_training = (int *)G_calloc(nsamples, sizeof(int));
     error = (int *)G_calloc(nsamples, sizeof(int));
+    margin = (double *)G_calloc(nsamples, sizeof(double));
 
     for (i = 0; i < nsamples; i++) {
 	prob[i] = 1.0 / nsamples;
@@ -1464,11 +1741,15 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
 		    xclasses_training, svm_kernel, kp, C, tol,
 		    svm_eps, maxloops, svm_verbose, svm_W);
 
+	/*the models depend on each other, but not their predictions */
+#pragma omp parallel for schedule(static)
+	for (i = 0; i < nsamples; i++)
+	    margin[i] = predict_svm(&(bsvm->svm[b]), data[i]);
+
 	e00 = e01 = e10 = e11 = prior0 = prior1 = 0.0;
 	for (i = 0; i < nsamples; i++) {
 	    if (data_class[i] == classes[0]) {
-		if (predict_svm(&(bsvm->svm[b]), data[i]) * data_class[i] <=
-		    0.0) {
+		if (margin[i] * data_class[i] <= 0.0) {
 		    error[i] = TRUE;
 		    e01 += prob[i];
 		}
@@ -1479,8 +1760,7 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
 		prior0 += prob[i];
 	    }
 	    else {
-		if (predict_svm(&(bsvm->svm[b]), data[i]) * data_class[i] <=
-		    0.0) {
+		if (margin[i] * data_class[i] <= 0.0) {
 		    error[i] = TRUE;
 		    e10 += prob[i];
 		}
@@ -1546,6 +1826,7 @@ void compute_svm_boosting(BSupportVectorMachine * bsvm, int boosting,
     G_free(extracted);
     G_free(xdata_training);
     G_free(error);
+    G_free(margin);
 
 }
 
@@ -1577,6 +1858,34 @@ double predict_bsvm(BSupportVectorMachine * bsvm, double *x)
     return out;
 }
 
+void predict_bsvm_block(BSupportVectorMachine * bsvm, double **x, int n,
+			double *y)
+
+     /* 
+        given a bsvm model, return in y the predicted margins of the n test
+        points x
+      */
+{
+    int i, b;
+    double *pred;
+
+    pred = (double *)G_calloc(n, sizeof(double));
+
+    for (i = 0; i < n; i++)
+	y[i] = 0.0;
+    for (b = 0; b < bsvm->nsvm; b++) {
+	predict_svm_block(&(bsvm->svm[b]), x, n, pred);
+	for (i = 0; i < n; i++) {
+	    if (pred[i] < 0.0)
+		y[i] -= bsvm->weights[b];
+	    else if (pred[i] > 0.0)
+		y[i] += bsvm->weights[b];
+	}
+    }
+
+    G_free(pred);
+}
+
 void test_bsvm(BSupportVectorMachine * bsvm, Features * features, char *file)
 
      /*
@@ -1409,6 +1409,71 @@ double predict_tree_2class(Tree * tree, double *x)
     }
 }
 
+static void tree_terminal_nodes(Tree * tree, double **x, int n, int *node)
+
+     /* 
+        terminal nodes of the n test points x. The points descend the tree
+        together, one level per pass
+      */
+{
+    int i, active;
+    Node *nd;
+
+    for (i = 0; i < n; i++)
+	node[i] = 0;
+
+    do {
+	active = 0;
+	for (i = 0; i < n; i++) {
+	    nd = &(tree->node[node[i]]);
+	    if (!nd->terminal) {
+		node[i] = x[i][nd->var] <= nd->value ? nd->left : nd->right;
+		active++;
+	    }
+	}
+    } while (active);
+}
+
+void predict_tree_multiclass_block(Tree * tree, double **x, int n, double *y)
+
+     /* 
+        multiclass problems: given a tree model, return in y the predicted
+        classes of the n test points x
+      */
+{
+    int i;
+    int *node;
+
+    node = (int *)G_calloc(n, sizeof(int));
+    tree_terminal_nodes(tree, x, n, node);
+    for (i = 0; i < n; i++)
+	y[i] = tree->node[node[i]].class;
+    G_free(node);
+}
+
+void predict_tree_2class_block(Tree * tree, double **x, int n, double *y)
+
+     /* 
+        2 class problems: given a tree model, return in y the proportion of
+        data in the terminal nodes (with sign) of the n test points x
+      */
+{
+    int i;
+    int *node;
+    Node *nd;
+
+    node = (int *)G_calloc(n, sizeof(int));
+    tree_terminal_nodes(tree, x, n, node);
+    for (i = 0; i < n; i++) {
+	nd = &(tree->node[node[i]]);
+	if (nd->priors[0] > nd->priors[1])
+	    y[i] = nd->priors[0] * nd->class;
+	else
+	    y[i] = nd->priors[1] * nd->class;
+    }
+    G_free(node);
+}
+
 void test_tree(Tree * tree, Features * features, char *file)
 
      /*
@@ -1556,6 +1621,70 @@ int predict_btree_multiclass(BTree * btree, double *x, int nclasses,
 }
 
 
+void predict_btree_2class_block(BTree * btree, double **x, int n, double *y)
+
+     /* 
+        for 2 classes problems: given a btree model, return in y the predicted
+        margins of the n test points x
+      */
+{
+    int i, b;
+    int *node;
+
+    node = (int *)G_calloc(n, sizeof(int));
+    for (i = 0; i < n; i++)
+	y[i] = 0.0;
+    for (b = 0; b < btree->ntrees; b++) {
+	tree_terminal_nodes(&(btree->tree[b]), x, n, node);
+	for (i = 0; i < n; i++)
+	    y[i] += btree->tree[b].node[node[i]].class * btree->weights[b];
+    }
+    G_free(node);
+}
+
+void predict_btree_multiclass_block(BTree * btree, double **x, int n,
+				    int nclasses, int *classes, double *y)
+
+     /* 
+        for multiclasses problems: given a btree model, return in y the
+        predicted classes of the n test points x
+      */
+{
+    int i, b, j;
+    int *node, *predict;
+    int pred_class, max, max_class;
+
+    node = (int *)G_calloc(n, sizeof(int));
+    predict = (int *)G_calloc(n * nclasses, sizeof(int));
+
+    for (b = 0; b < btree->ntrees; b++) {
+	tree_terminal_nodes(&(btree->tree[b]), x, n, node);
+	for (i = 0; i < n; i++) {
+	    pred_class = btree->tree[b].node[node[i]].class;
+	    for (j = 0; j < nclasses; j++) {
+		if (pred_class == classes[j]) {
+		    predict[i * nclasses + j] += 1;
+		}
+	    }
+	}
+    }
+
+    for (i = 0; i < n; i++) {
+	max = 0;
+	max_class = 0;
+	for (j = 0; j < nclasses; j++) {
+	    if (predict[i * nclasses + j] > max) {
+		max = predict[i * nclasses + j];
+		max_class = j;
+	    }
+	}
+	y[i] = classes[max_class];
+    }
+
+    G_free(node);
+    G_free(predict);
+}
+
 void test_btree(BTree * btree, Features * features, char *file)
 
      /*
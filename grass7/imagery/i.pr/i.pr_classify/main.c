@@ -23,10 +23,41 @@
 #include <grass/gis.h>
 #include <grass/raster.h>
 #include <grass/glocale.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include "global.h"
 
+/* number of pixels classified together */
+#define TILE_SIZE 256
+
+typedef struct
+{
+    int type;
+    NearestNeighbor nn;
+    GaussianMixture gm;
+    Tree tree;
+    SupportVectorMachine svm;
+    BTree btree;
+    BSupportVectorMachine bsvm;
+} Model;
+
+/* working space of one thread */
+typedef struct
+{
+    double ***window;		/* windows of the layers */
+    double *wind_vect;
+    double *projected;
+    double **X;			/* features of the pixels of a tile */
+    int *pix;			/* their columns */
+    double *pred;		/* their predictions */
+} Workspace;
 
 int extract_array_with_null();
+static int extract_features();
+static void classify_row();
+static void predict_tile();
+static void read_rows();
 
 int main(int argc, char *argv[])
 {
@@ -34,37 +65,26 @@ int main(int argc, char *argv[])
     struct Option *opt1;
     struct Option *opt2;
     struct Option *opt3;
-    int model_type;
-    NearestNeighbor nn;
-    GaussianMixture gm;
-    Tree tree;
-    SupportVectorMachine svm;
-    BTree btree;
-    BSupportVectorMachine bsvm;
+    struct Option *opt4;
+    Model model;
     char tmpbuf[500];
     char *mapset;
     struct Cell_head cellhd;
-    double ***matrix;
-    DCELL *rowbuf;
-    DCELL *tf;
+    double ***matrix[2];
+    DCELL **outrows[2];
     int *fd;
-    int r, c, l;
+    int r, l, k;
     Features features;
     int i, j;
     int fdout;
     int *space_for_each_layer;
-    double *wind_vect;
-    double *X;
-    int borderC, borderR, borderC_upper, dim;
-    double mean, sd;
-    int corrent_feature;
-    double *projected;
+    int borderR, dim;
     int *compute_features;
-    DCELL *output_cell;
-    int set_null;
+    DCELL *null_row;
     int n_input_map;
-    int R, C;
-    int last_row;
+    int threads, nthreads, block_rows, window_rows, buffer_rows;
+    int cur, first, n, prev_n, next_first, next_n;
+    Workspace *work;
 
     /* Define the different options */
 
@@ -92,6 +112,13 @@ int main(int argc, char *argv[])
     opt3->description =
 	"Name of the output raster map conaining the resulting classification.";
 
+    opt4 = G_define_option();
+    opt4->key = "threads";
+    opt4->type = TYPE_INTEGER;
+    opt4->required = NO;
+    opt4->description = "Number of threads for parallel computing.";
+    opt4->answer = "1";
+
   /***** Start of main *****/
     G_gisinit(argv[0]);
 
@@ -108,21 +135,37 @@ int main(int argc, char *argv[])
     if (G_parser(argc, argv) < 0)
 	exit(EXIT_FAILURE);
 
+    sscanf(opt4->answer, "%d", &threads);
+    if (threads < 1) {
+	sprintf(tmpbuf, "threads must be > 0\n");
+	G_fatal_error(tmpbuf);
+    }
+    nthreads = 1;
+#if defined(_OPENMP)
+    omp_set_num_threads(threads);
+    nthreads = threads;
+#else
+    if (threads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+#endif
+
     /*read the model */
-    model_type = read_model(opt2->answer, &features, &nn, &gm, &tree,
-			    &svm, &btree, &bsvm);
+    model.type = read_model(opt2->answer, &features, &model.nn, &model.gm,
+			    &model.tree, &model.svm, &model.btree,
+			    &model.bsvm);
 
     if (features.training.data_type != GRASS_data) {
 	sprintf(tmpbuf, "Model build using othe than GRASS data\n");
 	G_fatal_error(tmpbuf);
     }
-    if (model_type == 0) {
+    if (model.type == 0) {
 	sprintf(tmpbuf, "Model not recognized\n");
 	G_fatal_error(tmpbuf);
     }
 
-    if (model_type == GM_model) {
-	compute_test_gm(&gm);
+    if (model.type == GM_model) {
+	compute_test_gm(&model.gm);
     }
 
     /* load current region */
@@ -177,27 +220,54 @@ int main(int argc, char *argv[])
 	}
     }
 
+    /* this make the program working, but... */
+    features.npc = features.examples_dim;
+
+    /*
+       the rows are classified in blocks: while the rows of one block
+       are classified in parallel, the output of the previous block is
+       written and the input of the next block is read into the second
+       buffer
+     */
+    window_rows = features.training.rows;
+    block_rows = 4 * nthreads;
+    buffer_rows = block_rows + window_rows - 1;
+
     /*alloc memory */
-    matrix =
-	(double ***)G_calloc(features.training.nlayers, sizeof(double **));
-    for (l = 0; l < features.training.nlayers; l++) {
-	matrix[l] =
-	    (double **)G_calloc(features.training.rows, sizeof(double *));
-	for (r = 0; r < features.training.rows; r++) {
-	    matrix[l][r] = (double *)G_calloc(cellhd.cols, sizeof(double));
+    for (k = 0; k < 2; k++) {
+	matrix[k] =
+	    (double ***)G_calloc(features.training.nlayers,
+				 sizeof(double **));
+	for (l = 0; l < features.training.nlayers; l++) {
+	    matrix[k][l] = (double **)G_calloc(buffer_rows, sizeof(double *));
+	    for (r = 0; r < buffer_rows; r++) {
+		matrix[k][l][r] =
+		    (double *)G_calloc(cellhd.cols, sizeof(double));
+	    }
 	}
+	outrows[k] = (DCELL **) G_calloc(block_rows, sizeof(DCELL *));
+	for (r = 0; r < block_rows; r++)
+	    outrows[k][r] = Rast_allocate_d_buf();
     }
     fd = (int *)G_calloc(features.training.nlayers, sizeof(int));
-    X = (double *)G_calloc(features.examples_dim, sizeof(double));
-
-    wind_vect = (double *)G_calloc(dim, sizeof(double));
-
-    /* this make the program working, but... */
-    features.npc = features.examples_dim;
 
-    projected = (double *)G_calloc(features.npc, sizeof(double));
+    work = (Workspace *) G_calloc(nthreads, sizeof(Workspace));
+    for (k = 0; k < nthreads; k++) {
+	work[k].window = (double ***)G_calloc(features.training.nlayers,
+					      sizeof(double **));
+	work[k].wind_vect = (double *)G_calloc(dim, sizeof(double));
+	work[k].projected = (double *)G_calloc(features.npc, sizeof(double));
+	work[k].X = (double **)G_calloc(TILE_SIZE, sizeof(double *));
+	work[k].X[0] = (double *)G_calloc(TILE_SIZE * features.examples_dim,
+					  sizeof(double));
+	for (i = 1; i < TILE_SIZE; i++)
+	    work[k].X[i] = work[k].X[i - 1] + features.examples_dim;
+	work[k].pix = (int *)G_calloc(TILE_SIZE, sizeof(int));
+	work[k].pred = (double *)G_calloc(TILE_SIZE, sizeof(double));
+    }
 
-    output_cell = Rast_allocate_d_buf();
+    null_row = Rast_allocate_d_buf();
+    Rast_set_d_null_value(null_row, cellhd.cols);
 
     /*open the input maps */
     n_input_map = 0;
@@ -231,209 +301,305 @@ int main(int argc, char *argv[])
     fdout = open_new_DCELL(opt3->answer);
 
     /*useful vars */
-    borderC = (features.training.cols - 1) / 2;
-    borderC_upper = cellhd.cols - borderC;
     borderR = (features.training.rows - 1) / 2;
-    last_row = features.training.rows - 1;
-
-
-    /*read first rows */
-    for (r = 0; r < features.training.rows; r++) {
-	rowbuf =
-	    (DCELL *) G_calloc(features.training.nlayers * cellhd.cols,
-			       sizeof(DCELL));
-	tf = rowbuf;
-	for (l = 0; l < features.training.nlayers; l++) {
-	    Rast_get_d_row(fd[l], tf, r);
-	    for (c = 0; c < cellhd.cols; c++) {
-		if (Rast_is_d_null_value(tf))
-		    *tf = 0.0;
-		matrix[l][r][c] = *tf;
-		tf++;
-	    }
-	}
-	G_free(rowbuf);
-    }
 
     /*write the first rows of the output map */
-    for (c = 1; c <= cellhd.cols; c++)
-	Rast_set_d_null_value(output_cell, c);
     for (r = 0; r < borderR; r++)
-	Rast_put_d_row(fdout, output_cell);
+	Rast_put_d_row(fdout, null_row);
+
+    /*
+       a block holds the windows ending at the map rows
+       first ... first + n - 1, its buffer the map rows
+       first - window_rows + 1 ... first + n - 1
+     */
+    cur = 0;
+    first = window_rows - 1;
+    n = cellhd.rows - first;
+    if (n > block_rows)
+	n = block_rows;
+    if (n > 0)
+	read_rows(fd, features.training.nlayers, matrix[cur], 0, 0,
+		  window_rows - 1 + n, cellhd.cols);
+    prev_n = 0;
 
     /*computing... */
-    r = features.training.rows;
-
-    while (r <= cellhd.rows) {
-	for (c = borderC; c < borderC_upper; c++) {
-	    corrent_feature = 0;
-	    for (l = 0; l < features.training.nlayers; l++) {
-		set_null = extract_array_with_null(features.training.rows,
-						   features.training.cols,
-						   c, borderC, matrix[l],
-						   wind_vect);
-
-		if (set_null) {
-		    break;
-		}
-		else {
-		    mean = mean_of_double_array(wind_vect, dim);
-		    sd = sd_of_double_array_given_mean(wind_vect, dim, mean);
-
-		    if (features.f_normalize[0]) {
-			for (j = 2; j < 2 + features.f_normalize[1]; j++) {
-			    if (features.f_normalize[j] == l) {
-				for (i = 0; i < dim; i++) {
-				    wind_vect[i] = (wind_vect[i] - mean) / sd;
-				}
-				break;
-			    }
-			}
+    while (n > 0) {
+	next_first = first + n;
+	next_n = cellhd.rows - next_first;
+	if (next_n > block_rows)
+	    next_n = block_rows;
+
+#pragma omp parallel private(k)
+	{
+#pragma omp single
+	    {
+		/* input and output of the neighbouring blocks */
+#pragma omp task private(r, l)
+		{
+		    for (r = 0; r < prev_n; r++)
+			Rast_put_d_row(fdout, outrows[1 - cur][r]);
+		    if (prev_n > 0)
+			percent(first, cellhd.rows, 1);
+
+		    if (next_n > 0) {
+			for (l = 0; l < features.training.nlayers; l++)
+			    for (r = 0; r < window_rows - 1; r++)
+				memcpy(matrix[1 - cur][l][r],
+				       matrix[cur][l][n + r],
+				       cellhd.cols * sizeof(double));
+			read_rows(fd, features.training.nlayers,
+				  matrix[1 - cur], window_rows - 1,
+				  next_first, next_n, cellhd.cols);
 		    }
+		}
 
-		    if (!compute_features[l]) {
-			for (i = 0; i < dim; i++) {
-			    X[corrent_feature + i] = wind_vect[i];
-			}
-			corrent_feature += dim;
-		    }
-		    else {
-			if (features.f_mean[0]) {
-			    for (j = 2; j < 2 + features.f_mean[1]; j++) {
-				if (features.f_mean[j] == l) {
-				    X[corrent_feature] = mean;
-				    corrent_feature += 1;
-				    break;
-				}
-			    }
-			}
-			if (features.f_variance[0]) {
-			    for (j = 2; j < 2 + features.f_variance[1]; j++) {
-				if (features.f_variance[j] == l) {
-				    X[corrent_feature] = sd * sd;
-				    corrent_feature += 1;
-				    break;
-				}
-			    }
-			}
-			if (features.f_pca[0]) {
-			    for (j = 2; j < 2 + features.f_pca[1]; j++) {
-				if (features.f_pca[j] == l) {
-				    product_double_vector_double_matrix
-					(features.pca[l].eigmat, wind_vect,
-					 dim, features.npc, projected);
-
-				    for (i = 0; i < features.npc; i++) {
-					X[corrent_feature + i] = projected[i];
-				    }
-				    corrent_feature += features.npc;
-				    break;
-				}
-			    }
-			}
+		for (k = 0; k < n; k++) {
+#pragma omp task firstprivate(k)
+		    {
+			int tid = 0, layer;
+
+#if defined(_OPENMP)
+			tid = omp_get_thread_num();
+#endif
+			for (layer = 0; layer < features.training.nlayers;
+			     layer++)
+			    work[tid].window[layer] = matrix[cur][layer] + k;
+			classify_row(&model, &features, compute_features,
+				     work[tid].window, cellhd.cols,
+				     &work[tid], outrows[cur][k]);
 		    }
 		}
 	    }
-	    if (set_null) {
-		output_cell[c] = 0.0;
+	}
+
+	prev_n = n;
+	cur = 1 - cur;
+	first = next_first;
+	n = next_n;
+    }
+
+    /*write the output of the last block */
+    for (r = 0; r < prev_n; r++)
+	Rast_put_d_row(fdout, outrows[1 - cur][r]);
+    percent(cellhd.rows, cellhd.rows, 1);
+
+    /*write the last rows of the output map */
+    for (r = 0; r < borderR; r++)
+	Rast_put_d_row(fdout, null_row);
+
+    Rast_close(fdout);
+    return 0;
+}
+
+/* read n rows of all layers starting at map row, into the buffer rows
+   starting at offset. Null values are set to 0 */
+static void read_rows(int *fd, int nlayers, double ***matrix, int offset,
+		      int row, int n, int cols)
+{
+    int l, r, c;
+    DCELL *tf;
+
+    for (l = 0; l < nlayers; l++) {
+	for (r = 0; r < n; r++) {
+	    tf = matrix[l][offset + r];
+	    Rast_get_d_row(fd[l], tf, row + r);
+	    for (c = 0; c < cols; c++) {
+		if (Rast_is_d_null_value(&tf[c]))
+		    tf[c] = 0.0;
+	    }
+	}
+    }
+}
+
+/* classify the row at the center of the windows of the layers, the
+   pixels are collected into tiles which are predicted at once */
+static void classify_row(Model * model, Features * features,
+			 int *compute_features, double ***window, int cols,
+			 Workspace * work, DCELL * out)
+{
+    int c, c0, c1, i, n;
+    int borderC, borderC_upper;
+
+    borderC = (features->training.cols - 1) / 2;
+    borderC_upper = cols - borderC;
+
+    Rast_set_d_null_value(out, cols);
+
+    for (c0 = borderC; c0 < borderC_upper; c0 += TILE_SIZE) {
+	c1 = c0 + TILE_SIZE;
+	if (c1 > borderC_upper)
+	    c1 = borderC_upper;
+
+	n = 0;
+	for (c = c0; c < c1; c++) {
+	    if (extract_features(features, compute_features, window, c,
+				 borderC, work, work->X[n])) {
+		out[c] = 0.0;
 	    }
 	    else {
-		if (features.f_standardize[0]) {
-		    for (i = 2; i < 2 + features.f_standardize[1]; i++) {
-			X[features.f_standardize[i]] =
-			    (X[features.f_standardize[i]] -
-			     features.mean[i - 2]) / features.sd[i - 2];
+		work->pix[n] = c;
+		n++;
+	    }
+	}
+	if (n == 0)
+	    continue;
+
+	predict_tile(model, features, work->X, n, work->pred);
+	for (i = 0; i < n; i++)
+	    out[work->pix[i]] = work->pred[i];
+    }
+}
+
+/* features of the pixel at column c into X, returns 1 if the window
+   of a layer contains only zeros */
+static int extract_features(Features * features, int *compute_features,
+			    double ***window, int c, int borderC,
+			    Workspace * work, double *X)
+{
+    int i, j, l, dim;
+    int corrent_feature;
+    double mean, sd;
+    double *wind_vect = work->wind_vect;
+
+    dim = features->training.rows * features->training.cols;
+
+    corrent_feature = 0;
+    for (l = 0; l < features->training.nlayers; l++) {
+	if (extract_array_with_null(features->training.rows,
+				    features->training.cols,
+				    c, borderC, window[l], wind_vect))
+	    return 1;
+
+	mean = mean_of_double_array(wind_vect, dim);
+	sd = sd_of_double_array_given_mean(wind_vect, dim, mean);
+
+	if (features->f_normalize[0]) {
+	    for (j = 2; j < 2 + features->f_normalize[1]; j++) {
+		if (features->f_normalize[j] == l) {
+		    for (i = 0; i < dim; i++) {
+			wind_vect[i] = (wind_vect[i] - mean) / sd;
 		    }
+		    break;
 		}
-		if (features.nclasses == 2) {
-		    switch (model_type) {
-		    case NN_model:
-			output_cell[c] =
-			    predict_nn_2class(&nn, X, nn.k, features.nclasses,
-					      features.p_classes);
-			break;
-		    case GM_model:
-			output_cell[c] = predict_gm_2class(&gm, X);
-			break;
-		    case CT_model:
-			output_cell[c] = predict_tree_2class(&tree, X);
-			break;
-		    case SVM_model:
-			output_cell[c] = predict_svm(&svm, X);
-			break;
-		    case BCT_model:
-			output_cell[c] = predict_btree_2class(&btree, X);
-			break;
-		    case BSVM_model:
-			output_cell[c] = predict_bsvm(&bsvm, X);
-			break;
-		    default:
+	    }
+	}
+
+	if (!compute_features[l]) {
+	    for (i = 0; i < dim; i++) {
+		X[corrent_feature + i] = wind_vect[i];
+	    }
+	    corrent_feature += dim;
+	}
+	else {
+	    if (features->f_mean[0]) {
+		for (j = 2; j < 2 + features->f_mean[1]; j++) {
+		    if (features->f_mean[j] == l) {
+			X[corrent_feature] = mean;
+			corrent_feature += 1;
 			break;
 		    }
 		}
-		else {
-		    switch (model_type) {
-		    case NN_model:
-			output_cell[c] =
-			    predict_nn_multiclass(&nn, X, nn.k,
-						  features.nclasses,
-						  features.p_classes);
-			break;
-		    case GM_model:
-			output_cell[c] = predict_gm_multiclass(&gm, X);
-			break;
-		    case CT_model:
-			output_cell[c] = predict_tree_multiclass(&tree, X);
-			break;
-		    case BCT_model:
-			output_cell[c] =
-			    predict_btree_multiclass(&btree, X,
-						     features.nclasses,
-						     features.p_classes);
-			break;
-		    default:
+	    }
+	    if (features->f_variance[0]) {
+		for (j = 2; j < 2 + features->f_variance[1]; j++) {
+		    if (features->f_variance[j] == l) {
+			X[corrent_feature] = sd * sd;
+			corrent_feature += 1;
 			break;
 		    }
 		}
 	    }
-	}
-	Rast_put_d_row(fdout, output_cell);
-	percent(r, cellhd.rows, 1);
-
-	if (r < cellhd.rows) {
-	    for (l = 0; l < features.training.nlayers; l++) {
-		for (R = 0; R < last_row; R++) {
-		    for (C = 0; C < cellhd.cols; C++) {
-			matrix[l][R][C] = matrix[l][R + 1][C];
+	    if (features->f_pca[0]) {
+		for (j = 2; j < 2 + features->f_pca[1]; j++) {
+		    if (features->f_pca[j] == l) {
+			product_double_vector_double_matrix
+			    (features->pca[l].eigmat, wind_vect,
+			     dim, features->npc, work->projected);
+
+			for (i = 0; i < features->npc; i++) {
+			    X[corrent_feature + i] = work->projected[i];
+			}
+			corrent_feature += features->npc;
+			break;
 		    }
 		}
-
-		rowbuf = (DCELL *) G_calloc(cellhd.cols, sizeof(DCELL));
-		tf = rowbuf;
-
-		Rast_get_d_row(fd[l], tf, r);
-		for (c = 0; c < cellhd.cols; c++) {
-		    if (Rast_is_d_null_value(tf))
-			*tf = 0.0;
-		    matrix[l][last_row][c] = *tf;
-		    tf++;
-		}
-		G_free(rowbuf);
 	    }
 	}
-	r += 1;
     }
 
-    /*write the last rows of the output map */
-    for (c = 1; c <= cellhd.cols; c++)
-	Rast_set_d_null_value(output_cell, c);
-    for (r = 0; r < borderR; r++)
-	Rast_put_d_row(fdout, output_cell);
+    if (features->f_standardize[0]) {
+	for (i = 2; i < 2 + features->f_standardize[1]; i++) {
+	    X[features->f_standardize[i]] =
+		(X[features->f_standardize[i]] -
+		 features->mean[i - 2]) / features->sd[i - 2];
+	}
+    }
 
-    Rast_close(fdout);
     return 0;
 }
 
+/* predictions of the n pixels of a tile */
+static void predict_tile(Model * model, Features * features, double **X,
+			 int n, double *pred)
+{
+    int i;
+
+    Rast_set_d_null_value(pred, n);
+
+    if (features->nclasses == 2) {
+	switch (model->type) {
+	case NN_model:
+	    for (i = 0; i < n; i++)
+		pred[i] = predict_nn_2class(&model->nn, X[i], model->nn.k,
+					    features->nclasses,
+					    features->p_classes);
+	    break;
+	case GM_model:
+	    for (i = 0; i < n; i++)
+		pred[i] = predict_gm_2class(&model->gm, X[i]);
+	    break;
+	case CT_model:
+	    predict_tree_2class_block(&model->tree, X, n, pred);
+	    break;
+	case SVM_model:
+	    predict_svm_block(&model->svm, X, n, pred);
+	    break;
+	case BCT_model:
+	    predict_btree_2class_block(&model->btree, X, n, pred);
+	    break;
+	case BSVM_model:
+	    predict_bsvm_block(&model->bsvm, X, n, pred);
+	    break;
+	default:
+	    break;
+	}
+    }
+    else {
+	switch (model->type) {
+	case NN_model:
+	    for (i = 0; i < n; i++)
+		pred[i] = predict_nn_multiclass(&model->nn, X[i], model->nn.k,
+						features->nclasses,
+						features->p_classes);
+	    break;
+	case GM_model:
+	    for (i = 0; i < n; i++)
+		pred[i] = predict_gm_multiclass(&model->gm, X[i]);
+	    break;
+	case CT_model:
+	    predict_tree_multiclass_block(&model->tree, X, n, pred);
+	    break;
+	case BCT_model:
+	    predict_btree_multiclass_block(&model->btree, X, n,
+					   features->nclasses,
+					   features->p_classes, pred);
+	    break;
+	default:
+	    break;
+	}
+    }
+}
+
 int extract_array_with_null(int R, int C, int c, int bc, double **mat,
 			    double *wind_vect)
 {
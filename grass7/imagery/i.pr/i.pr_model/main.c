@@ -23,6 +23,9 @@
 #include <math.h>
 #include <grass/gis.h>
 #include <grass/glocale.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include "global.h"
 
 int main(int argc, char **argv)
@@ -56,6 +59,8 @@ int main(int argc, char **argv)
     struct Option *opt26;
     struct Option *opt27;
     struct Option *opt28;
+    struct Option *opt29;
+    struct Option *opt30;
     struct Flag *flag_g;
     struct Flag *flag_t;
     struct Flag *flag_s;
@@ -78,6 +83,8 @@ int main(int argc, char **argv)
     int svm_maxloops;
     int svm_kernel;
     int svm_verbose;
+    double svm_cache;
+    int threads;
     double svm_cost;
     double *svm_W;
     int bagging, boosting, reg, reg_verbose;
@@ -320,6 +327,22 @@ int main(int argc, char **argv)
     opt22->options = "0,1";
     opt22->answer = "0";
 
+    opt29 = G_define_option();
+    opt29->key = "svm_cache";
+    opt29->type = TYPE_DOUBLE;
+    opt29->required = NO;
+    opt29->description =
+	"For svm: memory for the kernel cache of each model in MB.";
+    opt29->answer = "100";
+
+    opt30 = G_define_option();
+    opt30->key = "threads";
+    opt30->type = TYPE_INTEGER;
+    opt30->required = NO;
+    opt30->description =
+	"Number of threads for parallel computing (svm bagging and boosting).";
+    opt30->answer = "1";
+
     opt17 = G_define_option();
     opt17->key = "nn_k";
     opt17->type = TYPE_INTEGER;
@@ -443,7 +466,25 @@ int main(int argc, char **argv)
 	}
 	sscanf(opt11->answer, "%d", &svm_l1o);
 	sscanf(opt22->answer, "%d", &svm_verbose);
+	sscanf(opt29->answer, "%lf", &svm_cache);
+	if (svm_cache <= 0) {
+	    sprintf(tmpbuf, "svm cache must be > 0\n");
+	    G_fatal_error(tmpbuf);
+	}
+	set_svm_cache_size(svm_cache);
+    }
+
+    sscanf(opt30->answer, "%d", &threads);
+    if (threads < 1) {
+	sprintf(tmpbuf, "threads must be > 0\n");
+	G_fatal_error(tmpbuf);
     }
+#if defined(_OPENMP)
+    omp_set_num_threads(threads);
+#else
+    if (threads > 1)
+	G_warning(_("i.pr.model was compiled without OpenMP support, using one thread"));
+#endif
 
     sscanf(opt13->answer, "%d", &bagging);
     sscanf(opt14->answer, "%d", &boosting);
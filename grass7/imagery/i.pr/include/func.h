@@ -14,9 +14,13 @@ void compute_tree_bagging();
 void write_bagging_boosting_tree();
 int predict_tree_multiclass();
 double predict_tree_2class();
+void predict_tree_multiclass_block();
+void predict_tree_2class_block();
 void test_tree();
 double predict_btree_2class();
 int predict_btree_multiclass();
+void predict_btree_2class_block();
+void predict_btree_multiclass_block();
 void test_btree();
 void test_btree_progressive();
 double predict_btree_2class_progressive();
@@ -101,6 +105,9 @@ int read_model();
 
 void compute_nn();
 void write_nn();
+void build_nn_index();
+void compute_nn_bounds();
+int search_nn();
 int predict_nn_multiclass();
 double predict_nn_2class();
 void test_nn();
@@ -110,14 +117,17 @@ void test_nn();
  */
 
 void compute_svm();
+void set_svm_cache_size();
 void estimate_cv_error();
 void write_svm();
 void test_svm();
 double predict_svm();
+void predict_svm_block();
 void compute_svm_bagging();
 void write_bagging_boosting_svm();
 void compute_svm_boosting();
 double predict_bsvm();
+void predict_bsvm_block();
 void test_bsvm();
 void test_bsvm_progressive();
 double predict_bsvm_progressive();
@@ -25,6 +25,9 @@
 #define SVM_KERNEL_GAUSSIAN 2
 #define SVM_KERNEL_DIRECT 3
 
+#define NN_KDTREE 1
+#define NN_BALLTREE 2
+
 
 #define FS_RFE 1
 #define FS_E_RFE 2
@@ -142,6 +145,18 @@ typedef struct
     Features features;		/*the features used for the model development */
 } GaussianMixture;
 
+typedef struct
+{
+    int start;			/*first example of the node */
+    int end;			/*last example of the node + 1 */
+    int left;			/*left child (-1 for leaves) */
+    int right;			/*right child */
+    int var;			/*variable used to split the node */
+    double value;		/*value of the variable for splitting the data */
+    double *center;		/*center of the examples (ball tree) */
+    double radius;		/*max distance from the center (ball tree) */
+} NN_node;
+
 typedef struct
 {
     int nsamples;		/*number of examples */
@@ -149,6 +164,9 @@ typedef struct
     double **data;		/*the data */
     int *class;			/*their classes */
     int k;
+    int index_type;		/*NN_KDTREE or NN_BALLTREE */
+    NN_node *node;		/*the nodes of the search tree */
+    int nnodes;			/*number of nodes */
     Features features;		/*the features used for the model development */
 } NearestNeighbor;
 
@@ -165,6 +183,17 @@ typedef struct
     double b;
 } SVM_direct_kernel;
 
+typedef struct
+{
+    int n;			/*length of a row (number of examples) */
+    int nrows;			/*number of rows kept */
+    double **row;		/*cached kernel rows */
+    int *slot;			/*slot holding the row of each example, -1 if none */
+    int *owner;			/*example whose row is held in a slot, -1 if none */
+    int *prev, *next;		/*slots in order of use */
+    int head, tail;		/*most and least recently used slot */
+} SVM_kernel_cache;
+
 typedef struct
 {
     int N;			/*number of examples */
@@ -197,6 +226,10 @@ typedef struct
     int convergence;
     int verbose;
     double cost;		/*sen/spe cost (only for single svm) */
+    SVM_kernel_cache *cache;	/*kernel rows (only during training) */
+    int *active;		/*examples not shrunk (only during training) */
+    int nactive;		/*number of examples not shrunk */
+    unsigned short rand_state[3];	/*random numbers of the optimization */
     Features features;		/*the features used for the model development */
 } SupportVectorMachine;
 
@@ -17,10 +17,10 @@
 #include <time.h>
 #endif
 
-/* This will do a typical rowmajor processing of the image(s).  
- * Z-order was implemented in Revision 53236, but since removed.
- * It did not show a speed increase on small rasters.  It could
- * be considered again after other processing steps are sped up. */
+/* The region growing works on the region adjacency graph of the
+ * segments (rag.c), the pixels are only read to build the graph and
+ * to write the results.  Z-order was implemented in Revision 53236
+ * for the earlier pixel based processing, but since removed. */
 
 /* is there a better way to do this? */
 #ifndef max
@@ -33,9 +33,7 @@
 
 int create_isegs(struct files *files, struct functions *functions)
 {
-    int lower_bound, upper_bound, row, col;
     int successflag = 1;
-    struct Range range;
 
     /* Modify the threshold for easier similarity comparisons.
      * For Euclidean, square the threshold so we don't need to calculate
@@ -49,607 +47,206 @@ int create_isegs(struct files *files, struct functions *functions)
     else
 	functions->threshold = functions->threshold * files->nbands;
 
-
-    /* set parameters for outer processing loop for polygon constraints */
-    if (files->bounds_map == NULL) {	/*normal processing */
-	lower_bound = upper_bound = 0;	/* so run the segmentation algorithm just one time */
-    }
-    else {
-	if (Rast_read_range(files->bounds_map, files->bounds_mapset, &range) != 1) {	/* returns -1 on error, 2 on empty range, quiting either way. */
-	    G_fatal_error(_("No min/max found in boundary raster map <%s>"),
-			  files->bounds_map);
-	}
-	Rast_get_range_min_max(&range, &lower_bound, &upper_bound);
-	/* speed enhancement, when processing with bounds: get the unique values.
-	 * As is, we will iterate at one time over the entire raster for 
-	 * each integer between the upper and lower bound, 
-	 * even if no regions exist with that value. */
-    }
-
-    /* processing loop for polygon/boundary constraints */
+    /* polygon constraints: pixels in different boundaries are never
+     * neighbors in the region adjacency graph, so all boundaries are
+     * segmented at once */
     if (files->bounds_map != NULL)
-	G_message(_("Starting image segmentation within boundary constraints, the percent complete is based the range of values in the boundary constraints map"));
-    for (files->current_bound = lower_bound;
-	 files->current_bound <= upper_bound; files->current_bound++) {
-
-	if (files->bounds_map != NULL)
-	    G_percent(files->current_bound - lower_bound,
-		      upper_bound - lower_bound, 1);
-
-	/* *** check the processing window *** */
-
-	/* set boundaries at "opposite" end, change until reach lowest/highest */
-	files->minrow = files->nrows;
-	files->mincol = files->ncols;
-	files->maxrow = files->maxcol = 0;
-
-	if (files->bounds_map == NULL) {
-	    /* check the NULL flag to see where the first/last row/col of 
-	     * real data are, and reduce the processing window.
-	     * This could help (a little?) if a MASK is used that 
-	     * removes a large border portion of the map. */
-	    for (row = 0; row < files->nrows; row++) {
-		for (col = 0; col < files->ncols; col++) {
-
-		    if (!(FLAG_GET(files->null_flag, row, col))) {
-
-			if (files->minrow > row)
-			    files->minrow = row;
-			if (files->maxrow < row)
-			    files->maxrow = row;
-			if (files->mincol > col)
-			    files->mincol = col;
-			if (files->maxcol < col)
-			    files->maxcol = col;
-		    }
-		}
-	    }
-	}
-	else {
-	    for (row = 0; row < files->nrows; row++) {
-		for (col = 0; col < files->ncols; col++) {
-
-		    Segment_get(&files->bounds_seg, &files->bounds_val, row,
-				col);
-		    if (files->bounds_val == files->current_bound &&
-			!(FLAG_GET(files->orig_null_flag, row, col))) {
-			FLAG_UNSET(files->null_flag, row, col);
-
-			if (files->minrow > row)
-			    files->minrow = row;
-			if (files->maxrow < row)
-			    files->maxrow = row;
-			if (files->mincol > col)
-			    files->mincol = col;
-			if (files->maxcol < col)
-			    files->maxcol = col;
-
-		    }
-		    else	/* pixel is outside the current boundary or was null in the input bands */
-			FLAG_SET(files->null_flag, row, col);
-		}
-	    }
+	G_message(_("Starting image segmentation within boundary constraints"));
 
-	}			/* end of else, set up for bounded segmentation */
+    /* run the segmentation algorithm */
 
-	/* consider maxrow/maxcol as nrow, ncol, loops will have: row < maxrow
-	 * so need to increment by one */
-	files->maxrow++;
-	files->maxcol++;
+    if (functions->method == 1) {
+	successflag = region_growing(files, functions);
+    }
 
-	/* run the segmentation algorithm */
+    /* check if something went wrong */
+    if (successflag == FALSE)
+	G_fatal_error(_("Error during segmentation"));
 
-	if (functions->method == 1) {
-	    successflag = region_growing(files, functions);
-	}
+    return successflag;
+}
 
-	/* check if something went wrong */
-	if (successflag == FALSE)
-	    G_fatal_error(_("Error during segmentation"));
+/* after merging a and b into r, updates the best neighbor of r.  The
+ * neighbors which had a or b as best neighbor are only marked, their
+ * queue entries remain lower bounds and are checked when they are first.
+ * The similarity of r with any neighbor is bounded by the entry of r. */
+static void update_neighbors(struct rag *g, int r, int a, int b,
+			     struct functions *functions)
+{
+    struct rag_nbrs *nb;
+    int i, c;
 
-    }				/* end outer loop for processing bounds constraints (will just run once if not provided) */
+    rag_best(g, r, functions);
 
-    /* reset null flag to the original if we have boundary constraints */
-    if (files->bounds_map != NULL) {
-	for (row = 0; row < files->nrows; row++) {
-	    for (col = 0; col < files->ncols; col++) {
-		if (FLAG_GET(files->orig_null_flag, row, col))
-		    FLAG_SET(files->null_flag, row, col);
-		else
-		    FLAG_UNSET(files->null_flag, row, col);
-	    }
+    for (nb = g->nbrs[r]; nb != NULL; nb = nb->next) {
+	for (i = 0; i < nb->n; i++) {
+	    c = nb->id[i];
+	    if (g->best[c] == a || g->best[c] == b)
+		g->best[c] = -1;
 	}
     }
-
-
-    return successflag;
 }
 
 int region_growing(struct files *files, struct functions *functions)
 {
-    int row, col, t;
-    double threshold, Ri_similarity, Rk_similarity, tempsim;
-    int endflag;		/* =TRUE if there were no merges on that processing iteration */
-    int pathflag;		/* =TRUE if we didn't find mutual neighbors, and should continue with Rk */
-    struct pixels *Ri_head, *Rk_head, *Rin_head, *Rkn_head,
-	*current, *newpixel, *Ri_bestn;
-    int Ri_count, Rk_count;	/* number of pixels/cells in Ri and Rk */
-
-#ifdef VCLOSE
-    struct pixels *Rclose_head, *Rc_head, *Rc_tail, *Rcn_head;
-    int Rc_count;
-#endif
+    int t, a, b, r;
+    double threshold, Ri_similarity;
+    int endflag;		/* =TRUE if no further merges can be made */
+    long nmerges;
+    struct rag rag;
+    struct rag_entry e, *deferred;
+    size_t ndeferred, deferred_alloc, i;
 
 #ifdef PROFILE
     clock_t start, end;
-    clock_t merge_start, merge_end;
-    double merge_accum, merge_lap;
-    clock_t fn_start, fn_end;
-    double fn_accum, fn_lap;
     clock_t pass_start, pass_end;
 
-    merge_accum = fn_accum = 0;
     start = clock();
 #endif
-    /* files->token has the "link_head" for linkm: linked list memory allocation.
-     * 
-     * 4 linked lists of pixels:
-     * Ri = current focus segment
-     * Rk = Ri's most similar neighbor
-     * Rkn = Rk's neighbors
-     * Rin = Ri's neigbors
-     * */
-    if (files->bounds_map == NULL)
-	G_message(_("Running region growing algorithm, the percent completed is based on %d max iterations, but the process will end earlier if no further merges can be made."),
-		  functions->end_t);
 
-    t = 1;
+    rag_create(&rag, files, functions);
 
-    /*set linked list head pointers to null. */
-    Ri_head = NULL;
-    Rk_head = NULL;
-    Rin_head = NULL;
-    Rkn_head = NULL;
-    Ri_bestn = NULL;
-#ifdef VCLOSE
-    Rclose_head = NULL;
-    Rc_head = NULL;
-    Rcn_head = NULL;
-#endif
+    /* The priority queue holds each segment with its most similar
+     * neighbor, the most similar pair of all is first.  These two
+     * segments are mutually most similar neighbors, after merging them
+     * only the neighbors of the new segment are updated. */
+
+    t = 1;
+    endflag = TRUE;
+    nmerges = 0;
 
     /* One paper mentioned gradually lowering the threshold at each iteration.
      * if this is implemented, move this assignment inside the do loop and make it a function of t. */
     threshold = functions->threshold;
 
-	/* user has option to skip the normal growing steps and skip to the final merge. */
-	if(!functions->final_merge_only){
-
-    /* do while loop until no merges are made, or until t reaches maximum number of iterations */
-    do {
+    /* user has option to skip the normal growing steps and skip to the final merge. */
+    if (!functions->final_merge_only) {
 
-#ifdef PROFILE
-	pass_start = clock();
-#endif
-#ifdef SIGNPOST
-	fprintf(stdout, "pass %d\n", t);
-#endif
-	G_debug(3, "#######   Starting outer do loop! t = %d    #######", t);
 	if (files->bounds_map == NULL)
-	    G_percent(t, functions->end_t, 1);
-
-	endflag = TRUE;
-
-	/* Set candidate flag to true/1 for all pixels */
-	set_all_candidate_flags(files);
-
-	/*process candidate pixels for this iteration */
-
-	/*check each pixel, start the processing only if it is a candidate pixel */
+	    G_message(_("Running region growing algorithm, the percent completed is based on %d max iterations, but the process will end earlier if no further merges can be made."),
+		      functions->end_t);
 
-	for (row = files->minrow; row < files->maxrow; row++) {
-	    for (col = files->mincol; col < files->maxcol; col++) {
+	for (a = 1; a <= rag.nnodes; a++)
+	    rag_best(&rag, a, functions);
 
-		if (FLAG_GET(files->candidate_flag, row, col) &&
-		    FLAG_GET(files->seeds_flag, row, col)) {
+	/* merges deferred to the next pass with the limited flag */
+	deferred_alloc = 1024;
+	deferred = G_malloc(deferred_alloc * sizeof(struct rag_entry));
 
-		    /*free memory for linked lists */
-		    my_dispose_list(files->token, &Ri_head);
-		    my_dispose_list(files->token, &Rk_head);
-		    my_dispose_list(files->token, &Rin_head);
-		    my_dispose_list(files->token, &Rkn_head);
-#ifdef VCLOSE
-		    my_dispose_list(files->token, &Rclose_head);
+	/* do while loop until no merges are made, or until t reaches maximum number of iterations */
+	do {
+#ifdef PROFILE
+	    pass_start = clock();
 #endif
-		    Rk_count = 0;
-
-		    /* First pixel in Ri is current row/col pixel.  
-		     * We may add more later if it is part of a segment */
-		    Ri_count = 1;
-		    newpixel = (struct pixels *)link_new(files->token);
-		    newpixel->next = NULL;
-		    newpixel->row = row;
-		    newpixel->col = col;
-		    Ri_head = newpixel;
-
-		    pathflag = TRUE;
+#ifdef SIGNPOST
+	    fprintf(stdout, "pass %d\n", t);
+#endif
+	    G_debug(3, "#######   Starting outer do loop! t = %d    #######",
+		    t);
+	    if (files->bounds_map == NULL)
+		G_percent(t, functions->end_t, 1);
 
-		    while (pathflag == TRUE) {	/*if don't find mutual neighbors on first try, will use Rk as next Ri. */
-			G_debug(4, "Next starting pixel: row, %d, col, %d",
-				Ri_head->row, Ri_head->col);
+	    ndeferred = 0;
 
-			pathflag = FALSE;
+	    while (rag_top(&rag, &e)) {
+		Ri_similarity = e.sim;
+		if (Ri_similarity >= threshold)
+		    break;
+		rag_pop(&rag);
 
-			/* find segment neighbors, if we don't already have them */
-			if (Rin_head == NULL) {
-#ifdef PROFILE
-			    fn_start = clock();
-#endif
+		a = e.node;
+		b = rag.best[a];
+		if (b < 0) {
+		    rag_best(&rag, a, functions);
+		    continue;
+		}
 
-			    find_segment_neighbors
-				(&Ri_head, &Rin_head, &Ri_count, files,
-				 functions);
-#ifdef PROFILE
-			    fn_end = clock();
-			    fn_lap =
-				((double)(fn_end - fn_start)) /
-				CLOCKS_PER_SEC;
-			    fn_accum += fn_lap;
-			    fprintf(stdout, "fsn(Ri): %g\t", fn_lap);
-#endif
-			}
+		/* segments merged in this pass wait for the next one */
+		if (functions->limited &&
+		    (rag.pass[a] == t || rag.pass[b] == t)) {
+		    if (ndeferred == deferred_alloc) {
+			deferred_alloc *= 2;
+			deferred = G_realloc(deferred, deferred_alloc *
+					     sizeof(struct rag_entry));
+		    }
+		    deferred[ndeferred++] = e;
+		    continue;
+		}
 
-			if (Rin_head != NULL) {	/*found neighbors, find best neighbor then see if is mutually best neighbor */
-
-			    /* ********  find Ri's most similar neighbor  ******** */
-			    Ri_bestn = NULL;
-			    Ri_similarity = threshold + 1;	/* set current similarity to max value */
-			    Segment_get(&files->bands_seg, (void *)files->bands_val, Ri_head->row, Ri_head->col);	/* current segment values */
-
-			    /* for each of Ri's neighbors */
-			    for (current = Rin_head; current != NULL;
-				 current = current->next) {
-				tempsim = (*functions->calculate_similarity)
-				    (Ri_head, current, files, functions);
-
-#ifdef VCLOSE
-				/* if very close, will merge, but continue checking other neighbors */
-				if (tempsim <
-				    functions->very_close * threshold) {
-				    /* add to Rclose list */
-				    newpixel = (struct pixels *)
-					link_new(files->token);
-				    newpixel->next = Rclose_head;
-				    newpixel->row = current->row;
-				    newpixel->col = current->col;
-				    Rclose_head = newpixel;
-				}
-				/* If "sort of" close, merge only if it is the mutually most similar */
-				else
-#endif
-				if (tempsim < Ri_similarity) {
-				    Ri_similarity = tempsim;
-				    Ri_bestn = current;
-				}
-			    }	/* finished similiarity check for all neighbors */
-
-			    /* *** merge all the "very close" pixels/segments *** */
-			    /* doing this after checking all Rin, so we don't 
-			     * change the bands_val between similarity comparisons
-			     * ... but that leaves the possibility that we have 
-			     * the wrong best Neighbor after doing these merges... 
-			     * but it seems we can't put this merge after the Rk/Rkn 
-			     * portion of the loop, because we are changing the available neighbors
-			     * ...maybe this extra "very close" idea has to be 
-			     * done completely differently or dropped???  */
-#ifdef VCLOSE
-			    for (current = Rclose_head; current != NULL;
-				 current = current->next) {
-				my_dispose_list(files->token, &Rc_head);
-				my_dispose_list(files->token, &Rcn_head);
-
-				/* get membership of neighbor segment */
-				Rc_count = 1;
-				newpixel =
-				    (struct pixels *)link_new(files->token);
-				newpixel->next = NULL;
-				newpixel->row = current->row;
-				newpixel->col = current->col;
-				Rc_head = Rc_tail = newpixel;
-				find_segment_neighbors(&Rc_head, &Rcn_head, &Rc_count, files, functions);	/* just to get members, not looking at neighbors now */
-				merge_values(Ri_head, Rc_head, Ri_count,
-					     Rc_count, files);
-
-				/* Add Rc pixels to Ri */
-				Rc_tail->next = Ri_head;
-				Ri_head = Rc_head;
-
-				/*to consider, recurse?  Check all Rcn neighbors if they are very close? */
-
-				Rc_head = NULL;
-				my_dispose_list(files->token, &Rcn_head);
-			    }
-			    my_dispose_list(files->token, &Rclose_head);
-#endif
+		r = rag_merge(&rag, a, b);
+		rag.pass[r] = t;
+		update_neighbors(&rag, r, a, b, functions);
+		nmerges++;
+	    }
 
-			    /* check if we have a bestn that is valid to use to look at Rk */
-			    if (Ri_bestn != NULL) {
-				if ((functions->limited == TRUE) && !
-				    (FLAG_GET
-				     (files->candidate_flag,
-				      Ri_bestn->row, Ri_bestn->col))) {
-				    /* this check is important:
-				     * best neighbor is not a valid candidate, 
-				     * was already merged earlier in this time step */
-				    Ri_bestn = NULL;
-				}
-			    }
-			    if (Ri_bestn != NULL && Ri_similarity < threshold) {	/* small TODO: should this be < or <= for threshold? */
-				/* Rk starts from Ri's best neighbor */
-				if (Rk_head) {
-				    G_warning(_("Rk_head is not NULL!"));
-				    my_dispose_list(files->token, &Rk_head);
-				}
-				if (Rkn_head) {
-				    G_warning(_("Rkn_head is not NULL!"));
-				    my_dispose_list(files->token, &Rkn_head);
-				}
-				Rk_count = 1;
-				newpixel =
-				    (struct pixels *)link_new(files->token);
-				newpixel->next = NULL;
-				newpixel->row = Ri_bestn->row;
-				newpixel->col = Ri_bestn->col;
-				newpixel->count_shared =
-				    Ri_bestn->count_shared;
-				Rk_head = newpixel;
-
-				find_segment_neighbors(&Rk_head, &Rkn_head,
-						       &Rk_count, files,
-						       functions);
-
-				/* ********  find Rk's most similar neighbor  ******** */
-				Rk_similarity = Ri_similarity;	/*Ri gets first priority - ties won't change anything, so we'll accept Ri and Rk as mutually best neighbors */
-				Segment_get(&files->bands_seg, (void *)files->bands_val, Rk_head->row, Rk_head->col);	/* current segment values */
-
-				/* check similarity for each of Rk's neighbors */
-				for (current = Rkn_head; current != NULL;
-				     current = current->next) {
-				    tempsim =
-					functions->calculate_similarity
-					(Rk_head, current, files, functions);
-
-				    if (tempsim < Rk_similarity) {
-					Rk_similarity = tempsim;
-					break;	/* exit for Rk's neighbors loop here, we know that Ri and Rk aren't mutually best neighbors */
-				    }
-				}	/* have checked all of Rk's neighbors */
+	    /* all other merges are above the threshold */
+	    endflag = ndeferred == 0;
 
-				if (Rk_similarity == Ri_similarity) {	/* mutually most similar neighbors */
+	    for (i = 0; i < ndeferred; i++) {
+		a = deferred[i].node;
+		if (rag.parent[a] == a && rag.version[a] == deferred[i].version)
+		    rag_push(&rag, deferred[i].sim, a);
+	    }
 
 #ifdef PROFILE
-				    merge_start = clock();
-#endif
-				    merge_values(Ri_head, Rk_head, Ri_count,
-						 Rk_count, files);
-#ifdef PROFILE
-				    merge_end = clock();
-				    merge_lap =
-					((double)(merge_end - merge_start)) /
-					CLOCKS_PER_SEC;
-				    merge_accum += merge_lap;
-				    fprintf(stdout, "merge time: %g\n",
-					    merge_lap);
+	    pass_end = clock();
+	    fprintf(stdout, "pass %d took: %g\n", t,
+		    ((double)(pass_end - pass_start)) / CLOCKS_PER_SEC);
 #endif
-				    endflag = FALSE;	/* we've made at least one merge, so want another t iteration */
-				}
-				else {	/* they weren't mutually best neighbors */
-
-				    /* checked Ri once, didn't find a mutually best neighbor, 
-				     * so remove all members of Ri from candidate pixels for this iteration */
-				    set_candidate_flag(Ri_head, FALSE, files);
-
-				    if (FLAG_GET
-					(files->candidate_flag, Rk_head->row,
-					 Rk_head->col) &&
-					FLAG_GET(files->seeds_flag,
-						 Rk_head->row, Rk_head->col))
-					pathflag = TRUE;
-				}
-			    }	/* end if (Ri_bestn != NULL && Ri_similarity < threshold) */
-			    else {
-				/* no valid best neighbor for this Ri
-				 * exclude this Ri from further comparisons 
-				 * because we checked already Ri for a mutually best neighbor with all valid candidates
-				 * thus Ri can not be the mutually best neighbor later on during this pass
-				 * unfortunately this does happen sometimes */
-				set_candidate_flag(Ri_head, FALSE, files);
-			    }
 
-			}	/* end if(Rin_head != NULL) */
-			else {	/* Ri didn't have a neighbor */
-			    G_debug(4, "Segment had no neighbors");
-			    set_candidate_flag(Ri_head, FALSE, files);
-			}
+	    /* finished one iteration over all segments */
+	    t++;
+	}
+	while (t <= functions->end_t && endflag == FALSE);	/*end t loop, either reached max iterations or didn't merge any segments */
 
-			if (pathflag) {	/*initialize Ri, Rin, using Rk as Ri and Rkn as Rin. */
-
-			    /* For the next iteration, lets start with Rk as the focus segment */
-			    if (functions->path == TRUE) {
-				Ri_count = Rk_count;
-				Rk_count = 0;
-				my_dispose_list(files->token, &Ri_head);
-				Ri_head = Rk_head;
-				Rk_head = NULL;
-				if (Rkn_head != NULL) {
-				    my_dispose_list(files->token, &Rin_head);
-				    Rin_head = Rkn_head;
-				    Rkn_head = NULL;
-				}
-				else
-				    my_dispose_list(files->token, &Rin_head);
-			    }
-			    else
-				pathflag = FALSE;
+	G_free(deferred);
+    }				/* end if from the final_merge_only flag */
 
-			}
-		    }		/*end pathflag do loop */
-		}		/*end if pixel is candidate and seed pixel */
-	    }			/*next column */
-	}			/*next row */
-#ifdef PROFILE
-	pass_end = clock();
-	fprintf(stdout, "pass %d took: %g\n", t,
-		((double)(pass_end - pass_start)) / CLOCKS_PER_SEC);
-#endif
-
-	/* finished one iteration over entire raster */
-	t++;
-    }
-    while (t <= functions->end_t && endflag == FALSE);	/*end t loop, either reached max iterations or didn't merge any segments */
-	}	/* end if from the final_merge_only flag */
-	
-    if (t == 2 && files->bounds_map == NULL)
+    if (nmerges == 0 && !functions->final_merge_only &&
+	files->bounds_map == NULL)
 	G_warning(_("No segments were created. Verify threshold and region settings."));
-    /* future enhancement, remove the "&& bounds_map == NULL" if we check for unique bounds values. */
 
     if (endflag == FALSE)
 	G_message(_("Merging processes stopped due to reaching max iteration limit, more merges may be possible"));
 
 
-
-    /* ****************************************************************************************** */
-    /* speed enhancement: after < 3 (?) merges are made in one pass, switch processing modes.
-     * It seems a significant portion of the time is spent merging small pixels into the largest
-     * segments.  So consider allowing multiple merges after finding one large Ri.
-     * 
-     * Maybe related to this, and/or integrated into the first loops:  If a segment has only one neighbor
-     * go ahead and merge it if similarity is < threshold.
-     * 
-     * ****************************************************************************************** */
-
-
-
     /* ****************************************************************************************** */
     /* final pass, ignore threshold and force a merge for small segments with their best neighbor */
     /* ****************************************************************************************** */
 
 
-    if ((functions->min_segment_size > 1 && t > 2) || functions->final_merge_only) {
-			/* NOTE: added t > 2, it doesn't make sense to force merges 
-			 * if no merges were made on the original pass.  
-			 * Something should be adjusted first */
-
-	if (files->bounds_map == NULL) {
-	    G_message
-		(_("Final iteration, forcing merges for small segments, percent complete based on rows."));
+    if ((functions->min_segment_size > 1 && nmerges > 0) || functions->final_merge_only) {
+	/* NOTE: added nmerges > 0, it doesn't make sense to force merges 
+	 * if no merges were made on the original pass.  
+	 * Something should be adjusted first */
+
+	G_message(_("Final iteration, forcing merges for small segments"));
+
+	/* the segments are visited in the order of their ids, a small
+	 * segment is merged with its best neighbor until it is large enough */
+	for (a = 1; a <= rag.nnodes; a++) {
+	    G_percent(a, rag.nnodes, 1);
+	    r = rag_find(&rag, a);
+	    while (rag.count[r] < functions->min_segment_size) {
+		b = rag_closest(&rag, r, FALSE, &Ri_similarity, functions);
+		if (b == 0) {	/* no neighbors were found */
+		    if (files->bounds_map == NULL)
+			G_warning(_("no neighbors found, this means only one segment was created."));
+		    break;
+		}
+		r = rag_merge(&rag, r, b);
+	    }
 	}
-	/* for the final forced merge, the candidate flag is just to keep track if we have confirmed if:
-	 *              a. the segment size is >= to the minimum allowed size  or
-	 *              b. we have merged it with its best neighbor
-	 */
-
-	set_all_candidate_flags(files);
-
-	for (row = files->minrow; row < files->maxrow; row++) {
-	    if (files->bounds_map == NULL)
-		G_percent(row, files->maxrow - 1, 1);
-	    for (col = files->mincol; col < files->maxcol; col++) {
-
-		if (FLAG_GET(files->candidate_flag, row, col)) {
-		    /*free memory for linked lists */
-		    my_dispose_list(files->token, &Ri_head);
-		    my_dispose_list(files->token, &Rk_head);
-		    my_dispose_list(files->token, &Rin_head);
-		    my_dispose_list(files->token, &Rkn_head);
-		    Rk_count = 0;
-
-		    /* First pixel in Ri is current row/col pixel.  We may add more later if it is part of a segment */
-		    Ri_count = 1;
-		    newpixel = (struct pixels *)link_new(files->token);
-		    newpixel->next = Ri_head;
-		    newpixel->row = row;
-		    newpixel->col = col;
-		    Ri_head = newpixel;
-
-		    G_debug(4, "Next starting pixel: row, %d, col, %d",
-			    Ri_head->row, Ri_head->col);
-
-		    /* find segment neighbors */
-		    find_segment_neighbors
-			(&Ri_head, &Rin_head, &Ri_count, files, functions);
-
-		    if (Rin_head != NULL) {	/*found neighbors */
-			if (Ri_count >= functions->min_segment_size)	/* don't force a merge */
-			    set_candidate_flag(Ri_head, FALSE, files);
-
-			else {	/* Merge with most similar neighbor */
-
-			    /* find Ri's most similar neighbor */
-			    Ri_bestn = NULL;
-			    Ri_similarity = DBL_MAX;	/* set current similarity to max value */
-			    Segment_get(&files->bands_seg, (void *)files->bands_val, Ri_head->row, Ri_head->col);	/* current segment values */
-
-			    /* for each of Ri's neighbors */
-			    for (current = Rin_head; current != NULL;
-				 current = current->next) {
-				tempsim = (*functions->calculate_similarity)
-				    (Ri_head, current, files, functions);
-
-				if (tempsim < Ri_similarity) {
-				    Ri_similarity = tempsim;
-				    Ri_bestn = current;
-				}
-			    }
-			    if (Ri_bestn != NULL) {
-
-				/* we'll have the neighbor pixel to start with. */
-				Rk_count = 1;
-				newpixel =
-				    (struct pixels *)link_new(files->token);
-				newpixel->next = NULL;
-				newpixel->row = Ri_bestn->row;
-				newpixel->col = Ri_bestn->col;
-				Rk_head = newpixel;
-
-				/* get the full pixel/cell membership list for Rk */
-				/* speed enhancement: a seperate function for this, since we don't need the neighbors */
-				find_segment_neighbors(&Rk_head, &Rkn_head,
-						       &Rk_count, files,
-						       functions);
-
-				merge_values(Ri_head, Rk_head, Ri_count,
-					     Rk_count, files);
-
-				/* merge_values sets Ri and Rk candidate flag to FALSE.  Put Rk back to TRUE if the size is too small. */
-				if (Ri_count + Rk_count <
-				    functions->min_segment_size)
-				    set_candidate_flag(Rk_head, TRUE, files);
-			    }	/* end if best neighbor != null */
-			    else
-				G_warning
-				    (_("No best neighbor found in final merge for small segment, this shouldn't happen!"));
-
-
-			}	/* end else - pixel count was below minimum allowed */
-		    }		/* end if neighbors found */
-		    else {	/* no neighbors were found */
-			if (files->bounds_map == NULL)
-			    G_warning
-				(_("no neighbors found, this means only one segment was created."));
-
-			set_candidate_flag(Ri_head, FALSE, files);
-		    }
-		}		/* end if pixel is candidate pixel */
-	    }			/* next column */
-	}			/* next row */
 	t++;			/* to count one more "iteration" */
     }				/* end if for force merge */
-    else if (t > 2 && files->bounds_map == NULL)
+    else if (nmerges > 0 && files->bounds_map == NULL)
 	G_verbose_message(_("Number of passes completed: %d"), t - 1);
+
+    rag_write(&rag, files);
+    rag_free(&rag);
+
 #ifdef PROFILE
     end = clock();
-    fprintf(stdout, "time spent merging: %g\n", merge_accum);
-    fprintf(stdout, "time spent finding neighbors: %g\n", fn_accum);
     fprintf(stdout, "total time: %g\n",
 	    ((double)(end - start) / CLOCKS_PER_SEC));
 #endif
@@ -928,29 +525,23 @@ int find_eight_pixel_neighbors(int p_row, int p_col,
     return TRUE;
 }
 
-    /* similarity / distance functions between two points based on their input raster values */
-    /* assumes first point values already saved in files->bands_seg */
-    /* speed enhancement: Segment_get was already done for a[] values in the main function.  
-     * Could remove a[] from these parameters, reducing number of parameters in 
-     * function call could provide a speed improvement. */
+    /* similarity / distance functions between two segments based on their mean values */
+    /* shared is the number of pixel sides the segments share, used for the 
+     * perimeter of the segment the two would form */
 
-double calculate_euclidean_similarity(struct pixels *a, struct pixels *b,
-				      struct files *files,
-				      struct functions *functions)
+double calculate_euclidean_similarity(struct rag *g, int a, int b,
+				      int shared, struct functions *functions)
 {
-    double val = 0;
+    double val = 0, diff;
     double smooth, compact, shape, PL;
+    const double *sa = g->sum + (size_t) a * g->nbands;
+    const double *sb = g->sum + (size_t) b * g->nbands;
     int n;
 
-    /* get values for pixel b */
-    Segment_get(&files->bands_seg, (void *)files->second_val, b->row, b->col);
-
     /* euclidean distance, sum the square differences for each dimension */
-    for (n = 0; n < files->nbands; n++) {
-	val =
-	    val + (files->bands_val[n] -
-		   files->second_val[n]) * (files->bands_val[n] -
-					    files->second_val[n]);
+    for (n = 0; n < g->nbands; n++) {
+	diff = sa[n] / g->count[a] - sb[n] / g->count[b];
+	val = val + diff * diff;
     }
 
     /* use squared distance, save the calculation time. 
@@ -965,31 +556,19 @@ double calculate_euclidean_similarity(struct pixels *a, struct pixels *b,
 	/*I assume the idea is to add to the similarity information about the 
 	 * shape of the new segment if the two candidates were to be merged. */
 
-	PL = files->bands_val[files->nbands + 1] +
-	    files->second_val[files->nbands + 1] - b->count_shared;
+	PL = g->perim[a] + g->perim[b] - 2 * shared;
 
 	/* compact = PL/sqrt(Npx) */
 
-	compact =
-	    PL / sqrt(files->bands_val[files->nbands] +
-		      files->second_val[files->nbands]);
+	compact = PL / sqrt((double)g->count[a] + g->count[b]);
 
 	/* smooth = PL/Pbbox */
 
 	smooth = PL /
-	    (2 *
-	     (max
-	      (files->bands_val[files->nbands + 2],
-	       files->second_val[files->nbands + 2])
-	      - min(files->bands_val[files->nbands + 3],
-		    files->second_val[files->nbands + 3]))
-	     +
-	     2 *
-	     (max
-	      (files->bands_val[files->nbands + 4],
-	       files->second_val[files->nbands + 4])
-	      - min(files->bands_val[files->nbands + 5],
-		    files->second_val[files->nbands + 5])));
+	    (2 * (max(g->maxcol[a], g->maxcol[b]) -
+		  min(g->mincol[a], g->mincol[b]))
+	     + 2 * (max(g->maxrow[a], g->maxrow[b]) -
+		    min(g->minrow[a], g->minrow[b])));
 
 	shape =
 	    functions->smooth_weight * smooth + (1 - functions->smooth_weight)
@@ -1003,19 +582,17 @@ double calculate_euclidean_similarity(struct pixels *a, struct pixels *b,
 
 }
 
-double calculate_manhattan_similarity(struct pixels *a, struct pixels *b,
-				      struct files *files,
-				      struct functions *functions)
+double calculate_manhattan_similarity(struct rag *g, int a, int b,
+				      int shared, struct functions *functions)
 {
     double val = 0;
+    const double *sa = g->sum + (size_t) a * g->nbands;
+    const double *sb = g->sum + (size_t) b * g->nbands;
     int n;
 
-    /* get values for pixel b */
-    Segment_get(&files->bands_seg, (void *)files->second_val, b->row, b->col);
-
     /* Manhattan distance, sum the absolute difference between values for each dimension */
-    for (n = 0; n < files->nbands; n++) {
-	val += fabs(files->bands_val[n] - files->second_val[n]);	/* speed enhancement: is fabs() is the "fast" way for absolute value calculations? */
+    for (n = 0; n < g->nbands; n++) {
+	val += fabs(sa[n] / g->count[a] - sb[n] / g->count[b]);
     }
 
     return val;
@@ -1042,67 +619,6 @@ double calculate_manhattan_similarity(struct pixels *a, struct pixels *b,
      object, and Pbbox the perimeter of the bounding box of the object.
      */
 
-int merge_values(struct pixels *Ri_head, struct pixels *Rk_head,
-		 int Ri_count, int Rk_count, struct files *files)
-{
-    int n, Ri_iseg, Rk_iseg;
-    struct pixels *current;
-
-    /*get input values */
-    /*speed enhancement: Confirm if we can assume we already have 
-     * bands_val for Ri, so don't need to Segment_get() again?  
-     * note...current very_close implementation requires 
-     * getting this value again... */
-    Segment_get(&files->bands_seg, (void *)files->bands_val, Ri_head->row,
-		Ri_head->col);
-    Segment_get(&files->bands_seg, (void *)files->second_val,
-		Rk_head->row, Rk_head->col);
-
-    Segment_get(&files->iseg_seg, &Rk_iseg, Rk_head->row, Rk_head->col);
-    Segment_get(&files->iseg_seg, &Ri_iseg, Ri_head->row, Ri_head->col);
-
-    for (n = 0; n < files->nbands; n++) {
-	files->bands_val[n] =
-	    (files->bands_val[n] * Ri_count +
-	     files->second_val[n] * Rk_count) / (Ri_count + Rk_count);
-    }
-
-    /* update shape parameters */
-
-    files->bands_val[n] += files->second_val[n];	/* area */
-    files->bands_val[n + 1] = files->bands_val[n + 1] + files->second_val[n + 1] - 2 * Rk_head->count_shared;	/* Perimeter Length */
-    files->bands_val[n + 2] = max(files->bands_val[n + 2], files->second_val[n + 2]);	/*max col */
-    files->bands_val[n + 3] = min(files->bands_val[n + 3], files->second_val[n + 3]);	/*min col */
-    files->bands_val[n + 4] = max(files->bands_val[n + 4], files->second_val[n + 4]);	/*max row */
-    files->bands_val[n + 5] = min(files->bands_val[n + 5], files->second_val[n + 5]);	/*min row */
-
-    /* update segment number and candidate flag ==0 */
-#ifdef SIGNPOST
-    fprintf(stdout,
-	    "merging Ri (pixel count): %d (%d) with Rk (count): %d (%d).\n",
-	    Ri_iseg, Ri_count, Rk_iseg, Rk_count);
-#endif
-
-    /* for each member of Ri and Rk, write new average bands values and segment values */
-    for (current = Ri_head; current != NULL; current = current->next) {
-	Segment_put(&files->bands_seg, (void *)files->bands_val,
-		    current->row, current->col);
-	FLAG_UNSET(files->candidate_flag, current->row, current->col);	/*candidate pixel flag, only one merge allowed per t iteration */
-    }
-    for (current = Rk_head; current != NULL; current = current->next) {
-	Segment_put(&files->bands_seg, (void *)files->bands_val,
-		    current->row, current->col);
-	Segment_put(&files->iseg_seg, &Ri_iseg, current->row, current->col);
-	FLAG_UNSET(files->candidate_flag, current->row, current->col);
-    }
-
-    /* merged two segments, decrement count if Rk was an actual segment (not a non-seed pixel) */
-    if (Rk_iseg > 0)
-	files->nsegs--;
-
-    return TRUE;
-}
-
     /* calculates and stores the mean value for all pixels in a list, assuming they are all in the same segment */
 int merge_pixels(struct pixels *R_head, int borderPixels, struct files *files)
 {
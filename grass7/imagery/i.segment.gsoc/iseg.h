@@ -36,12 +36,16 @@ struct pixels
 				 * this is an OK way to do this... */
 };
 
+/* region adjacency graph, see rag.c */
+struct rag;
+
 /* input and output files, as well as some other processing info */
 struct files
 {
     /* user parameters */
     char *image_group;
     int weighted;		/* 0 if false/not selected, so we should scale input.  1 if the scaling should be skipped */
+    int memory;			/* MB available for the region adjacency graph */
 
     /* region info */
     int nrows, ncols;
@@ -85,31 +89,72 @@ struct functions
     float radio_weight, smooth_weight;	/* radiometric (bands) vs. shape and smoothness vs. compactness */
     /* Some function pointers to set in parse_args() */
     int (*find_pixel_neighbors) (int, int, int[8][2], struct files *);	/*parameters: row, col, pixel_neighbors */
-    double (*calculate_similarity) (struct pixels *, struct pixels *, struct files *, struct functions *);	/*parameters: two pixels (each with row,col) to compare */
+    double (*calculate_similarity) (struct rag *, int, int, int, struct functions *);	/*parameters: graph, two segments and the number of pixel sides they share */
 
     /* max number of iterations/passes */
     int end_t;
 
-    int path;			/* flag if we are using Rk as next Ri for non-mutually best neighbor. */
     int limited;		/* flag if we are limiting merges to one per pass */
     int estimate_threshold;	/* flag if we just want to estimate a suggested threshold value and exit. */
     int final_merge_only;	/* flag if we want to just run the final merge portion of the algorithm. */
+};
+
+/* region adjacency graph: the nodes are the segments, numbered from 1,
+ * merged segments are joined with union-find, the root is the smaller
+ * id.  The band sums and the shape parameters of a segment are kept
+ * with its root.  The neighbors of a segment are kept in chunks of a
+ * linkm list, they may refer to segments merged since then until the
+ * list is compacted. */
+#define RAG_CHUNK 8
+
+struct rag_nbrs
+{
+    struct rag_nbrs *next;
+    int n;
+    int id[RAG_CHUNK];		/* neighbor segment */
+    int shared[RAG_CHUNK];	/* number of pixel sides shared with it */
+};
+
+struct rag_edge
+{
+    int id, shared;
+};
 
-    /* todo: is there a fast way (and valid from an algorithm 
-       standpoint) to merge all neighbors that are within some small % 
-       of the treshold? * There is some code using "very_close" that is 
-       excluded with IFDEF * The goal is to speed processing, since in 
-       the end many of these very similar neighbors will be merged. * 
-       But the problem is that the find_segment_neighbors() function 
-       only returns a single pixel, not the entire segment membership. 
-       * The commented out code actually slowed down processing times 
-       in the first tries. */
-#ifdef VCLOSE
-    double very_close;		/* segments with very_close similarity 
-				 * will be merged without changing or checking the candidate flag. 
-				 * The algorithm will continue looking for the "most similar" 
-				 * neighbor that isn't "very close". */
-#endif
+/* priority queue entry, only valid if the version of the segment
+ * did not change since it was queued */
+struct rag_entry
+{
+    double sim;
+    int node;
+    unsigned int version;
+};
+
+struct rag
+{
+    int nnodes, nbands;
+    int nseeds;			/* segments 1..nseeds are seeds, the others are non-seed pixels */
+    int *parent;
+    double *sum;		/* nbands sums per segment */
+    int *count, *perim;
+    int *mincol, *maxcol, *minrow, *maxrow;
+    struct rag_nbrs **nbrs;
+
+    /* most similar neighbor of each segment, 0 if none, -1 if it has
+     * to be found again */
+    int *best;
+    double *bestsim;
+    unsigned int *version;
+    int *pass;			/* last pass in which the segment was merged */
+
+    /* best merges, ordered by similarity */
+    struct rag_entry *heap;
+    size_t nheap, heap_alloc;
+
+    /* compaction of a neighbor list, mark is the position + 1 of a
+     * segment in tmp */
+    struct rag_edge *tmp;
+    int tmp_alloc, *mark;
+    struct link_head *token;
 };
 
 /* main.c */
@@ -131,19 +176,31 @@ int region_growing(struct files *, struct functions *);
 int find_segment_neighbors(struct pixels **, struct pixels **, int *,
 			   struct files *, struct functions *);
 int set_candidate_flag(struct pixels *, int, struct files *);
-int merge_values(struct pixels *, struct pixels *, int, int, struct files *);
 int merge_pixels(struct pixels *, int, struct files *);
 int find_four_pixel_neighbors(int, int, int[][2], struct files *);
 int find_eight_pixel_neighbors(int, int, int[8][2], struct files *);
-double calculate_euclidean_similarity(struct pixels *, struct pixels *,
-				      struct files *, struct functions *);
-double calculate_manhattan_similarity(struct pixels *, struct pixels *,
-				      struct files *, struct functions *);
+double calculate_euclidean_similarity(struct rag *, int, int, int,
+				      struct functions *);
+double calculate_manhattan_similarity(struct rag *, int, int, int,
+				      struct functions *);
 int my_dispose_list(struct link_head *, struct pixels **);
 int compare_ids(const void *, const void *);
 int compare_pixels(const void *, const void *);
 int set_all_candidate_flags(struct files *);
 
+/* rag.c */
+int rag_create(struct rag *, struct files *, struct functions *);
+void rag_free(struct rag *);
+int rag_find(struct rag *, int);
+struct rag_nbrs *rag_neighbors(struct rag *, int);
+int rag_closest(struct rag *, int, int, double *, struct functions *);
+void rag_best(struct rag *, int, struct functions *);
+int rag_merge(struct rag *, int, int);
+void rag_push(struct rag *, double, int);
+int rag_top(struct rag *, struct rag_entry *);
+void rag_pop(struct rag *);
+int rag_write(struct rag *, struct files *);
+
 /* write_output.c */
 int write_output(struct files *);
 int close_files(struct files *);
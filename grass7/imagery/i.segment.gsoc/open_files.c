@@ -15,8 +15,6 @@ int open_files(struct files *files, struct functions *functions)
     int n, s, row, col, srows, scols, inlen, nseg, borderPixels;
     DCELL **inbuf;		/* buffer array, to store lines from each of the imagery group rasters */
     CELL *boundsbuf, *seedsbuf;
-    void *ptr;			/* for iterating seedsbuf */
-    size_t ptrsize;
     struct FPRange *fp_range;	/* for getting min/max values on each input raster */
     DCELL *min, *max;
     struct Range range;		/* for seeds range */
@@ -88,7 +86,6 @@ int open_files(struct files *files, struct functions *functions)
     if (files->seeds_map != NULL) {
 	seeds_fd = Rast_open_old(files->seeds_map, "");
 	seedsbuf = Rast_allocate_c_buf();
-	ptrsize = sizeof(CELL);
 
 	if (Rast_read_range(files->seeds_map, files->seeds_mapset, &range) != 1) {	/* returns -1 on error, 2 on empty range, quiting either way. */
 	    G_fatal_error(_("No min/max found in seeds raster map <%s>"),
@@ -201,10 +198,8 @@ int open_files(struct files *files, struct functions *functions)
 	for (n = 0; n < Ref.nfiles; n++) {
 	    Rast_get_d_row(in_fd[n], inbuf[n], row);
 	}
-	if (files->seeds_map != NULL) {
+	if (files->seeds_map != NULL)
 	    Rast_get_c_row(seeds_fd, seedsbuf, row);
-	    ptr = seedsbuf;
-	}
 
 	for (col = 0; col < files->ncols; col++) {
 	    if (FLAG_GET(files->null_flag, row, col))
@@ -232,16 +227,17 @@ int open_files(struct files *files, struct functions *functions)
 	    if (null_check != -1) {	/*good pixel */
 		FLAG_UNSET(files->null_flag, row, col);	/*flag */
 		if (files->seeds_map != NULL) {
-		    if (Rast_is_c_null_value(ptr) == TRUE) {
+		    if (Rast_is_c_null_value(&seedsbuf[col]) == TRUE ||
+			seedsbuf[col] == 0) {
 			/* when using iseg_seg the segmentation file is already initialized to zero.  Just initialize seeds_flag: */
 			FLAG_UNSET(files->seeds_flag, row, col);
 		    }
 		    else {
 			FLAG_SET(files->seeds_flag, row, col);	/* RAM enhancement, but it might cost speed.  Could look for seg ID > 0 instead of using seed_flag. */
 			/* seed value is starting segment ID. */
-			Segment_put(&files->iseg_seg, ptr, row, col);
+			Segment_put(&files->iseg_seg, &seedsbuf[col], row,
+				    col);
 		    }
-		    ptr = G_incr_void_ptr(ptr, ptrsize);
 		}
 		else {		/* no seeds provided */
 		    s++;	/* sequentially number all pixels with their own segment ID */
@@ -296,8 +292,11 @@ int open_files(struct files *files, struct functions *functions)
 						 * - not entirely accurate for the actual %,
 						 *  but will give the user something to see. */
 	    for (col = 0; col < files->ncols; col++) {
+		/* non-seed pixels keep id 0, they are numbered after
+		 * the seeds when the region adjacency graph is built */
 		if (!(FLAG_GET(files->candidate_flag, row, col)) ||
-		    FLAG_GET(files->null_flag, row, col))
+		    FLAG_GET(files->null_flag, row, col) ||
+		    !(FLAG_GET(files->seeds_flag, row, col)))
 		    continue;
 		/*start R_head */
 		newpixel = (struct pixels *)link_new(files->token);
@@ -14,10 +14,7 @@ int parse_args(int argc, char *argv[], struct files *files,
     struct Option *radio_weight, *smooth_weight;
     struct Flag *estimate_threshold, *diagonal, *weighted, *limited, *final;	/* Establish a Flag pointer for each option */
     struct Option *outband;	/* optional saving of segment data, until a seperate module is written */
-
-#ifdef VCLOSE
-    struct Option *very_close;
-#endif
+    struct Option *mem;
 
     /* required parameters */
     /* enhancement: consider giving the option to process just one
@@ -58,18 +55,6 @@ int parse_args(int argc, char *argv[], struct files *files,
     min_segment_size->description =
 	_("The final iteration will ignore the threshold for any segments with fewer pixels.");
 
-#ifdef VCLOSE
-    very_close = G_define_option();
-    very_close->key = "very_close";
-    very_close->type = TYPE_DOUBLE;
-    very_close->required = YES;
-    very_close->answer = "0";
-    very_close->options = "0-1";
-    very_close->label = _("Fraction of the threshold.");
-    very_close->description =
-	_("Neighbors similarity lower then this fraction of the threshold will be merged without regard to any other processing rules.");
-#endif
-
     /* for the weights of bands values vs. shape parameters, and weight of smoothness vs. compactness */
 
     radio_weight = G_define_option();
@@ -138,18 +123,14 @@ int parse_args(int argc, char *argv[], struct files *files,
     endt->description =
 	_("Maximum number of passes (time steps) to complete.");
 
-    /* Leaving path flag out of user options, will hardcode TRUE for 
-       this option.  This does change the resulting segments, but I 
-       don't see any reason why one version is more valid.  It 
-       reduced the processing time by 50% when segmenting the ortho 
-       image. Code in the segmenation algorithm remains, in case more 
-       validation of this option should be done. */
-    /*
-       path = G_define_flag();
-       path->key = 'p';
-       path->description =
-       _("temporary option, pathflag, select to use Rk as next Ri if not mutually best neighbors.");
-     */
+    mem = G_define_option();
+    mem->key = "memory";
+    mem->type = TYPE_INTEGER;
+    mem->required = NO;
+    mem->answer = "300";
+    mem->description =
+	_("Maximum memory to be used for the region adjacency graph (in MB)");
+
     limited = G_define_flag();
     limited->key = 'l';
     limited->description =
@@ -203,10 +184,6 @@ int parse_args(int argc, char *argv[], struct files *files,
     else
 	G_fatal_error(_("Couldn't assign similarity method."));	/*shouldn't be able to get here */
 
-#ifdef VCLOSE
-    functions->very_close = atof(very_close->answer);
-#endif
-
     functions->min_segment_size = atoi(min_segment_size->answer);
 
     functions->radio_weight = atof(radio_weight->answer);
@@ -272,11 +249,9 @@ int parse_args(int argc, char *argv[], struct files *files,
 
     /* other parameters */
 
-    /* default/0 for no pathflag, but selected/1 to use 
-     * Rk as next Ri if not mutually best neighbors. */
-    /* functions->path = path->answer; */
-    functions->path = TRUE;
-    /* see notes above about pathflag. */
+    files->memory = atoi(mem->answer);
+    if (files->memory < 1)
+	G_fatal_error(_("Invalid memory size <%s>"), mem->answer);
 
     functions->limited = limited->answer;
 
@@ -0,0 +1,507 @@
+/* PURPOSE:      Region adjacency graph of the segments */
+
+/* The segments are the nodes of the graph, two segments are neighbors
+ * if any of their pixels are neighbors.  Merging two segments joins
+ * their neighbor lists, so the cost of a merge depends on the number
+ * of neighbors and not on the number of pixels of the segments. */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <float.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#include <grass/raster.h>
+#include <grass/segment.h>
+#include <grass/linkm.h>
+#include "iseg.h"
+
+static void add_neighbor(struct rag *g, int a, int b, int shared)
+{
+    struct rag_nbrs *nb = g->nbrs[a];
+
+    /* the pixels of a seed segment often have the same neighbor */
+    if (nb && nb->n && nb->id[nb->n - 1] == b) {
+	nb->shared[nb->n - 1] += shared;
+	return;
+    }
+    if (!nb || nb->n == RAG_CHUNK) {
+	nb = (struct rag_nbrs *)link_new(g->token);
+	nb->next = g->nbrs[a];
+	nb->n = 0;
+	g->nbrs[a] = nb;
+    }
+    nb->id[nb->n] = b;
+    nb->shared[nb->n] = shared;
+    nb->n++;
+}
+
+/* builds the graph from the segment ids in iseg_seg, each non-seed
+ * pixel (id 0) becomes a segment of its own.  Pixels in different
+ * boundary constraints are not neighbors.  The graph is kept in memory,
+ * the module stops if it needs more than the memory option. */
+int rag_create(struct rag *g, struct files *files,
+	       struct functions *functions)
+{
+    int row, col, n, i, a, b, r, c, bound, nbound, orth;
+    int s;
+    double *sum, mb;
+    size_t node_size;
+
+    /* forward neighbors: right, below, and the diagonals below */
+    static const int nbr[4][3] = { {0, 1, 1}, {1, 0, 1}, {1, 1, 0},
+    {1, -1, 0}
+    };
+    int nnbr = functions->num_pn == 8 ? 4 : 2;
+
+    g->nbands = files->nbands;
+    g->nseeds = files->nsegs;
+
+    /* number the non-seed pixels */
+    s = files->nsegs;
+    if (files->seeds_map != NULL) {
+	for (row = 0; row < files->nrows; row++) {
+	    for (col = 0; col < files->ncols; col++) {
+		if (FLAG_GET(files->null_flag, row, col))
+		    continue;
+		Segment_get(&files->iseg_seg, &a, row, col);
+		if (a > 0)
+		    continue;
+		if (s == INT_MAX)
+		    G_fatal_error(_("Exceeded integer storage limit, too many initial pixels."));
+		s++;
+		Segment_put(&files->iseg_seg, &s, row, col);
+	    }
+	}
+    }
+    g->nnodes = s;
+
+    /* the arrays below, the queue and about one chunk of neighbors
+     * for each segment */
+    node_size = 10 * sizeof(int) + sizeof(unsigned int) +
+	(g->nbands + 1) * sizeof(double) + sizeof(struct rag_nbrs *) +
+	sizeof(struct rag_entry) + sizeof(struct rag_nbrs);
+    mb = (double)(s + 1) * node_size / (1024 * 1024);
+    G_verbose_message(_("The region adjacency graph of %d segments needs about %.0f MB"),
+		      s, mb);
+    if (mb > files->memory)
+	G_fatal_error(_("The region adjacency graph of %d segments needs about %.0f MB, "
+		       "more than memory=%d. Increase memory or use a smaller region."),
+		      s, mb, files->memory);
+
+    g->parent = G_malloc((s + 1) * sizeof(int));
+    g->sum = G_calloc((size_t) (s + 1) * g->nbands, sizeof(double));
+    g->count = G_calloc(s + 1, sizeof(int));
+    g->perim = G_calloc(s + 1, sizeof(int));
+    g->mincol = G_malloc((s + 1) * sizeof(int));
+    g->maxcol = G_malloc((s + 1) * sizeof(int));
+    g->minrow = G_malloc((s + 1) * sizeof(int));
+    g->maxrow = G_malloc((s + 1) * sizeof(int));
+    g->nbrs = G_calloc(s + 1, sizeof(struct rag_nbrs *));
+    g->best = G_calloc(s + 1, sizeof(int));
+    g->bestsim = G_malloc((s + 1) * sizeof(double));
+    g->version = G_calloc(s + 1, sizeof(unsigned int));
+    g->pass = G_calloc(s + 1, sizeof(int));
+    g->mark = G_calloc(s + 1, sizeof(int));
+    for (a = 0; a <= s; a++) {
+	g->parent[a] = a;
+	g->mincol[a] = g->minrow[a] = INT_MAX;
+	g->maxcol[a] = g->maxrow[a] = -1;
+	g->bestsim[a] = DBL_MAX;
+    }
+
+    g->heap_alloc = s + 1;
+    g->heap = G_malloc(g->heap_alloc * sizeof(struct rag_entry));
+    g->nheap = 0;
+    g->tmp_alloc = 64;
+    g->tmp = G_malloc(g->tmp_alloc * sizeof(struct rag_edge));
+
+    link_set_chunk_size(1000);
+    g->token = link_init(sizeof(struct rag_nbrs));
+
+    G_message(_("Building the region adjacency graph"));
+    bound = nbound = 0;
+    for (row = 0; row < files->nrows; row++) {
+	G_percent(row, files->nrows, 1);
+	for (col = 0; col < files->ncols; col++) {
+	    if (FLAG_GET(files->null_flag, row, col))
+		continue;
+
+	    Segment_get(&files->iseg_seg, &a, row, col);
+	    Segment_get(&files->bands_seg, (void *)files->bands_val, row,
+			col);
+	    if (files->bounds_map != NULL)
+		Segment_get(&files->bounds_seg, &bound, row, col);
+
+	    sum = g->sum + (size_t) a * g->nbands;
+	    for (n = 0; n < g->nbands; n++)
+		sum[n] += files->bands_val[n];
+	    g->count[a]++;
+	    g->perim[a] += 4;
+	    if (g->mincol[a] > col)
+		g->mincol[a] = col;
+	    if (g->maxcol[a] < col)
+		g->maxcol[a] = col;
+	    if (g->minrow[a] > row)
+		g->minrow[a] = row;
+	    if (g->maxrow[a] < row)
+		g->maxrow[a] = row;
+
+	    for (i = 0; i < nnbr; i++) {
+		r = row + nbr[i][0];
+		c = col + nbr[i][1];
+		orth = nbr[i][2];
+		if (r >= files->nrows || c < 0 || c >= files->ncols ||
+		    FLAG_GET(files->null_flag, r, c))
+		    continue;
+		if (files->bounds_map != NULL) {
+		    Segment_get(&files->bounds_seg, &nbound, r, c);
+		    if (nbound != bound)
+			continue;
+		}
+		Segment_get(&files->iseg_seg, &b, r, c);
+		if (b == a) {
+		    /* the shared side is not part of the perimeter */
+		    if (orth)
+			g->perim[a] -= 2;
+		}
+		else {
+		    add_neighbor(g, a, b, orth);
+		    add_neighbor(g, b, a, orth);
+		}
+	    }
+	}
+    }
+    G_percent(1, 1, 1);
+
+    return TRUE;
+}
+
+void rag_free(struct rag *g)
+{
+    link_cleanup(g->token);
+    G_free(g->parent);
+    G_free(g->sum);
+    G_free(g->count);
+    G_free(g->perim);
+    G_free(g->mincol);
+    G_free(g->maxcol);
+    G_free(g->minrow);
+    G_free(g->maxrow);
+    G_free(g->nbrs);
+    G_free(g->best);
+    G_free(g->bestsim);
+    G_free(g->version);
+    G_free(g->pass);
+    G_free(g->mark);
+    G_free(g->heap);
+    G_free(g->tmp);
+}
+
+/* root of a segment, with path halving */
+int rag_find(struct rag *g, int a)
+{
+    while (g->parent[a] != a) {
+	g->parent[a] = g->parent[g->parent[a]];
+	a = g->parent[a];
+    }
+
+    return a;
+}
+
+/* compacts the neighbor list of the root segment a: the neighbors are
+ * replaced by their roots and listed once */
+struct rag_nbrs *rag_neighbors(struct rag *g, int a)
+{
+    struct rag_nbrs *nb, *next;
+    int i, k, n, r;
+
+    n = 0;
+    for (nb = g->nbrs[a]; nb != NULL; nb = nb->next) {
+	for (i = 0; i < nb->n; i++) {
+	    r = rag_find(g, nb->id[i]);
+	    if (r == a)
+		continue;
+	    if (g->mark[r]) {
+		g->tmp[g->mark[r] - 1].shared += nb->shared[i];
+		continue;
+	    }
+	    if (n == g->tmp_alloc) {
+		g->tmp_alloc *= 2;
+		g->tmp =
+		    G_realloc(g->tmp, g->tmp_alloc * sizeof(struct rag_edge));
+	    }
+	    g->tmp[n].id = r;
+	    g->tmp[n].shared = nb->shared[i];
+	    n++;
+	    g->mark[r] = n;
+	}
+    }
+    for (i = 0; i < n; i++)
+	g->mark[g->tmp[i].id] = 0;
+    k = n;
+
+    /* write back, reusing the chunks */
+    nb = g->nbrs[a];
+    i = 0;
+    while (i < k) {
+	nb->n = 0;
+	while (nb->n < RAG_CHUNK && i < k) {
+	    nb->id[nb->n] = g->tmp[i].id;
+	    nb->shared[nb->n] = g->tmp[i].shared;
+	    nb->n++;
+	    i++;
+	}
+	if (i < k)
+	    nb = nb->next;
+    }
+    if (k == 0) {
+	next = g->nbrs[a];
+	g->nbrs[a] = NULL;
+    }
+    else {
+	next = nb->next;
+	nb->next = NULL;
+    }
+    while (next != NULL) {
+	nb = next->next;
+	link_dispose(g->token, (VOID_T *) next);
+	next = nb;
+    }
+
+    return g->nbrs[a];
+}
+
+/* most similar neighbor of the root segment a, 0 if there is none.
+ * If eligible is set, non-seed pixels are not neighbors of each other. */
+int rag_closest(struct rag *g, int a, int eligible, double *sim,
+		struct functions *functions)
+{
+    struct rag_nbrs *nb;
+    int i, c, best;
+    double tempsim;
+
+    best = 0;
+    *sim = DBL_MAX;
+    for (nb = rag_neighbors(g, a); nb != NULL; nb = nb->next) {
+	for (i = 0; i < nb->n; i++) {
+	    c = nb->id[i];
+	    if (eligible && a > g->nseeds && c > g->nseeds)
+		continue;
+	    tempsim = (*functions->calculate_similarity)
+		(g, a, c, nb->shared[i], functions);
+	    /* the smaller id wins a tie */
+	    if (tempsim < *sim || (tempsim == *sim && c < best)) {
+		*sim = tempsim;
+		best = c;
+	    }
+	}
+    }
+
+    return best;
+}
+
+/* updates the most similar neighbor of the root segment a and queues it */
+void rag_best(struct rag *g, int a, struct functions *functions)
+{
+    g->best[a] = rag_closest(g, a, TRUE, &g->bestsim[a], functions);
+    g->version[a]++;
+    if (g->best[a])
+	rag_push(g, g->bestsim[a], a);
+}
+
+/* merges the root segments a and b, returns the new root */
+int rag_merge(struct rag *g, int a, int b)
+{
+    struct rag_nbrs *nb, *small;
+    double *sa, *sb;
+    int i, n, r, o, other, shared;
+
+    /* the seeds have the smaller ids, so a non-seed pixel merged with
+     * a seed segment becomes part of the seed segment */
+    r = a < b ? a : b;
+    o = a < b ? b : a;
+
+#ifdef SIGNPOST
+    fprintf(stdout,
+	    "merging Ri (pixel count): %d (%d) with Rk (count): %d (%d).\n",
+	    r, g->count[r], o, g->count[o]);
+#endif
+
+    /* pixel sides shared by a and b, from the smaller segment */
+    if (g->count[r] < g->count[o]) {
+	small = g->nbrs[r];
+	other = o;
+    }
+    else {
+	small = g->nbrs[o];
+	other = r;
+    }
+    shared = 0;
+    for (nb = small; nb != NULL; nb = nb->next)
+	for (i = 0; i < nb->n; i++)
+	    if (rag_find(g, nb->id[i]) == other)
+		shared += nb->shared[i];
+
+    g->parent[o] = r;
+    g->version[o]++;
+
+    sa = g->sum + (size_t) r * g->nbands;
+    sb = g->sum + (size_t) o * g->nbands;
+    for (n = 0; n < g->nbands; n++)
+	sa[n] += sb[n];
+    g->count[r] += g->count[o];
+    if (g->mincol[r] > g->mincol[o])
+	g->mincol[r] = g->mincol[o];
+    if (g->maxcol[r] < g->maxcol[o])
+	g->maxcol[r] = g->maxcol[o];
+    if (g->minrow[r] > g->minrow[o])
+	g->minrow[r] = g->minrow[o];
+    if (g->maxrow[r] < g->maxrow[o])
+	g->maxrow[r] = g->maxrow[o];
+
+    g->perim[r] += g->perim[o] - 2 * shared;
+
+    /* join the neighbor lists, walking the shorter one, they are
+     * compacted when the best neighbor of r is searched */
+    if (small == NULL)
+	g->nbrs[r] = other == o ? g->nbrs[o] : g->nbrs[r];
+    else {
+	for (nb = small; nb->next != NULL; nb = nb->next) ;
+	nb->next = other == o ? g->nbrs[o] : g->nbrs[r];
+	g->nbrs[r] = small;
+    }
+    g->nbrs[o] = NULL;
+
+    return r;
+}
+
+static int entry_less(const struct rag_entry *x, const struct rag_entry *y)
+{
+    return x->sim < y->sim || (x->sim == y->sim && x->node < y->node);
+}
+
+static int entry_valid(struct rag *g, const struct rag_entry *e)
+{
+    return g->parent[e->node] == e->node &&
+	g->version[e->node] == e->version;
+}
+
+static void sift_down(struct rag *g, size_t i)
+{
+    struct rag_entry e = g->heap[i];
+    size_t c;
+
+    while ((c = 2 * i + 1) < g->nheap) {
+	if (c + 1 < g->nheap && entry_less(&g->heap[c + 1], &g->heap[c]))
+	    c++;
+	if (!entry_less(&g->heap[c], &e))
+	    break;
+	g->heap[i] = g->heap[c];
+	i = c;
+    }
+    g->heap[i] = e;
+}
+
+/* queues segment a with the similarity to its best neighbor,
+ * the outdated entries are dropped when the queue is full */
+void rag_push(struct rag *g, double sim, int a)
+{
+    size_t i, k;
+
+    if (g->nheap == g->heap_alloc) {
+	k = 0;
+	for (i = 0; i < g->nheap; i++)
+	    if (entry_valid(g, &g->heap[i]))
+		g->heap[k++] = g->heap[i];
+	g->nheap = k;
+	for (i = g->nheap / 2; i-- > 0;)
+	    sift_down(g, i);
+	if (g->nheap > g->heap_alloc / 2) {
+	    g->heap_alloc *= 2;
+	    g->heap =
+		G_realloc(g->heap, g->heap_alloc * sizeof(struct rag_entry));
+	}
+    }
+
+    i = g->nheap++;
+    while (i > 0) {
+	k = (i - 1) / 2;
+	if (g->heap[k].sim < sim || (g->heap[k].sim == sim &&
+				     g->heap[k].node < a))
+	    break;
+	g->heap[i] = g->heap[k];
+	i = k;
+    }
+    g->heap[i].sim = sim;
+    g->heap[i].node = a;
+    g->heap[i].version = g->version[a];
+}
+
+/* first valid entry of the queue, returns 0 if the queue is empty */
+int rag_top(struct rag *g, struct rag_entry *e)
+{
+    while (g->nheap > 0) {
+	if (entry_valid(g, &g->heap[0])) {
+	    *e = g->heap[0];
+	    return 1;
+	}
+	rag_pop(g);
+    }
+
+    return 0;
+}
+
+void rag_pop(struct rag *g)
+{
+    if (--g->nheap > 0) {
+	g->heap[0] = g->heap[g->nheap];
+	sift_down(g, 0);
+    }
+}
+
+/* writes the segment ids and mean values back to iseg_seg and bands_seg,
+ * non-seed pixels which were not merged get id 0.  Segments of non-seed
+ * pixels merged in the final pass are numbered after the seeds. */
+int rag_write(struct rag *g, struct files *files)
+{
+    int row, col, n, a, r, id;
+    double *sum;
+
+    files->nsegs = 0;
+    id = g->nseeds;
+    for (a = 1; a <= g->nnodes; a++) {
+	if (g->parent[a] != a)
+	    continue;
+	if (a <= g->nseeds)
+	    files->nsegs++;
+	else if (g->count[a] > 1) {
+	    files->nsegs++;
+	    g->mark[a] = ++id;
+	}
+    }
+
+    for (row = 0; row < files->nrows; row++) {
+	for (col = 0; col < files->ncols; col++) {
+	    if (FLAG_GET(files->null_flag, row, col))
+		continue;
+	    Segment_get(&files->iseg_seg, &a, row, col);
+	    r = rag_find(g, a);
+	    id = r <= g->nseeds ? r : g->mark[r];
+	    Segment_put(&files->iseg_seg, &id, row, col);
+
+	    sum = g->sum + (size_t) r * g->nbands;
+	    for (n = 0; n < g->nbands; n++)
+		files->bands_val[n] = sum[n] / g->count[r];
+	    files->bands_val[n] = g->count[r];	/* area */
+	    files->bands_val[n + 1] = g->perim[r];	/* Perimeter Length */
+	    files->bands_val[n + 2] = g->maxcol[r];	/*max col */
+	    files->bands_val[n + 3] = g->mincol[r];	/*min col */
+	    files->bands_val[n + 4] = g->maxrow[r];	/*max row */
+	    files->bands_val[n + 5] = g->minrow[r];	/*min row */
+	    Segment_put(&files->bands_seg, (void *)files->bands_val, row,
+			col);
+	}
+    }
+
+    return TRUE;
+}
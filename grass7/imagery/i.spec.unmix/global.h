@@ -11,18 +11,46 @@
 #endif
 
 
+#define GAMMA 10		/* last row value in Matrix and last b vector element
+				 * for constraint Sum xi = 1 (GAMMA=weight) 
+				 */
+
+/* number of pixels unmixed at once */
+#define UNMIX_BLOCK 64
+
+/* the spectral matrix with the constraint row, set up once */
+struct unmix
+{
+    int nbands;			/* rows of A_tilde: bands + 1 */
+    int nspec;			/* cols of A_tilde: spectra */
+    int iterative;		/* projected gradient instead of active set */
+    double mu;			/* step size of the iteration */
+    double *a;			/* A_tilde, row-major */
+    double *at;			/* A_tilde transposed */
+    double *gram;		/* A_tilde^T A_tilde */
+    double *chol;		/* its Cholesky factor if full is set */
+    int full;
+    double tol;
+};
+
+/* workspace of one thread */
+struct unmix_work
+{
+    double *b;			/* nbands rows of UNMIX_BLOCK pixels */
+    double *c;			/* A_tilde^T b, nspec rows */
+    double *x;			/* fractions, nspec rows */
+    double *e, *w, *z, *l, *xp, *cp;
+    int *idx, *passive, *col;
+};
+
 GLOBAL struct Ref Ref;
 
-GLOBAL CELL **cell;
 GLOBAL int *cellfd;
 
-GLOBAL CELL **result_cell;
 GLOBAL int *resultfd;
 
-GLOBAL CELL *error_cell;
 GLOBAL int error_fd;
 
-GLOBAL CELL *iter_cell;
 GLOBAL int iter_fd;
 
 
@@ -32,5 +60,11 @@ GLOBAL void make_history(char *, char *, char *);
 GLOBAL mat_struct *open_files(char *matrixfile, char *img_grp,
                               char *result_prefix, char *iter_name,
 			      char *error_name);
+GLOBAL void unmix_init(struct unmix *, mat_struct *, double, int);
+GLOBAL void unmix_free(struct unmix *);
+GLOBAL void unmix_work_init(struct unmix_work *, const struct unmix *);
+GLOBAL void unmix_work_free(struct unmix_work *);
+GLOBAL void unmix_row(const struct unmix *, struct unmix_work *, int,
+		      CELL **, CELL **, CELL *, CELL *);
 
 #endif /* __GLOBAL_H__ */
@@ -46,10 +46,9 @@
 #include <grass/glocale.h>
 #include "global.h"
 
-
-#define GAMMA 10		/* last row value in Matrix and last b vector element
-				 * for constraint Sum xi = 1 (GAMMA=weight) 
-				 */
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 static double find_max(double x, double y)
 {
@@ -61,14 +60,14 @@ int main(int argc, char *argv[])
 {
     char result_name[GNAME_MAX];
     int nrows, ncols;
-    int row;
-    int i, j, k;
-    vec_struct *b_gamma;
+    int row0, nchunk;
+    int i, j, t, nthreads;
     struct Cell_head region;
 
-    vec_struct *startvector, *A_times_startvector, *errorvector, *temp;
-    mat_struct *A, *A_tilde, *A_tilde_trans_mu, *A_tilde_trans;
-    mat_struct B, B_tilde, B_tilde_trans_mu;
+    mat_struct *A;
+    struct unmix unmix;
+    struct unmix_work *work;
+    CELL ***inrow, ***outrow, **errrow, **iterrow;
     struct Colors colors;
     struct History hist;
 
@@ -80,8 +79,9 @@ int main(int argc, char *argv[])
     double error = 0.0;
     struct
     {
-        struct Option *group, *matrixfile, *result, *error, *iter;
+        struct Option *group, *matrixfile, *result, *error, *iter, *threads;
     } parm;
+    struct Flag *gradient;
 
     /* initialize GIS engine */
     G_gisinit(argv[0]);
@@ -118,9 +118,33 @@ int main(int argc, char *argv[])
     parm.iter->required = NO;
     parm.iter->description = _("Raster map to hold number of iterations");
 
+    parm.threads = G_define_option();
+    parm.threads->key = "threads";
+    parm.threads->type = TYPE_INTEGER;
+    parm.threads->required = NO;
+    parm.threads->description = _("Number of threads for parallel computing");
+    parm.threads->answer = "1";
+
+    gradient = G_define_flag();
+    gradient->key = 'g';
+    gradient->description =
+        _("Use the projected gradient iteration instead of the active set method");
+
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
 
+    nthreads = atoi(parm.threads->answer);
+    if (nthreads < 1)
+        G_fatal_error(_("<%s> must be greater than 0"), parm.threads->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+        G_warning(_("%s was compiled without OpenMP support, using one thread"),
+                  G_program_name());
+    nthreads = 1;
+#endif
+
 
     /* here we go... A is created here */
     A = open_files(parm.matrixfile->answer,
@@ -218,22 +242,6 @@ int main(int argc, char *argv[])
      *   A_tilde is one row-dimension more than A 
      */
 
-    /* memory allocation */
-    A_tilde = G_matrix_init(A->rows + 1, A->cols, A->rows + 1);
-    if (A_tilde == NULL)
-        G_fatal_error(_("Unable to allocate memory for matrix"));
-
-    for (i = 0; i < A->rows; i++)
-        for (j = 0; j < A->cols; j++)
-            G_matrix_set_element(A_tilde, i, j,
-                                 G_matrix_get_element(A, i, j));
-
-    /* fill last row with 1 elements */
-    for (j = 0; j < A_tilde->cols; j++) {
-        G_matrix_set_element(A_tilde, i, j, GAMMA);
-    }
-
-
     /* now we have an overdetermined (non-square) system 
 
      * We have a least square problem here: error minimization
@@ -243,15 +251,12 @@ int main(int argc, char *argv[])
      * A_tilde is the non-square matrix with first constraint in last row.
      * b is pixel vector from satellite image
      * 
-     * Solve this by deriving above equation and searching the
-     * minimum of this error function in an iterative loop within
-     * both constraints.
+     * Solve this within the second constraint x_i >= 0 with the active
+     * set method (non-negative least squares), or by deriving above
+     * equation and searching the minimum of this error function in an
+     * iterative loop.
      */
 
-
-    /* calculate the transpose of A_tilde */
-    A_tilde_trans = G_matrix_transpose(A_tilde);
-
     /* initialize some values
      * step size must be small enough for covergence  of iteration:
      *  mu = 0.000001;      step size for spectra in range of W/m^2/um
@@ -262,37 +267,8 @@ int main(int argc, char *argv[])
     /* check  max_total for number of digits to configure mu size */
     mu = 0.0001 * pow(10, -1 * ceil(log10(max_total)));
 
-    /* TODO: Missing? startvector = G_vector_init (0, 0, RVEC); */
-    startvector = G_vector_init(A->cols, 1, RVEC);
-
-
-    if (startvector == NULL)
-        G_fatal_error(_("Unable to allocate memory for vector"));
-
-    /* TODO: Missing? A_times_startvector = G_vector_init (0, 0, RVEC); */
-    A_times_startvector = G_vector_init(A_tilde->rows, 1, RVEC);        /* length: no. of bands   */
-    /* TODO: Missing? errorvector = G_vector_init (0, 0, RVEC); */
-    errorvector = G_vector_init(A_tilde->rows, 1, RVEC);        /* length: no. of bands   */
-    /* TODO: Missing? temp = G_vector_init (0, 0, RVEC); */
-    temp = G_vector_init(A_tilde->cols, 1, RVEC);       /* length: no. of spectra */
-
-
-    /* length: no. of bands   */
-    if (A_times_startvector == NULL)
-        G_fatal_error(_("Unable to allocate memory for vector"));
-
-    /* length: no. of bands   */
-    if (errorvector == NULL)
-        G_fatal_error(_("Unable to allocate memory for vector"));
-
-    /* length: no. of spectra */
-    if (temp == NULL)
-        G_fatal_error(_("Unable to allocate memory for vector"));
-
-    A_tilde_trans_mu =
-        G_matrix_init(A_tilde->rows, A_tilde->cols, A_tilde->rows);
-    if (A_tilde_trans_mu == NULL)
-        G_fatal_error(_("Unable to allocate memory for matrix"));
+    /* A_tilde and its normal matrix are set up once for all pixels */
+    unmix_init(&unmix, A, mu, gradient->answer);
 
     /* Now we can calculated the fractions pixelwise */
     G_get_window(&region);      /* get geographical region */
@@ -303,115 +279,53 @@ int main(int argc, char *argv[])
     G_message(_("Calculating for %i x %i pixels (%i bands) = %i pixelvectors."),
               nrows, ncols, Ref.nfiles, (ncols * ncols));
 
-    for (row = 0; row < nrows; row++) {
-        int col, band;
+    /* one row of all bands and spectra per thread */
+    inrow = G_malloc(nthreads * sizeof(CELL **));
+    outrow = G_malloc(nthreads * sizeof(CELL **));
+    errrow = G_malloc(nthreads * sizeof(CELL *));
+    iterrow = G_malloc(nthreads * sizeof(CELL *));
+    work = G_malloc(nthreads * sizeof(struct unmix_work));
+    for (t = 0; t < nthreads; t++) {
+        inrow[t] = G_malloc(Ref.nfiles * sizeof(CELL *));
+        for (i = 0; i < Ref.nfiles; i++)
+            inrow[t][i] = Rast_allocate_c_buf();
+        outrow[t] = G_malloc(A->cols * sizeof(CELL *));
+        for (i = 0; i < A->cols; i++)
+            outrow[t][i] = Rast_allocate_c_buf();
+        errrow[t] = error_fd >= 0 ? Rast_allocate_c_buf() : NULL;
+        iterrow[t] = iter_fd >= 0 ? Rast_allocate_c_buf() : NULL;
+        unmix_work_init(&work[t], &unmix);
+    }
 
-        G_percent(row, nrows, 1);
+    /* a chunk of rows is read, unmixed in parallel, one row per
+     * thread, and written */
+    for (row0 = 0; row0 < nrows; row0 += nthreads) {
+        G_percent(row0, nrows, 1);
+        nchunk = nrows - row0 < nthreads ? nrows - row0 : nthreads;
 
         /* get one row for all bands */
-        for (band = 0; band < Ref.nfiles; band++)
-            Rast_get_c_row(cellfd[band], cell[band], row);
-
-        for (col = 0; col < ncols; col++) {
-
-            double change = 1000;
-            double deviation = 1000;
-            int iterations = 0;
-
-            /* get pixel values of each band and store in b vector: */
-            /* length: no. of bands + 1 (GAMMA) */
-
-            b_gamma = G_vector_init(A_tilde->rows, 1, RVEC);
-
-            if (b_gamma == NULL)
-                G_fatal_error(_("Unable to allocate memory for matrix"));
-
-            for (band = 0; band < Ref.nfiles; band++)
-                G_matrix_set_element(b_gamma, 0, band, cell[band][col]);
-
-            /* add GAMMA for 1. constraint as last element */
-            G_matrix_set_element(b_gamma, 0, Ref.nfiles, GAMMA);
-
-            for (k = 0; k < A_tilde->cols; k++)
-                G_matrix_set_element(startvector, 0, k,
-                                     (1.0 / A_tilde->cols));
-
-            /* calculate fraction vector for current pixel
-               Result is stored in fractions vector       
-               with second constraint: Sum x_i = 1
-             */
-
-            /* get start vector and initialize it with equal fractions:
-               using the neighbor pixelvector as startvector
-             */
-
-            /* solve with iterative solution: */
-            while (fabs(change) > 0.0001) {
-
-                G_matvect_product(A_tilde, startvector, A_times_startvector);
-
-                G_vector_sub(A_times_startvector, b_gamma, errorvector);
-
-                A_tilde_trans_mu =
-                    G_matrix_scalar_mul(mu, A_tilde_trans, A_tilde_trans_mu);
-
-                G_matvect_product(A_tilde_trans_mu, errorvector, temp);
-                G_vector_sub(startvector, temp, startvector);   /* update startvector */
-
-                for (k = 0; k < A_tilde->cols; k++)
-                    /* no. of spectra times */
-                    /* if one element gets negative, set it to zero */
-                    if ((G_matrix_get_element(startvector, 0, k) < 0))
-                        G_matrix_set_element(startvector, 0, k, 0);
-
-                /* Check the deviation */
-                double norm = G_vector_norm_euclid(errorvector);
-
-                change = deviation - norm;
-                deviation = norm;
-
-                iterations++;
-
-                /* G_message("change=%lf, norm2=%lf",change, norm);   */
-            }
-
-            vec_struct *fraction;
-
-            /* G_message("fcol %d  and A->cols %d", startvector->dim, A->cols); */
-            fraction = G_vector_init(A->cols, 1, RVEC); /* length: no. of spectra */
-            error = deviation / G_vector_norm_euclid(b_gamma);
-            fraction = G_vector_copy(startvector, NO_COMPACT);
-
-            /* write result in full percent */
-            for (i = 0; i < A->cols; i++)       /* no. of spectra */
-                result_cell[i][col] =
-                    (CELL) (100 * G_matrix_get_element(fraction, 0, i) *
-                            100.0 / 255.0);
-
-            /* save error and iterations */
-	    if (error_fd >= 0)
-                error_cell[col] = (CELL) (100 * error);
-	    if (iter_fd >= 0)
-                iter_cell[col] = iterations;
-
-            G_vector_free(fraction);
-            G_vector_free(b_gamma);
-        }                       /* end cols loop */
+        for (t = 0; t < nchunk; t++)
+            for (i = 0; i < Ref.nfiles; i++)
+                Rast_get_c_row(cellfd[i], inrow[t][i], row0 + t);
 
+#pragma omp parallel for schedule(static, 1) private(t)
+        for (t = 0; t < nchunk; t++)
+            unmix_row(&unmix, &work[t], ncols, inrow[t], outrow[t],
+                      errrow[t], iterrow[t]);
 
         /* write the resulting rows into output files:  */
-        for (i = 0; i < A->cols; i++)   /* no. of spectra  */
-            Rast_put_c_row(resultfd[i], result_cell[i]);
-
-        if (error_fd >= 0)
-            Rast_put_c_row(error_fd, error_cell);
+        for (t = 0; t < nchunk; t++) {
+            for (i = 0; i < A->cols; i++)       /* no. of spectra  */
+                Rast_put_c_row(resultfd[i], outrow[t][i]);
 
-        if (iter_fd >= 0)
-            Rast_put_c_row(iter_fd, iter_cell);
+            if (error_fd >= 0)
+                Rast_put_c_row(error_fd, errrow[t]);
 
+            if (iter_fd >= 0)
+                Rast_put_c_row(iter_fd, iterrow[t]);
+        }
     }                           /* rows loop  */
-
-    G_percent(row, nrows, 2);
+    G_percent(nrows, nrows, 1);
 
     /* close files  */
     for (i = 0; i < Ref.nfiles; i++)    /* no. of bands  */
@@ -480,11 +394,26 @@ int main(int argc, char *argv[])
 	Rast_write_history(result_name, &hist);
     }
 
+    for (t = 0; t < nthreads; t++) {
+        for (i = 0; i < Ref.nfiles; i++)
+            G_free(inrow[t][i]);
+        for (i = 0; i < A->cols; i++)
+            G_free(outrow[t][i]);
+        G_free(inrow[t]);
+        G_free(outrow[t]);
+        if (errrow[t])
+            G_free(errrow[t]);
+        if (iterrow[t])
+            G_free(iterrow[t]);
+        unmix_work_free(&work[t]);
+    }
+    G_free(inrow);
+    G_free(outrow);
+    G_free(errrow);
+    G_free(iterrow);
+    G_free(work);
+    unmix_free(&unmix);
     G_matrix_free(A);
-    G_vector_free(errorvector);
-    G_vector_free(temp);
-    G_vector_free(startvector);
-    G_vector_free(A_times_startvector);
 
     /* disabled, done separately for the different types of output */
     /*
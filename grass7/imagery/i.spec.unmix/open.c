@@ -87,12 +87,9 @@ mat_struct *open_files(char *matrixfile, char *img_grp,
                         "does not match number of spectra in matrix. "
                         "(contains %i cols)."), Ref.nfiles, img_grp, A->rows);
 
-    /* get memory for input files */
-    cell = (CELL **) G_malloc(Ref.nfiles * sizeof(CELL *));
+    /* open input files */
     cellfd = (int *)G_malloc(Ref.nfiles * sizeof(int));
     for (i = 0; i < Ref.nfiles; i++) {
-        cell[i] = Rast_allocate_c_buf();
-
         G_message(_("Opening input file no. %i [%s]"), (i + 1),
                   Ref.file[i].name);
 
@@ -105,31 +102,25 @@ mat_struct *open_files(char *matrixfile, char *img_grp,
 
 
     /* open files for results */
-    result_cell = (CELL **) G_malloc(A->cols * sizeof(CELL *));
     resultfd = (int *)G_malloc(A->cols * sizeof(int));
 
     for (i = 0; i < A->cols; i++) {     /* no. of spectra */
         sprintf(result_name, "%s.%d", result_prefix, (i + 1));
         G_message(_("Opening output file [%s]"), result_name);
 
-        result_cell[i] = Rast_allocate_c_buf();
         if ((resultfd[i] = Rast_open_c_new(result_name)) < 0)
             G_fatal_error(_("GRASS-DB internal error: Unable to proceed."));
     }
     /* open file containing SMA error */
-    error_cell = NULL;
     error_fd = -1;
     if (error_name) {
         G_message(_("Opening error file [%s]"), error_name);
 
         if ((error_fd = Rast_open_c_new(error_name)) < 0)
             G_fatal_error(_("Unable to create error layer [%s]"), error_name);
-        else
-            error_cell = Rast_allocate_c_buf();
     }
 
     /* open file containing number of iterations */
-    iter_cell = NULL;
     iter_fd = -1;
     if (iter_name) {
         G_message(_("Opening iteration file [%s]"), iter_name);
@@ -137,8 +128,6 @@ mat_struct *open_files(char *matrixfile, char *img_grp,
         if ((iter_fd = Rast_open_c_new(iter_name)) < 0)
             G_fatal_error(_("Unable to create iterations layer [%s]"),
                           iter_name);
-        else
-            iter_cell = Rast_allocate_c_buf();
     }
 
     /* give back number of output files (= Ref.nfiles) */
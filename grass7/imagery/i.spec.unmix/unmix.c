@@ -0,0 +1,417 @@
+/* Unmixing of the pixels of a row in blocks of UNMIX_BLOCK pixels.
+ *
+ * The matrix A_tilde (spectra col-wise, one more row for the constraint
+ * Sum x_i = 1) and its normal matrix are set up once.  For a block the
+ * products A_tilde^T * b are computed together, then each pixel is
+ * solved with the non-negativity constraint x_i >= 0: with the active
+ * set method of Lawson and Hanson on the normal matrix, or with the
+ * projected gradient iteration of earlier versions. */
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/gmath.h>
+#include <grass/glocale.h>
+#include "global.h"
+
+/* Cholesky factorisation in place of the n x n matrix l (row-major,
+ * lower triangle used), returns 0 if it is not positive definite */
+static int cholesky(double *l, int n)
+{
+    int i, j, k;
+    double s;
+
+    for (j = 0; j < n; j++) {
+	s = l[j * n + j];
+	for (k = 0; k < j; k++)
+	    s -= l[j * n + k] * l[j * n + k];
+	if (s <= DBL_EPSILON * fabs(l[j * n + j]) || s <= 0.0)
+	    return 0;
+	l[j * n + j] = sqrt(s);
+	for (i = j + 1; i < n; i++) {
+	    s = l[i * n + j];
+	    for (k = 0; k < j; k++)
+		s -= l[i * n + k] * l[j * n + k];
+	    l[i * n + j] = s / l[j * n + j];
+	}
+    }
+
+    return 1;
+}
+
+/* solves L L^T x = c */
+static void cholesky_solve(const double *l, int n, const double *c,
+			   double *x)
+{
+    int i, k;
+    double s;
+
+    for (i = 0; i < n; i++) {
+	s = c[i];
+	for (k = 0; k < i; k++)
+	    s -= l[i * n + k] * x[k];
+	x[i] = s / l[i * n + i];
+    }
+    for (i = n - 1; i >= 0; i--) {
+	s = x[i];
+	for (k = i + 1; k < n; k++)
+	    s -= l[k * n + i] * x[k];
+	x[i] = s / l[i * n + i];
+    }
+}
+
+void unmix_init(struct unmix *u, mat_struct * A, double mu, int iterative)
+{
+    int i, j, k, m, n;
+    double s, norm1;
+
+    m = u->nbands = A->rows + 1;
+    n = u->nspec = A->cols;
+    u->mu = mu;
+    u->iterative = iterative;
+
+    u->a = G_malloc(m * n * sizeof(double));
+    u->at = G_malloc(n * m * sizeof(double));
+    u->gram = G_malloc(n * n * sizeof(double));
+    u->chol = G_malloc(n * n * sizeof(double));
+
+    for (i = 0; i < A->rows; i++)
+	for (j = 0; j < n; j++)
+	    u->a[i * n + j] = G_matrix_get_element(A, i, j);
+    /* fill last row with GAMMA elements */
+    for (j = 0; j < n; j++)
+	u->a[(m - 1) * n + j] = GAMMA;
+
+    for (i = 0; i < m; i++)
+	for (j = 0; j < n; j++)
+	    u->at[j * m + i] = u->a[i * n + j];
+
+    for (j = 0; j < n; j++) {
+	for (k = 0; k < n; k++) {
+	    s = 0.0;
+	    for (i = 0; i < m; i++)
+		s += u->at[j * m + i] * u->at[k * m + i];
+	    u->gram[j * n + k] = s;
+	}
+    }
+    memcpy(u->chol, u->gram, n * n * sizeof(double));
+    u->full = cholesky(u->chol, n);
+
+    /* tolerance for the Lagrange multipliers as in lsqnonneg */
+    norm1 = 0.0;
+    for (j = 0; j < n; j++) {
+	s = 0.0;
+	for (i = 0; i < m; i++)
+	    s += fabs(u->a[i * n + j]);
+	if (s > norm1)
+	    norm1 = s;
+    }
+    u->tol = 10 * DBL_EPSILON * norm1 * (m > n ? m : n);
+}
+
+void unmix_free(struct unmix *u)
+{
+    G_free(u->a);
+    G_free(u->at);
+    G_free(u->gram);
+    G_free(u->chol);
+}
+
+void unmix_work_init(struct unmix_work *w, const struct unmix *u)
+{
+    w->b = G_malloc(u->nbands * UNMIX_BLOCK * sizeof(double));
+    w->c = G_malloc(u->nspec * UNMIX_BLOCK * sizeof(double));
+    w->x = G_malloc(u->nspec * UNMIX_BLOCK * sizeof(double));
+    w->e = G_malloc(u->nbands * sizeof(double));
+    w->w = G_malloc(u->nspec * sizeof(double));
+    w->z = G_malloc(u->nspec * sizeof(double));
+    w->l = G_malloc(u->nspec * u->nspec * sizeof(double));
+    w->idx = G_malloc(u->nspec * sizeof(int));
+    w->passive = G_malloc(u->nspec * sizeof(int));
+    w->col = G_malloc(UNMIX_BLOCK * sizeof(int));
+    w->xp = G_malloc(u->nspec * sizeof(double));
+    w->cp = G_malloc(u->nspec * sizeof(double));
+}
+
+void unmix_work_free(struct unmix_work *w)
+{
+    G_free(w->b);
+    G_free(w->c);
+    G_free(w->x);
+    G_free(w->e);
+    G_free(w->w);
+    G_free(w->z);
+    G_free(w->l);
+    G_free(w->idx);
+    G_free(w->passive);
+    G_free(w->col);
+    G_free(w->xp);
+    G_free(w->cp);
+}
+
+/* least squares solution for the passive spectra, returns the number
+ * of passive spectra or -1 if they are linear dependent */
+static int solve_passive(const struct unmix *u, struct unmix_work *w,
+			 const double *c)
+{
+    int i, j, np, n = u->nspec;
+
+    np = 0;
+    for (i = 0; i < n; i++)
+	if (w->passive[i])
+	    w->idx[np++] = i;
+    for (i = 0; i < np; i++) {
+	for (j = 0; j <= i; j++)
+	    w->l[i * np + j] = u->gram[w->idx[i] * n + w->idx[j]];
+	w->w[i] = c[w->idx[i]];
+    }
+    if (!cholesky(w->l, np))
+	return -1;
+    cholesky_solve(w->l, np, w->w, w->z);
+
+    return np;
+}
+
+/* non-negative least squares with the normal matrix, c = A_tilde^T b,
+ * returns the number of iterations */
+static int nnls(const struct unmix *u, struct unmix_work *w,
+		const double *c, double *x)
+{
+    int i, k, j, np, iter, imin;
+    int n = u->nspec;
+    double s, wmax, alpha, a;
+
+    /* all spectra present: the factorisation of the normal matrix */
+    if (u->full) {
+	cholesky_solve(u->chol, n, c, x);
+	for (k = 0; k < n; k++)
+	    if (x[k] <= 0.0)
+		break;
+	if (k == n)
+	    return 0;
+    }
+
+    for (k = 0; k < n; k++) {
+	x[k] = 0.0;
+	w->passive[k] = 0;
+    }
+
+    iter = 0;
+    while (iter < 3 * n) {
+	/* the spectrum with the largest Lagrange multiplier
+	 * w = A_tilde^T (b - A_tilde x) becomes passive */
+	j = -1;
+	wmax = u->tol;
+	for (k = 0; k < n; k++) {
+	    if (w->passive[k])
+		continue;
+	    s = c[k];
+	    for (i = 0; i < n; i++)
+		s -= u->gram[k * n + i] * x[i];
+	    if (s > wmax) {
+		wmax = s;
+		j = k;
+	    }
+	}
+	if (j < 0)
+	    break;
+	iter++;
+	w->passive[j] = 1;
+
+	for (;;) {
+	    np = solve_passive(u, w, c);
+	    if (np < 0) {
+		/* linear dependent spectra, keep the last solution */
+		w->passive[j] = 0;
+		return iter;
+	    }
+	    for (i = 0; i < np; i++)
+		if (w->z[i] <= 0.0)
+		    break;
+	    if (i == np) {
+		for (i = 0; i < np; i++)
+		    x[w->idx[i]] = w->z[i];
+		break;
+	    }
+
+	    /* go from x towards z until a spectrum gets zero */
+	    alpha = 2.0;
+	    imin = -1;
+	    for (i = 0; i < np; i++) {
+		if (w->z[i] <= 0.0) {
+		    a = x[w->idx[i]] / (x[w->idx[i]] - w->z[i]);
+		    if (a < alpha) {
+			alpha = a;
+			imin = i;
+		    }
+		}
+	    }
+	    for (i = 0; i < np; i++) {
+		k = w->idx[i];
+		x[k] += alpha * (w->z[i] - x[k]);
+		if (i == imin || x[k] <= u->tol) {
+		    x[k] = 0.0;
+		    w->passive[k] = 0;
+		}
+	    }
+	}
+    }
+
+    return iter;
+}
+
+/* projected gradient iteration with the step size mu, starts with
+ * equal fractions, returns the number of iterations */
+static int gradient(const struct unmix *u, struct unmix_work *w,
+		    const double *b, double *x, double *deviation)
+{
+    int i, k, m = u->nbands, n = u->nspec;
+    double s, norm, change = 1000;
+    int iterations = 0;
+
+    *deviation = 1000;
+    for (k = 0; k < n; k++)
+	x[k] = 1.0 / n;
+
+    while (fabs(change) > 0.0001) {
+	/* errorvector = A_tilde x - b */
+	for (i = 0; i < m; i++) {
+	    s = 0.0;
+	    for (k = 0; k < n; k++)
+		s += u->a[i * n + k] * x[k];
+	    w->e[i] = s - b[i * UNMIX_BLOCK];
+	}
+	/* update x, if one element gets negative, set it to zero */
+	for (k = 0; k < n; k++) {
+	    s = 0.0;
+	    for (i = 0; i < m; i++)
+		s += u->mu * u->at[k * m + i] * w->e[i];
+	    x[k] -= s;
+	    if (x[k] < 0)
+		x[k] = 0;
+	}
+
+	/* Check the deviation */
+	norm = 0.0;
+	for (i = 0; i < m; i++)
+	    norm += w->e[i] * w->e[i];
+	norm = sqrt(norm);
+
+	change = *deviation - norm;
+	*deviation = norm;
+
+	iterations++;
+    }
+
+    return iterations;
+}
+
+/* the w->b values of npix pixels are unmixed to w->x */
+static void unmix_block(const struct unmix *u, struct unmix_work *w,
+			int npix, double *error, int *iter)
+{
+    int i, k, p, m = u->nbands, n = u->nspec;
+    double *x = w->xp, *c = w->cp;
+    double s, e, norm, deviation;
+
+    if (!u->iterative) {
+	/* c = A_tilde^T b for all pixels of the block */
+	for (k = 0; k < n; k++) {
+	    double *ck = w->c + k * UNMIX_BLOCK;
+
+	    for (p = 0; p < npix; p++)
+		ck[p] = 0.0;
+	    for (i = 0; i < m; i++) {
+		const double *bi = w->b + i * UNMIX_BLOCK;
+
+		double aik = u->at[k * m + i];
+
+		for (p = 0; p < npix; p++)
+		    ck[p] += aik * bi[p];
+	    }
+	}
+    }
+
+    for (p = 0; p < npix; p++) {
+	if (u->iterative) {
+	    iter[p] = gradient(u, w, w->b + p, x, &deviation);
+	}
+	else {
+	    for (k = 0; k < n; k++)
+		c[k] = w->c[k * UNMIX_BLOCK + p];
+	    iter[p] = nnls(u, w, c, x);
+
+	    /* deviation = |A_tilde x - b| */
+	    deviation = 0.0;
+	    for (i = 0; i < m; i++) {
+		s = 0.0;
+		for (k = 0; k < n; k++)
+		    s += u->a[i * n + k] * x[k];
+		e = s - w->b[i * UNMIX_BLOCK + p];
+		deviation += e * e;
+	    }
+	    deviation = sqrt(deviation);
+	}
+
+	norm = 0.0;
+	for (i = 0; i < m; i++)
+	    norm += w->b[i * UNMIX_BLOCK + p] * w->b[i * UNMIX_BLOCK + p];
+	error[p] = deviation / sqrt(norm);
+
+	for (k = 0; k < n; k++)
+	    w->x[k * UNMIX_BLOCK + p] = x[k];
+    }
+}
+
+/* unmixes one row, inrow holds the rows of all bands, outrow the rows
+ * of all spectra in percent, errrow and iterrow may be NULL.  Pixels
+ * with a null band are null. */
+void unmix_row(const struct unmix *u, struct unmix_work *w, int ncols,
+	       CELL ** inrow, CELL ** outrow, CELL * errrow, CELL * iterrow)
+{
+    int col, band, k, p, npix, nbands = u->nbands - 1;
+    double error[UNMIX_BLOCK];
+    int iter[UNMIX_BLOCK];
+
+    col = 0;
+    while (col < ncols) {
+	/* collect a block of pixels without nulls */
+	npix = 0;
+	for (; col < ncols && npix < UNMIX_BLOCK; col++) {
+	    for (band = 0; band < nbands; band++)
+		if (Rast_is_c_null_value(&inrow[band][col]))
+		    break;
+	    if (band < nbands) {
+		for (k = 0; k < u->nspec; k++)
+		    Rast_set_c_null_value(&outrow[k][col], 1);
+		if (errrow)
+		    Rast_set_c_null_value(&errrow[col], 1);
+		if (iterrow)
+		    Rast_set_c_null_value(&iterrow[col], 1);
+		continue;
+	    }
+	    for (band = 0; band < nbands; band++)
+		w->b[band * UNMIX_BLOCK + npix] = inrow[band][col];
+	    /* add GAMMA for 1. constraint as last element */
+	    w->b[nbands * UNMIX_BLOCK + npix] = GAMMA;
+	    w->col[npix++] = col;
+	}
+	if (npix == 0)
+	    continue;
+
+	unmix_block(u, w, npix, error, iter);
+
+	/* write result in full percent */
+	for (p = 0; p < npix; p++) {
+	    for (k = 0; k < u->nspec; k++)
+		outrow[k][w->col[p]] =
+		    (CELL) (100 * w->x[k * UNMIX_BLOCK + p] * 100.0 / 255.0);
+	    if (errrow)
+		errrow[w->col[p]] = (CELL) (100 * error[p]);
+	    if (iterrow)
+		iterrow[w->col[p]] = iter[p];
+	}
+    }
+}
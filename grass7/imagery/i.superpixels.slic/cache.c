@@ -13,6 +13,22 @@ static void *cache_put_r(struct cache *c, void *p, int row, int col)
     return memcpy(c->r + ((size_t)row * c->cols + col) * c->n, p, c->n);
 }
 
+/* the rows of a memory cache are used in place */
+static void *cache_get_rows_r(struct cache *c, void *p, int row, int nrows)
+{
+    return c->r + (size_t)row * c->cols * c->n;
+}
+
+static void *cache_put_rows_r(struct cache *c, void *p, int row, int nrows)
+{
+    char *r = c->r + (size_t)row * c->cols * c->n;
+
+    if (p != r)
+	memcpy(r, p, (size_t)nrows * c->cols * c->n);
+
+    return r;
+}
+
 static void *cache_get_s(struct cache *c, void *p, int row, int col)
 {
     Segment_get(&c->s, p, row, col);
@@ -28,6 +44,30 @@ static void *cache_put_s(struct cache *c, void *p, int row, int col)
     return p;
 }
 
+static void *cache_get_rows_s(struct cache *c, void *p, int row, int nrows)
+{
+    int i;
+
+    for (i = 0; i < nrows; i++)
+	Segment_get_row(&c->s, (char *)p + (size_t)i * c->cols * c->n,
+			row + i);
+
+    return p;
+}
+
+static void *cache_put_rows_s(struct cache *c, void *p, int row, int nrows)
+{
+    int i;
+
+    for (i = 0; i < nrows; i++) {
+	if (Segment_put_row(&c->s, (char *)p + (size_t)i * c->cols * c->n,
+			    row + i) != 1)
+	    G_fatal_error(_("Unable to write to temporary file"));
+    }
+
+    return p;
+}
+
 int cache_create(struct cache *c, int nrows, int ncols, int srows,
                  int scols, int nbytes, int nseg)
 {
@@ -50,6 +90,8 @@ int cache_create(struct cache *c, int nrows, int ncols, int srows,
 	c->r = NULL;
 	c->get = cache_get_s;
 	c->put = cache_put_s;
+	c->get_rows = cache_get_rows_s;
+	c->put_rows = cache_put_rows_s;
     }
     else {
 	G_verbose_message("Using memory cache");
@@ -57,6 +99,8 @@ int cache_create(struct cache *c, int nrows, int ncols, int srows,
 	c->r = G_malloc(sizeof(char) * c->rows * c->cols * c->n);
 	c->get = cache_get_r;
 	c->put = cache_put_r;
+	c->get_rows = cache_get_rows_r;
+	c->put_rows = cache_put_rows_r;
     }
 
     return 1;
@@ -83,3 +127,17 @@ void *cache_put(struct cache *c, void *p, int row, int col)
 {
     return c->put(c, p, row, col);
 }
+
+/* nrows contiguous rows starting at row, p must hold them for a disk
+ * cache, a memory cache returns its own rows. The rows of a disk cache
+ * bypass the segments held in memory, thus the same data must not be
+ * accessed both by rows and by cells. */
+void *cache_get_rows(struct cache *c, void *p, int row, int nrows)
+{
+    return c->get_rows(c, p, row, nrows);
+}
+
+void *cache_put_rows(struct cache *c, void *p, int row, int nrows)
+{
+    return c->put_rows(c, p, row, nrows);
+}
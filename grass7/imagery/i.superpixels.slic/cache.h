@@ -8,6 +8,8 @@ struct cache
     int rows, cols;
     void *(* get)(struct cache *c, void *p, int row, int col);
     void *(* put)(struct cache *c, void *p, int row, int col);
+    void *(* get_rows)(struct cache *c, void *p, int row, int nrows);
+    void *(* put_rows)(struct cache *c, void *p, int row, int nrows);
 };
 
 int cache_create(struct cache *c, int nrows, int ncols, int srows,
@@ -15,3 +17,5 @@ int cache_create(struct cache *c, int nrows, int ncols, int srows,
 int cache_destroy(struct cache *c);
 void *cache_get(struct cache *c, void *p, int row, int col);
 void *cache_put(struct cache *c, void *p, int row, int col);
+void *cache_get_rows(struct cache *c, void *p, int row, int nrows);
+void *cache_put_rows(struct cache *c, void *p, int row, int nrows);
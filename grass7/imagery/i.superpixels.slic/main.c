@@ -20,12 +20,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include <grass/gis.h>
 #include <grass/raster.h>
 #include <grass/segment.h>	
 #include <grass/imagery.h>
 #include <grass/glocale.h>
 #include "cache.h"
+#include "slic.h"
 
 #ifndef MAX
 #define MAX(x,y) ((x) > (y) ? (x) : (y))
@@ -34,9 +38,6 @@
 #define MIN(x,y) ((x) < (y) ? (x) : (y))
 #endif
 
-int SLIC_EnforceLabelConnectivity(struct cache *k_seg, int ncols, int nrows,
-				  struct cache *nk_seg, int minsize);
-
 int perturb_seeds(struct cache *bands_seg, int nbands, DCELL **kseedsb,
 		  double *kseedsx, double *kseedsy, int numk, int offset);
 
@@ -49,7 +50,8 @@ int main(int argc, char *argv[])
     struct GModule *module;	/* GRASS module for parsing arguments */
     struct Option *opt_in;		/* imagery group input option */
     struct Option *opt_iteration, *opt_super_pixels, *opt_step, 
-                  *opt_compactness, *opt_perturb, *opt_minsize, *opt_mem;
+                  *opt_compactness, *opt_perturb, *opt_minsize, *opt_mem,
+		  *opt_threads;
     struct Option *opt_out;	/* option for output */
     struct Flag *flag_n, *flag_h;
 
@@ -63,7 +65,7 @@ int main(int argc, char *argv[])
     struct Colors colors;
     struct History hist;
     
-    int seg_size, nseg;
+    int seg_size, nseg, nthreads;
     double segs_mb, k_mb;
 
     int n_iterations, n_super_pixels, numk, numlabels, slic0;
@@ -73,16 +75,17 @@ int main(int argc, char *argv[])
     int superpixelsize, minsize;
     int step;
     int offset;
-    DCELL *pdata;
-    double *dists;
-    struct cache bands_seg, k_seg, nk_seg, dist_seg;
+    DCELL *pdata, *prow;
+    int *krow;
+    struct cache bands_seg, k_seg, nk_seg;
+    struct slic slic;
     int schange;
 
     double xerrperstrip, yerrperstrip;
     int xstrips, ystrips, xoff, yoff, xerr, yerr;
 
     double xe, ye;
-    int x, y, x1, y1, x2, y2, itr;
+    int x, y, itr;
     short int hexgrid;
     int perturbseeds;
     int seedx, seedy;
@@ -90,11 +93,9 @@ int main(int argc, char *argv[])
     int *clustersize;
     double *kseedsx, *kseedsy, *sigmax, *sigmay;
     DCELL **kseedsb, **sigmab;
-    double *maxdistspeck, maxdistspec, maxdistspecprev;
+    double *maxdistspeck, *maxdistk, maxdistspec, maxdistspecprev;
 
     double invwt;
-    double dist, distxy, dx, dy;
-    double distsum;
 
 
     /* initialize GIS environment */
@@ -167,6 +168,13 @@ int main(int argc, char *argv[])
     opt_mem->answer = "300";
     opt_mem->description = _("Memory in MB");
 
+    opt_threads = G_define_option();
+    opt_threads->key = "threads";
+    opt_threads->type = TYPE_INTEGER;
+    opt_threads->required = NO;
+    opt_threads->answer = "1";
+    opt_threads->description = _("Number of threads for parallel computing");
+
     flag_n = G_define_flag();
     flag_n->key = 'n';
     flag_n->label = _("Normalize spectral distances");
@@ -270,6 +278,22 @@ int main(int argc, char *argv[])
 	segs_mb = mb;
     }
 
+    nthreads = 1;
+    if (opt_threads->answer) {
+	if (sscanf(opt_threads->answer, "%d", &nthreads) != 1 || nthreads < 1) {
+	    G_fatal_error(_("Illegal value for threads (%s)"),
+			  opt_threads->answer);
+	}
+    }
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+    nthreads = 1;
+#endif
+
     slic0 = flag_n->answer;
 
     outname = opt_out->answer;
@@ -321,7 +345,8 @@ int main(int argc, char *argv[])
     G_debug(1, "numk = %d", numk);
 
     /* segment structures */
-    k_mb = 2 * (sizeof(DCELL *) * 2 + sizeof(DCELL) * nbands + 2 * sizeof(double)) + sizeof(double);
+    k_mb = 2 * (sizeof(DCELL *) * 2 + sizeof(DCELL) * nbands + 2 * sizeof(double)) + 2 * sizeof(double);
+    k_mb += (5 + nthreads) * sizeof(int);
     k_mb = k_mb * numk / (1024. * 1024.);
 
     G_debug(1, "MB for seeds: %g", k_mb);
@@ -334,17 +359,12 @@ int main(int argc, char *argv[])
 
     seg_size = 64;
     nseg = 1024. * 1024. * segs_mb /
-           (seg_size * seg_size * (sizeof(DCELL) * nbands +
-	    sizeof(double) * 2 + sizeof(int)));
+           (seg_size * seg_size * (sizeof(DCELL) * nbands + sizeof(int) * 2));
 
     if (cache_create(&bands_seg, nrows, ncols, seg_size, seg_size,
 		     sizeof(DCELL) * nbands, nseg) != 1)
 	G_fatal_error("Unable to create grid cache");
 
-    if (cache_create(&dist_seg, nrows, ncols, seg_size, seg_size,
-		     sizeof(double) * 2, nseg) != 1)
-	G_fatal_error("Unable to create grid cache");
-
     if (cache_create(&k_seg, nrows, ncols, seg_size, seg_size,
 		     sizeof(int), nseg) != 1)
 	G_fatal_error("Unable to create grid cache");
@@ -369,16 +389,17 @@ int main(int argc, char *argv[])
 	rng[b] = max[b] - min[b];
     }
 
-    pdata = G_malloc(sizeof(DCELL) * nbands);
-    dists = G_malloc(sizeof(double) * 2);
-    dists[0] = dists[1] = 0;
-    k = -1;
+    prow = G_malloc(sizeof(DCELL) * nbands * ncols);
+    krow = G_malloc(sizeof(int) * ncols);
+    for (col = 0; col < ncols; col++)
+	krow[col] = -1;
     for (row = 0; row < nrows; row++) {
 	G_percent(row, nrows, 2);
 
 	for (b = 0; b < nbands; b++)
 	    Rast_get_d_row(ifd[b], ibuf[b], row);
 	for (col = 0; col < ncols; col++) {
+	    pdata = prow + (size_t)col * nbands;
 	    for (b = 0; b < nbands; b++) {
 		if (Rast_is_d_null_value(&ibuf[b][col])) {
 		    Rast_set_d_null_value(pdata, nbands);
@@ -389,12 +410,15 @@ int main(int argc, char *argv[])
 		else
 		    pdata[b] = 0;
 	    }
-	    cache_put(&bands_seg, pdata, row, col);
-	    cache_put(&k_seg, &k, row, col);
-	    cache_put(&dist_seg, dists, row, col);
 	}
+	/* the bands and seeds of a cell are contiguous */
+	cache_put_rows(&bands_seg, prow, row, 1);
+	cache_put_rows(&k_seg, krow, row, 1);
     }
     G_percent(nrows, nrows, 2);
+    G_free(prow);
+    G_free(krow);
+    pdata = G_malloc(sizeof(DCELL) * nbands);
 
     for (b = 0; b < nbands; b++) {
 	Rast_close(ifd[b]);
@@ -489,6 +513,29 @@ int main(int argc, char *argv[])
     /* of compactness.										    */
     invwt = 0.1 * compactness / (offset * offset);
 
+    maxdistk = NULL;
+    if (slic0)
+	maxdistk = G_malloc(sizeof(double) * numk);
+
+    slic.nrows = nrows;
+    slic.ncols = ncols;
+    slic.nbands = nbands;
+    slic.numk = numk;
+    slic.offset = offset;
+    slic.invwt = invwt;
+    slic.bands_seg = &bands_seg;
+    slic.k_seg = &k_seg;
+    slic.kseedsb = kseedsb;
+    slic.kseedsx = kseedsx;
+    slic.kseedsy = kseedsy;
+    slic.maxdistspeck = maxdistspeck;
+    slic.sigmab = sigmab;
+    slic.sigmax = sigmax;
+    slic.sigmay = sigmay;
+    slic.maxdistk = maxdistk;
+    slic.clustersize = clustersize;
+    slic_init(&slic, nthreads);
+
     G_message(_("Performing K-means segmentation..."));
     schange = 0;
     for (itr = 0; itr < n_iterations; itr++) {
@@ -496,59 +543,9 @@ int main(int argc, char *argv[])
 
 	schange = 0;
 
-	dists[0] = 0;
-	dists[1] = 1E+9;
-	for (row = 0; row < nrows; row++) {
-	    for (col = 0; col < ncols; col++) {
-		cache_put(&dist_seg, dists, row, col);
-	    }
-	}
-
-	for (k = 0; k < numk; k++) {
-	    y1 = (int)MAX(0.0, kseedsy[k] - offset);
-	    y2 = (int)MIN(nrows - 1, kseedsy[k] + offset);
-	    x1 = (int)MAX(0.0, kseedsx[k] - offset);
-	    x2 = (int)MIN(ncols - 1, kseedsx[k] + offset);
-
-	    for (y = y1; y <= y2; y++) {
-		dy = y - kseedsy[k];
-		
-		for (x = x1; x <= x2; x++) {
-		    cache_get(&bands_seg, pdata, y, x);
-		    if (Rast_is_d_null_value(pdata))
-			continue;
-
-		    cache_get(&dist_seg, dists, y, x);
-		    dist = 0.0;
-		    for (b = 0; b < nbands; b++) {
-			dist += (pdata[b] - kseedsb[k][b]) *
-			        (pdata[b] - kseedsb[k][b]);
-		    }
-		    dist /= nbands;
-
-		    dx = x - kseedsx[k];
-		    distxy = (dx * dx + dy * dy) / 2.0;
-
-		    /* ----------------------------------------------------------------------- */
-		    distsum = dist / maxdistspeck[k] + distxy * invwt;
-		    /* We use a slightly different formula than that of Achanta et al.:        */
-		    /* D^2 = (dc / m)^2 + c * (ds / S)^2				       */	
-		    /* This means that m and S are always determined within the code and c is  */
-		    /* a factor to weigh the relative importance between color similarity and  */
-		    /* spatial proximity. Thus user-determined compactness is always taken     */
-		    /* into account, even in SLIC0, and is independent of the number of bands. */
-		    /*------------------------------------------------------------------------ */
-		    if (distsum < dists[1]) {
-			dists[0] = dist;
-			dists[1] = distsum;
-
-			cache_put(&dist_seg, dists, y, x);
-			cache_put(&k_seg, &k, y, x);
-		    }
-
-		}		/* for( x=x1 */
-	    }			/* for( y=y1 */
-	}			/* for (n=0 */
+	/* assign the cells to the seeds and sum up the cells of each seed */
+	maxdistspecprev = maxdistspec;
+	maxdistspec = slic_assign(&slic);
 
 	if (slic0) {
 	    /* adaptive m for SLIC zero */
@@ -556,58 +553,17 @@ int main(int argc, char *argv[])
 		for (k = 0; k < numk; k++)
 		    maxdistspeck[k] = 0;
 	    }
-	    for (row = 0; row < nrows; row++) {
-		for (col = 0; col < ncols; col++) {
-		    cache_get(&k_seg, &k, row, col);
-		    if (k >= 0) {
-			cache_get(&dist_seg, dists, row, col);
-			if (maxdistspeck[k] < dists[0])
-			    maxdistspeck[k] = dists[0];
-		    }
-		}
+	    for (k = 0; k < numk; k++) {
+		if (maxdistspeck[k] < maxdistk[k])
+		    maxdistspeck[k] = maxdistk[k];
 	    }
 	}
 	else {
-	    maxdistspecprev = maxdistspec;
-	    maxdistspec = 0;
-	    for (row = 0; row < nrows; row++) {
-		for (col = 0; col < ncols; col++) {
-		    cache_get(&k_seg, &k, row, col);
-		    if (k >= 0) {
-			cache_get(&dist_seg, dists, row, col);
-			if (maxdistspec < dists[0])
-			    maxdistspec = dists[0];
-		    }
-		}
-	    }
 	    for (k = 0; k < numk; k++)
 		maxdistspeck[k] = maxdistspec;
 	    G_debug(1, "Largest spectral distance = %.15g", maxdistspec);
 	}
 
-	for (k = 0; k < numk; k++) {
-	    memset(sigmab[k], 0, sizeof(double) * nbands);
-	}
-
-	memset(sigmax, 0, sizeof(double) * numk);
-	memset(sigmay, 0, sizeof(double) * numk);
-	memset(clustersize, 0, sizeof(int) * numk);
-
-	for (row = 0; row < nrows; row++) {
-	    for (col = 0; col < ncols; col++) {
-		cache_get(&k_seg, &k, row, col);
-		if (k >= 0) {
-		    cache_get(&bands_seg, pdata, row, col);
-		    for (b = 0; b < nbands; b++) {
-			sigmab[k][b] += pdata[b];
-		    }
-		    sigmax[k] += col;
-		    sigmay[k] += row;
-		    clustersize[k] += 1;
-		}
-	    }
-	}
-
 	for (k = 0; k < numk; k++) {
 	    double newxy;
 	    int kchange = 0;
@@ -656,6 +612,7 @@ int main(int argc, char *argv[])
 
     /* free */
 
+    slic_free(&slic);
     for (k = 0; k < numk; k++) {
 	G_free(kseedsb[k]);
 	G_free(sigmab[k]);
@@ -667,24 +624,15 @@ int main(int argc, char *argv[])
     G_free(sigmax);
     G_free(sigmay);
     G_free(clustersize);
+    G_free(maxdistspeck);
+    if (maxdistk)
+	G_free(maxdistk);
 
-    cache_destroy(&dist_seg);
     cache_create(&nk_seg, nrows, ncols, seg_size, seg_size,
 		 sizeof(int), nseg);
 
     numlabels = SLIC_EnforceLabelConnectivity(&k_seg, ncols, nrows, 
-                                              &nk_seg, 0);
-    for (row = 0; row < nrows; row++) {
-	for (col = 0; col < ncols; col++) {
-	    cache_get(&k_seg, &k, row, col);
-	    if (k >= 0) {
-		int n;
-
-		cache_get(&nk_seg, &n, row, col);
-		cache_put(&k_seg, &n, row, col);
-	    }
-	}
-    }
+                                              &nk_seg);
 
     cache_destroy(&nk_seg);
 
@@ -728,109 +676,6 @@ int main(int argc, char *argv[])
 }
 
 
-int SLIC_EnforceLabelConnectivity(struct cache *k_seg, int ncols, int nrows,
-                                  struct cache *nk_seg,	/*new labels */
-				  int minsize)
-{
-
-    const int dx4[4] = { -1, 0, 1, 0 };
-    const int dy4[4] = { 0, -1, 0, 1 };
-
-    int n, label, adjlabel, k, k2, nk;
-    int row, col;
-    int x, y, c, count;
-    int *xvec, *yvec, vec_alloc;
-
-    nk = -1;
-    for (row = 0; row < nrows; row++) {
-	for (col = 0; col < ncols; col++)
-	    cache_put(nk_seg, &nk, row, col);
-    }
-    label = 0;
-
-    vec_alloc = 100;
-    xvec = G_malloc(sizeof(int) * vec_alloc);
-    yvec = G_malloc(sizeof(int) * vec_alloc);
-
-    adjlabel = 0;		/* adjacent label */
-
-    for (row = 0; row < nrows; row++) {
-	for (col = 0; col < ncols; col++) {
-	    cache_get(k_seg, &k, row, col);
-	    cache_get(nk_seg, &nk, row, col);
-	    if (k >= 0 && nk < 0) {
-		cache_put(nk_seg, &label, row, col);
-
-		/*--------------------
-		 Start a new segment
-		 --------------------*/
-		xvec[0] = col;
-		yvec[0] = row;
-
-		/*-------------------------------------------------------
-		 Quickly find an adjacent label for use later if needed
-		 -------------------------------------------------------*/
-
-		for (n = 0; n < 4; n++) {
-		    x = xvec[0] + dx4[n];
-		    y = yvec[0] + dy4[n];
-		    if ((x >= 0 && x < ncols) && (y >= 0 && y < nrows)) {
-			cache_get(nk_seg, &nk, y, x);
-			if (nk >= 0)
-			    adjlabel = nk;
-		    }
-		}
-
-		count = 1;
-		for (c = 0; c < count; c++) {
-		    for (n = 0; n < 4; n++) {
-			x = xvec[c] + dx4[n];
-			y = yvec[c] + dy4[n];
-
-			if ((x >= 0 && x < ncols) && (y >= 0 && y < nrows)) {
-
-			    cache_get(k_seg, &k2, y, x);
-			    cache_get(nk_seg, &nk, y, x);
-			    if (0 > nk && k == k2) {
-				if (vec_alloc <= count) {
-				    vec_alloc += 100;
-				    xvec =
-					G_realloc(xvec,
-						  sizeof(int) * vec_alloc);
-				    yvec =
-					G_realloc(yvec,
-						  sizeof(int) * vec_alloc);
-				}
-				xvec[count] = x;
-				yvec[count] = y;
-				cache_put(nk_seg, &label, y, x);
-				count++;
-			    }
-			}
-		    }
-		}
-
-		/*-------------------------------------------------------
-		 If segment size is less than a limit, assign an
-		 adjacent label found before, and decrement label count.
-		-------------------------------------------------------*/
-		if (count < minsize) {
-		    for (c = 0; c < count; c++) {
-			cache_put(nk_seg, &adjlabel, yvec[c], xvec[c]);
-		    }
-		    label--;
-		}
-		label++;
-	    }
-	}
-    }
-
-    G_free(xvec);
-    G_free(yvec);
-
-    return label;
-}
-
 int perturb_seeds(struct cache *bands_seg, int nbands, DCELL **kseedsb,
 		  double *kseedsx, double *kseedsy, int numk, int offset)
 {
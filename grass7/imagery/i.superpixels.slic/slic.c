@@ -0,0 +1,562 @@
+
+/****************************************************************************
+ *
+ * Assignment of the cells to the seeds and connected components
+ *
+ * The grid is processed in bands of rows, a band is split into tiles.
+ * The seeds are bucketed by grid cells of the size of the search window
+ * radius, thus the seeds whose search windows overlap a tile are found
+ * quickly. Each cell of a tile is assigned to the nearest of these seeds,
+ * in the order of the seeds, such that the result is the same as when
+ * the search window of each seed is scanned in turn. The tiles do not
+ * overlap and are processed in parallel.
+ *
+ * The sums of the cells assigned to a seed are accumulated by scanning
+ * the search window of the seed, in the order of the cells. Each seed is
+ * owned by one thread.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/segment.h>
+#include <grass/glocale.h>
+#include "cache.h"
+#include "slic.h"
+
+#ifndef MAX
+#define MAX(x,y) ((x) > (y) ? (x) : (y))
+#endif
+#ifndef MIN
+#define MIN(x,y) ((x) < (y) ? (x) : (y))
+#endif
+
+/* rows of the grid labelled at once by the connected components */
+#define CC_BAND_ROWS 256
+
+static int cmp_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+void slic_init(struct slic *s, int nthreads)
+{
+    int t;
+
+    s->x1 = G_malloc(sizeof(int) * s->numk);
+    s->x2 = G_malloc(sizeof(int) * s->numk);
+    s->y1 = G_malloc(sizeof(int) * s->numk);
+    s->y2 = G_malloc(sizeof(int) * s->numk);
+
+    s->gcols = (s->ncols - 1) / s->offset + 1;
+    s->grows = (s->nrows - 1) / s->offset + 1;
+    s->gstart = G_malloc(sizeof(int) * (s->gcols * s->grows + 1));
+    s->gseeds = G_malloc(sizeof(int) * s->numk);
+
+    s->tsize = MIN(s->offset, SLIC_BAND_ROWS);
+    s->brows = s->tsize * ((SLIC_BAND_ROWS + s->tsize - 1) / s->tsize);
+
+    /* rows of a memory cache are used in place */
+    s->bbuf = NULL;
+    if (s->bands_seg->r == NULL)
+	s->bbuf = G_malloc(sizeof(DCELL) * s->nbands * s->brows * s->ncols);
+    s->kbuf = NULL;
+    if (s->k_seg->r == NULL)
+	s->kbuf = G_malloc(sizeof(int) * s->brows * s->ncols);
+    s->dbuf = G_malloc(sizeof(double) * s->brows * s->ncols);
+
+    s->nthreads = nthreads;
+    s->cand = G_malloc(sizeof(int *) * nthreads);
+    for (t = 0; t < nthreads; t++)
+	s->cand[t] = G_malloc(sizeof(int) * s->numk);
+    s->bandk = G_malloc(sizeof(int) * s->numk);
+}
+
+void slic_free(struct slic *s)
+{
+    int t;
+
+    G_free(s->x1);
+    G_free(s->x2);
+    G_free(s->y1);
+    G_free(s->y2);
+    G_free(s->gstart);
+    G_free(s->gseeds);
+    if (s->bbuf)
+	G_free(s->bbuf);
+    if (s->kbuf)
+	G_free(s->kbuf);
+    G_free(s->dbuf);
+    for (t = 0; t < s->nthreads; t++)
+	G_free(s->cand[t]);
+    G_free(s->cand);
+    G_free(s->bandk);
+}
+
+static int seed_cell(struct slic *s, int k)
+{
+    int gx, gy;
+
+    gx = MIN(s->gcols - 1, (int)(s->kseedsx[k] / s->offset));
+    gy = MIN(s->grows - 1, (int)(s->kseedsy[k] / s->offset));
+
+    return gy * s->gcols + gx;
+}
+
+/* search windows and grid buckets of the seeds, the seeds of a bucket
+ * are in ascending order */
+static void bucket_seeds(struct slic *s)
+{
+    int k, c, ncells;
+
+    ncells = s->gcols * s->grows;
+    memset(s->gstart, 0, sizeof(int) * (ncells + 1));
+
+    for (k = 0; k < s->numk; k++) {
+	s->y1[k] = (int)MAX(0.0, s->kseedsy[k] - s->offset);
+	s->y2[k] = (int)MIN(s->nrows - 1, s->kseedsy[k] + s->offset);
+	s->x1[k] = (int)MAX(0.0, s->kseedsx[k] - s->offset);
+	s->x2[k] = (int)MIN(s->ncols - 1, s->kseedsx[k] + s->offset);
+
+	s->gstart[seed_cell(s, k) + 1]++;
+    }
+    for (c = 0; c < ncells; c++)
+	s->gstart[c + 1] += s->gstart[c];
+    for (k = 0; k < s->numk; k++)
+	s->gseeds[s->gstart[seed_cell(s, k)]++] = k;
+    for (c = ncells; c > 0; c--)
+	s->gstart[c] = s->gstart[c - 1];
+    s->gstart[0] = 0;
+}
+
+/* range of grid buckets holding the seeds whose search window can
+ * overlap the cells first to last */
+static void bucket_range(struct slic *s, int first, int last, int *g1,
+			 int *g2, int ng)
+{
+    int lo;
+
+    lo = first - s->offset - 1;
+    *g1 = lo < 0 ? 0 : lo / s->offset;
+    *g2 = MIN(ng - 1, (last + s->offset + 1) / s->offset);
+}
+
+/* seeds whose search window overlaps the tile, in ascending order */
+static int tile_seeds(struct slic *s, int *cand, int row1, int row2,
+		      int col1, int col2)
+{
+    int gx1, gx2, gy1, gy2, gx, gy, i, k, ncand;
+
+    bucket_range(s, row1, row2, &gy1, &gy2, s->grows);
+    bucket_range(s, col1, col2, &gx1, &gx2, s->gcols);
+
+    ncand = 0;
+    for (gy = gy1; gy <= gy2; gy++) {
+	for (gx = gx1; gx <= gx2; gx++) {
+	    int c = gy * s->gcols + gx;
+
+	    for (i = s->gstart[c]; i < s->gstart[c + 1]; i++) {
+		k = s->gseeds[i];
+		if (s->y1[k] <= row2 && s->y2[k] >= row1 &&
+		    s->x1[k] <= col2 && s->x2[k] >= col1)
+		    cand[ncand++] = k;
+	    }
+	}
+    }
+    qsort(cand, ncand, sizeof(int), cmp_int);
+
+    return ncand;
+}
+
+/* assign the cells of a tile of the band starting at row0, returns the
+ * number of cells not in the search window of any seed that keep their
+ * previous seed */
+static int assign_tile(struct slic *s, int *cand, DCELL *bands, int *kr,
+		       int row0, int row1, int row2, int col1, int col2,
+		       double *maxdist)
+{
+    int row, col, b, j, k, ncand, bestk, norphans;
+    size_t i;
+    DCELL *pdata;
+    double dist, distxy, dx, dy, distsum, bestsum, bestdist;
+
+    ncand = tile_seeds(s, cand, row1, row2, col1, col2);
+
+    norphans = 0;
+    *maxdist = 0;
+    for (row = row1; row <= row2; row++) {
+	for (col = col1; col <= col2; col++) {
+	    i = (size_t)(row - row0) * s->ncols + col;
+	    pdata = bands + i * s->nbands;
+	    if (Rast_is_d_null_value(pdata))
+		continue;
+
+	    bestk = -1;
+	    bestsum = 1E+9;
+	    bestdist = 0;
+	    for (j = 0; j < ncand; j++) {
+		k = cand[j];
+		if (row < s->y1[k] || row > s->y2[k] ||
+		    col < s->x1[k] || col > s->x2[k])
+		    continue;
+
+		dist = 0.0;
+		for (b = 0; b < s->nbands; b++) {
+		    dist += (pdata[b] - s->kseedsb[k][b]) *
+			    (pdata[b] - s->kseedsb[k][b]);
+		}
+		dist /= s->nbands;
+
+		dx = col - s->kseedsx[k];
+		dy = row - s->kseedsy[k];
+		distxy = (dx * dx + dy * dy) / 2.0;
+
+		/* ----------------------------------------------------------------------- */
+		distsum = dist / s->maxdistspeck[k] + distxy * s->invwt;
+		/* We use a slightly different formula than that of Achanta et al.:        */
+		/* D^2 = (dc / m)^2 + c * (ds / S)^2				       */
+		/* This means that m and S are always determined within the code and c is  */
+		/* a factor to weigh the relative importance between color similarity and  */
+		/* spatial proximity. Thus user-determined compactness is always taken     */
+		/* into account, even in SLIC0, and is independent of the number of bands. */
+		/*------------------------------------------------------------------------ */
+		if (distsum < bestsum) {
+		    bestk = k;
+		    bestsum = distsum;
+		    bestdist = dist;
+		}
+	    }
+
+	    s->dbuf[i] = bestdist;
+	    if (bestk >= 0) {
+		kr[i] = bestk;
+		if (*maxdist < bestdist)
+		    *maxdist = bestdist;
+	    }
+	    else if (kr[i] >= 0)
+		norphans++;
+	}
+    }
+
+    return norphans;
+}
+
+/* sums of the cells of the band assigned to seed k within its window */
+static void sum_seed(struct slic *s, int k, DCELL *bands, int *kr,
+		     int row0, int row1, int row2)
+{
+    int row, col, b;
+    size_t i;
+    DCELL *pdata;
+
+    for (row = MAX(s->y1[k], row1); row <= MIN(s->y2[k], row2); row++) {
+	for (col = s->x1[k]; col <= s->x2[k]; col++) {
+	    i = (size_t)(row - row0) * s->ncols + col;
+	    if (kr[i] != k)
+		continue;
+
+	    pdata = bands + i * s->nbands;
+	    for (b = 0; b < s->nbands; b++) {
+		s->sigmab[k][b] += pdata[b];
+	    }
+	    s->sigmax[k] += col;
+	    s->sigmay[k] += row;
+	    s->clustersize[k] += 1;
+
+	    if (s->maxdistk && s->maxdistk[k] < s->dbuf[i])
+		s->maxdistk[k] = s->dbuf[i];
+	}
+    }
+}
+
+/* sums of the cells of the band assigned to a seed outside its window */
+static void sum_orphans(struct slic *s, DCELL *bands, int *kr, int row0,
+			int row1, int row2)
+{
+    int row, col, b, k;
+    size_t i;
+    DCELL *pdata;
+
+    for (row = row1; row <= row2; row++) {
+	for (col = 0; col < s->ncols; col++) {
+	    i = (size_t)(row - row0) * s->ncols + col;
+	    k = kr[i];
+	    if (k < 0)
+		continue;
+	    if (row >= s->y1[k] && row <= s->y2[k] &&
+		col >= s->x1[k] && col <= s->x2[k])
+		continue;
+
+	    pdata = bands + i * s->nbands;
+	    for (b = 0; b < s->nbands; b++) {
+		s->sigmab[k][b] += pdata[b];
+	    }
+	    s->sigmax[k] += col;
+	    s->sigmay[k] += row;
+	    s->clustersize[k] += 1;
+	}
+    }
+}
+
+/* assign each cell to the nearest seed and sum up the cells of each
+ * seed, returns the largest spectral distance of a cell to its seed */
+double slic_assign(struct slic *s)
+{
+    int k, b, j, t, row1, row2, nr, ntiles, tcols, nbandk, norphans, gy1, gy2;
+    DCELL *bands;
+    int *kr;
+    double maxdist;
+
+    bucket_seeds(s);
+
+    for (k = 0; k < s->numk; k++) {
+	for (b = 0; b < s->nbands; b++)
+	    s->sigmab[k][b] = 0;
+	s->sigmax[k] = 0;
+	s->sigmay[k] = 0;
+	s->clustersize[k] = 0;
+	if (s->maxdistk)
+	    s->maxdistk[k] = 0;
+    }
+
+    maxdist = 0;
+    tcols = (s->ncols + s->tsize - 1) / s->tsize;
+    for (row1 = 0; row1 < s->nrows; row1 += s->brows) {
+	nr = MIN(s->brows, s->nrows - row1);
+	row2 = row1 + nr - 1;
+
+	bands = cache_get_rows(s->bands_seg, s->bbuf, row1, nr);
+	kr = cache_get_rows(s->k_seg, s->kbuf, row1, nr);
+
+	norphans = 0;
+	ntiles = ((nr + s->tsize - 1) / s->tsize) * tcols;
+#pragma omp parallel for schedule(dynamic) reduction(+:norphans) reduction(max:maxdist)
+	for (t = 0; t < ntiles; t++) {
+	    int tid = 0, trow, tcol;
+	    double tmax;
+
+#if defined(_OPENMP)
+	    tid = omp_get_thread_num();
+#endif
+	    trow = row1 + (t / tcols) * s->tsize;
+	    tcol = (t % tcols) * s->tsize;
+	    norphans += assign_tile(s, s->cand[tid], bands, kr, row1, trow,
+				    MIN(trow + s->tsize - 1, row2), tcol,
+				    MIN(tcol + s->tsize - 1, s->ncols - 1),
+				    &tmax);
+	    if (maxdist < tmax)
+		maxdist = tmax;
+	}
+
+	/* seeds whose window overlaps the band */
+	bucket_range(s, row1, row2, &gy1, &gy2, s->grows);
+	nbandk = 0;
+	for (j = s->gstart[gy1 * s->gcols];
+	     j < s->gstart[(gy2 + 1) * s->gcols]; j++) {
+	    k = s->gseeds[j];
+	    if (s->y1[k] <= row2 && s->y2[k] >= row1)
+		s->bandk[nbandk++] = k;
+	}
+
+#pragma omp parallel for schedule(dynamic, 8)
+	for (j = 0; j < nbandk; j++)
+	    sum_seed(s, s->bandk[j], bands, kr, row1, row1, row2);
+
+	if (norphans)
+	    sum_orphans(s, bands, kr, row1, row1, row2);
+
+	cache_put_rows(s->k_seg, kr, row1, nr);
+    }
+
+    return maxdist;
+}
+
+/* connected components */
+
+struct cc_band
+{
+    int n, nalloc;
+    int *parent;
+};
+
+static int uf_find(int *parent, int i)
+{
+    int root, next;
+
+    root = i;
+    while (parent[root] != root)
+	root = parent[root];
+    while (parent[i] != root) {
+	next = parent[i];
+	parent[i] = root;
+	i = next;
+    }
+
+    return root;
+}
+
+/* the smaller label is the root, thus the root of a component is the
+ * label created first */
+static int uf_union(int *parent, int a, int b)
+{
+    a = uf_find(parent, a);
+    b = uf_find(parent, b);
+    if (a < b) {
+	parent[b] = a;
+	return a;
+    }
+    parent[a] = b;
+
+    return b;
+}
+
+/* provisional labels of 4-connected cells with the same seed */
+static void cc_label_band(const int *k, int *nk, int nrows, int ncols,
+			  struct cc_band *cb)
+{
+    int row, col, l;
+    size_t i;
+
+    cb->n = 0;
+    cb->nalloc = 0;
+    cb->parent = NULL;
+
+    for (row = 0; row < nrows; row++) {
+	for (col = 0; col < ncols; col++) {
+	    i = (size_t)row * ncols + col;
+	    if (k[i] < 0) {
+		nk[i] = -1;
+		continue;
+	    }
+
+	    l = -1;
+	    if (col > 0 && k[i - 1] == k[i])
+		l = nk[i - 1];
+	    if (row > 0 && k[i - ncols] == k[i]) {
+		if (l < 0)
+		    l = nk[i - ncols];
+		else
+		    l = uf_union(cb->parent, l, nk[i - ncols]);
+	    }
+	    if (l < 0) {
+		if (cb->n >= cb->nalloc) {
+		    cb->nalloc += 1024;
+		    cb->parent = G_realloc(cb->parent,
+					   sizeof(int) * cb->nalloc);
+		}
+		cb->parent[cb->n] = cb->n;
+		l = cb->n++;
+	    }
+	    nk[i] = l;
+	}
+    }
+}
+
+/* Labels of the connected components of cells with the same seed in
+ * k_seg, numbered in the order of their first cell. The bands of rows
+ * are labelled independently, the labels of adjacent bands are joined
+ * afterwards. k_seg is relabelled, nk_seg holds the provisional labels.
+ * Returns the number of labels. */
+int SLIC_EnforceLabelConnectivity(struct cache *k_seg, int ncols, int nrows,
+				  struct cache *nk_seg)
+{
+    int nb, b, inmem, col, id, label, total;
+    int *kbuf, *nkbuf, *offset, *parent, *labels;
+    int *k0, *k1, *nk0, *nk1;
+    struct cc_band *cb;
+
+    nb = (nrows + CC_BAND_ROWS - 1) / CC_BAND_ROWS;
+    cb = G_malloc(sizeof(struct cc_band) * nb);
+
+    /* bands of a disk cache are done one by one */
+    inmem = k_seg->r != NULL && nk_seg->r != NULL;
+    kbuf = nkbuf = NULL;
+    if (!inmem) {
+	kbuf = G_malloc(sizeof(int) * CC_BAND_ROWS * ncols);
+	nkbuf = G_malloc(sizeof(int) * CC_BAND_ROWS * ncols);
+    }
+
+#pragma omp parallel for schedule(dynamic) if(inmem)
+    for (b = 0; b < nb; b++) {
+	int row1, nr, *k, *nk;
+
+	row1 = b * CC_BAND_ROWS;
+	nr = MIN(CC_BAND_ROWS, nrows - row1);
+	k = cache_get_rows(k_seg, kbuf, row1, nr);
+	nk = inmem ? cache_get_rows(nk_seg, NULL, row1, nr) : nkbuf;
+	cc_label_band(k, nk, nr, ncols, &cb[b]);
+	cache_put_rows(nk_seg, nk, row1, nr);
+    }
+
+    /* global labels */
+    offset = G_malloc(sizeof(int) * nb);
+    total = 0;
+    for (b = 0; b < nb; b++) {
+	offset[b] = total;
+	total += cb[b].n;
+    }
+    parent = G_malloc(sizeof(int) * (total + 1));
+    for (b = 0; b < nb; b++) {
+	for (id = 0; id < cb[b].n; id++)
+	    parent[offset[b] + id] = offset[b] + cb[b].parent[id];
+	if (cb[b].parent)
+	    G_free(cb[b].parent);
+    }
+    G_free(cb);
+
+    /* join the components across the bands */
+    for (b = 1; b < nb; b++) {
+	int row = b * CC_BAND_ROWS;
+
+	k0 = cache_get_rows(k_seg, kbuf, row - 1, 2);
+	nk0 = cache_get_rows(nk_seg, nkbuf, row - 1, 2);
+	k1 = k0 + ncols;
+	nk1 = nk0 + ncols;
+	for (col = 0; col < ncols; col++) {
+	    if (k0[col] >= 0 && k0[col] == k1[col])
+		uf_union(parent, offset[b - 1] + nk0[col],
+			 offset[b] + nk1[col]);
+	}
+    }
+
+    /* final labels in order of the roots */
+    labels = G_malloc(sizeof(int) * (total + 1));
+    label = 0;
+    for (id = 0; id < total; id++) {
+	int root = uf_find(parent, id);
+
+	labels[id] = root == id ? label++ : labels[root];
+    }
+    G_free(parent);
+
+#pragma omp parallel for schedule(dynamic) if(inmem)
+    for (b = 0; b < nb; b++) {
+	int row1, nr, *k, *nk;
+	size_t i, n;
+
+	row1 = b * CC_BAND_ROWS;
+	nr = MIN(CC_BAND_ROWS, nrows - row1);
+	k = cache_get_rows(k_seg, kbuf, row1, nr);
+	nk = cache_get_rows(nk_seg, nkbuf, row1, nr);
+	n = (size_t)nr * ncols;
+	for (i = 0; i < n; i++) {
+	    if (k[i] >= 0)
+		k[i] = labels[offset[b] + nk[i]];
+	}
+	cache_put_rows(k_seg, k, row1, nr);
+    }
+
+    if (kbuf) {
+	G_free(kbuf);
+	G_free(nkbuf);
+    }
+    G_free(offset);
+    G_free(labels);
+
+    return label;
+}
@@ -0,0 +1,43 @@
+/* assignment of the cells to the seeds */
+
+/* rows of the grid processed at once */
+#define SLIC_BAND_ROWS 64
+
+struct slic
+{
+    int nrows, ncols, nbands, numk;
+    int offset;			/* radius of the search window */
+    double invwt;
+    struct cache *bands_seg, *k_seg;
+
+    /* seeds */
+    DCELL **kseedsb;
+    double *kseedsx, *kseedsy, *maxdistspeck;
+
+    /* sums of the cells assigned to each seed in the last iteration,
+     * largest spectral distance of each seed if maxdistk is not NULL */
+    DCELL **sigmab;
+    double *sigmax, *sigmay, *maxdistk;
+    int *clustersize;
+
+    /* search windows */
+    int *x1, *x2, *y1, *y2;
+
+    /* seeds bucketed by grid cells of size offset */
+    int gcols, grows, *gstart, *gseeds;
+
+    /* tiles of size tsize of a band of brows rows */
+    int tsize, brows;
+    DCELL *bbuf;
+    int *kbuf;
+    double *dbuf;
+
+    /* seeds searched for a tile, per thread, and seeds of a band */
+    int nthreads, **cand, *bandk;
+};
+
+void slic_init(struct slic *s, int nthreads);
+void slic_free(struct slic *s);
+double slic_assign(struct slic *s);
+int SLIC_EnforceLabelConnectivity(struct cache *k_seg, int ncols, int nrows,
+				  struct cache *nk_seg);
@@ -0,0 +1,203 @@
+/****************************************************************************
+ *
+ * MODULE:     i.vi.mpi
+ * PURPOSE:    Block mode: the rows are split into blocks which are assigned
+ *             round robin to the processes. Each process reads its own
+ *             blocks from the input maps and computes them. The first
+ *             process writes the output map in row order; it receives the
+ *             blocks of the other processes with receives posted ahead, the
+ *             other processes send with non-blocking sends, thus reading,
+ *             computing and communication overlap.
+ *
+ * COPYRIGHT:  (C) 2002-2013 by the GRASS Development Team
+ *
+ *             This program is free software under the GNU General Public
+ *             License (>=v2). Read the file COPYING that comes with GRASS
+ *             for details.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+#include "mpi.h"
+#include "local_proto.h"
+
+#define NCHANNELS 6
+
+/* all blocks travel with one tag: rank 0 keeps at most one receive
+ * posted per worker and posts them in block order, and MPI delivers
+ * the messages of one sender in the order they were sent */
+#define BLOCK_TAG 1
+
+struct block_input
+{
+    int fd[NCHANNELS];		/* -1 if the channel is not given */
+    DCELL *buf[NCHANNELS];	/* one block of rows of each channel */
+};
+
+static void open_inputs(struct vi_params *p, struct block_input *in,
+			int block_rows, int ncols)
+{
+    const char *names[NCHANNELS];
+    int i;
+
+    names[0] = p->red;
+    names[1] = p->nir;
+    names[2] = p->green;
+    names[3] = p->blue;
+    names[4] = p->chan5;
+    names[5] = p->chan7;
+
+    for (i = 0; i < NCHANNELS; i++) {
+	if (names[i][0]) {
+	    in->fd[i] = Rast_open_old(names[i], "");
+	    in->buf[i] =
+		G_malloc((size_t) block_rows * ncols * sizeof(DCELL));
+	}
+	else {
+	    in->fd[i] = -1;
+	    in->buf[i] = NULL;
+	}
+    }
+}
+
+static void close_inputs(struct block_input *in)
+{
+    int i;
+
+    for (i = 0; i < NCHANNELS; i++) {
+	if (in->fd[i] >= 0) {
+	    Rast_close(in->fd[i]);
+	    G_free(in->buf[i]);
+	}
+    }
+}
+
+/* read and compute the rows of block b into out */
+static void compute_block(int b, int vi, int repeat, int block_rows,
+			  int nrows, int ncols, struct block_input *in,
+			  DCELL * out)
+{
+    int row, first, n, i, t;
+    DCELL *ch[NCHANNELS];
+
+    first = b * block_rows;
+    n = nrows - first < block_rows ? nrows - first : block_rows;
+
+    for (row = 0; row < n; row++) {
+	for (i = 0; i < NCHANNELS; i++) {
+	    if (in->fd[i] >= 0) {
+		ch[i] = in->buf[i] + (size_t) row * ncols;
+		Rast_get_d_row(in->fd[i], ch[i], first + row);
+	    }
+	    else
+		ch[i] = NULL;
+	}
+	for (t = 0; t < repeat; t++)
+	    vi_row(vi, ncols, ch[0], ch[1], ch[2], ch[3], ch[4], ch[5],
+		   out + (size_t) row * ncols);
+    }
+}
+
+void vi_blocks(int me, int nprocs, struct vi_params *p)
+{
+    struct block_input in;
+    int nrows, ncols, nblocks, block_rows, vi;
+    int b, i, n, row, slot, window;
+    DCELL **outbuf;
+    MPI_Request *req;
+    MPI_Status status;
+
+    /* the index was validated by rank 0 before the broadcast */
+    vi = vi_index(p->viname);
+    nrows = Rast_window_rows();
+    ncols = Rast_window_cols();
+    block_rows = p->block_rows;
+    nblocks = (nrows + block_rows - 1) / block_rows;
+
+    open_inputs(p, &in, block_rows, ncols);
+
+    if (me > 0) {
+	/* two output buffers: one being sent while the other is computed */
+	outbuf = G_malloc(2 * sizeof(DCELL *));
+	req = G_malloc(2 * sizeof(MPI_Request));
+	for (i = 0; i < 2; i++) {
+	    outbuf[i] =
+		G_malloc((size_t) block_rows * ncols * sizeof(DCELL));
+	    req[i] = MPI_REQUEST_NULL;
+	}
+
+	slot = 0;
+	for (b = me; b < nblocks; b += nprocs) {
+	    MPI_Wait(&req[slot], &status);
+	    compute_block(b, vi, p->repeat, block_rows, nrows, ncols, &in,
+			  outbuf[slot]);
+	    n = nrows - b * block_rows < block_rows ?
+		nrows - b * block_rows : block_rows;
+	    MPI_Isend(outbuf[slot], n * ncols, MPI_DOUBLE, 0, BLOCK_TAG,
+		      MPI_COMM_WORLD, &req[slot]);
+	    slot = 1 - slot;
+	}
+	MPI_Waitall(2, req, MPI_STATUSES_IGNORE);
+    }
+    else {
+	int outfd;
+	struct History history;
+
+	outfd = Rast_open_new(p->output, DCELL_TYPE);
+
+	/* the receives of the next blocks are posted ahead, one buffer
+	 * for each of the following window blocks */
+	window = nprocs < nblocks ? nprocs : nblocks;
+	outbuf = G_malloc(window * sizeof(DCELL *));
+	req = G_malloc(window * sizeof(MPI_Request));
+	for (i = 0; i < window; i++) {
+	    outbuf[i] =
+		G_malloc((size_t) block_rows * ncols * sizeof(DCELL));
+	    req[i] = MPI_REQUEST_NULL;
+	}
+
+	for (b = 0; b < window; b++) {
+	    if (b % nprocs != 0)
+		MPI_Irecv(outbuf[b], block_rows * ncols, MPI_DOUBLE,
+			  b % nprocs, BLOCK_TAG, MPI_COMM_WORLD, &req[b]);
+	}
+
+	for (b = 0; b < nblocks; b++) {
+	    slot = b % window;
+	    G_percent(b, nblocks, 2);
+
+	    if (b % nprocs == 0)
+		compute_block(b, vi, p->repeat, block_rows, nrows, ncols,
+			      &in, outbuf[slot]);
+	    else
+		MPI_Wait(&req[slot], &status);
+
+	    n = nrows - b * block_rows < block_rows ?
+		nrows - b * block_rows : block_rows;
+	    for (row = 0; row < n; row++)
+		Rast_put_d_row(outfd, outbuf[slot] + (size_t) row * ncols);
+
+	    if (b + window < nblocks && (b + window) % nprocs != 0)
+		MPI_Irecv(outbuf[slot], block_rows * ncols, MPI_DOUBLE,
+			  (b + window) % nprocs, BLOCK_TAG, MPI_COMM_WORLD,
+			  &req[slot]);
+	}
+	G_percent(1, 1, 1);
+
+	Rast_close(outfd);
+	Rast_short_history(p->output, "raster", &history);
+	Rast_command_history(&history);
+	Rast_write_history(p->output, &history);
+    }
+
+    for (i = 0; i < (me > 0 ? 2 : window); i++)
+	G_free(outbuf[i]);
+    G_free(outbuf);
+    G_free(req);
+    close_inputs(&in);
+}
@@ -0,0 +1,47 @@
+#ifndef __LOCAL_PROTO_H__
+#define __LOCAL_PROTO_H__
+
+#include <grass/gis.h>
+
+/* vegetation indices, same numbering as the row by row mode */
+#define VI_SR      1
+#define VI_NDVI    2
+#define VI_IPVI    3
+#define VI_DVI     4
+#define VI_PVI     5
+#define VI_WDVI    6
+#define VI_SAVI    7
+#define VI_MSAVI   8
+#define VI_MSAVI2  9
+#define VI_GEMI   10
+#define VI_ARVI   11
+#define VI_GVI    12
+#define VI_GARI   13
+
+/* value written for cells with no data in an input channel */
+#define VI_NULL -999.99
+
+/* parameters broadcast by the first process in the block mode */
+struct vi_params
+{
+    char viname[16];
+    char red[GNAME_MAX + GMAPSET_MAX + 1];
+    char nir[GNAME_MAX + GMAPSET_MAX + 1];
+    char green[GNAME_MAX + GMAPSET_MAX + 1];
+    char blue[GNAME_MAX + GMAPSET_MAX + 1];
+    char chan5[GNAME_MAX + GMAPSET_MAX + 1];
+    char chan7[GNAME_MAX + GMAPSET_MAX + 1];
+    char output[GNAME_MAX];
+    int repeat;
+    int block_rows;
+};
+
+/* vi.c */
+int vi_index(const char *);
+void vi_row(int, int, DCELL *, DCELL *, DCELL *, DCELL *, DCELL *,
+	    DCELL *, DCELL *);
+
+/* blocks.c */
+void vi_blocks(int, int, struct vi_params *);
+
+#endif
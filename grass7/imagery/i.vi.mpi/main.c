@@ -32,11 +32,14 @@
 #include "grass/raster.h"
 #include "grass/glocale.h"
 #include "mpi.h"
+#include "local_proto.h"
 
 int main(int argc, char *argv[])
 {
     int me, host_n, nrows, ncols;
     int NUM_HOSTS;
+    int block_mode;
+    struct vi_params params;
     MPI_Status status;
     MPI_Init(&argc, &argv);
     MPI_Comm_size(MPI_COMM_WORLD, &NUM_HOSTS);
@@ -49,7 +52,7 @@ int main(int argc, char *argv[])
 	char *viflag;		/*Switch for particular index */
 	struct GModule *module;
 	struct Option *input1, *input2, *input3, *input4, *input5, *input6,
-	    *input7, *input8, *output;
+	    *input7, *input8, *input9, *output;
 	struct Flag *flag1;
 	struct History history;	/*metadata */
 	struct Colors colors;	/*colors */
@@ -154,9 +157,21 @@ int main(int argc, char *argv[])
 	input8->gisprompt = _("no of operation value");
 	input8->label = _("User input for number of operation");
 
+	input9 = G_define_option();
+	input9->key = "rows";
+	input9->type = TYPE_INTEGER;
+	input9->required = NO;
+	input9->answer = "32";
+	input9->label = _("Number of rows of a block in the block mode");
+
 	output = G_define_standard_option(G_OPT_R_OUTPUT);
 	output->label = _("Name of the output vi layer");
 
+	flag1 = G_define_flag();
+	flag1->key = 'b';
+	flag1->description =
+	    _("Block mode: each process reads and computes its own blocks of rows");
+
 		/********************/
 	if (G_parser(argc, argv))
 	    exit(EXIT_FAILURE);
@@ -167,7 +182,7 @@ int main(int argc, char *argv[])
 	bluechan = input5->answer;
 	chan5chan = input6->answer;
 	chan7chan = input7->answer;
-	temp = atoi(input8->answer);
+	temp = input8->answer ? atoi(input8->answer) : 1;
 
 	result = output->answer;
 
@@ -208,6 +223,41 @@ int main(int argc, char *argv[])
                 || !(input4->answer) || !(input5->answer)
                 || !(input6->answer) || !(input7->answer)) )
 		G_fatal_error(_("gvi index requires blue, green, red, nir, chan5 and chan7 maps"));
+
+	block_mode = flag1->answer;
+	/* a negative mode tells the workers to quit */
+	if (block_mode && !vi_index(viflag))
+	    block_mode = -1;
+	MPI_Bcast(&block_mode, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (block_mode < 0) {
+	    MPI_Finalize();
+	    G_fatal_error(_("Index <%s> is not available in the block mode"),
+			  viflag);
+	}
+	if (block_mode) {
+	    memset(&params, 0, sizeof(params));
+	    strncpy(params.viname, viflag, sizeof(params.viname) - 1);
+	    strncpy(params.red, redchan, sizeof(params.red) - 1);
+	    strncpy(params.nir, nirchan, sizeof(params.nir) - 1);
+	    if (greenchan)
+		strncpy(params.green, greenchan, sizeof(params.green) - 1);
+	    if (bluechan)
+		strncpy(params.blue, bluechan, sizeof(params.blue) - 1);
+	    if (chan5chan)
+		strncpy(params.chan5, chan5chan, sizeof(params.chan5) - 1);
+	    if (chan7chan)
+		strncpy(params.chan7, chan7chan, sizeof(params.chan7) - 1);
+	    strncpy(params.output, result, sizeof(params.output) - 1);
+	    params.repeat = temp;
+	    params.block_rows = atoi(input9->answer);
+	    if (params.block_rows < 1)
+		params.block_rows = 1;
+	    MPI_Bcast(&params, sizeof(params), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+	    vi_blocks(me, NUM_HOSTS, &params);
+	    MPI_Finalize();
+	    exit(EXIT_SUCCESS);
+	}
 	/***************************************************/
 	infd_redchan = Rast_open_old(redchan, "");
 	data_type_redchan = Rast_map_type(redchan, "");
@@ -727,6 +777,19 @@ int main(int argc, char *argv[])
 	int *I;
 	double *a, *b, *c, *d, *e, *f, *r;
 	/*double *r; */
+
+	MPI_Bcast(&block_mode, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (block_mode < 0) {
+	    MPI_Finalize();
+	    exit(EXIT_FAILURE);
+	}
+	if (block_mode) {
+	    MPI_Bcast(&params, sizeof(params), MPI_BYTE, 0, MPI_COMM_WORLD);
+	    G_gisinit(argv[0]);
+	    vi_blocks(me, NUM_HOSTS, &params);
+	    MPI_Finalize();
+	    exit(EXIT_SUCCESS);
+	}
 	MPI_Recv(&temp, 1, MPI_INT, 0, 1, MPI_COMM_WORLD, &status);
 	MPI_Recv(&nrows, 1, MPI_INT, 0, 1, MPI_COMM_WORLD, &status);
 	MPI_Recv(&ncols, 1, MPI_INT, 0, 1, MPI_COMM_WORLD, &status);
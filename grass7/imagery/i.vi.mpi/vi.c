@@ -0,0 +1,145 @@
+/****************************************************************************
+ *
+ * MODULE:     i.vi.mpi
+ * PURPOSE:    Vegetation indices of a row of cells, used by the block mode.
+ *             The index is selected once per row, thus each loop below is
+ *             a straight computation over the columns the compiler can
+ *             vectorise. Cells with no data in an input channel are set
+ *             afterwards.
+ *
+ * COPYRIGHT:  (C) 2002-2013 by the GRASS Development Team
+ *
+ *             This program is free software under the GNU General Public
+ *             License (>=v2). Read the file COPYING that comes with GRASS
+ *             for details.
+ *
+ *****************************************************************************/
+
+#include <string.h>
+#include <math.h>
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include "local_proto.h"
+
+int vi_index(const char *viname)
+{
+    if (!strcasecmp(viname, "sr"))
+	return VI_SR;
+    if (!strcasecmp(viname, "ndvi"))
+	return VI_NDVI;
+    if (!strcasecmp(viname, "ipvi"))
+	return VI_IPVI;
+    if (!strcasecmp(viname, "dvi"))
+	return VI_DVI;
+    if (!strcasecmp(viname, "pvi"))
+	return VI_PVI;
+    if (!strcasecmp(viname, "wdvi"))
+	return VI_WDVI;
+    if (!strcasecmp(viname, "savi"))
+	return VI_SAVI;
+    if (!strcasecmp(viname, "msavi"))
+	return VI_MSAVI;
+    if (!strcasecmp(viname, "msavi2"))
+	return VI_MSAVI2;
+    if (!strcasecmp(viname, "gemi"))
+	return VI_GEMI;
+    if (!strcasecmp(viname, "arvi"))
+	return VI_ARVI;
+    if (!strcasecmp(viname, "gvi"))
+	return VI_GVI;
+    if (!strcasecmp(viname, "gari"))
+	return VI_GARI;
+
+    return 0;
+}
+
+/* index vi of ncols cells, the channels not needed by the index may be
+ * NULL. The results are the same as those of the row by row mode */
+void vi_row(int vi, int ncols, DCELL * a, DCELL * b, DCELL * c, DCELL * d,
+	    DCELL * e, DCELL * f, DCELL * r)
+{
+    int col;
+    double slope = 1;		/*slope of soil line */
+    double g;
+
+    switch (vi) {
+    case VI_SR:
+	for (col = 0; col < ncols; col++)
+	    r[col] = a[col] == 0.0 ? -1.0 : b[col] / a[col];
+	break;
+    case VI_NDVI:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 :
+		(b[col] - a[col]) / (b[col] + a[col]);
+	break;
+    case VI_IPVI:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 :
+		b[col] / (b[col] + a[col]);
+	break;
+    case VI_DVI:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 : b[col] - a[col];
+	break;
+    case VI_PVI:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 :
+		(sin(1.0) * b[col]) / (cos(1.0) * a[col]);
+	break;
+    case VI_WDVI:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 :
+		b[col] - slope * a[col];
+	break;
+    case VI_SAVI:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 :
+		((1 + 0.5) * (b[col] - a[col])) / (b[col] + a[col] + 0.5);
+	break;
+    case VI_MSAVI:
+    case VI_MSAVI2:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 :
+		(1 / 2) * (2 * (b[col] + 1) -
+			   sqrt((2 * b[col] + 1) * (2 * b[col] + 1)) -
+			   (8 * (b[col] - a[col])));
+	break;
+    case VI_GEMI:
+	for (col = 0; col < ncols; col++) {
+	    g = 2 * ((b[col] * b[col]) - (a[col] * a[col])) +
+		1.5 * b[col] + 0.5 * a[col];
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 :
+		((g / (b[col] + a[col] + 0.5)) *
+		 (1 - 0.25 * g / (b[col] + a[col] + 0.5))) -
+		((a[col] - 0.125) / (1 - a[col]));
+	}
+	break;
+    case VI_ARVI:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 :
+		(b[col] - (2 * a[col] - d[col])) /
+		(b[col] + (2 * a[col] - d[col]));
+	break;
+    case VI_GVI:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] + a[col]) == 0.0 ? -1.0 :
+		(-0.2848 * d[col] - 0.2435 * c[col] - 0.5436 * a[col] +
+		 0.7243 * b[col] + 0.0840 * e[col] - 0.1800 * f[col]);
+	break;
+    case VI_GARI:
+	for (col = 0; col < ncols; col++)
+	    r[col] = (b[col] - (c[col] - (d[col] - a[col]))) /
+		(b[col] + (c[col] - (d[col] - a[col])));
+	break;
+    }
+
+    /* no data in any of the given channels */
+    for (col = 0; col < ncols; col++) {
+	if (Rast_is_d_null_value(&a[col]) || Rast_is_d_null_value(&b[col]) ||
+	    (c && Rast_is_d_null_value(&c[col])) ||
+	    (d && Rast_is_d_null_value(&d[col])) ||
+	    (e && Rast_is_d_null_value(&e[col])) ||
+	    (f && Rast_is_d_null_value(&f[col])))
+	    r[col] = VI_NULL;
+    }
+}
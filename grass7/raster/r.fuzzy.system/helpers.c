@@ -89,6 +89,65 @@ int get_universe(void)
     return 0;
 }
 
+int build_tables(void)
+/* memberships of the output sets at the universe points, and of the terms
+   of integer maps for every value in the range of the map */
+{
+    struct Range range;
+    CELL min, max;
+    STRING mapset;
+    TERMS *term;
+    SETS *sets = s_maps[output_index].sets;
+    int i, j;
+
+    consequents =
+	(float **)G_malloc(s_maps[output_index].nsets * sizeof(float *));
+    for (j = 0; j < s_maps[output_index].nsets; ++j) {
+	consequents[j] = (float *)G_malloc(resolution * sizeof(float));
+	for (i = 0; i < resolution; ++i)
+	    consequents[j][i] = fuzzy(universe[i], &sets[j]);
+    }
+
+    for (j = 0; j < nterms; ++j) {
+	term = &s_terms[j];
+	if (s_maps[term->map].raster_type != CELL_TYPE)
+	    continue;
+
+	mapset = (STRING) G_find_raster2(s_maps[term->map].name, "");
+	if (Rast_read_range(s_maps[term->map].name, mapset, &range) != 1)
+	    continue;
+	Rast_get_range_min_max(&range, &min, &max);
+	if (Rast_is_c_null_value(&min) || Rast_is_c_null_value(&max) ||
+	    (double)max - min >= TABLEMAX)
+	    continue;
+
+	term->min = min;
+	term->size = max - min + 1;
+	term->table = (float *)G_malloc(term->size * sizeof(float));
+	for (i = 0; i < term->size; ++i) {
+	    term->table[i] = fuzzy((DCELL) (min + i), term->set);
+	    if (term->oper == '~')
+		term->table[i] = f_not(term->table[i], family);
+	}
+    }
+
+    return 0;
+}
+
+void free_tables(void)
+{
+    int i;
+
+    for (i = 0; i < s_maps[output_index].nsets; ++i)
+	G_free(consequents[i]);
+    G_free(consequents);
+
+    for (i = 0; i < nterms; ++i)
+	if (s_terms[i].table)
+	    G_free(s_terms[i].table);
+    G_free(s_terms);
+}
+
 void process_coors(char *answer)
 {
 
@@ -98,6 +157,8 @@ void process_coors(char *answer)
     int r, c;
     int num_points;
     float result;
+    void **bufs;
+    WORK work;
 
     visual_output = (float **)G_malloc(resolution * sizeof(float *));
 
@@ -113,14 +174,16 @@ void process_coors(char *answer)
     c = (int)Rast_easting_to_col(x, &window);
     r = (int)Rast_northing_to_row(y, &window);
 
-    get_rows(r);
-    get_cells(c);
+    bufs = allocate_bufs();
+    init_work(&work);
+    get_rows(r, bufs);
+    get_cells(bufs, c, work.cells);
 
-    result = implicate();	/* jump to different function */
+    result = implicate(&work);	/* jump to different function */
 
     for (i = 0; i < nrules; ++i)
 	fprintf(stdout, "ANTECEDENT %s: %5.3f\n", s_rules[i].outname,
-		antecedents[i]);
+		work.antecedents[i]);
 
     fprintf(stdout, "RESULT (defuzzified):  %5.3f\n", result);
 
@@ -138,11 +201,14 @@ void process_coors(char *answer)
 		fprintf(stdout, "\n");
 	}
 
+    free_bufs(bufs);
+    free_work(&work);
+    free_tables();
+
     for (i = 0; i < nmaps; ++i) {
 	G_free(s_maps[i].sets);
 	if (s_maps[i].output)
 	    continue;
-	G_free(s_maps[i].in_buf);
 	Rast_close(s_maps[i].cfd);
     }
 
@@ -150,7 +216,6 @@ void process_coors(char *answer)
 	G_free(visual_output[j]);
     G_free(visual_output);
 
-    G_free(antecedents);
     G_free(s_maps);
     G_free(s_rules);
 
@@ -8,10 +8,8 @@ int open_maps(void)
     struct Cell_head cellhd;
 
     for (i = 0; i < nmaps; ++i) {
-	if (s_maps[i].output) {
-	    s_maps[i].in_buf = NULL;
+	if (s_maps[i].output)
 	    continue;
-	}
 	mapset = (char *)G_find_raster2(s_maps[i].name, "");
 
 	if (mapset == NULL)
@@ -21,25 +19,47 @@ int open_maps(void)
 	Rast_get_cellhd(s_maps[i].name, mapset, &cellhd);
 
 	s_maps[i].raster_type = Rast_map_type(s_maps[i].name, mapset);
-	s_maps[i].in_buf = Rast_allocate_buf(s_maps[i].raster_type);
     }
     return 0;
 }
 
-int get_rows(int row)
+void **allocate_bufs(void)
+/* row buffers of the input maps, one set for every thread */
+{
+    int i;
+    void **bufs;
+
+    bufs = (void **)G_malloc(nmaps * sizeof(void *));
+    for (i = 0; i < nmaps; ++i)
+	bufs[i] = s_maps[i].output ? NULL :
+	    Rast_allocate_buf(s_maps[i].raster_type);
+    return bufs;
+}
+
+void free_bufs(void **bufs)
+{
+    int i;
+
+    for (i = 0; i < nmaps; ++i)
+	if (bufs[i])
+	    G_free(bufs[i]);
+    G_free(bufs);
+}
+
+int get_rows(int row, void **bufs)
 {
     int i;
 
     for (i = 0; i < nmaps; ++i) {
 	if (s_maps[i].output)
 	    continue;
-	Rast_get_row(s_maps[i].cfd, s_maps[i].in_buf, row,
-		     s_maps[i].raster_type);
+	Rast_get_row(s_maps[i].cfd, bufs[i], row, s_maps[i].raster_type);
     }
     return 0;
 }
 
-int get_cells(int col)
+int get_cells(void **bufs, int col, DCELL * cells)
+/* values of the maps at col, returns 1 if any of them is null */
 {
     int i;
     CELL c;
@@ -54,27 +74,27 @@ int get_cells(int col)
 	switch (s_maps[i].raster_type) {
 
 	case CELL_TYPE:
-	    c = ((CELL *) s_maps[i].in_buf)[col];
+	    c = ((CELL *) bufs[i])[col];
 	    if (Rast_is_null_value(&c, CELL_TYPE))
 		return 1;
 	    else
-		s_maps[i].cell = (DCELL) c;
+		cells[i] = (DCELL) c;
 	    break;
 
 	case FCELL_TYPE:
-	    f = ((FCELL *) s_maps[i].in_buf)[col];
+	    f = ((FCELL *) bufs[i])[col];
 	    if (Rast_is_null_value(&f, FCELL_TYPE))
 		return 1;
 	    else
-		s_maps[i].cell = (DCELL) f;
+		cells[i] = (DCELL) f;
 	    break;
 
 	case DCELL_TYPE:
-	    d = ((DCELL *) s_maps[i].in_buf)[col];
+	    d = ((DCELL *) bufs[i])[col];
 	    if (Rast_is_null_value(&d, DCELL_TYPE))
 		return 1;
 	    else
-		s_maps[i].cell = (DCELL) d;
+		cells[i] = (DCELL) d;
 	    break;
 	}
     }				/* end for */
@@ -5,6 +5,9 @@
 #include <grass/gis.h>
 #include <grass/raster.h>
 #include <grass/glocale.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 /*
    PI2= PI/2
@@ -20,6 +23,7 @@
 
 #define STACKMAX 500
 #define VARMAX 50
+#define TABLEMAX 65536		/* max number of values of a membership table */
 
 #undef MIN
 #undef MAX
@@ -107,19 +111,23 @@ typedef struct
     int output;			/* is output map? */
     RASTER_MAP_TYPE raster_type;
     fpos_t position;
-    void *in_buf;
-    DCELL cell;
     int cfd;			/* file descriptor */
     SETS *sets;
 } MAPS;
 
 typedef struct
 {
-    DCELL *value;
+    int map;			/* index in s_maps */
     SETS *set;
     char oper;
 } VALUES;
 
+typedef struct
+{				/* one step of a compiled rule */
+    tokens token;		/* t_VAL, t_AND or t_OR */
+    int term;			/* index in s_terms if t_VAL */
+} CODE;
+
 
 typedef struct			/* stores queues with rules */
 {
@@ -128,9 +136,30 @@ typedef struct			/* stores queues with rules */
     char parse_queue[STACKMAX][VARMAX];	/* original rule */
     int work_queue[STACKMAX];	/* symbols of values and operators */
     VALUES value_queue[STACKMAX];	/* pointers to values, operators and sets */
+    CODE program[STACKMAX];	/* rule in postfix order */
+    int program_len;
     float weight;
 } RULES;
 
+typedef struct
+{				/* map = set or map ~ set, shared by the rules */
+    int map;
+    SETS *set;
+    char oper;
+    float *table;		/* memberships of CELL values from min, or NULL */
+    CELL min;
+    int size;
+} TERMS;
+
+typedef struct
+{				/* working space of one thread */
+    DCELL *cells;		/* values of the maps at the cell */
+    float *members;		/* memberships of the terms */
+    float *antecedents;
+    float *agregate;
+    float *stack;
+} WORK;
+
 typedef struct _outs
 {
     char output_name[52];
@@ -144,12 +173,12 @@ extern STRING rule_name_file;
 extern STRING output;
 extern MAPS *s_maps;
 extern RULES *s_rules;
+extern TERMS *s_terms;
 extern OUTPUTS *m_outputs;
 extern float **visual_output;
 extern float *universe;
-extern float *antecedents;
-extern float *agregate;
-extern int nmaps, nrules, output_index, multiple, membership_only, coor_proc;
+extern float **consequents;
+extern int nmaps, nrules, nterms, output_index, multiple, membership_only, coor_proc;
 extern int resolution;
 extern implications implication;
 extern defuzz defuzzification;
@@ -169,17 +198,24 @@ int parse_rule_file(STRING file);
 int parser(void);
 int open_maps(void);
 int create_output_maps(void);
-int get_rows(int row);
-int get_cells(int col);
+int get_rows(int row, void **bufs);
+int get_cells(void **bufs, int col, DCELL * cells);
+void **allocate_bufs(void);
+void free_bufs(void **bufs);
 
 int parse_sets(SETS * set, char buf[], const char mapname[]);
 int parse_rules(int rule_num, int n, char buf[]);
+int compile_rule(int rule_num);
+int build_tables(void);
+void free_tables(void);
+void init_work(WORK * w);
+void free_work(WORK * w);
 void process_coors(char *answer);
 void show_membership(void);
 
-float implicate(void);
-float parse_expression(int n);
-float defuzzify(int defuzzification, float max_agregate);
+float implicate(WORK * w);
+float evaluate(int n, WORK * w);
+float defuzzify(float *agregate, int defuzzification, float max_agregate);
 
 float f_and(float cellx, float celly, logics family);
 float f_or(float cellx, float celly, logics family);
@@ -21,12 +21,12 @@ STRING rule_name_file;
 STRING output;
 MAPS *s_maps;
 RULES *s_rules;
+TERMS *s_terms;
 OUTPUTS *m_outputs;
 float **visual_output;
 float *universe;
-float *antecedents;
-float *agregate;
-int nmaps, nrules, output_index, multiple, membership_only, coor_proc;
+float **consequents;
+int nmaps, nrules, nterms, output_index, multiple, membership_only, coor_proc;
 int resolution;
 implications implication;
 defuzz defuzzification;
@@ -41,7 +41,8 @@ int main(int argc, char **argv)
 	*file_rules,
 	*par_family,
 	*par_resolution,
-	*par_defuzzify, *par_implication, *in_coor_opt, *opt_output;
+	*par_defuzzify, *par_implication, *in_coor_opt, *opt_output,
+	*par_threads;
 
     struct History history;
 
@@ -49,10 +50,14 @@ int main(int argc, char **argv)
     struct Flag *out_multiple, *out_membership;
 
     int nrows, ncols;
-    int row, col;
+    int col;
     int outfd;
     float tmp;
-    FCELL *out_buf;
+    FCELL **out_buf;
+    FCELL ***rule_buf;
+    void ***bufs;
+    WORK *work;
+    int row0, nchunk, t, nthreads;
 
     int i, j, n;
 
@@ -122,6 +127,13 @@ int main(int argc, char **argv)
 	"Coordinate of cell for detail data (print end exit)";
     in_coor_opt->guisection = _("Visual Output");
 
+    par_threads = G_define_option();
+    par_threads->key = "threads";
+    par_threads->type = TYPE_INTEGER;
+    par_threads->required = NO;
+    par_threads->description = _("Number of threads for parallel computing");
+    par_threads->answer = "1";
+
     out_membership = G_define_flag();
     out_membership->key = 'o';
     out_membership->description = _("Print only membership values and exit");
@@ -156,6 +168,18 @@ int main(int argc, char **argv)
     if (resolution > 500)
 	G_warning(_("Universe resolution is very high, computation may take a long time"));
 
+    nthreads = atoi(par_threads->answer);
+    if (nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than 0"), par_threads->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+    nthreads = 1;
+#endif
+
     if (!strcmp(par_family->answer, "Zadeh"))
 	family = l_ZADEH;
     else if (!strcmp(par_family->answer, "product"))
@@ -195,51 +219,79 @@ int main(int argc, char **argv)
     parse_rule_file(rule_name_file);
     get_universe();
     open_maps();
+    build_tables();
 
-    antecedents = (float *)G_malloc(nrules * sizeof(float));
-    agregate = (float *)G_calloc(resolution, sizeof(float));
     if (coor_proc)
 	process_coors(in_coor_opt->answer);
 
     outfd = Rast_open_new(output, FCELL_TYPE);
-    out_buf = Rast_allocate_f_buf();
 
     if (multiple)
 	create_output_maps();
 
-    G_message("Calculate...");
+    /* input rows, output rows and working space of every thread */
+    bufs = (void ***)G_malloc(nthreads * sizeof(void **));
+    work = (WORK *) G_malloc(nthreads * sizeof(WORK));
+    out_buf = (FCELL **) G_malloc(nthreads * sizeof(FCELL *));
+    rule_buf = (FCELL ***) G_malloc(nthreads * sizeof(FCELL **));
+    for (t = 0; t < nthreads; ++t) {
+	bufs[t] = allocate_bufs();
+	init_work(&work[t]);
+	out_buf[t] = Rast_allocate_f_buf();
+	rule_buf[t] = NULL;
+	if (multiple) {
+	    rule_buf[t] = (FCELL **) G_malloc(nrules * sizeof(FCELL *));
+	    for (i = 0; i < nrules; ++i)
+		rule_buf[t][i] = t ? Rast_allocate_f_buf() :
+		    m_outputs[i].out_buf;
+	}
+    }
 
-    for (row = 0; row < nrows; ++row) {
-	G_percent(row, nrows, 2);
-	get_rows(row);
-	for (col = 0; col < ncols; ++col) {
-	    if (get_cells(col)) {
-		Rast_set_f_null_value(&out_buf[col], 1);
+    G_message("Calculate...");
 
-		if (multiple) {
-		    for (i = 0; i < nrules; ++i)
-			Rast_set_f_null_value(&m_outputs[i].out_buf[col], 1);
+    /* a chunk of rows is classified in parallel, one row per thread,
+     * and written in order */
+    for (row0 = 0; row0 < nrows; row0 += nthreads) {
+	G_percent(row0, nrows, 2);
+	nchunk = nrows - row0 < nthreads ? nrows - row0 : nthreads;
+
+	for (t = 0; t < nchunk; ++t)
+	    get_rows(row0 + t, bufs[t]);
+
+#pragma omp parallel for schedule(static, 1) private(col, i)
+	for (t = 0; t < nchunk; ++t) {
+	    for (col = 0; col < ncols; ++col) {
+		if (get_cells(bufs[t], col, work[t].cells)) {
+		    Rast_set_f_null_value(&out_buf[t][col], 1);
+
+		    if (multiple) {
+			for (i = 0; i < nrules; ++i)
+			    Rast_set_f_null_value(&rule_buf[t][i][col], 1);
+		    }
 		}
-	    }
-	    else {
-		out_buf[col] = implicate();
-		if (out_buf[col] == -9999)
-		    Rast_set_f_null_value(&out_buf[col], 1);
-
-		if (multiple) {
-		    for (i = 0; i < nrules; ++i)
-			m_outputs[i].out_buf[col] = antecedents[i];
+		else {
+		    out_buf[t][col] = implicate(&work[t]);
+		    if (out_buf[t][col] == -9999)
+			Rast_set_f_null_value(&out_buf[t][col], 1);
+
+		    if (multiple) {
+			for (i = 0; i < nrules; ++i)
+			    rule_buf[t][i][col] = work[t].antecedents[i];
+		    }
 		}
 	    }
 	}
-	Rast_put_row(outfd, out_buf, FCELL_TYPE);
 
-	if (multiple)
-	    for (i = 0; i < nrules; ++i)
-		Rast_put_row(m_outputs[i].ofd, m_outputs[i].out_buf,
-			     FCELL_TYPE);
+	for (t = 0; t < nchunk; ++t) {
+	    Rast_put_row(outfd, out_buf[t], FCELL_TYPE);
+
+	    if (multiple)
+		for (i = 0; i < nrules; ++i)
+		    Rast_put_row(m_outputs[i].ofd, rule_buf[t][i],
+				 FCELL_TYPE);
+	}
     }
-    G_percent(row, nrows, 2);
+    G_percent(nrows, nrows, 2);
 
     G_message("Close...");
 
@@ -255,12 +307,24 @@ int main(int argc, char **argv)
 	G_free(s_maps[i].sets);
 	if (s_maps[i].output)
 	    continue;
-	G_free(s_maps[i].in_buf);
 	Rast_close(s_maps[i].cfd);
     }
-    G_free(antecedents);
-    G_free(agregate);
+    for (t = 0; t < nthreads; ++t) {
+	free_bufs(bufs[t]);
+	free_work(&work[t]);
+	G_free(out_buf[t]);
+	if (multiple) {
+	    for (i = 0; i < nrules; ++i)
+		if (t)
+		    G_free(rule_buf[t][i]);
+	    G_free(rule_buf[t]);
+	}
+    }
+    G_free(bufs);
+    G_free(work);
     G_free(out_buf);
+    G_free(rule_buf);
+    free_tables();
     G_free(s_maps);
     G_free(s_rules);
 
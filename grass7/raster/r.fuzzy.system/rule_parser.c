@@ -192,8 +192,7 @@ int parse_rules(int rule_num, int n, char buf[])
 				s_rules[rule_num].work_queue[work_queue_pos] =
 				    t_VAL;
 				s_rules[rule_num].
-				    value_queue[work_queue_pos].value =
-				    &s_maps[j].cell;
+				    value_queue[work_queue_pos].map = j;
 				s_rules[rule_num].
 				    value_queue[work_queue_pos].set =
 				    &s_maps[j].sets[k];
@@ -308,5 +307,73 @@ int parse_rules(int rule_num, int n, char buf[])
 
     }				/* END check if rule syntax is proper and map names and vars values exist */
 
+    compile_rule(rule_num);
+
     return 0;
 }				/* END parse_rules */
+
+
+static int add_term(VALUES * value)
+/* index of the term of the value, terms used by several rules are stored once */
+{
+    int i;
+
+    for (i = 0; i < nterms; ++i)
+	if (s_terms[i].map == value->map && s_terms[i].set == value->set &&
+	    s_terms[i].oper == value->oper)
+	    return i;
+
+    s_terms = (TERMS *) G_realloc(s_terms, (nterms + 1) * sizeof(TERMS));
+    s_terms[nterms].map = value->map;
+    s_terms[nterms].set = value->set;
+    s_terms[nterms].oper = value->oper;
+    s_terms[nterms].table = NULL;
+    s_terms[nterms].min = 0;
+    s_terms[nterms].size = 0;
+
+    return nterms++;
+}
+
+
+int compile_rule(int rule_num)
+/* convert the checked work queue to postfix order, with the operators
+   applied in the same order as the shift-reduce parser did: & and | are
+   of equal precedence and left associative */
+{
+    RULES *rule = &s_rules[rule_num];
+    tokens operator_stack[STACKMAX];
+    int opr_top = 0;
+    int i, n = 0;
+
+    for (i = 1; rule->work_queue[i] != t_STOP; ++i) {
+	switch (rule->work_queue[i]) {
+
+	case t_VAL:
+	    rule->program[n].token = t_VAL;
+	    rule->program[n++].term = add_term(&rule->value_queue[i]);
+	    break;
+
+	case t_AND:
+	case t_OR:
+	    while (opr_top > 0 && operator_stack[opr_top - 1] != t_LBRC)
+		rule->program[n++].token = operator_stack[--opr_top];
+	    operator_stack[opr_top++] = rule->work_queue[i];
+	    break;
+
+	case t_LBRC:
+	    operator_stack[opr_top++] = t_LBRC;
+	    break;
+
+	case t_RBRC:
+	    while (operator_stack[opr_top - 1] != t_LBRC)
+		rule->program[n++].token = operator_stack[--opr_top];
+	    opr_top--;
+	    break;
+	}
+    }
+    while (opr_top > 0)
+	rule->program[n++].token = operator_stack[--opr_top];
+
+    rule->program_len = n;
+    return 0;
+}
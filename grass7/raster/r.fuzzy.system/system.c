@@ -1,24 +1,43 @@
 #include "local_proto.h"
 
-float implicate(void)
+static float membership(TERMS * term, DCELL * cells)
+{
+    DCELL cell = cells[term->map];
+    float f_value;
+    int k;
+
+    if (term->table) {
+	k = (int)cell - term->min;
+	if (k >= 0 && k < term->size)
+	    return term->table[k];
+    }
+    f_value = fuzzy(cell, term->set);
+    return (term->oper == '~') ? f_not(f_value, family) : f_value;
+}
+
+float implicate(WORK * w)
 {
 
     int i, j;
 
-    //float *agregate = NULL;
     int set_index;
-    float consequent;
+    float antecedent;
+    float *consequent;
+    float *agregate = w->agregate;
     float max_antecedent = 0;
     float max_agregate = 0;
     float result;
 
     memset(agregate, 0, resolution * sizeof(float));
 
+    for (j = 0; j < nterms; ++j)
+	w->members[j] = membership(&s_terms[j], w->cells);
+
     for (j = 0; j < nrules; ++j) {
-	antecedents[j] = parse_expression(j);
+	w->antecedents[j] = evaluate(j, w);
 	max_antecedent =
 	    (max_antecedent >
-	     antecedents[j]) ? max_antecedent : antecedents[j];
+	     w->antecedents[j]) ? max_antecedent : w->antecedents[j];
     }
 
     if (max_antecedent == 0. && !coor_proc)
@@ -26,141 +45,104 @@ float implicate(void)
 
     for (j = 0; j < nrules; ++j) {
 
-	if (defuzzification > d_BISECTOR && antecedents[j] < max_antecedent &&
+	antecedent = w->antecedents[j];
+	if (defuzzification > d_BISECTOR && antecedent < max_antecedent &&
 	    !coor_proc)
 	    continue;
+	/* implication of 0 can not raise the agregate */
+	if (antecedent == 0. && !coor_proc)
+	    continue;
 
 	set_index = s_rules[j].output_set_index;
+	consequent = consequents[set_index];
 
-	for (i = 0; i < resolution; ++i) {
-
-	    consequent = fuzzy(universe[i],
-			       &s_maps[output_index].sets[set_index]);
-
-	    consequent = (!implication) ? MIN(antecedents[j], consequent) :
-		antecedents[j] * consequent;
-	    agregate[i] = MAX(agregate[i], consequent);
-
-	    max_agregate = (max_agregate > agregate[i])
-		? max_agregate : agregate[i];
-
-
-	    if (coor_proc)
-		visual_output[i][j + 1] = consequent;
+	if (!implication) {
+	    for (i = 0; i < resolution; ++i)
+		agregate[i] = MAX(agregate[i], MIN(antecedent, consequent[i]));
+	}
+	else {
+	    for (i = 0; i < resolution; ++i)
+		agregate[i] = MAX(agregate[i], antecedent * consequent[i]);
 	}
 
+	if (coor_proc)
+	    for (i = 0; i < resolution; ++i)
+		visual_output[i][j + 1] = (!implication) ?
+		    MIN(antecedent, consequent[i]) : antecedent * consequent[i];
     }
     if (coor_proc)
 	for (i = 0; i < resolution; ++i)
 	    visual_output[i][j + 1] = agregate[i];
 
-    result = defuzzify(defuzzification, max_agregate);
+    for (i = 0; i < resolution; ++i)
+	max_agregate = (max_agregate > agregate[i])
+	    ? max_agregate : agregate[i];
+
+    result = defuzzify(agregate, defuzzification, max_agregate);
     return result;
 }
 
-float parse_expression(int n)
+float evaluate(int n, WORK * w)
+/* run the compiled rule on the memberships of the terms */
 {
-
-    /*  tokens and actions must heve the same order */
-    actions parse_tab[t_size][t_size] = {
-	/* stk -----------INPUT------------------ */
-	/*              {   &  | ~   =  (  )  }   */
-	/*      --  -- -- -- -- -- -- -- */
-	/* { */ {E, S, S, E, E, S, E, A},
-	/* & */ {E, R, R, E, E, S, R, R},
-	/* | */ {E, R, R, E, E, S, R, R},
-	/* ~ */ {E, E, E, E, E, E, E, E},
-	/* = */ {E, E, E, E, E, E, E, E},
-	/* ( */ {E, S, S, E, E, S, S, E},
-	/* ) */ {E, R, R, E, E, E, R, R},
-	/* } */ {E, E, E, E, E, E, E, E}
-    };
-
-    tokens operator_stack[STACKMAX];
-    float values_stack[STACKMAX];
-
-    int i = 0, k = 0;
-    int opr_top = 0;
-    int val_top = 0;
-    int set_index;
-    float f_value;
-
-
-    do {
-	if (s_rules[n].work_queue[i] == t_START) {	/* first token */
-	    if (i > 0)
-		G_fatal_error("Operator stack error, contact author");
-	    operator_stack[opr_top] = t_START;
-	    continue;
-	}
-
-	if (s_rules[n].work_queue[i] == t_VAL) {
-	    f_value =
-		fuzzy(*s_rules[n].value_queue[i].value,
-		      s_rules[n].value_queue[i].set);
-	    values_stack[++val_top] =
-		(s_rules[n].value_queue[i].oper == '~') ? f_not(f_value,
-								family) :
-		f_value;
-	    continue;
+    CODE *code = s_rules[n].program;
+    float *values_stack = w->stack;
+    int i;
+    int val_top = -1;
+
+    for (i = 0; i < s_rules[n].program_len; ++i) {
+	switch (code[i].token) {
+
+	case t_VAL:
+	    values_stack[++val_top] = w->members[code[i].term];
+	    break;
+
+	case t_AND:
+	    values_stack[val_top - 1] =
+		f_and(values_stack[val_top], values_stack[val_top - 1],
+		      family);
+	    val_top--;
+	    break;
+
+	case t_OR:
+	    values_stack[val_top - 1] =
+		f_or(values_stack[val_top], values_stack[val_top - 1],
+		     family);
+	    val_top--;
+	    break;
+
+	default:
+	    G_fatal_error("Program error, contact author");
 	}
+    }
 
-	if (s_rules[n].work_queue[i] < t_size) {
-	    switch (parse_tab[operator_stack[opr_top]]
-		    [s_rules[n].work_queue[i]]) {
-
-	    case E:		/* error */
-		G_fatal_error("Stack error, contact author");
-		break;
-
-	    case S:		/* shift */
-		operator_stack[++opr_top] = s_rules[n].work_queue[i];
-		break;
-
-	    case R:		/* reduce */
-
-		switch (operator_stack[opr_top]) {
-
-		case t_AND:
-		    values_stack[val_top - 1] =
-			f_and(values_stack[val_top],
-			      values_stack[val_top - 1], family);
-		    val_top--;
-		    break;
-
-		case t_OR:
-		    values_stack[val_top - 1] =
-			f_or(values_stack[val_top], values_stack[val_top - 1],
-			     family);
-		    val_top--;
-		    break;
-
-		case t_RBRC:
-		    opr_top--;
-		    break;
-		}
-
-		opr_top--;
-		i--;
-		break;
-
-	    case A:		/* accept */
-
-		if (!val_top)
-		    G_fatal_error("Stack error at end, contact author");
-		return values_stack[val_top];
+    if (val_top != 0)
+	G_fatal_error("Stack error at end, contact author");
+    return values_stack[0];
+}
 
-	    }
-	}
 
-    } while (s_rules[n].work_queue[i++] != t_STOP);
+void init_work(WORK * w)
+{
+    w->cells = (DCELL *) G_calloc(nmaps, sizeof(DCELL));
+    w->members = (float *)G_calloc(nterms > 0 ? nterms : 1, sizeof(float));
+    w->antecedents = (float *)G_malloc(nrules * sizeof(float));
+    w->agregate = (float *)G_calloc(resolution, sizeof(float));
+    w->stack = (float *)G_malloc(STACKMAX * sizeof(float));
+}
 
-    G_fatal_error("Parse Stack empty, contact author");
+void free_work(WORK * w)
+{
+    G_free(w->cells);
+    G_free(w->members);
+    G_free(w->antecedents);
+    G_free(w->agregate);
+    G_free(w->stack);
 }
 
 
 
-float defuzzify(int defuzzification, float max_agregate)
+float defuzzify(float *agregate, int defuzzification, float max_agregate)
 {
     int i;
     float d_value = 0;
@@ -185,7 +167,7 @@ float defuzzify(int defuzzification, float max_agregate)
 	return universe[i];
 
     case d_MAXOFHIGHEST:
-	for (i = resolution; agregate[i] < max_agregate; --i) ;
+	for (i = resolution - 1; agregate[i] < max_agregate; --i) ;
 	return universe[i];
 
     case d_MEANOFHIGHEST:
@@ -10,6 +10,13 @@
 #include <grass/raster.h>
 #include "local_proto.h"
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+/* number of cells to use for bandwidth estimation */
+#define NSAMPLES 10000
+
 #ifndef USE_RAND
 
 #ifndef HAVE_DRAND48
@@ -48,10 +55,12 @@ void init_rand(void)
 #endif
 
 /* estimate bandwidth
- * start with a small bandwidth */
+ * start with a small bandwidth
+ * 
+ * row-by-row version, used if the input maps do not fit into memory */
 
-int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
-        DCELL *est, int bw)
+static int estimate_bandwidth_rows(int *inx, int ninx, int iny, int nrows,
+        int ncols, DCELL *est, int bw)
 {
     int i;
     int r, c;
@@ -87,7 +96,7 @@ int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
 	G_fatal_error(_("No non-NULL cells in input map"));
 
     /* number of cells to use for bandwidth estimation */
-    nr = 10000;
+    nr = NSAMPLES;
     if (nr > nc)
 	nr = nc;
 
@@ -420,3 +429,334 @@ int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
 
     return bw;
 }
+
+/* in-memory cross-validation
+ *
+ * all input maps are loaded once into a read-only cache,
+ * a fixed random sample of cells is drawn once and used for all
+ * candidate bandwidths, and the sampled cells are distributed
+ * over threads for each candidate bandwidth */
+
+struct bwcache
+{
+    int nrows, ncols, ninx;
+    DCELL **x;			/* x[i][row * ncols + col] */
+    DCELL *y;
+    int nsamp;			/* number of sampled cells */
+    int *srow, *scol;		/* sampled cells */
+    double *err;		/* squared error for each sampled cell */
+    double *score;		/* memo of CV scores, index is bandwidth */
+    int bwmax;
+};
+
+/* copy the moving window around a sampled cell into
+ * row buffers as used by gwr() with cc = 0 */
+static void fill_window(struct bwcache *bc, struct rb *xwin, struct rb *ywin,
+			int bw, int row, int col)
+{
+    int i, r, c, rr, cc, nsize;
+    size_t idx;
+
+    nsize = bw * 2 + 1;
+
+    for (r = 0; r < nsize; r++) {
+	rr = row - bw + r;
+	if (rr < 0 || rr >= bc->nrows) {
+	    for (i = 0; i < bc->ninx; i++)
+		Rast_set_d_null_value(xwin[i].buf[r], nsize);
+	    Rast_set_d_null_value(ywin->buf[r], nsize);
+	    continue;
+	}
+	for (c = 0; c < nsize; c++) {
+	    cc = col - bw + c;
+	    if (cc < 0 || cc >= bc->ncols) {
+		for (i = 0; i < bc->ninx; i++)
+		    Rast_set_d_null_value(&(xwin[i].buf[r][c]), 1);
+		Rast_set_d_null_value(&(ywin->buf[r][c]), 1);
+		continue;
+	    }
+	    idx = (size_t)rr * bc->ncols + cc;
+	    for (i = 0; i < bc->ninx; i++)
+		xwin[i].buf[r][c] = bc->x[i][idx];
+	    ywin->buf[r][c] = bc->y[idx];
+	}
+    }
+}
+
+/* leave-one-out cross-validation score for bandwidth bw:
+ * mean squared error over all sampled cells
+ * returns infinity if any of the sampled cells could not be estimated */
+static double cv_score(struct bwcache *bc, int bw)
+{
+    int s, nfailed;
+    double **w, ss;
+
+    if (bw < 1)
+	return 1.0 / 0.0;
+    if (bw <= bc->bwmax && bc->score[bw] >= 0)
+	return bc->score[bw];
+
+    G_message(_("Testing bandwidth %d"), bw);
+
+    w = calc_weights(bw);
+    /* leave one out: the center cell */
+    w[bw][bw] = 0.;
+
+    nfailed = 0;
+
+#pragma omp parallel private(s)
+    {
+	int i;
+	struct rb *xwin, ywin;
+	DCELL *est, yval;
+
+	xwin = G_malloc(bc->ninx * sizeof(struct rb));
+	for (i = 0; i < bc->ninx; i++)
+	    allocate_bufs(&(xwin[i]), 1, bw, -1);
+	allocate_bufs(&ywin, 1, bw, -1);
+	est = G_malloc((bc->ninx + 1) * sizeof(DCELL));
+
+#pragma omp for schedule(dynamic, 16) reduction(+:nfailed)
+	for (s = 0; s < bc->nsamp; s++) {
+	    fill_window(bc, xwin, &ywin, bw, bc->srow[s], bc->scol[s]);
+	    yval = ywin.buf[bw][bw];
+
+	    if (gwr(xwin, bc->ninx, &ywin, 0, bw, w, est, NULL)) {
+		bc->err[s] = (est[0] - yval) * (est[0] - yval);
+	    }
+	    else {
+		bc->err[s] = 0;
+		nfailed++;
+	    }
+	}
+
+	for (i = 0; i < bc->ninx; i++)
+	    release_bufs(&(xwin[i]));
+	release_bufs(&ywin);
+	G_free(xwin);
+	G_free(est);
+    }
+
+    G_free(w[0]);
+    G_free(w);
+
+    if (nfailed) {
+	G_debug(1, "%d of %d cells failed for bandwidth %d",
+	        nfailed, bc->nsamp, bw);
+	ss = 1.0 / 0.0;
+    }
+    else {
+	/* sum up in a fixed order: independent of the number of threads */
+	ss = 0;
+	for (s = 0; s < bc->nsamp; s++)
+	    ss += bc->err[s];
+	ss /= bc->nsamp;
+    }
+    G_debug(1, "CV score for bandwidth %d: %g", bw, ss);
+
+    if (bw <= bc->bwmax)
+	bc->score[bw] = ss;
+
+    return ss;
+}
+
+static int estimate_bandwidth_mem(int *inx, int ninx, int iny, int nrows,
+        int ncols, int bw)
+{
+    int i, r, c, nc, nr, nct, isnull;
+    size_t idx;
+    struct bwcache bc;
+    int a, b, x1, x2, d;
+    double f1, f2;
+    const double invphi = 0.6180339887498949;
+
+    G_message(_("Estimating optimal bandwidth..."));
+
+    bc.nrows = nrows;
+    bc.ncols = ncols;
+    bc.ninx = ninx;
+    bc.x = G_malloc(ninx * sizeof(DCELL *));
+    for (i = 0; i < ninx; i++)
+	bc.x[i] = G_malloc((size_t)nrows * ncols * sizeof(DCELL));
+    bc.y = G_malloc((size_t)nrows * ncols * sizeof(DCELL));
+
+    /* load input maps, count cells with all values non-NULL */
+    G_message(_("Loading input maps..."));
+    nc = 0;
+    for (r = 0; r < nrows; r++) {
+	G_percent(r, nrows, 4);
+
+	idx = (size_t)r * ncols;
+	for (i = 0; i < ninx; i++)
+	    Rast_get_d_row(inx[i], bc.x[i] + idx, r);
+	Rast_get_d_row(iny, bc.y + idx, r);
+
+	for (c = 0; c < ncols; c++, idx++) {
+	    isnull = Rast_is_d_null_value(&(bc.y[idx]));
+	    for (i = 0; i < ninx && !isnull; i++)
+		isnull = Rast_is_d_null_value(&(bc.x[i][idx]));
+	    if (!isnull)
+		nc++;
+	}
+    }
+    G_percent(nrows, nrows, 4);
+
+    if (nc == 0)
+	G_fatal_error(_("No non-NULL cells in input maps"));
+
+    /* draw a fixed random sample of cells: the same cells are used
+     * for all candidate bandwidths */
+    nr = NSAMPLES;
+    if (nr > nc)
+	nr = nc;
+
+    init_rand();
+
+    bc.srow = G_malloc(nr * sizeof(int));
+    bc.scol = G_malloc(nr * sizeof(int));
+    bc.err = G_malloc(nr * sizeof(double));
+    bc.nsamp = 0;
+    nct = nc;
+    for (r = 0; r < nrows && bc.nsamp < nr; r++) {
+	idx = (size_t)r * ncols;
+	for (c = 0; c < ncols; c++, idx++) {
+	    isnull = Rast_is_d_null_value(&(bc.y[idx]));
+	    for (i = 0; i < ninx && !isnull; i++)
+		isnull = Rast_is_d_null_value(&(bc.x[i][idx]));
+	    if (isnull)
+		continue;
+
+	    if (make_rand() % nct < nr - bc.nsamp) {
+		bc.srow[bc.nsamp] = r;
+		bc.scol[bc.nsamp] = c;
+		bc.nsamp++;
+	    }
+	    nct--;
+	}
+    }
+    G_debug(1, "%d cells sampled", bc.nsamp);
+
+    bc.bwmax = sqrt((double) nrows * nrows + (double) ncols * ncols);
+    bc.score = G_malloc((bc.bwmax + 1) * sizeof(double));
+    for (i = 0; i <= bc.bwmax; i++)
+	bc.score[i] = -1;
+
+    if (bw < 2) {
+	G_warning(_("Initial bandwidth must be > 1"));
+	bw = 2;
+    }
+    if (bw > bc.bwmax)
+	bw = bc.bwmax;
+
+    /* find a bandwidth for which all sampled cells can be estimated */
+    while (cv_score(&bc, bw) == 1.0 / 0.0) {
+	if (bw == bc.bwmax)
+	    G_fatal_error(_("Unable to estimate bandwidth"));
+	bw += bw / 2;
+	if (bw > bc.bwmax)
+	    bw = bc.bwmax;
+    }
+
+    /* bracket the minimum [a, b] by walking downhill
+     * with increasing step size */
+    d = bw / 2;
+    if (d < 2)
+	d = 2;
+    x1 = bw + d;
+    if (x1 > bc.bwmax)
+	x1 = bc.bwmax;
+    if (x1 > bw && cv_score(&bc, x1) < cv_score(&bc, bw)) {
+	/* walk up */
+	a = bw;
+	bw = x1;
+	while (1) {
+	    d += d / 2;
+	    x1 = bw + d;
+	    if (x1 > bc.bwmax)
+		x1 = bc.bwmax;
+	    if (x1 == bw || cv_score(&bc, x1) >= cv_score(&bc, bw)) {
+		b = x1;
+		break;
+	    }
+	    a = bw;
+	    bw = x1;
+	}
+    }
+    else {
+	/* walk down */
+	b = x1;
+	while (1) {
+	    x1 = bw - d;
+	    if (x1 < 1)
+		x1 = 1;
+	    if (x1 == bw || cv_score(&bc, x1) >= cv_score(&bc, bw)) {
+		a = x1;
+		break;
+	    }
+	    b = bw;
+	    bw = x1;
+	    d += d / 2;
+	}
+    }
+    G_debug(1, "minimum bracketed by [%d, %d]", a, b);
+
+    /* golden section search on integer bandwidths,
+     * stop as soon as the remaining interval is small */
+    while (b - a > 3) {
+	x1 = b - (int)((b - a) * invphi + 0.5);
+	x2 = a + (int)((b - a) * invphi + 0.5);
+	if (x1 >= x2) {
+	    x1 = (a + b) / 2;
+	    x2 = x1 + 1;
+	}
+	f1 = cv_score(&bc, x1);
+	f2 = cv_score(&bc, x2);
+	/* both infinite: the minimum is at larger bandwidths */
+	if (f1 <= f2 && f1 != 1.0 / 0.0)
+	    b = x2;
+	else
+	    a = x1;
+    }
+
+    /* test the remaining candidates */
+    bw = a;
+    f1 = cv_score(&bc, a);
+    for (i = a + 1; i <= b; i++) {
+	f2 = cv_score(&bc, i);
+	if (f2 < f1) {
+	    f1 = f2;
+	    bw = i;
+	}
+    }
+
+    if (f1 == 1.0 / 0.0)
+	G_warning(_("Could not find minimum"));
+
+    for (i = 0; i < ninx; i++)
+	G_free(bc.x[i]);
+    G_free(bc.x);
+    G_free(bc.y);
+    G_free(bc.srow);
+    G_free(bc.scol);
+    G_free(bc.err);
+    G_free(bc.score);
+
+    return bw;
+}
+
+int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
+        DCELL *est, int bw, double mem_mb)
+{
+    double cache_mb;
+
+    cache_mb = (double)nrows * ncols * (ninx + 1) * sizeof(DCELL) /
+               (1024. * 1024.);
+
+    if (cache_mb > mem_mb) {
+	G_verbose_message(_("%.0f MB are needed to load the input maps, "
+	                    "estimating bandwidth row by row"), cache_mb);
+	return estimate_bandwidth_rows(inx, ninx, iny, nrows, ncols, est, bw);
+    }
+
+    return estimate_bandwidth_mem(inx, ninx, iny, nrows, ncols, bw);
+}
@@ -11,6 +11,16 @@
 /* geographically weighted regression:
  * estimate coefficients for given cell */
 
+/* work space for gwr(), one set per thread */
+static DCELL *xval = NULL;
+/* OLS */
+static double **a = NULL;
+static double **B = NULL;
+static struct MATRIX *m_all = NULL;
+#if defined(_OPENMP)
+#pragma omp threadprivate(xval, a, B, m_all)
+#endif
+
 int solvemat(struct MATRIX *m, double a[], double B[])
 {
     int i, j, i2, j2, imark;
@@ -90,13 +100,8 @@ int gwr(struct rb *xbuf, int ninx, struct rb *ybuf, int cc,
     int r, c;
     int i, j, k;
     int nsize;
-    static DCELL *xval = NULL;
     DCELL yval;
     int count, isnull, solved;
-    /* OLS */
-    static double **a = NULL;
-    static double **B = NULL;
-    static struct MATRIX *m_all = NULL;
     struct MATRIX *m;
 
     if (!xval) {
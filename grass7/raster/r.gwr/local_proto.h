@@ -15,4 +15,4 @@ int gwra(SEGMENT *in_seg, FLAG *yflag, int ninx, int rr, int cc,
         int npnts, DCELL *est, double **B0);
 
 int estimate_bandwidth(int *inx, int ninx, int iny, int nrows, int ncols,
-         DCELL *est, int bw);
+         DCELL *est, int bw, double mem_mb);
@@ -27,6 +27,9 @@
 #include <grass/raster.h>
 #include "local_proto.h"
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 int main(int argc, char *argv[])
 {
@@ -54,11 +57,12 @@ int main(int argc, char *argv[])
 	DCELL *buf;
     } *outb, *outbp;
     double **weights;
-    int bw, npnts;
+    int bw, npnts, threads;
     char *name;
     struct Option *input_mapx, *input_mapy, *mask_opt,
                   *output_res, *output_est, *output_b, *output_opt,
-		  *kernel_opt, *vf_opt, *bw_opt, *pnts_opt, *mem_opt;
+		  *kernel_opt, *vf_opt, *bw_opt, *pnts_opt, *mem_opt,
+		  *threads_opt;
     struct Flag *shell_style, *estimate;
     struct Cell_head region;
     struct GModule *module;
@@ -148,7 +152,14 @@ int main(int argc, char *argv[])
     mem_opt->type = TYPE_INTEGER;
     mem_opt->required = NO;
     mem_opt->answer = "300";
-    mem_opt->description = _("Memory in MB for adaptive bandwidth");
+    mem_opt->description = _("Memory in MB for adaptive bandwidth and bandwidth estimation");
+
+    threads_opt = G_define_option();
+    threads_opt->key = "threads";
+    threads_opt->type = TYPE_INTEGER;
+    threads_opt->required = NO;
+    threads_opt->answer = "1";
+    threads_opt->description = _("Number of threads for bandwidth estimation");
 
     shell_style = G_define_flag();
     shell_style->key = 'g';
@@ -188,6 +199,16 @@ int main(int argc, char *argv[])
 
     set_wfn(kernel_opt->answer, atoi(vf_opt->answer));
 
+    threads = atoi(threads_opt->answer);
+    if (threads < 1)
+	G_fatal_error(_("Option <%s> must be > 0"), threads_opt->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(threads);
+#else
+    if (threads > 1)
+	G_warning(_("r.gwr was compiled without OpenMP support, using one thread"));
+#endif
+
     /* open maps */
     G_debug(1, "open maps");
 
@@ -210,7 +231,7 @@ int main(int argc, char *argv[])
 
     if (estimate->answer) {
 	bw = estimate_bandwidth(mapx_fd, n_predictors, mapy_fd, rows, cols,
-				yest, bw);
+				yest, bw, atof(mem_opt->answer));
 	if (shell_style->answer)
 	    fprintf(stdout, "estimate=%d\n", bw);
 	else
@@ -26,20 +26,54 @@
 #include <grass/glocale.h>
 #include <grass/gmath.h>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 struct input
 {
     const char *name;
     int fd;
-    DCELL *buf;
 };
 
 struct output
 {
     const char *name;
     int fd;
-    DCELL *buf;
 };
 
+/* HANTS parameters shared by all threads */
+struct hants_par
+{
+    int num_inputs, nf, nr, noutmax;
+    double fet, lo, hi, delta;
+    int use_range, rejlo, rejhi, interp_only;
+    int do_amp, do_phase;
+    double **mat, **mat_t;
+    double **Afull;		/* A for a series without NULL values */
+    double **P;			/* zr = P * y for a series without NULL values */
+    int have_P;
+};
+
+/* work space, one per thread */
+struct hants_ws
+{
+    DCELL *values, *rc;
+    int *useval;
+    double **A, *Abase, *za, *zr;
+    double **zrb;		/* zr for a block of cells */
+    char *full;
+};
+
+/* row buffers */
+struct hants_bufs
+{
+    DCELL **out, **amp, **phase;
+};
+
+/* number of cells processed together */
+#define BLOCK_SIZE 256
+
 static int solvemat(double **m, double a[], double B[], int n)
 {
     int i, j, i2, j2, imark;
@@ -66,6 +100,7 @@ static int solvemat(double **m, double a[], double B[], int n)
 	/* co-linear points results in a solution with rounding error */
 
 	if (pivot == 0.0) {
+#pragma omp critical
 	    G_warning(_("Matrix is unsolvable"));
 	    return 0;
 	}
@@ -114,6 +149,448 @@ static int solvemat(double **m, double a[], double B[], int n)
 }
 
 
+static void hants_ws_init(const struct hants_par *p, struct hants_ws *ws)
+{
+    ws->values = G_malloc(p->num_inputs * sizeof(DCELL));
+    ws->rc = G_malloc(p->num_inputs * sizeof(DCELL));
+    ws->useval = G_malloc(p->num_inputs * sizeof(int));
+    ws->A = G_alloc_matrix(p->nr, p->nr);
+    ws->Abase = ws->A[0];
+    ws->za = G_alloc_vector(p->nr);
+    ws->zr = G_alloc_vector(p->nr);
+    ws->zrb = G_alloc_matrix(p->nr, BLOCK_SIZE);
+    ws->full = G_malloc(BLOCK_SIZE);
+}
+
+/* A = mat * mat' with delta added to the diagonal 
+ * and P = A^-1 * mat for a series without NULL values */
+static void hants_init(struct hants_par *p)
+{
+    int i, j, k, nr = p->nr;
+    double **A, *Abase, **Ainv, *e, *x;
+
+    p->Afull = G_alloc_matrix(nr, nr);
+    for (i = 0; i < nr; i++) {
+	for (k = 0; k < nr; k++) {
+	    p->Afull[i][k] = 0;
+	    for (j = 0; j < p->num_inputs; j++)
+		p->Afull[i][k] += p->mat[i][j] * p->mat_t[j][k];
+	}
+	if (i > 0)
+	    p->Afull[i][i] += p->delta;
+    }
+
+    A = G_alloc_matrix(nr, nr);
+    Abase = A[0];
+    Ainv = G_alloc_matrix(nr, nr);
+    e = G_alloc_vector(nr);
+    x = G_alloc_vector(nr);
+
+    p->have_P = 1;
+    for (k = 0; k < nr && p->have_P; k++) {
+	/* solvemat() swaps rows */
+	for (i = 0; i < nr; i++) {
+	    A[i] = Abase + i * nr;
+	    memcpy(A[i], p->Afull[i], nr * sizeof(double));
+	    e[i] = (i == k);
+	}
+	p->have_P = solvemat(A, e, x, nr);
+	for (i = 0; i < nr; i++)
+	    Ainv[i][k] = x[i];
+    }
+
+    p->P = NULL;
+    if (p->have_P) {
+	p->P = G_alloc_matrix(nr, p->num_inputs);
+	for (i = 0; i < nr; i++) {
+	    for (j = 0; j < p->num_inputs; j++) {
+		p->P[i][j] = 0;
+		for (k = 0; k < nr; k++)
+		    p->P[i][j] += Ainv[i][k] * p->mat[k][j];
+	    }
+	}
+    }
+
+    A[0] = Abase;
+    G_free_matrix(A);
+    G_free_matrix(Ainv);
+    G_free_vector(e);
+    G_free_vector(x);
+}
+
+static void hants_set_null(const struct hants_par *p, struct hants_bufs *b,
+                           int col)
+{
+    int i;
+
+    for (i = 0; i < p->num_inputs; i++)
+	Rast_set_d_null_value(&b->out[i][col], 1);
+    for (i = 0; i < p->nf; i++) {
+	if (p->do_amp)
+	    Rast_set_d_null_value(&b->amp[i][col], 1);
+	if (p->do_phase)
+	    Rast_set_d_null_value(&b->phase[i][col], 1);
+    }
+}
+
+static void hants_amp_phase(const struct hants_par *p, struct hants_bufs *b,
+                            const double *zr, int col)
+{
+    int i;
+
+    /* amplitude and phase */
+    /* skip constant */
+
+    for (i = 1; i < p->nr; i += 2) {
+	int ifr = i >> 1;
+
+	if (p->do_amp) {
+	    b->amp[ifr][col] = sqrt(zr[i] * zr[i] + zr[i + 1] * zr[i + 1]);
+	}
+
+	if (p->do_phase) {
+	    double angle = atan2(zr[i + 1], zr[i]) * 180 / M_PI;
+
+	    if (angle < 0)
+		angle += 360;
+	    b->phase[ifr][col] = angle;
+	}
+    }
+}
+
+/* HANTS for one cell */
+static void hants_cell(const struct hants_par *p, struct hants_ws *ws,
+                       DCELL **inbuf, struct hants_bufs *b, int col)
+{
+    int i, j, k;
+    int num_inputs = p->num_inputs, nr = p->nr;
+    int first, last, nout, nuse;
+    double maxerrlo, maxerrhi;
+    double **mat = p->mat, **mat_t = p->mat_t;
+    double **A = ws->A, *za = ws->za, *zr = ws->zr;
+    DCELL *values = ws->values, *rc = ws->rc;
+    int *useval = ws->useval;
+
+    first = last = -1;
+    nout = 0;
+
+    for (i = 0; i < num_inputs; i++) {
+	DCELL v = inbuf[i][col];
+
+	useval[i] = 0;
+	if (Rast_is_d_null_value(&v)) {
+	    nout++;
+	}
+	else if (p->use_range && (v < p->lo || v > p->hi)) {
+	    Rast_set_d_null_value(&v, 1);
+	    nout++;
+	}
+	else {
+	    useval[i] = 1;
+
+	    if (first == -1)
+		first = i;
+	    last = i;
+	}
+
+	values[i] = v;
+    }
+
+    if (!p->interp_only) {
+	first = 0;
+	last = num_inputs - 1;
+    }
+
+    if (nout > p->noutmax) {
+	hants_set_null(p, b, col);
+
+	return;
+    }
+
+    /* HANTS */
+    {
+	int n = 0, done = 0;
+
+	while (!done) {
+
+	    /* za = mat * y */
+
+	    /* A = mat * diag(p) * mat' */
+
+	    /* mat: nr, num_inputs
+	     * diag(p): num_inputs, num_inputs 
+	     * mat_t: num_inputs, nr
+	     * A temp: nr, num_inputs
+	     * A: nr, nr */
+
+	    /* solvemat() swaps rows */
+	    for (i = 0; i < nr; i++)
+		A[i] = ws->Abase + i * nr;
+
+	    nuse = num_inputs - nout;
+	    if (nout < nuse) {
+		/* remove unused observations from the full matrix */
+		for (i = 0; i < nr; i++) {
+		    memcpy(A[i], p->Afull[i], nr * sizeof(double));
+		    za[i] = 0;
+		    for (j = 0; j < num_inputs; j++) {
+			if (useval[j]) {
+			    za[i] += mat[i][j] * values[j];
+			}
+			else {
+			    for (k = 0; k < nr; k++)
+				A[i][k] -= mat[i][j] * mat_t[j][k];
+			}
+		    }
+		}
+	    }
+	    else {
+		for (i = 0; i < nr; i++) {
+		    za[i] = 0;
+		    for (k = 0; k < nr; k++)
+			A[i][k] = 0;
+		    for (j = 0; j < num_inputs; j++) {
+			if (useval[j]) {
+			    za[i] += mat[i][j] * values[j];
+
+			    for (k = 0; k < nr; k++)
+				A[i][k] += mat[i][j] * mat_t[j][k];
+			}
+		    }
+
+		    if (i > 0) {
+			A[i][i] += p->delta;
+		    }
+		}
+	    }
+
+	    /* zr = A \ za
+	     * solve A * zr = za */
+	    if (!solvemat(A, za, zr, nr)) {
+		done = -1;
+		Rast_set_d_null_value(rc, num_inputs);
+		break;
+	    }
+	    /* G_math_solver_gauss(A, zr, za, nr) is much slower */
+
+	    /* rc = mat' * zr */
+	    maxerrlo = maxerrhi = 0;
+	    for (i = 0; i < num_inputs; i++) {
+		rc[i] = 0;
+		for (j = 0; j < nr; j++) {
+		    rc[i] += mat_t[i][j] * zr[j];
+		}
+		if (useval[i]) {
+		    if (maxerrlo < rc[i] - values[i])
+			maxerrlo = rc[i] - values[i];
+		    if (maxerrhi < values[i] - rc[i])
+			maxerrhi = values[i] - rc[i];
+		}
+	    }
+	    /* without outlier rejection, the solution does not change */
+	    done = 1;
+	    if (p->rejlo || p->rejhi) {
+		if (p->rejlo && maxerrlo > p->fet)
+		    done = 0;
+		if (p->rejhi && maxerrhi > p->fet)
+		    done = 0;
+
+		if (!done) {
+		    /* filter outliers */
+		    for (i = 0; i < num_inputs; i++) {
+
+			if (useval[i]) {
+			    if (p->rejlo && rc[i] - values[i] > maxerrlo * 0.5) {
+				useval[i] = 0;
+				nout++;
+			    }
+			    if (p->rejhi && values[i] - rc[i] > maxerrhi * 0.5) {
+				useval[i] = 0;
+				nout++;
+			    }
+			}
+		    }
+		}
+	    }
+
+	    n++;
+	    if (n >= num_inputs)
+		done = 1;
+	    if (nout > p->noutmax)
+		done = 1;
+	}
+
+	i = 0;
+	while (i < first) {
+	    Rast_set_d_null_value(&b->out[i][col], 1);
+	    i++;
+	}
+
+	for (i = first; i <= last; i++) {
+	    b->out[i][col] = rc[i];
+	    if (rc[i] < p->lo)
+		b->out[i][col] = p->lo;
+	    else if (rc[i] > p->hi)
+		b->out[i][col] = p->hi;
+	}
+
+	i = last + 1;
+	while (i < num_inputs) {
+	    Rast_set_d_null_value(&b->out[i][col], 1);
+	    i++;
+	}
+
+	if (p->do_amp || p->do_phase)
+	    hants_amp_phase(p, b, zr, col);
+    }
+}
+
+/* HANTS for a block of cells [c0, c1)
+ * series without NULL values are processed together with the
+ * precomputed P, looping over cells in the innermost loop */
+static void hants_block(const struct hants_par *p, struct hants_ws *ws,
+                        DCELL **inbuf, struct hants_bufs *b, int c0, int c1)
+{
+    int i, j, k, c, nfull;
+    int nb = c1 - c0;
+    char *full = ws->full;
+    double **zrb = ws->zrb;
+
+    nfull = 0;
+    if (p->have_P) {
+	for (c = c0; c < c1; c++) {
+	    full[c - c0] = 1;
+	    for (i = 0; i < p->num_inputs; i++) {
+		DCELL v = inbuf[i][c];
+
+		if (Rast_is_d_null_value(&v) ||
+		    (p->use_range && (v < p->lo || v > p->hi))) {
+		    full[c - c0] = 0;
+		    break;
+		}
+	    }
+	    nfull += full[c - c0];
+	}
+    }
+
+    if (nfull) {
+	/* zr = P * y */
+	for (k = 0; k < p->nr; k++) {
+	    double *z = zrb[k];
+
+	    for (c = 0; c < nb; c++)
+		z[c] = 0;
+	    for (j = 0; j < p->num_inputs; j++) {
+		double pkj = p->P[k][j];
+		const DCELL *in = inbuf[j] + c0;
+
+		for (c = 0; c < nb; c++)
+		    z[c] += pkj * in[c];
+	    }
+	}
+
+	/* rc = mat' * zr */
+	for (i = 0; i < p->num_inputs; i++) {
+	    DCELL *out = b->out[i] + c0;
+
+	    for (c = 0; c < nb; c++)
+		out[c] = 0;
+	    for (k = 0; k < p->nr; k++) {
+		double mik = p->mat_t[i][k];
+		const double *z = zrb[k];
+
+		for (c = 0; c < nb; c++)
+		    out[c] += mik * z[c];
+	    }
+	}
+
+	for (c = 0; c < nb; c++) {
+	    if (!full[c])
+		continue;
+
+	    if (p->rejlo || p->rejhi) {
+		double maxerrlo = 0, maxerrhi = 0;
+
+		for (i = 0; i < p->num_inputs; i++) {
+		    double rc = b->out[i][c + c0];
+		    double v = inbuf[i][c + c0];
+
+		    if (maxerrlo < rc - v)
+			maxerrlo = rc - v;
+		    if (maxerrhi < v - rc)
+			maxerrhi = v - rc;
+		}
+		if ((p->rejlo && maxerrlo > p->fet) ||
+		    (p->rejhi && maxerrhi > p->fet)) {
+		    /* outliers need to be rejected */
+		    full[c] = 0;
+		    continue;
+		}
+	    }
+
+	    for (i = 0; i < p->num_inputs; i++) {
+		DCELL *out = &b->out[i][c + c0];
+
+		if (*out < p->lo)
+		    *out = p->lo;
+		else if (*out > p->hi)
+		    *out = p->hi;
+	    }
+
+	    if (p->do_amp || p->do_phase) {
+		for (k = 0; k < p->nr; k++)
+		    ws->zr[k] = zrb[k][c];
+		hants_amp_phase(p, b, ws->zr, c + c0);
+	    }
+	}
+    }
+    else {
+	for (c = 0; c < nb; c++)
+	    full[c] = 0;
+    }
+
+    for (c = c0; c < c1; c++) {
+	if (!full[c - c0])
+	    hants_cell(p, ws, inbuf, b, c);
+    }
+}
+
+static void read_row(struct input *inputs, int num_inputs, DCELL **buf,
+                     int row, int lazy)
+{
+    int i;
+
+    if (lazy) {
+	/* Open the files only on run time */
+	for (i = 0; i < num_inputs; i++) {
+	    inputs[i].fd = Rast_open_old(inputs[i].name, "");
+	    Rast_get_d_row(inputs[i].fd, buf[i], row);
+	    Rast_close(inputs[i].fd);
+	}
+    }
+    else {
+	for (i = 0; i < num_inputs; i++)
+	    Rast_get_d_row(inputs[i].fd, buf[i], row);
+    }
+}
+
+static void write_row(const struct hants_par *p, struct output *outputs,
+                      struct output *out_amp, struct output *out_phase,
+		      struct hants_bufs *b)
+{
+    int i;
+
+    for (i = 0; i < p->num_inputs; i++)
+	Rast_put_d_row(outputs[i].fd, b->out[i]);
+
+    for (i = 0; i < p->nf; i++) {
+	if (p->do_amp)
+	    Rast_put_d_row(out_amp[i].fd, b->amp[i]);
+	if (p->do_phase)
+	    Rast_put_d_row(out_phase[i].fd, b->phase[i]);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     struct GModule *module;
@@ -128,7 +605,8 @@ int main(int argc, char *argv[])
 	              *range,	/* low/high threshold */
 		      *ts,	/* time steps*/
 		      *bl,	/* length of base period */
-		      *delta;	/* threshold for high amplitudes */
+		      *delta,	/* threshold for high amplitudes */
+		      *threads;	/* number of threads */
     } parm;
     struct
     {
@@ -143,17 +621,20 @@ int main(int argc, char *argv[])
     struct output *out_phase = NULL;
     char *suffix;
     struct History history;
-    DCELL *values = NULL, *rc = NULL;
     int nrows, ncols;
-    int row, col;
+    int row;
     double lo, hi, fet, *cs, *sn, *ts, delta;
     int bl;
-    double **mat, **mat_t, **A, *Av, *Azero, *za, *zr, maxerrlo, maxerrhi;
-    int asize;
-    int first, last, interp_only;
-    int dod, nf, nr, nout, noutmax;
-    int rejlo, rejhi, *useval;
+    double **mat, **mat_t;
+    int interp_only;
+    int dod, nf, nr, noutmax;
+    int rejlo, rejhi;
     int do_amp, do_phase;
+    int threads, nblocks;
+    struct hants_par par;
+    struct hants_ws *ws;
+    DCELL **inbuf[2];
+    struct hants_bufs outbuf[2];
 
     G_gisinit(argv[0]);
 
@@ -237,6 +718,12 @@ int main(int argc, char *argv[])
     parm.delta->label = _("Threshold for high amplitudes");
     parm.delta->description = _("Delta should be between 0 and 1");
 
+    parm.threads = G_define_option();
+    parm.threads->key = "threads";
+    parm.threads->type = TYPE_INTEGER;
+    parm.threads->answer = "1";
+    parm.threads->description = _("Number of threads for parallel computing");
+
     flag.lo = G_define_flag();
     flag.lo->key = 'l';
     flag.lo->description = _("Reject low outliers");
@@ -307,6 +794,17 @@ int main(int argc, char *argv[])
 
     interp_only = flag.int_only->answer;
 
+    threads = atoi(parm.threads->answer);
+    if (threads < 1)
+	G_fatal_error(_("The number of threads must be > 0"));
+#if defined(_OPENMP)
+    omp_set_num_threads(threads);
+#else
+    if (threads > 1)
+	G_warning(_("r.hants was compiled without OpenMP support, using one thread"));
+    threads = 1;
+#endif
+
     /* process the input maps from the file */
     if (parm.file->answer) {
 	FILE *in;
@@ -341,7 +839,6 @@ int main(int argc, char *argv[])
 
 	    p->name = G_store(name);
 	    G_verbose_message(_("Reading raster map <%s>..."), p->name);
-	    p->buf = Rast_allocate_d_buf();
 	    if (!flag.lazy->answer)
 		p->fd = Rast_open_old(p->name, "");
 	}
@@ -366,7 +863,6 @@ int main(int argc, char *argv[])
 
 	    p->name = parm.input->answers[i];
 	    G_verbose_message(_("Reading raster map <%s>..."), p->name);
-	    p->buf = Rast_allocate_d_buf();
 	    if (!flag.lazy->answer)
 		p->fd = Rast_open_old(p->name, "");
     	}
@@ -401,7 +897,6 @@ int main(int argc, char *argv[])
 	sprintf(output_name, "%s%s", uname, suffix);
 
 	out->name = G_store(output_name);
-	out->buf = Rast_allocate_d_buf();
 	out->fd = Rast_open_new(output_name, DCELL_TYPE);
     }
 
@@ -434,7 +929,6 @@ int main(int argc, char *argv[])
 	    sprintf(output_name, "%s.%d", parm.amp->answer, i);
 
 	    out->name = G_store(output_name);
-	    out->buf = Rast_allocate_d_buf();
 	    out->fd = Rast_open_new(output_name, DCELL_TYPE);
 	}
     }
@@ -450,22 +944,17 @@ int main(int argc, char *argv[])
 	    sprintf(output_name, "%s.%d", parm.phase->answer, i);
 
 	    out->name = G_store(output_name);
-	    out->buf = Rast_allocate_d_buf();
 	    out->fd = Rast_open_new(output_name, DCELL_TYPE);
 	}
     }
 
     /* initialise variables */
-    values = G_malloc(num_inputs * sizeof(DCELL));
-
     nrows = Rast_window_rows();
     ncols = Rast_window_cols();
 
     cs = G_alloc_vector(bl);
     sn = G_alloc_vector(bl);
     ts = G_alloc_vector(num_inputs);
-    rc = G_malloc(num_inputs * sizeof(DCELL));
-    useval = G_malloc(num_inputs * sizeof(int));
 
     if (parm.ts->answer) {
     	for (i = 0; parm.ts->answers[i]; i++);
@@ -482,16 +971,6 @@ int main(int argc, char *argv[])
 
     mat = G_alloc_matrix(nr, num_inputs);
     mat_t = G_alloc_matrix(num_inputs, nr);
-    A = G_alloc_matrix(nr, nr);
-    Av = *A;
-    Azero = G_alloc_vector(nr * nr);
-    asize = nr * nr * sizeof(double);
-    za = G_alloc_vector(nr);
-    zr = G_alloc_vector(nr);
-    rc = G_alloc_vector(num_inputs);
-
-    for (i = 0; i < nr * nr; i++)
-	Azero[i] = 0;
 
     for (i = 0; i < bl; i++) {
 	double ang = 2.0 * M_PI * i / bl;
@@ -525,224 +1004,92 @@ int main(int argc, char *argv[])
 	}
     }
 
-    /* process the data */
-    G_message(_("Harmonic analysis of %d input maps..."), num_inputs);
-
-    for (row = 0; row < nrows; row++) {
-	G_percent(row, nrows, 4);
-
-	if (flag.lazy->answer) {
-	    /* Open the files only on run time */
-	    for (i = 0; i < num_inputs; i++) {
-		inputs[i].fd = Rast_open_old(inputs[i].name, "");
-		Rast_get_d_row(inputs[i].fd, inputs[i].buf, row);
-		Rast_close(inputs[i].fd);
-	    }
+    par.num_inputs = num_inputs;
+    par.nf = nf;
+    par.nr = nr;
+    par.noutmax = noutmax;
+    par.fet = fet;
+    par.lo = lo;
+    par.hi = hi;
+    par.delta = delta;
+    par.use_range = parm.range->answer != NULL;
+    par.rejlo = rejlo;
+    par.rejhi = rejhi;
+    par.interp_only = interp_only;
+    par.do_amp = do_amp;
+    par.do_phase = do_phase;
+    par.mat = mat;
+    par.mat_t = mat_t;
+    hants_init(&par);
+
+    ws = G_malloc(threads * sizeof(struct hants_ws));
+    for (i = 0; i < threads; i++)
+	hants_ws_init(&par, &ws[i]);
+
+    /* double buffering: the next row is read and the previous row is
+     * written while the current row is processed */
+    for (k = 0; k < 2; k++) {
+	inbuf[k] = G_malloc(num_inputs * sizeof(DCELL *));
+	outbuf[k].out = G_malloc(num_outputs * sizeof(DCELL *));
+	for (i = 0; i < num_inputs; i++) {
+	    inbuf[k][i] = Rast_allocate_d_buf();
+	    outbuf[k].out[i] = Rast_allocate_d_buf();
 	}
-	else {
-	    for (i = 0; i < num_inputs; i++)
-	        Rast_get_d_row(inputs[i].fd, inputs[i].buf, row);
+	outbuf[k].amp = outbuf[k].phase = NULL;
+	if (do_amp) {
+	    outbuf[k].amp = G_malloc(nf * sizeof(DCELL *));
+	    for (i = 0; i < nf; i++)
+		outbuf[k].amp[i] = Rast_allocate_d_buf();
 	}
+	if (do_phase) {
+	    outbuf[k].phase = G_malloc(nf * sizeof(DCELL *));
+	    for (i = 0; i < nf; i++)
+		outbuf[k].phase[i] = Rast_allocate_d_buf();
+	}
+    }
+    nblocks = (ncols + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-	for (col = 0; col < ncols; col++) {
-	    int null = 0, non_null = 0;
-
-	    first = last = -1;
-
-	    for (i = 0; i < num_inputs; i++) {
-		DCELL v = inputs[i].buf[col];
+    /* process the data */
+    G_message(_("Harmonic analysis of %d input maps..."), num_inputs);
 
-		useval[i] = 0;
-		if (Rast_is_d_null_value(&v)) {
-		    null++;
-		}
-		else if (parm.range->answer && (v < lo || v > hi)) {
-		    Rast_set_d_null_value(&v, 1);
-		    null++;
-		}
-		else {
-		    non_null++;
-		    useval[i] = 1;
+    read_row(inputs, num_inputs, inbuf[0], 0, flag.lazy->answer);
 
-		    if (first == -1)
-			first = i;
-		    last = i;
-		}
+    for (row = 0; row < nrows; row++) {
+	int cur = row & 1;
 
-		values[i] = v;
-	    }
-	    nout = null;
+	G_percent(row, nrows, 4);
 
-	    if (!interp_only) {
-		first = 0;
-		last = num_inputs - 1;
+#pragma omp parallel
+	{
+	    int blk, tid = 0;
+
+#if defined(_OPENMP)
+	    tid = omp_get_thread_num();
+#endif
+
+#pragma omp single nowait
+	    {
+		if (row > 0)
+		    write_row(&par, outputs, out_amp, out_phase,
+		              &outbuf[!cur]);
+		if (row < nrows - 1)
+		    read_row(inputs, num_inputs, inbuf[!cur], row + 1,
+		             flag.lazy->answer);
 	    }
 
-	    /* HANTS */
-	    if (nout <= noutmax) {
-		int n = 0, done = 0;
-
-		while (!done) {
-		    
-		    /* za = mat * y */
-
-		    /* A = mat * diag(p) * mat' */
-
-		    /* mat: nr, num_inputs
-		     * diag(p): num_inputs, num_inputs 
-		     * mat_t: num_inputs, nr
-		     * A temp: nr, num_inputs
-		     * A: nr, nr */
-
-		    memcpy(Av, Azero, asize);
-		    for (i = 0; i < nr; i++) {
-			za[i] = 0;
-			for (j = 0; j < num_inputs; j++) {
-			    if (useval[j]) {
-				za[i] += mat[i][j] * values[j];
-
-				for (k = 0; k < nr; k++)
-				    A[i][k] += mat[i][j] * mat_t[j][k];
-			    }
-			}
-
-			if (i > 0) {
-			    A[i][i] += delta;
-			}
-		    }
-		    
-		    /* zr = A \ za
-		     * solve A * zr = za */
-		    if (!solvemat(A, za, zr, nr)) {
-			done = -1;
-			Rast_set_d_null_value(rc, num_outputs);
-			break;
-		    }
-		    /* G_math_solver_gauss(A, zr, za, nr) is much slower */
-
-		    /* rc = mat' * zr */
-		    maxerrlo = maxerrhi = 0;
-		    for (i = 0; i < num_inputs; i++) {
-			rc[i] = 0;
-			for (j = 0; j < nr; j++) {
-			    rc[i] += mat_t[i][j] * zr[j];
-			}
-			if (useval[i]) {
-			    if (maxerrlo < rc[i] - values[i])
-				maxerrlo = rc[i] - values[i];
-			    if (maxerrhi < values[i] - rc[i])
-				maxerrhi = values[i] - rc[i];
-			}
-		    }
-		    if (rejlo || rejhi) {
-			done = 1;
-			if (rejlo && maxerrlo > fet)
-			    done = 0;
-			if (rejhi && maxerrhi > fet)
-			    done = 0;
-		    
-			if (!done) {
-			    /* filter outliers */
-			    for (i = 0; i < num_inputs; i++) {
-
-				if (useval[i]) {
-				    if (rejlo && rc[i] - values[i] > maxerrlo * 0.5) {
-					useval[i] = 0;
-					nout++;
-				    }
-				    if (rejhi && values[i] - rc[i] > maxerrhi * 0.5) {
-					useval[i] = 0;
-					nout++;
-				    }
-				}
-			    }
-			}
-		    }
-
-		    n++;
-		    if (n >= num_inputs)
-			done = 1;
-		    if (nout > noutmax)
-			done = 1;
-		}
-
-		i = 0;
-		while (i < first) {
-		    struct output *out = &outputs[i];
-
-		    Rast_set_d_null_value(&out->buf[col], 1);
-		    i++;
-		}
-
-		for (i = first; i <= last; i++) {
-		    struct output *out = &outputs[i];
-
-		    out->buf[col] = rc[i];
-		    if (rc[i] < lo)
-			out->buf[col] = lo;
-		    else if (rc[i] > hi)
-			out->buf[col] = hi;
-		}
-
-		i = last + 1;
-		while (i < num_outputs) {
-		    struct output *out = &outputs[i];
-
-		    Rast_set_d_null_value(&out->buf[col], 1);
-		    i++;
-		}
-
-		if (do_amp || do_phase) {
-		    /* amplitude and phase */
-		    /* skip constant */
-
-		    for (i = 1; i < nr; i += 2) {
-			int ifr = i >> 1;
+#pragma omp for schedule(dynamic)
+	    for (blk = 0; blk < nblocks; blk++) {
+		int c0 = blk * BLOCK_SIZE;
+		int c1 = c0 + BLOCK_SIZE;
 
-			if (do_amp) {
-			    out_amp[ifr].buf[col] = sqrt(zr[i] * zr[i] +
-						    zr[i + 1] * zr[i + 1]);
-			}
-
-			if (do_phase) {
-			    double angle = atan2(zr[i + 1], zr[i]) * 180 / M_PI;
-
-			    if (angle < 0)
-				angle += 360;
-			    out_phase[ifr].buf[col] = angle;
-			}
-		    }
-		}
-	    }
-	    else {
-		for (i = 0; i < num_outputs; i++) {
-		    struct output *out = &outputs[i];
-
-		    Rast_set_d_null_value(&out->buf[col], 1);
-		}
-		if (do_amp || do_phase) {
-		    for (i = 0; i < nf; i++) {
-			if (do_amp)
-			    Rast_set_d_null_value(&out_amp[i].buf[col], 1);
-			if (do_phase)
-			    Rast_set_d_null_value(&out_phase[i].buf[col], 1);
-		    }
-		}
-	    }
-	}
+		if (c1 > ncols)
+		    c1 = ncols;
 
-	for (i = 0; i < num_outputs; i++)
-	    Rast_put_d_row(outputs[i].fd, outputs[i].buf);
-	
-	if (do_amp || do_phase) {
-	    for (i = 0; i < nf; i++) {
-		if (do_amp)
-		    Rast_put_d_row(out_amp[i].fd, out_amp[i].buf);
-		if (do_phase)
-		    Rast_put_d_row(out_phase[i].fd, out_phase[i].buf);
+		hants_block(&par, &ws[tid], inbuf[cur], &outbuf[cur], c0, c1);
 	    }
 	}
     }
+    write_row(&par, outputs, out_amp, out_phase, &outbuf[(nrows - 1) & 1]);
 
     G_percent(row, nrows, 2);
 
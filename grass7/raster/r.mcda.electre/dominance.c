@@ -47,71 +47,440 @@ void build_weight_vect(int ncriteria,struct Option *weight,
 }
 
 
+/* criterion value of a cell */
+struct cell_value
+{
+    double value;
+    int cell;
+};
+
+/* item of the dominance sweep: a cell counted (data) or a cell that
+ * counts the data cells it dominates (query) */
+struct dom_item
+{
+    double *key;		/* coordinates */
+    double s;			/* coordinate of the current dimension */
+    double w;			/* value summed for data cells */
+    int id;			/* cell of a query */
+    int data;
+    int order;			/* order of equal coordinates */
+};
+
+static int cmp_cell_value(const void *a, const void *b)
+{
+    const struct cell_value *va = a, *vb = b;
+
+    if (va->value < vb->value)
+        return -1;
+    if (va->value > vb->value)
+        return 1;
+    return va->cell - vb->cell;
+}
+
+static int cmp_dom_item(const void *a, const void *b)
+{
+    const struct dom_item *ia = a, *ib = b;
+
+    if (ia->s < ib->s)
+        return -1;
+    if (ia->s > ib->s)
+        return 1;
+    return ia->order - ib->order;
+}
+
+/* sorts by dimension k; with a strict comparison queries come before
+ * data cells of the same coordinate, otherwise after them */
+static void dom_sort(struct dom_item *it, int n, int k, const int *strict)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        it[i].s = it[i].key[k];
+        it[i].order = it[i].data == strict[k];
+    }
+    qsort(it, n, sizeof(struct dom_item), cmp_dom_item);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    const double *da = a, *db = b;
+
+    if (*da < *db)
+        return -1;
+    return *da > *db;
+}
+
+/* number of the sorted values x[0..n-1] smaller than (strict) or not
+ * larger than v */
+static int count_below(const double *x, int n, double v, int strict)
+{
+    int lo = 0, hi = n, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (x[mid] < v || (!strict && x[mid] == v))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* two dimensions: sweep along the second one, the data cells are kept
+ * in a Fenwick tree over the ranks of their first coordinate */
+static void dom_sweep2(struct dom_item *it, int n, const int *strict,
+                       int *cnt, double *sum)
+{
+    double *x;
+    int *tcnt;
+    long double *tsum, s;
+    int i, j, nx, c;
+
+    x = G_malloc(n * sizeof(double));
+    nx = 0;
+    for (i = 0; i < n; i++)
+        if (it[i].data)
+            x[nx++] = it[i].key[0];
+    qsort(x, nx, sizeof(double), cmp_double);
+    tcnt = G_calloc(nx + 1, sizeof(int));
+    tsum = G_calloc(nx + 1, sizeof(long double));
+
+    dom_sort(it, n, 1, strict);
+    for (i = 0; i < n; i++)
+    {
+        if (it[i].data)
+        {
+            for (j = count_below(x, nx, it[i].key[0], 1) + 1; j <= nx;
+                 j += j & -j)
+            {
+                tcnt[j]++;
+                tsum[j] += it[i].w;
+            }
+        }
+        else
+        {
+            c = 0;
+            s = 0;
+            for (j = count_below(x, nx, it[i].key[0], strict[0]); j > 0;
+                 j -= j & -j)
+            {
+                c += tcnt[j];
+                s += tsum[j];
+            }
+            cnt[it[i].id] += c;
+            sum[it[i].id] += s;
+        }
+    }
+
+    G_free(x);
+    G_free(tcnt);
+    G_free(tsum);
+}
+
+/* adds to cnt[id] and sum[id] of every query the number and the sum of
+ * the data cells whose first k coordinates are all smaller (strict) or
+ * not larger than the ones of the query; divide and conquer on the
+ * last dimension, the lower data and upper queries of each split are
+ * solved with one dimension less.  sorted is set if the items are
+ * already sorted by the last dimension. */
+static void dom_solve(struct dom_item *it, int n, int k, int sorted,
+                      const int *strict, int *cnt, double *sum)
+{
+    struct dom_item *cross;
+    long double s;
+    int i, m, c, mid, ndata;
+
+    ndata = 0;
+    for (i = 0; i < n; i++)
+        ndata += it[i].data;
+    if (ndata == 0 || ndata == n)
+        return;
+
+    if (k == 0)
+    {
+        s = 0;
+        for (i = 0; i < n; i++)
+            if (it[i].data)
+                s += it[i].w;
+        for (i = 0; i < n; i++)
+            if (!it[i].data)
+            {
+                cnt[it[i].id] += ndata;
+                sum[it[i].id] += s;
+            }
+        return;
+    }
+
+    if (k == 2)
+    {
+        dom_sweep2(it, n, strict, cnt, sum);
+        return;
+    }
+
+    if (!sorted)
+        dom_sort(it, n, k - 1, strict);
+
+    if (k == 1)
+    {
+        s = 0;
+        c = 0;
+        for (i = 0; i < n; i++)
+        {
+            if (it[i].data)
+            {
+                c++;
+                s += it[i].w;
+            }
+            else
+            {
+                cnt[it[i].id] += c;
+                sum[it[i].id] += s;
+            }
+        }
+        return;
+    }
+
+    mid = n / 2;
+    m = 0;
+    for (i = 0; i < n; i++)
+        if ((i < mid) == (it[i].data != 0))
+            m++;
+    cross = G_malloc(m * sizeof(struct dom_item));
+    m = 0;
+    for (i = 0; i < n; i++)
+        if ((i < mid) == (it[i].data != 0))
+            cross[m++] = it[i];
+    dom_solve(cross, m, k - 1, 0, strict, cnt, sum);
+    G_free(cross);
+
+    dom_solve(it, mid, k, 1, strict, cnt, sum);
+    dom_solve(it + mid, n - mid, k, 1, strict, cnt, sum);
+}
+
+/* For the ncells cells with the values x = sign * v (ncriteria values
+ * per cell) the discordance of a cell a with b is
+ *   max(-100, max_j(x_a,j - x_b,j))
+ * The cells b for which criterion i gives the maximum are counted and
+ * their x_b,i summed: their differences x_b,i - x_b,j must not be
+ * larger than x_a,i - x_a,j (smaller for j > i, the last criterion
+ * wins on ties), and with floor x_b,i must not exceed x_a,i + 100.
+ * Adds sum_b (x_a,i - x_b,i) of these cells to disc and their number
+ * to covered. */
+static void discordance_criterion(const double *v, int ncells, int ncriteria,
+                                  int i, double sign, int floor,
+                                  double *disc, int *covered)
+{
+    struct dom_item *it;
+    double *key;
+    int *strict, *cnt;
+    double *sum;
+    int c, j, k, d = ncriteria - 1 + floor;
+
+    it = G_malloc(2 * ncells * sizeof(struct dom_item));
+    key = G_malloc(2 * ncells * (d > 0 ? d : 1) * sizeof(double));
+    strict = G_malloc((d > 0 ? d : 1) * sizeof(int));
+    cnt = G_calloc(ncells, sizeof(int));
+    sum = G_calloc(ncells, sizeof(double));
+
+    k = 0;
+    for (j = 0; j < ncriteria; j++)
+        if (j != i)
+            strict[k++] = j > i;
+    if (floor)
+        strict[k] = 0;
+
+    for (c = 0; c < 2 * ncells; c++)
+    {
+        const double *x = v + (c % ncells) * ncriteria;
+        int data = c < ncells;
+        double xi = sign * x[i];
+
+        it[c].key = key + c * d;
+        k = 0;
+        for (j = 0; j < ncriteria; j++)
+            if (j != i)
+                it[c].key[k++] = xi - sign * x[j];
+        if (floor)
+            it[c].key[k] = data ? xi : xi + 100;
+        it[c].w = xi;
+        it[c].id = c % ncells;
+        it[c].data = data;
+    }
+
+    dom_solve(it, 2 * ncells, d, 0, strict, cnt, sum);
+
+    for (c = 0; c < ncells; c++)
+    {
+        disc[c] = cnt[c] * sign * v[c * ncriteria + i] - sum[c];
+        covered[c] = cnt[c];
+    }
+
+    G_free(it);
+    G_free(key);
+    G_free(strict);
+    G_free(cnt);
+    G_free(sum);
+}
+
+/* The concordance index of a cell is the weighted number of cells with
+ * a smaller value minus the one of the cells with a larger value, which
+ * follows from the sorted values of each criterion.  The discordance
+ * index needs the cells for which each criterion gives the maximum
+ * difference, they are found with sorted sweeps (see dom_solve).  The
+ * criteria are processed in parallel and added in criteria order.
+ * Cells with a null criterion are not compared and get null indexes. */
 void build_dominance_matrix(int nrows, int ncols, int ncriteria,
                             double *weight_vect, double ***decision_vol)
 {
-    int row1, col1, row2, col2;
-    int i, j, k, cont;
-	double *row_sum_conc;
-	double *col_sum_conc;
-	double *row_sum_disc;
-	double *col_sum_disc;
-
-	row_sum_conc=G_malloc(ncriteria * nrows * ncols * sizeof(double*));
-	col_sum_conc=G_malloc(ncriteria * nrows * ncols * sizeof(double*));
-	row_sum_disc=G_malloc(ncriteria * nrows * ncols * sizeof(double*));
-	col_sum_disc=G_malloc(ncriteria * nrows * ncols * sizeof(double*));
-
-    k = 0;			/* make pairwise comparation and build concordance/discordance matrix */
+    int row1, col1;
+    int i, j, c, ncells, floor;
+    int *cells;
+    double *v, *conc, *row_disc, *col_disc;
+    int *row_covered, *col_covered;
+
+    /* the cells without nulls */
+    cells = G_malloc(nrows * ncols * sizeof(int));
+    ncells = 0;
     for (row1 = 0; row1 < nrows; row1++)
-    {
-        G_percent(row1, nrows, 2);
         for (col1 = 0; col1 < ncols; col1++)
         {
-            j = 0;
-            for (row2 = 0; row2 < nrows; row2++)
+            for (i = 0; i < ncriteria; i++)
+                if (Rast_is_d_null_value(&decision_vol[row1][col1][i]))
+                    break;
+            if (i < ncriteria)
             {
-                for (col2 = 0; col2 < ncols; col2++)
+                Rast_set_d_null_value(&decision_vol[row1][col1][ncriteria], 2);
+                continue;
+            }
+            cells[ncells++] = row1 * ncols + col1;
+        }
+
+    v = G_malloc((size_t)ncells * ncriteria * sizeof(double));
+    for (c = 0; c < ncells; c++)
+        for (i = 0; i < ncriteria; i++)
+            v[c * ncriteria + i] =
+                decision_vol[cells[c] / ncols][cells[c] % ncols][i];
+
+    conc = G_calloc(ncells, sizeof(double));
+    row_disc = G_calloc(ncells, sizeof(double));
+    col_disc = G_calloc(ncells, sizeof(double));
+    row_covered = G_calloc(ncells, sizeof(int));
+    col_covered = G_calloc(ncells, sizeof(int));
+
+    /* the -100 bound of the discordance only matters if every criterion
+     * spans more than 100 */
+    floor = ncells > 0;
+    for (i = 0; i < ncriteria && floor; i++)
+    {
+        double min, max;
+
+        min = max = v[i];
+        for (c = 1; c < ncells; c++)
+        {
+            if (v[c * ncriteria + i] < min)
+                min = v[c * ncriteria + i];
+            if (v[c * ncriteria + i] > max)
+                max = v[c * ncriteria + i];
+        }
+        if (max - min <= 100)
+            floor = 0;
+    }
+
+    G_message(_("Concordance index..."));
+#pragma omp parallel for ordered schedule(static, 1) private(c)
+    for (i = 0; i < ncriteria; i++)
+    {
+        struct cell_value *sorted;
+        double *part;
+        int j, k;
+
+        sorted = G_malloc(ncells * sizeof(struct cell_value));
+        part = G_malloc(ncells * sizeof(double));
+        for (c = 0; c < ncells; c++)
+        {
+            sorted[c].value = v[c * ncriteria + i];
+            sorted[c].cell = c;
+        }
+        qsort(sorted, ncells, sizeof(struct cell_value), cmp_cell_value);
+
+        /* smaller minus larger values, equal ones cancel */
+        for (c = 0; c < ncells; c = k)
+        {
+            for (k = c; k < ncells && sorted[k].value == sorted[c].value; k++)
+                ;
+            for (j = c; j < k; j++)
+                part[sorted[j].cell] =
+                    weight_vect[i] * ((double)c - (ncells - k));
+        }
+
+#pragma omp ordered
+        {
+            for (c = 0; c < ncells; c++)
+                conc[c] += part[c];
+        }
+
+        G_free(sorted);
+        G_free(part);
+    }
+
+    G_message(_("Discordance index..."));
+#pragma omp parallel for ordered schedule(static, 1) private(c)
+    for (j = 0; j < 2 * ncriteria; j++)
+    {
+        double *part = G_malloc(ncells * sizeof(double));
+        int *covered = G_malloc(ncells * sizeof(int));
+        int col = j >= ncriteria;	/* comparison of the others with the cell */
+
+        discordance_criterion(v, ncells, ncriteria, j % ncriteria,
+                              col ? -1.0 : 1.0, floor, part, covered);
+
+#pragma omp ordered
+        {
+            for (c = 0; c < ncells; c++)
+            {
+                if (col)
+                {
+                    col_disc[c] += part[c];
+                    col_covered[c] += covered[c];
+                }
+                else
                 {
-                    double conc = 0, disc = -100;
-                    for (i = 0; i < ncriteria; i++)
-                    {
-                        double d;
-						d = decision_vol[row1][col1][i] - decision_vol[row2][col2][i];
-                        if (d >= 0 )
-                            conc += weight_vect[i];
-                        if (d >= disc)	/*WARNING: if(d>conc) */
-                            disc = d;
-						//printf("\ndisc:%f-:%f -:%f",disc,decision_vol[row1][col1][i], decision_vol[row2][col2][i]);
-                    }
-                    row_sum_conc[k] += conc;
-                    col_sum_conc[j] += conc;
-                    row_sum_disc[k] += disc;
-                    col_sum_disc[j] += disc;
-		    
-
-                    j++;	/* increase rows index up to nrows*ncols */
+                    row_disc[c] += part[c];
+                    row_covered[c] += covered[c];
                 }
             }
-            k++;		/* increase columns index up to nrows*ncols */;
+            G_percent(j + 1, 2 * ncriteria, 1);
         }
+
+        G_free(part);
+        G_free(covered);
     }
 
     /*calculate concordance and discordance index and storage in decision_vol */
-    cont = 0;			/*variabile progressiva per riga/colonna della concordance_map */
-    for (row1 = 0; row1 < nrows; row1++)
+    for (c = 0; c < ncells; c++)
     {
-        G_percent(row1, nrows, 2);
-        for (col1 = 0; col1 < ncols; col1++)
-        {
+        double *cell = decision_vol[cells[c] / ncols][cells[c] % ncols];
 
-            /*fill matrix with concordance index for each DCELL */
-            decision_vol[row1][col1][ncriteria] =
-                row_sum_conc[cont] - col_sum_conc[cont];
-            /*fill matrix with discordance index for each DCELL */
-            decision_vol[row1][col1][ncriteria + 1] =
-                col_sum_disc[cont]-row_sum_disc[cont];
-            cont++;
+        /* the remaining pairs are at the -100 bound */
+        if (floor)
+        {
+            row_disc[c] -= 100.0 * (ncells - row_covered[c]);
+            col_disc[c] -= 100.0 * (ncells - col_covered[c]);
         }
+
+        /*fill matrix with concordance index for each DCELL */
+        cell[ncriteria] = conc[c];
+        /*fill matrix with discordance index for each DCELL */
+        cell[ncriteria + 1] = col_disc[c] - row_disc[c];
     }
+
+    G_free(cells);
+    G_free(v);
+    G_free(conc);
+    G_free(row_disc);
+    G_free(col_disc);
+    G_free(row_covered);
+    G_free(col_covered);
 }
@@ -6,6 +6,9 @@
 #include <grass/raster.h>
 #include <grass/glocale.h>
 #include <grass/config.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 
 struct input
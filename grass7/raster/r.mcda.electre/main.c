@@ -34,6 +34,7 @@ int main(int argc, char *argv[])
     /*char *mapset;		 mapset name */
     unsigned char *outrast_concordance, *outrast_discordance;	/* output buffer */
     int i,j, ncriteria=0;	/* index and  files number*/
+    int nthreads;
     int nrows, ncols;
     int row1, col1;
     int outfd_concordance, outfd_discordance;		/* output file descriptor */
@@ -45,7 +46,7 @@ int main(int argc, char *argv[])
 
     struct GModule *module;	/* GRASS module for parsing arguments */
 
-    struct Option *criteria, *weight, *discordance, *concordance;	/* options */
+    struct Option *criteria, *weight, *discordance, *concordance, *threads;	/* options */
 
     struct input *attributes; /*storage  alla input criteria GRID files and output concordance and discordance GRID files*/
 
@@ -91,10 +92,29 @@ int main(int argc, char *argv[])
     discordance->answer ="discordance";
     discordance->description = "discordance output map";
 
+    threads = G_define_option();
+    threads->key = "threads";
+    threads->type = TYPE_INTEGER;
+    threads->required = NO;
+    threads->description = _("Number of threads for parallel computing");
+    threads->answer = "1";
+
     /* options and flags parser */
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
 
+    nthreads = atoi(threads->answer);
+    if (nthreads < 1)
+        G_fatal_error(_("<%s> must be greater than 0"), threads->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+        G_warning(_("%s was compiled without OpenMP support, using one thread"),
+                  G_program_name());
+    nthreads = 1;
+#endif
+
 
     G_message("Start: %s",G_date()); /*write calculation start time*/
 
@@ -189,7 +209,7 @@ int main(int argc, char *argv[])
     }
 
 
-    build_dominance_matrix(nrows,ncols,ncriteria,weight_vect,decision_vol); /*scan all DCELL, make a pairwise comparatione, buil concordance and discordance matrix and relative index*/
+    build_dominance_matrix(nrows,ncols,ncriteria,weight_vect,decision_vol); /*sort all DCELL, build concordance and discordance matrix and relative index*/
 
 
     for (row1 = 0; row1 < nrows; row1++)
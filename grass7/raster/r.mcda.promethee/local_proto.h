@@ -6,6 +6,9 @@
 #include <grass/raster.h>
 #include <grass/glocale.h>
 #include <grass/config.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 
 struct input
@@ -20,4 +23,5 @@ void build_weight_vect(int ncriteria, struct Option *weight,
 
 void build_flow_matrix(int nrows, int ncols, int ncriteria,
                             double *weight_vect, double ***decision_vol,
-                            double **positive_flow_vol, double **negative_flow_vol);
+                            double **positive_flow_vol, double **negative_flow_vol,
+                            int nthreads);
@@ -34,6 +34,7 @@ int main(int argc, char *argv[])
     /*char *mapset;      mapset name */
     unsigned char *outrast_positive_flow, *outrast_negative_flow;  /* output buffer */
     int i,j, ncriteria=0;   /* index and  files number*/
+    int nthreads;
     int nrows, ncols;
     int row1, col1;
     int outfd_positive_flow, outfd_negative_flow;      /* output file descriptor */
@@ -45,7 +46,7 @@ int main(int argc, char *argv[])
 
     struct GModule *module; /* GRASS module for parsing arguments */
 
-    struct Option *criteria, *weight, *positiveflow, *negativeflow;   /* options */
+    struct Option *criteria, *weight, *positiveflow, *negativeflow, *threads;   /* options */
 
     struct input *attributes; /*storage  alla input criteria GRID files and output concordance and discordance GRID files*/
 
@@ -90,11 +91,30 @@ int main(int argc, char *argv[])
     negativeflow->gisprompt = "new,cell,raster";
     negativeflow->answer ="negativeflow";
     negativeflow->description = "negative flow output map";
+
+    threads = G_define_option();
+    threads->key = "threads";
+    threads->type = TYPE_INTEGER;
+    threads->required = NO;
+    threads->description = _("Number of threads for parallel computing");
+    threads->answer = "1";
     
     /* options and flags parser */
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
 
+    nthreads = atoi(threads->answer);
+    if (nthreads < 1)
+        G_fatal_error(_("<%s> must be greater than 0"), threads->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+        G_warning(_("%s was compiled without OpenMP support, using one thread"),
+                  G_program_name());
+    nthreads = 1;
+#endif
+
 
     G_message("Start: %s",G_date()); /*write calculation start time*/
 
@@ -198,7 +218,7 @@ int main(int argc, char *argv[])
     }
     
     G_message("run algorithm");
-    build_flow_matrix(nrows,ncols,ncriteria,weight_vect,decision_vol,positive_flow_vol,negative_flow_vol); /*scan all DCELL, make a pairwise comparatione, buil positive flow matrix*/
+    build_flow_matrix(nrows,ncols,ncriteria,weight_vect,decision_vol,positive_flow_vol,negative_flow_vol,nthreads); /*sort all DCELL of each criterion, build positive and negative flow matrix*/
 
     G_message("buil mcda maps");
     for (row1 = 0; row1 < nrows; row1++)
@@ -9,7 +9,8 @@ void build_weight_vect(int ncriteria, struct Option *weight,
 
 void build_flow_matrix(int nrows, int ncols, int ncriteria,
                             double *weight_vect, double ***decision_vol,
-                            double **positive_flow_vol, double **negative_flow_vol);
+                            double **positive_flow_vol, double **negative_flow_vol,
+                            int nthreads);
 
 
 /*
@@ -50,50 +51,126 @@ void build_weight_vect(int ncriteria,struct Option *weight,
 }
 
 
+/* criterion value of a cell */
+struct cell_value
+{
+    double value;
+    int cell;
+};
+
+static int cmp_cell_value(const void *a, const void *b)
+{
+    const struct cell_value *va = a, *vb = b;
+
+    if (va->value < vb->value)
+        return -1;
+    if (va->value > vb->value)
+        return 1;
+    return va->cell - vb->cell;
+}
+
+/* With the linear preference function the positive flow of a cell is
+ * the sum of the differences to all cells with a smaller value and the
+ * negative flow the sum of the differences to all cells with a larger
+ * value.  Both follow from the sorted values and their prefix sums:
+ *   positive = n_smaller * v - sum_smaller
+ *   negative = sum_larger - n_larger * v
+ * which is O(N log N) per criterion instead of O(N^2).  The criteria
+ * are sorted in parallel and added in criteria order. */
 void build_flow_matrix(int nrows, int ncols, int ncriteria,
                             double *weight_vect, double ***decision_vol,
-                            double **positive_flow_vol, double **negative_flow_vol)
+                            double **positive_flow_vol, double **negative_flow_vol,
+                            int nthreads)
 {
-    int row1, col1, row2, col2;
-    int i;
-	double threshold;
+    int row1, col1;
+    int i, t, ncells = nrows * ncols;
+    struct cell_value **values;
+    double **positive, **negative;
+
+    values = G_malloc(nthreads * sizeof(struct cell_value *));
+    positive = G_malloc(nthreads * sizeof(double *));
+    negative = G_malloc(nthreads * sizeof(double *));
+    for (t = 0; t < nthreads; t++)
+    {
+        values[t] = G_malloc(ncells * sizeof(struct cell_value));
+        positive[t] = G_malloc(ncells * sizeof(double));
+        negative[t] = G_malloc(ncells * sizeof(double));
+    }
 
-/* make pairwise comparation and build positive flow matrix */
-	for (i = 0; i < ncriteria; i++)
-	{
-		G_message("Processing criteria #%d ...",i+1);
-		for (row1 = 0; row1 < nrows; row1++)
-		{
-			for (col1 = 0; col1 < ncols; col1++)
-			{
-				//G_percent(i, (nrows*ncriteria), 2);
-				for (row2 = 0; row2 < nrows; row2++)
-				{
-					//G_percent(row2, (nrows), 2);
-					for (col2 = 0; col2 < ncols; col2++)
-					{
-						G_percent(row2, (nrows), 2);
-						threshold = (decision_vol[row1][col1][i] - decision_vol[row2][col2][i]);
-
-						if (threshold>0) /* if therehold is positive, it fill the positive flow*/
-							{
-							positive_flow_vol[row1][col1]=positive_flow_vol[row1][col1]+(threshold*weight_vect[i]);
-							negative_flow_vol[row1][col1]=negative_flow_vol[row1][col1];
-
-							}
-						else if (threshold<0)/* if thershold is negative, it  fill the negative flow*/
-							{
-							negative_flow_vol[row1][col1]=negative_flow_vol[row1][col1]+(-threshold*weight_vect[i]);
-							positive_flow_vol[row1][col1]=positive_flow_vol[row1][col1];
-							}
-						else
-							negative_flow_vol[row1][col1]=negative_flow_vol[row1][col1];
-							positive_flow_vol[row1][col1]=positive_flow_vol[row1][col1];
-					}
-				}
-			}
-		}
-	}
+    G_message(_("Processing %d criteria..."), ncriteria);
+
+#pragma omp parallel for ordered schedule(static, 1) private(t, row1, col1)
+    for (i = 0; i < ncriteria; i++)
+    {
+        struct cell_value *v;
+        double *pos, *neg;
+        long double sum, total;
+        int n, j, k, cell;
+
+#if defined(_OPENMP)
+        t = omp_get_thread_num();
+#else
+        t = 0;
+#endif
+        v = values[t];
+        pos = positive[t];
+        neg = negative[t];
+
+        /* sort the values of the criterion, null cells are not compared */
+        n = 0;
+        for (row1 = 0; row1 < nrows; row1++)
+            for (col1 = 0; col1 < ncols; col1++)
+                if (!Rast_is_d_null_value(&decision_vol[row1][col1][i]))
+                {
+                    v[n].value = decision_vol[row1][col1][i];
+                    v[n].cell = row1 * ncols + col1;
+                    n++;
+                }
+        qsort(v, n, sizeof(struct cell_value), cmp_cell_value);
+
+        total = 0;
+        for (j = 0; j < n; j++)
+            total += v[j].value;
+
+        /* cells with equal values do not prefer each other */
+        sum = 0;
+        for (j = 0; j < n; j = k)
+        {
+            long double value = v[j].value;
+            long double larger;
+
+            for (k = j; k < n && v[k].value == v[j].value; k++)
+                ;
+            larger = total - sum - (k - j) * value;
+            for (cell = j; cell < k; cell++)
+            {
+                pos[cell] = (double)((j * value - sum) * weight_vect[i]);
+                neg[cell] = (double)((larger - (n - k) * value) * weight_vect[i]);
+            }
+            sum += (k - j) * value;
+        }
+
+#pragma omp ordered
+        {
+            for (j = 0; j < n; j++)
+            {
+                cell = v[j].cell;
+                positive_flow_vol[cell / ncols][cell % ncols] += pos[j];
+                negative_flow_vol[cell / ncols][cell % ncols] += neg[j];
+            }
+            G_percent(i + 1, ncriteria, 1);
+        }
+    }
+
+    for (t = 0; t < nthreads; t++)
+    {
+        G_free(values[t]);
+        G_free(positive[t]);
+        G_free(negative[t]);
+    }
+    G_free(values);
+    G_free(positive);
+    G_free(negative);
 
 	for(row1 = 0; row1 < nrows; row1++)
 		{
@@ -24,18 +24,20 @@
 #include <grass/glocale.h>
 #include <grass/gmath.h>
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 struct input
 {
     const char *name;
     int fd;
-    DCELL *buf;
 };
 
 struct output
 {
     const char *name;
     int fd;
-    DCELL *buf;
 };
 
 static double uniform(double ref, double x, double max)
@@ -208,6 +210,631 @@ static double term(int term, double x)
     return 0.0;
 }
 
+/* LWR parameters shared by all threads */
+struct lwr_par
+{
+    int num_inputs;
+    double *ts;
+    int order, min_points;
+    double (*weight_func)(double, double, double);
+    double fet, lo, hi, maxgap, delta;
+    int use_range, rejlo, rejhi, interp_only;
+    struct lwr_fit *fit;
+};
+
+/* precomputed fit for time step i of a series without NULL values:
+ * the design matrix only depends on the time steps, 
+ * the coefficients are a linear combination of the observations */
+struct lwr_fit
+{
+    int in_lo, in_hi;		/* first and last observation used */
+    double max_ts;		/* bandwidth */
+    int solved;			/* 0 if points are co-linear */
+    double **H;			/* B[j] = sum(H[j][n - in_lo] * y[n]) */
+    double *L;			/* estimate = sum(L[n - in_lo] * y[n]) */
+};
+
+/* work space, one per thread */
+struct lwr_ws
+{
+    DCELL *values, *values2, *resultn;
+    int *isnull;
+    int *nnull;			/* number of NULL values before i */
+    char *full;
+    double **m, **m2, *a, *a2, *B;
+};
+
+/* number of cells processed together */
+#define BLOCK_SIZE 256
+
+/* search order + 1 + dod valid values around time step i,
+ * returns the margin */
+static int lwr_window(const struct lwr_par *p, const int *isnull, int i,
+                      int *in_lo, int *in_hi, double *max_ts)
+{
+    int j, n_points, this_margin;
+    double tsdiff1, tsdiff2;
+
+    n_points = 0;
+    *in_lo = *in_hi = i;
+    this_margin = 0;
+    if (!isnull[i])
+	n_points++;
+    for (j = 1; j < p->num_inputs; j++) {
+	if (i - j >= 0) {
+	    if (!isnull[i - j]) {
+		n_points++;
+		*in_lo = i - j;
+	    }
+	}
+	if (i + j < p->num_inputs) {
+	    if (!isnull[i + j]) {
+		n_points++;
+		*in_hi = i + j;
+	    }
+	}
+	if (n_points >= p->min_points) {
+	    this_margin = j;
+	    break;
+	}
+    }
+
+    tsdiff1 = p->ts[i] - p->ts[*in_lo];
+    tsdiff2 = p->ts[*in_hi] - p->ts[i];
+
+    *max_ts = tsdiff1;
+    if (*max_ts < tsdiff2)
+	*max_ts = tsdiff2;
+
+    *max_ts *= (1.0 + 1.0 / this_margin);
+
+    return this_margin;
+}
+
+/* precompute fits for series without NULL values */
+static struct lwr_fit *lwr_fit_init(const struct lwr_par *p)
+{
+    int i, j, k, n, np, msize, ncolinear;
+    int *isnull;
+    double **m, **m2, *m2base, *a, *B, **minv, weight, wsum;
+    struct lwr_fit *fit;
+
+    msize = p->order + 1;
+    m = G_alloc_matrix(msize, msize);
+    m2 = G_alloc_matrix(msize, msize);
+    m2base = m2[0];
+    minv = G_alloc_matrix(msize, msize);
+    a = G_alloc_vector(msize);
+    B = G_alloc_vector(msize);
+    isnull = G_calloc(p->num_inputs, sizeof(int));
+
+    fit = G_malloc(p->num_inputs * sizeof(struct lwr_fit));
+    ncolinear = 0;
+
+    for (i = 0; i < p->num_inputs; i++) {
+	struct lwr_fit *f = &fit[i];
+
+	lwr_window(p, isnull, i, &f->in_lo, &f->in_hi, &f->max_ts);
+	np = f->in_hi - f->in_lo + 1;
+	f->H = G_alloc_matrix(msize, np);
+	f->L = G_alloc_vector(np);
+
+	for (j = 0; j <= p->order; j++) {
+	    for (k = 0; k <= p->order; k++)
+		m[j][k] = 0;
+	}
+	for (n = f->in_lo; n <= f->in_hi; n++) {
+	    weight = p->weight_func(p->ts[i], p->ts[n], f->max_ts);
+	    for (j = 0; j <= p->order; j++) {
+		double val1 = term(j, p->ts[n]);
+
+		for (k = j; k <= p->order; k++)
+		    m[j][k] += val1 * term(k, p->ts[n]) * weight;
+	    }
+	}
+	for (j = 1; j <= p->order; j++) {
+	    for (k = 0; k < j; k++)
+		m[j][k] = m[k][j];
+	    m[j][j] *= (1 + p->delta);
+	}
+
+	/* inverse of m, column by column */
+	f->solved = 1;
+	for (k = 0; k <= p->order && f->solved; k++) {
+	    /* solvemat() swaps rows */
+	    for (j = 0; j <= p->order; j++) {
+		m2[j] = m2base + j * msize;
+		memcpy(m2[j], m[j], msize * sizeof(double));
+		a[j] = (j == k);
+	    }
+	    f->solved = solvemat(m2, a, B, msize);
+	    for (j = 0; j <= p->order; j++)
+		minv[j][k] = B[j];
+	}
+
+	if (f->solved) {
+	    for (n = f->in_lo; n <= f->in_hi; n++) {
+		weight = p->weight_func(p->ts[i], p->ts[n], f->max_ts);
+		f->L[n - f->in_lo] = 0;
+		for (j = 0; j <= p->order; j++) {
+		    f->H[j][n - f->in_lo] = 0;
+		    for (k = 0; k <= p->order; k++)
+			f->H[j][n - f->in_lo] +=
+			    minv[j][k] * term(k, p->ts[n]) * weight;
+		    f->L[n - f->in_lo] +=
+			f->H[j][n - f->in_lo] * term(j, p->ts[i]);
+		}
+	    }
+	}
+	else {
+	    /* weighted average */
+	    ncolinear++;
+	    wsum = 0;
+	    for (n = f->in_lo; n <= f->in_hi; n++) {
+		weight = p->weight_func(p->ts[i], p->ts[n], f->max_ts);
+		f->L[n - f->in_lo] = weight;
+		wsum += weight;
+	    }
+	    for (n = 0; n < np; n++)
+		f->L[n] /= wsum;
+	}
+    }
+    if (ncolinear)
+	G_warning(_("Points are (nearly) co-linear for %d time steps, using weighted average"),
+	          ncolinear);
+
+    m2[0] = m2base;
+    G_free_matrix(m);
+    G_free_matrix(m2);
+    G_free_matrix(minv);
+    G_free_vector(a);
+    G_free_vector(B);
+    G_free(isnull);
+
+    return fit;
+}
+
+static void lwr_ws_init(struct lwr_ws *ws, int num_inputs, int order)
+{
+    int msize = order + 1;
+
+    ws->values = G_malloc(num_inputs * sizeof(DCELL));
+    ws->values2 = G_malloc(num_inputs * sizeof(DCELL));
+    ws->resultn = G_malloc(num_inputs * sizeof(DCELL));
+    ws->isnull = G_malloc(num_inputs * sizeof(int));
+    ws->nnull = G_malloc((num_inputs + 1) * sizeof(int));
+    ws->full = G_malloc(BLOCK_SIZE);
+    ws->m = G_alloc_matrix(msize, msize);
+    ws->m2 = G_alloc_matrix(msize, msize);
+    ws->a = G_alloc_vector(msize);
+    ws->a2 = G_alloc_vector(msize);
+    ws->B = G_alloc_vector(msize);
+}
+
+/* reject outliers using the precomputed fit for time step i */
+static double lwr_reject_fit(const struct lwr_par *p, struct lwr_ws *ws,
+                             const struct lwr_fit *f, int i)
+{
+    int j, n, done;
+    double result, maxerrlo, maxerrhi, *B = ws->B;
+    DCELL *values = ws->values, *values2 = ws->values2,
+          *resultn = ws->resultn;
+
+    for (j = 0; j <= p->order; j++) {
+	B[j] = 0;
+	for (n = f->in_lo; n <= f->in_hi; n++)
+	    B[j] += f->H[j][n - f->in_lo] * values[n];
+    }
+    result = 0.0;
+    for (j = 0; j <= p->order; j++)
+	result += B[j] * term(j, p->ts[i]);
+
+    for (n = f->in_lo; n <= f->in_hi; n++)
+	values2[n] = values[n];
+
+    done = 0;
+    while (!done) {
+	done = 1;
+
+	maxerrlo = maxerrhi = 0;
+	for (n = f->in_lo; n <= f->in_hi; n++) {
+	    resultn[n] = 0.0;
+	    for (j = 0; j <= p->order; j++)
+		resultn[n] += B[j] * term(j, p->ts[n]);
+	    if (maxerrlo < resultn[n] - values2[n])
+		maxerrlo = resultn[n] - values2[n];
+	    if (maxerrhi < values2[n] - resultn[n])
+		maxerrhi = values2[n] - resultn[n];
+	}
+
+	if (p->rejlo && maxerrlo > p->fet)
+	    done = 0;
+	if (p->rejhi && maxerrhi > p->fet)
+	    done = 0;
+
+	if (!done) {
+	    /* replace outliers */
+	    for (n = f->in_lo; n <= f->in_hi; n++) {
+		if (p->rejlo && resultn[n] - values2[n] > maxerrlo * 0.5)
+		    values2[n] = (resultn[n] + values2[n]) * 0.5;
+		if (p->rejhi && values2[n] - resultn[n] > maxerrhi * 0.5)
+		    values2[n] = (values2[n] + resultn[n]) * 0.5;
+	    }
+	    for (j = 0; j <= p->order; j++) {
+		B[j] = 0;
+		for (n = f->in_lo; n <= f->in_hi; n++)
+		    B[j] += f->H[j][n - f->in_lo] * values2[n];
+	    }
+	    /* update estimate */
+	    result = 0.0;
+	    for (j = 0; j <= p->order; j++)
+		result += B[j] * term(j, p->ts[i]);
+	}
+    }
+
+    return result;
+}
+
+/* estimate for time step i with the precomputed fit,
+ * the observations in the window must not be NULL */
+static double lwr_fit_value(const struct lwr_par *p, struct lwr_ws *ws,
+                            const struct lwr_fit *f, int i)
+{
+    int n;
+    double result;
+
+    if (f->solved && (p->rejlo || p->rejhi))
+	result = lwr_reject_fit(p, ws, f, i);
+    else {
+	result = 0;
+	for (n = f->in_lo; n <= f->in_hi; n++)
+	    result += f->L[n - f->in_lo] * ws->values[n];
+    }
+    if (result < p->lo)
+	result = p->lo;
+    if (result > p->hi)
+	result = p->hi;
+
+    return result;
+}
+
+/* LWR for one cell with NULL values or values outside the range */
+static void lwr_cell(const struct lwr_par *p, struct lwr_ws *ws,
+                     DCELL **inbuf, DCELL **outbuf, int col)
+{
+    int i, j, k, n;
+    int num_inputs = p->num_inputs, order = p->order;
+    int n_nulls, first, last, in_lo, in_hi;
+    double thisgap, prev_ts, next_ts, weight, max_ts;
+    double maxerrlo, maxerrhi;
+    double *ts = p->ts;
+    double **m = ws->m, **m2 = ws->m2, *a = ws->a, *a2 = ws->a2,
+           *B = ws->B;
+    DCELL *values = ws->values, *values2 = ws->values2,
+          *resultn = ws->resultn;
+    int *isnull = ws->isnull, *nnull = ws->nnull;
+    const struct lwr_fit *f;
+
+    first = last = -1;
+    n_nulls = 0;
+    nnull[0] = 0;
+    for (i = 0; i < num_inputs; i++) {
+	DCELL v = inbuf[i][col];
+
+	isnull[i] = 0;
+	if (Rast_is_d_null_value(&v)) {
+	    isnull[i] = 1;
+	    n_nulls++;
+	}
+	else if (p->use_range && (v < p->lo || v > p->hi)) {
+	    Rast_set_d_null_value(&v, 1);
+	    isnull[i] = 1;
+	    n_nulls++;
+	}
+	else {
+	    if (first == -1)
+		first = i;
+	    last = i;
+	}
+	values[i] = v;
+	nnull[i + 1] = n_nulls;
+    }
+    if (!p->interp_only) {
+	first = 0;
+	last = num_inputs - 1;
+    }
+    else {
+	for (i = 0; i < first; i++)
+	    Rast_set_d_null_value(&outbuf[i][col], 1);
+	for (i = last + 1; i < num_inputs; i++)
+	    Rast_set_d_null_value(&outbuf[i][col], 1);
+    }
+
+    if (num_inputs - n_nulls < p->min_points) {
+	for (i = 0; i < num_inputs; i++)
+	    Rast_set_d_null_value(&outbuf[i][col], 1);
+
+	return;
+    }
+
+    /* LWR */
+    thisgap = 0;
+    prev_ts = next_ts = ts[0] - (ts[1] - ts[0]);
+
+    for (i = first; i <= last; i++) {
+	DCELL result;
+
+	if (isnull[i]) {
+	    if (next_ts < ts[i]) {
+		if (i > 0)
+		    prev_ts = ts[i] - (ts[i] - ts[i - 1]) / 2.0;
+		else
+		    prev_ts = ts[i] - (ts[i + 1] - ts[i]) / 2.0;
+
+		j = i;
+		while (j < num_inputs - 1 && isnull[j + 1])
+		    j++;
+
+		if (j < num_inputs - 1)
+		    next_ts = ts[j] + (ts[j + 1] - ts[j]) / 2.0;
+		else
+		    next_ts = ts[j] + (ts[j] - ts[j - 1]) / 2.0;
+
+		thisgap = next_ts - prev_ts;
+	    }
+	    if (thisgap > p->maxgap) {
+		Rast_set_d_null_value(&outbuf[i][col], 1);
+		continue;
+	    }
+	}
+
+	/* no NULL values around i: same window as without NULL values */
+	f = &p->fit[i];
+	if (nnull[f->in_hi + 1] - nnull[f->in_lo] == 0) {
+	    outbuf[i][col] = lwr_fit_value(p, ws, f, i);
+	    continue;
+	}
+
+	/* margin around i */
+	lwr_window(p, isnull, i, &in_lo, &in_hi, &max_ts);
+
+	if (p->interp_only && isnull[i] &&
+	    (in_lo == i || in_hi == i)) {
+
+	    Rast_set_d_null_value(&outbuf[i][col], 1);
+	    continue;
+	}
+
+	/* initialize matrix and vectors */
+	for (j = 0; j <= order; j++) {
+	    a[j] = 0;
+	    B[j] = 0;
+	    m[j][j] = 0;
+	    for (k = 0; k < j; k++) {
+		m[j][k] = m[k][j] = 0;
+	    }
+	}
+
+	/* load points */
+	for (n = in_lo; n <= in_hi; n++) {
+	    if (isnull[n])
+		continue;
+
+	    weight = p->weight_func(ts[i], ts[n], max_ts);
+	    for (j = 0; j <= order; j++) {
+		double val1 = term(j, ts[n]);
+
+		for (k = j; k <= order; k++) {
+		    double val2 = term(k, ts[n]);
+
+		    m[j][k] += val1 * val2 * weight;
+		}
+		a[j] += values[n] * val1 * weight;
+	    }
+	}
+
+	/* TRANSPOSE VALUES IN UPPER HALF OF M TO OTHER HALF */
+	m2[0][0] = m[0][0];
+	a2[0] = a[0];
+	for (j = 1; j <= order; j++) {
+	    for (k = 0; k < j; k++) {
+		m[j][k] = m[k][j];
+		m2[j][k] = m2[k][j] = m[k][j];
+	    }
+	    m[j][j] *= (1 + p->delta);
+	    m2[j][j] = m[j][j];
+	    a2[j] = a[j];
+	}
+
+	if (solvemat(m2, a2, B, order + 1) != 0) {
+	    /* get estimate */
+	    result = 0.0;
+	    for (j = 0; j <= order; j++) {
+		result += B[j] * term(j, ts[i]);
+	    }
+
+	    if (p->rejlo || p->rejhi) {
+		int done = 0;
+
+		for (n = in_lo; n <= in_hi; n++) {
+		    if (isnull[n])
+			continue;
+
+		    values2[n] = values[n];
+		}
+
+		while (!done) {
+		    done = 1;
+
+		    maxerrlo = maxerrhi = 0;
+		    for (n = in_lo; n <= in_hi; n++) {
+			if (isnull[n])
+			    continue;
+
+			resultn[n] = 0.0;
+			for (j = 0; j <= order; j++) {
+			    resultn[n] += B[j] * term(j, ts[n]);
+			}
+			if (maxerrlo < resultn[n] - values2[n])
+			    maxerrlo = resultn[n] - values2[n];
+			if (maxerrhi < values2[n] - resultn[n])
+			    maxerrhi = values2[n] - resultn[n];
+		    }
+
+		    if (p->rejlo && maxerrlo > p->fet)
+			done = 0;
+		    if (p->rejhi && maxerrhi > p->fet)
+			done = 0;
+
+		    if (!done) {
+
+			a2[0] = 0;
+			m2[0][0] = m[0][0];
+			for (j = 1; j <= order; j++) {
+			    for (k = 0; k < j; k++) {
+				m2[j][k] = m2[k][j] = m[k][j];
+			    }
+			    m2[j][j] = m[j][j];
+			    a2[j] = 0;
+			}
+
+			/* replace outliers */
+			for (n = in_lo; n <= in_hi; n++) {
+			    if (isnull[n])
+				continue;
+
+			    weight = p->weight_func(ts[i], ts[n], max_ts);
+			    if (p->rejlo && resultn[n] - values2[n] > maxerrlo * 0.5) {
+				values2[n] = (resultn[n] + values2[n]) * 0.5;
+			    }
+			    if (p->rejhi && values2[n] - resultn[n] > maxerrhi * 0.5) {
+				values2[n] = (values2[n] + resultn[n]) * 0.5;
+			    }
+			    for (j = 0; j <= order; j++) {
+				double val1 = term(j, ts[n]);
+
+				a2[j] += values2[n] * val1 * weight;
+			    }
+			}
+			done = 1;
+			if (solvemat(m2, a2, B, order + 1) != 0) {
+			    /* update estimate */
+			    result = 0.0;
+			    for (j = 0; j <= order; j++) {
+				result += B[j] * term(j, ts[i]);
+			    }
+			    done = 0;
+			}
+		    }
+		}
+	    }
+	}
+	else {
+	    double wsum = 0.0;
+
+#pragma omp critical
+	    G_warning(_("Points are (nearly) co-linear, using weighted average"));
+
+	    result = 0.0;
+	    for (n = in_lo; n <= in_hi; n++) {
+		if (isnull[n])
+		    continue;
+
+		weight = p->weight_func(ts[i], ts[n], max_ts);
+		result += values[n] * weight;
+		wsum += weight;
+	    }
+	    result /= wsum;
+	}
+	if (result < p->lo)
+	    result = p->lo;
+	if (result > p->hi)
+	    result = p->hi;
+	outbuf[i][col] = result;
+    }
+}
+
+/* LWR for a block of cells [c0, c1)
+ * series without NULL values are processed together with the
+ * precomputed fits, looping over cells in the innermost loop */
+static void lwr_block(const struct lwr_par *p, struct lwr_ws *ws,
+                      DCELL **inbuf, DCELL **outbuf, int c0, int c1)
+{
+    int i, n, c, nfull;
+    char *full = ws->full;
+
+    nfull = 0;
+    for (c = c0; c < c1; c++) {
+	full[c - c0] = 1;
+	for (i = 0; i < p->num_inputs; i++) {
+	    DCELL v = inbuf[i][c];
+
+	    if (Rast_is_d_null_value(&v) ||
+	        (p->use_range && (v < p->lo || v > p->hi))) {
+		full[c - c0] = 0;
+		break;
+	    }
+	}
+	nfull += full[c - c0];
+    }
+
+    if (nfull && !p->rejlo && !p->rejhi) {
+	for (i = 0; i < p->num_inputs; i++) {
+	    const struct lwr_fit *f = &p->fit[i];
+	    DCELL *out = outbuf[i];
+
+	    for (c = c0; c < c1; c++)
+		out[c] = 0;
+	    for (n = f->in_lo; n <= f->in_hi; n++) {
+		double l = f->L[n - f->in_lo];
+		const DCELL *in = inbuf[n];
+
+		for (c = c0; c < c1; c++)
+		    out[c] += l * in[c];
+	    }
+	    for (c = c0; c < c1; c++) {
+		if (out[c] < p->lo)
+		    out[c] = p->lo;
+		if (out[c] > p->hi)
+		    out[c] = p->hi;
+	    }
+	}
+    }
+
+    for (c = c0; c < c1; c++) {
+	if (!full[c - c0]) {
+	    lwr_cell(p, ws, inbuf, outbuf, c);
+	}
+	else if (p->rejlo || p->rejhi) {
+	    for (i = 0; i < p->num_inputs; i++)
+		ws->values[i] = inbuf[i][c];
+
+	    for (i = 0; i < p->num_inputs; i++)
+		outbuf[i][c] = lwr_fit_value(p, ws, &p->fit[i], i);
+	}
+    }
+}
+
+static void read_row(struct input *inputs, int num_inputs, DCELL **buf,
+                     int row, int lazy)
+{
+    int i;
+
+    if (lazy) {
+	/* Open the files only on run time */
+	for (i = 0; i < num_inputs; i++) {
+	    inputs[i].fd = Rast_open_old(inputs[i].name, "");
+	    Rast_get_d_row(inputs[i].fd, buf[i], row);
+	    Rast_close(inputs[i].fd);
+	}
+    }
+    else {
+	for (i = 0; i < num_inputs; i++)
+	    Rast_get_d_row(inputs[i].fd, buf[i], row);
+    }
+}
+
+
 int main(int argc, char *argv[])
 {
     struct GModule *module;
@@ -221,38 +848,36 @@ int main(int argc, char *argv[])
 		      *maxgap,	/* maximum gap size */
 		      *dod,	/* degree of over-determination */
 		      *range,	/* range of valid values */
-		      *delta;	/* threshold for high amplitudes */
+		      *delta,	/* threshold for high amplitudes */
+		      *threads;	/* number of threads */
     } parm;
     struct
     {
 	struct Flag *lo, *hi, *lazy, *int_only;
     } flag;
-    int i, j, k, n;
-    int num_inputs, in_lo, in_hi;
+    int i, k;
+    int num_inputs;
     struct input *inputs = NULL;
     int num_outputs;
     struct output *outputs = NULL;
     char *suffix;
     struct History history;
     struct Colors colors;
-    DCELL *values = NULL, *values2 = NULL;
     int nrows, ncols;
-    int row, col;
+    int row;
     int order;
-    double fet, maxerrlo, maxerrhi, lo, hi;
-    DCELL *resultn;
-    int msize;
-    double **m, **m2, *a, *a2, *B;
-    double *ts, maxgap, thisgap, prev_ts, next_ts, weight;
+    double fet, lo, hi;
+    double *ts, maxgap;
     double (*weight_func)(double, double, double);
     int dod;
-    int *isnull, n_nulls;
-    int min_points, n_points;
-    int first, last, interp_only;
-    int this_margin;
-    double max_ts, tsdiff1, tsdiff2;
+    int min_points;
+    int interp_only;
     double delta;
     int rejlo, rejhi;
+    int threads, nblocks;
+    struct lwr_par par;
+    struct lwr_ws *ws;
+    DCELL **inbuf[2], **outbuf[2];
 
     G_gisinit(argv[0]);
 
@@ -334,6 +959,12 @@ int main(int argc, char *argv[])
     parm.delta->label = _("Threshold for high amplitudes");
     parm.delta->description = _("Delta should be between 0 and 1");
 
+    parm.threads = G_define_option();
+    parm.threads->key = "threads";
+    parm.threads->type = TYPE_INTEGER;
+    parm.threads->answer = "1";
+    parm.threads->description = _("Number of threads for parallel computing");
+
     flag.lo = G_define_flag();
     flag.lo->key = 'l';
     flag.lo->description = _("Reject low outliers");
@@ -415,6 +1046,17 @@ int main(int argc, char *argv[])
 
     interp_only = flag.int_only->answer;
 
+    threads = atoi(parm.threads->answer);
+    if (threads < 1)
+	G_fatal_error(_("The number of threads must be > 0"));
+#if defined(_OPENMP)
+    omp_set_num_threads(threads);
+#else
+    if (threads > 1)
+	G_warning(_("r.series.lwr was compiled without OpenMP support, using one thread"));
+    threads = 1;
+#endif
+
     /* process the input maps from the file */
     if (parm.file->answer) {
 	FILE *in;
@@ -449,7 +1091,6 @@ int main(int argc, char *argv[])
 
 	    p->name = G_store(name);
 	    G_verbose_message(_("Reading raster map <%s>..."), p->name);
-	    p->buf = Rast_allocate_d_buf();
 	    if (!flag.lazy->answer)
 		p->fd = Rast_open_old(p->name, "");
 	}
@@ -474,7 +1115,6 @@ int main(int argc, char *argv[])
 
 	    p->name = parm.input->answers[i];
 	    G_verbose_message(_("Reading raster map <%s>..."), p->name);
-	    p->buf = Rast_allocate_d_buf();
 	    if (!flag.lazy->answer)
 		p->fd = Rast_open_old(p->name, "");
     	}
@@ -526,7 +1166,6 @@ int main(int argc, char *argv[])
 	sprintf(output_name, "%s%s", uname, suffix);
 
 	out->name = G_store(output_name);
-	out->buf = Rast_allocate_d_buf();
 	out->fd = Rast_open_new(output_name, DCELL_TYPE);
     }
 
@@ -539,310 +1178,84 @@ int main(int argc, char *argv[])
 	                min_points, order, dod);
 
     /* initialise variables */
-    values = G_malloc(num_inputs * sizeof(DCELL));
-    values2 = G_malloc(num_inputs * sizeof(DCELL));
-    resultn = G_malloc(num_inputs * sizeof(DCELL));
-
     nrows = Rast_window_rows();
     ncols = Rast_window_cols();
 
-    isnull = G_malloc(num_inputs * sizeof(int));
-
-    msize = 1 + order;
-    m = G_alloc_matrix(msize, msize);
-    m2 = G_alloc_matrix(msize, msize);
-    a = G_alloc_vector(msize);
-    a2 = G_alloc_vector(msize);
-    B = G_alloc_vector(msize);
-
-    /* calculate weights for different margins */
+    par.num_inputs = num_inputs;
+    par.ts = ts;
+    par.order = order;
+    par.min_points = min_points;
+    par.weight_func = weight_func;
+    par.fet = fet;
+    par.lo = lo;
+    par.hi = hi;
+    par.maxgap = maxgap;
+    par.delta = delta;
+    par.use_range = parm.range->answer != NULL;
+    par.rejlo = rejlo;
+    par.rejhi = rejhi;
+    par.interp_only = interp_only;
+    par.fit = lwr_fit_init(&par);
+
+    ws = G_malloc(threads * sizeof(struct lwr_ws));
+    for (i = 0; i < threads; i++)
+	lwr_ws_init(&ws[i], num_inputs, order);
+
+    /* double buffering: the next row is read and the previous row is
+     * written while the current row is processed */
+    for (k = 0; k < 2; k++) {
+	inbuf[k] = G_malloc(num_inputs * sizeof(DCELL *));
+	outbuf[k] = G_malloc(num_outputs * sizeof(DCELL *));
+	for (i = 0; i < num_inputs; i++) {
+	    inbuf[k][i] = Rast_allocate_d_buf();
+	    outbuf[k][i] = Rast_allocate_d_buf();
+	}
+    }
+    nblocks = (ncols + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
     /* process the data */
     G_message(_("Local weighted regression of %d input maps..."), num_inputs);
 
+    read_row(inputs, num_inputs, inbuf[0], 0, flag.lazy->answer);
+
     for (row = 0; row < nrows; row++) {
-	G_percent(row, nrows, 4);
+	int cur = row & 1;
 
-	if (flag.lazy->answer) {
-	    /* Open the files only on run time */
-	    for (i = 0; i < num_inputs; i++) {
-		inputs[i].fd = Rast_open_old(inputs[i].name, "");
-		Rast_get_d_row(inputs[i].fd, inputs[i].buf, row);
-		Rast_close(inputs[i].fd);
-	    }
-	}
-	else {
-	    for (i = 0; i < num_inputs; i++)
-	        Rast_get_d_row(inputs[i].fd, inputs[i].buf, row);
-	}
+	G_percent(row, nrows, 4);
 
-	for (col = 0; col < ncols; col++) {
+#pragma omp parallel private(i)
+	{
+	    int blk, tid = 0;
 
-	    first = last = -1;
-	    n_nulls = 0;
-	    for (i = 0; i < num_inputs; i++) {
-		DCELL v = inputs[i].buf[col];
+#if defined(_OPENMP)
+	    tid = omp_get_thread_num();
+#endif
 
-		isnull[i] = 0;
-		if (Rast_is_d_null_value(&v)) {
-		    isnull[i] = 1;
-		    n_nulls++;
-		}
-		else if (parm.range->answer && (v < lo || v > hi)) {
-		    Rast_set_d_null_value(&v, 1);
-		    isnull[i] = 1;
-		    n_nulls++;
+#pragma omp single nowait
+	    {
+		if (row > 0) {
+		    for (i = 0; i < num_outputs; i++)
+			Rast_put_d_row(outputs[i].fd, outbuf[!cur][i]);
 		}
-		else {
-		    if (first == -1)
-			first = i;
-		    last = i;
-		}
-		values[i] = v;
-	    }
-	    if (!interp_only) {
-		first = 0;
-		last = num_inputs - 1;
+		if (row < nrows - 1)
+		    read_row(inputs, num_inputs, inbuf[!cur], row + 1,
+		             flag.lazy->answer);
 	    }
-	    else {
-		for (i = 0; i < first; i++)
-		    Rast_set_d_null_value(&outputs[i].buf[col], 1);
-		for (i = last + 1; i < num_inputs; i++)
-		    Rast_set_d_null_value(&outputs[i].buf[col], 1);
-	    }
-
-	    /* LWR */
-	    if (num_inputs - n_nulls >= min_points) {
-		
-		thisgap = 0;
-		prev_ts = next_ts = ts[0] - (ts[1] - ts[0]);
-
-		for (i = first; i <= last; i++) {
-		    DCELL result;
-
-		    if (isnull[i]) {
-			if (next_ts < ts[i]) {
-			    if (i > 0)
-				prev_ts = ts[i] - (ts[i] - ts[i - 1]) / 2.0;
-			    else
-				prev_ts = ts[i] - (ts[i + 1] - ts[i]) / 2.0;
 
-			    j = i;
-			    while (j < num_inputs - 1 && isnull[j + 1])
-				j++;
+#pragma omp for schedule(dynamic)
+	    for (blk = 0; blk < nblocks; blk++) {
+		int c0 = blk * BLOCK_SIZE;
+		int c1 = c0 + BLOCK_SIZE;
 
-			    if (j < num_inputs - 1)
-				next_ts = ts[j] + (ts[j + 1] - ts[j]) / 2.0;
-			    else
-				next_ts = ts[j] + (ts[j] - ts[j - 1]) / 2.0;
+		if (c1 > ncols)
+		    c1 = ncols;
 
-			    thisgap = next_ts - prev_ts;
-			}
-			if (thisgap > maxgap) {
-			    Rast_set_d_null_value(&outputs[i].buf[col], 1);
-			    continue;
-			}
-		    }
-
-		    /* margin around i */
-		    n_points = 0;
-		    in_lo = in_hi = i;
-		    this_margin = 0;
-		    if (!isnull[i])
-			n_points++;
-		    for (j = 1; j < num_inputs; j++) {
-			if (i - j >= 0) {
-			    if (!isnull[i - j]) {
-				n_points++;
-				in_lo = i - j;
-			    }
-			}
-			if (i + j < num_inputs) {
-			    if (!isnull[i + j]) {
-				n_points++;
-				in_hi = i + j;
-			    }
-			}
-			if (n_points >= min_points) {
-			    this_margin = j;
-			    break;
-			}
-		    }
-		    if (interp_only && isnull[i] &&
-		        (in_lo == i || in_hi == i)) {
-
-			Rast_set_d_null_value(&outputs[i].buf[col], 1);
-			continue;
-		    }
-
-		    tsdiff1 = ts[i] - ts[in_lo];
-		    tsdiff2 = ts[in_hi] - ts[i];
-			
-		    max_ts = tsdiff1;
-		    if (max_ts < tsdiff2)
-			max_ts = tsdiff2;
-		    
-		    max_ts *= (1.0 + 1.0 / this_margin);
-
-		    /* initialize matrix and vectors */
-		    for (j = 0; j <= order; j++) {
-			a[j] = 0;
-			B[j] = 0;
-			m[j][j] = 0;
-			for (k = 0; k < j; k++) {
-			    m[j][k] = m[k][j] = 0;
-			}
-		    }
-		    
-		    /* load points */
-		    for (n = in_lo; n <= in_hi; n++) {
-			if (isnull[n])
-			    continue;
-
-			weight = weight_func(ts[i], ts[n], max_ts);
-			for (j = 0; j <= order; j++) {
-			    double val1 = term(j, ts[n]);
-
-			    for (k = j; k <= order; k++) {
-				double val2 = term(k, ts[n]);
-
-				m[j][k] += val1 * val2 * weight;
-			    }
-			    a[j] += values[n] * val1 * weight;
-			}
-		    }
-
-		    /* TRANSPOSE VALUES IN UPPER HALF OF M TO OTHER HALF */
-		    m2[0][0] = m[0][0];
-		    a2[0] = a[0];
-		    for (j = 1; j <= order; j++) {
-			for (k = 0; k < j; k++) {
-			    m[j][k] = m[k][j];
-			    m2[j][k] = m2[k][j] = m[k][j];
-			}
-			m[j][j] *= (1 + delta);
-			m2[j][j] = m[j][j];
-			a2[j] = a[j];
-		    }
-
-		    if (solvemat(m2, a2, B, order + 1) != 0) {
-			/* get estimate */
-			result = 0.0;
-			for (j = 0; j <= order; j++) {
-			    result += B[j] * term(j, ts[i]);
-			}
-			
-			if (rejlo || rejhi) {
-			    int done = 0;
-
-			    for (n = in_lo; n <= in_hi; n++) {
-				if (isnull[n])
-				    continue;
-				
-				values2[n] = values[n];
-			    }
-
-			    while (!done) {
-				done = 1;
-
-				maxerrlo = maxerrhi = 0;
-				for (n = in_lo; n <= in_hi; n++) {
-				    if (isnull[n])
-					continue;
-
-				    resultn[n] = 0.0;
-				    for (j = 0; j <= order; j++) {
-					resultn[n] += B[j] * term(j, ts[n]);
-				    }
-				    if (maxerrlo < resultn[n] - values2[n])
-					maxerrlo = resultn[n] - values2[n];
-				    if (maxerrhi < values2[n] - resultn[n])
-					maxerrhi = values2[n] - resultn[n];
-				}
-
-				if (rejlo && maxerrlo > fet)
-				    done = 0;
-				if (rejhi && maxerrhi > fet)
-				    done = 0;
-
-				if (!done) {
-
-				    a2[0] = 0;
-				    m2[0][0] = m[0][0];
-				    for (j = 1; j <= order; j++) {
-					for (k = 0; k < j; k++) {
-					    m2[j][k] = m2[k][j] = m[k][j];
-					}
-					m2[j][j] = m[j][j];
-					a2[j] = 0;
-				    }
-
-				    /* replace outliers */
-				    for (n = in_lo; n <= in_hi; n++) {
-					if (isnull[n])
-					    continue;
-
-					weight = weight_func(ts[i], ts[n], max_ts);
-					if (rejlo && resultn[n] - values2[n] > maxerrlo * 0.5) {
-					    values2[n] = (resultn[n] + values2[n]) * 0.5;
-					}
-					if (rejhi && values2[n] - resultn[n] > maxerrhi * 0.5) {
-					    values2[n] = (values2[n] + resultn[n]) * 0.5;
-					}
-					for (j = 0; j <= order; j++) {
-					    double val1 = term(j, ts[n]);
-
-					    a2[j] += values2[n] * val1 * weight;
-					}
-				    }
-				    done = 1;
-				    if (solvemat(m2, a2, B, order + 1) != 0) {
-					/* update estimate */
-					result = 0.0;
-					for (j = 0; j <= order; j++) {
-					    result += B[j] * term(j, ts[i]);
-					}
-					done = 0;
-				    }
-				}
-			    }
-			}
-		    }
-		    else {
-			double wsum = 0.0;
-
-			G_warning(_("Points are (nearly) co-linear, using weighted average"));
-
-			result = 0.0;
-			for (n = in_lo; n <= in_hi; n++) {
-			    if (isnull[n])
-				continue;
-			    
-			    weight = weight_func(ts[i], ts[n], max_ts);
-			    result += values[n] * weight;
-			    wsum += weight;
-			}
-			result /= wsum;
-		    }
-		    if (result < lo)
-			result = lo;
-		    if (result > hi)
-			result = hi;
-		    outputs[i].buf[col] = result;
-		}
-	    }
-	    else {
-		for (i = 0; i < num_outputs; i++) {
-		    struct output *out = &outputs[i];
-
-		    Rast_set_d_null_value(&out->buf[col], 1);
-		}
+		lwr_block(&par, &ws[tid], inbuf[cur], outbuf[cur], c0, c1);
 	    }
 	}
-
-	for (i = 0; i < num_outputs; i++)
-	    Rast_put_d_row(outputs[i].fd, outputs[i].buf);
     }
+    for (i = 0; i < num_outputs; i++)
+	Rast_put_d_row(outputs[i].fd, outbuf[(nrows - 1) & 1][i]);
 
     G_percent(row, nrows, 2);
 
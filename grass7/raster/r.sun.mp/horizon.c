@@ -0,0 +1,241 @@
+/****************************************************************************
+ r.sun.mp: horizon.c
+
+ Horizon angles of all cells for a number of azimuth sectors, computed
+ once from the elevation map and used by the shadowing in place of the
+ horizon_basename input maps.
+
+ For each sector the grid is traversed along discrete lines parallel to
+ the sector direction, each cell belongs to exactly one line. The cells of
+ a line are visited from the far end backwards, keeping the upper convex
+ hull of the cells visited so far on a stack. The horizon of a cell is
+ the tangent from the cell to that hull, thus each line is done in O(n)
+ (Stewart 1998, "Fast horizon computation at all points of a terrain
+ with visibility and shading applications").
+
+  (C) 2019 by the GRASS Development Team
+****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+#include "sunradstruct.h"
+#include "local_proto.h"
+#include "rsunglobals.h"
+
+#define SCALING_FACTOR 150.
+
+/* the horizons are kept in a temporary file, sector by sector,
+ * each sector holding rows * cols bytes in map row order */
+static char *horizon_file = NULL;
+static FILE *fhorizon = NULL;
+static int hrows, hcols;
+
+/* horizon angles of all cells for the direction angle (east = 0,
+ * counterclockwise), dem holds the elevation of all cells in map row
+ * order, ew_m and ns_m the cell size in meters */
+static void sweep_sector(const FCELL *dem, int rows, int cols,
+			 double ew_m, double ns_m, double angle,
+			 double *hs, double *hz, unsigned char *out)
+{
+    double dc, dr, t, ds, s, slope, slope2, h;
+    int colmajor, nsteps, nlines, k, kmin, step, top;
+    int r, c, start, dir;
+    const FCELL *zp;
+
+    /* direction in cells, rows increase southwards */
+    dc = cos(angle) / ew_m;
+    dr = -sin(angle) / ns_m;
+
+    colmajor = fabs(dc) >= fabs(dr);
+    if (colmajor) {
+	/* one cell per column, line k has row k + t * col */
+	t = dr / dc;
+	ds = ew_m / fabs(cos(angle));
+	nsteps = cols;
+	nlines = rows;
+	dir = dc > 0 ? 1 : -1;
+    }
+    else {
+	/* one cell per row, line k has col k + t * row */
+	t = dc / dr;
+	ds = ns_m / fabs(sin(angle));
+	nsteps = rows;
+	nlines = cols;
+	dir = dr > 0 ? 1 : -1;
+    }
+    /* start at the far end of the lines */
+    start = dir > 0 ? nsteps - 1 : 0;
+
+    /* range of lines such that all cells are covered */
+    kmin = -(int)ceil(fabs(t) * (nsteps - 1)) - 1;
+
+    for (k = kmin; k <= nlines - kmin; k++) {
+	top = 0;
+	for (step = 0; step < nsteps; step++) {
+	    /* going backwards against the sector direction */
+	    if (colmajor) {
+		c = start - dir * step;
+		r = (int)floor(k + t * c + 0.5);
+		if (r < 0 || r >= rows)
+		    continue;
+	    }
+	    else {
+		r = start - dir * step;
+		c = (int)floor(k + t * r + 0.5);
+		if (c < 0 || c >= cols)
+		    continue;
+	    }
+
+	    zp = dem + (size_t)r * cols + c;
+	    if (Rast_is_f_null_value(zp)) {
+		/* the ray marching stops at no data, too */
+		out[(size_t)r * cols + c] = 0;
+		top = 0;
+		continue;
+	    }
+
+	    /* distance along the line, decreasing backwards */
+	    s = -step * ds;
+
+	    /* remove hull points below the tangent from this cell */
+	    while (top >= 2) {
+		slope = (hz[top - 1] - *zp) / (hs[top - 1] - s);
+		slope2 = (hz[top - 2] - *zp) / (hs[top - 2] - s);
+		if (slope > slope2)
+		    break;
+		top--;
+	    }
+
+	    h = 0.;
+	    if (top > 0) {
+		slope = (hz[top - 1] - *zp) / (hs[top - 1] - s);
+		if (slope > 0.)
+		    h = atan(slope);
+	    }
+	    if (h > 255. / SCALING_FACTOR)
+		h = 255. / SCALING_FACTOR;
+	    out[(size_t)r * cols + c] = (unsigned char)rint(SCALING_FACTOR * h);
+
+	    hs[top] = s;
+	    hz[top] = *zp;
+	    top++;
+	}
+    }
+}
+
+/* compute the horizons of nsectors directions with the given angle
+ * interval, the first direction is east. The elevation map is held in
+ * memory, and each thread holds the horizons of one sector; with
+ * save_memory the sectors are done one after another */
+void compute_horizons(const char *elev, int rows, int cols, double ew_m,
+		      double ns_m, int nsectors, double interval,
+		      int save_memory)
+{
+    FCELL *dem;
+    int fd, row, sector, done, nthreads, maxlen;
+    double **hs, **hz;
+    unsigned char **out;
+
+    G_message(_("Computing horizons for %d directions..."), nsectors);
+
+    hrows = rows;
+    hcols = cols;
+
+    dem = G_malloc((size_t)rows * cols * sizeof(FCELL));
+    fd = Rast_open_old(elev, "");
+    for (row = 0; row < rows; row++)
+	Rast_get_f_row(fd, dem + (size_t)row * cols, row);
+    Rast_close(fd);
+
+    horizon_file = G_tempfile();
+    if (!(fhorizon = fopen(horizon_file, "w+b")))
+	G_fatal_error(_("Unable to open temporary file <%s>"), horizon_file);
+
+    nthreads = 1;
+#if defined(_OPENMP)
+    if (!save_memory)
+	nthreads = omp_get_max_threads();
+    if (nthreads > nsectors)
+	nthreads = nsectors;
+#endif
+
+    /* per thread hull stack and output of one sector */
+    maxlen = rows > cols ? rows : cols;
+    hs = G_malloc(nthreads * sizeof(double *));
+    hz = G_malloc(nthreads * sizeof(double *));
+    out = G_malloc(nthreads * sizeof(unsigned char *));
+    for (row = 0; row < nthreads; row++) {
+	hs[row] = G_malloc(maxlen * sizeof(double));
+	hz[row] = G_malloc(maxlen * sizeof(double));
+	out[row] = G_malloc((size_t)rows * cols);
+    }
+
+    done = 0;
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads) private(sector)
+    for (sector = 0; sector < nsectors; sector++) {
+	int tid = 0;
+
+#if defined(_OPENMP)
+	tid = omp_get_thread_num();
+#endif
+	sweep_sector(dem, rows, cols, ew_m, ns_m, sector * interval,
+		     hs[tid], hz[tid], out[tid]);
+
+#pragma omp critical(horizon_write)
+	{
+	    G_fseek(fhorizon, (off_t)sector * rows * cols, SEEK_SET);
+	    if (fwrite(out[tid], 1, (size_t)rows * cols, fhorizon) !=
+		(size_t)rows * cols)
+		G_fatal_error(_("Unable to write to temporary file <%s>"),
+			      horizon_file);
+	    G_percent(++done, nsectors, 10);
+	}
+    }
+
+    for (row = 0; row < nthreads; row++) {
+	G_free(hs[row]);
+	G_free(hz[row]);
+	G_free(out[row]);
+    }
+    G_free(hs);
+    G_free(hz);
+    G_free(out);
+    G_free(dem);
+}
+
+/* read the horizons of one sector and map row */
+void get_horizon_row(int sector, int row, unsigned char *buf)
+{
+    G_fseek(fhorizon, ((off_t)sector * hrows + row) * hcols, SEEK_SET);
+    if (fread(buf, 1, hcols, fhorizon) != (size_t)hcols)
+	G_fatal_error(_("Unable to read from temporary file <%s>"),
+		      horizon_file);
+}
+
+void close_horizons(void)
+{
+    if (fhorizon == NULL)
+	return;
+
+    fclose(fhorizon);
+    remove(horizon_file);
+    G_free(horizon_file);
+    fhorizon = NULL;
+}
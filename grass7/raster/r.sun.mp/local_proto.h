@@ -32,6 +32,14 @@ int searching_parallel(double *length,
                         double *gridGeom_delty);
 
 
+/* horizon.c */
+void compute_horizons(const char *elev, int rows, int cols, double ew_m,
+		      double ns_m, int nsectors, double interval,
+		      int save_memory);
+void get_horizon_row(int sector, int row, unsigned char *buf);
+void close_horizons(void);
+
+
 int useCivilTime();
 void setUseCivilTime(int val);
 int useShadow();
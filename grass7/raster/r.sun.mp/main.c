@@ -120,6 +120,8 @@ struct History hist;
 
 int INPUT_part(int offset, double *zmax);
 int OUTGR(void);
+int OUTGR_series(void);
+void init_slices(void);
 int min(int, int);
 int max(int, int);
 
@@ -166,8 +168,9 @@ void calculate(double singleSlope, double singleAspect,
 double com_declin(int);
 
 int n, m, ip, jp;
-int d, day;
+int d, day, end_day, day_step;
 int saveMemory, numPartitions = 1;
+int computeHorizons = FALSE;
 long int shadowoffset = 0;
 int varCount_global = 0;
 int bitCount_global = 0;
@@ -182,6 +185,21 @@ float **lumcl, **beam, **insol, **diff, **refl, **globrad;
 unsigned char *horizonarray = NULL;
 double civilTime;
 
+/* time slices: days from day to end_day and in mode 1 the given times */
+struct TimeSlice *slices;
+int nslices = 1, ndays = 1, ntimes = 1;
+size_t time_decimals;
+int accumulate;			/* sum all slices into one map */
+int series;			/* one output map per slice */
+
+/* series mode: the results of a row for all slices are written to a
+   temporary file and turned into maps in OUTGR() */
+#define NOUTPUTS 6
+int out_index[NOUTPUTS], nactive;
+float *rowbuf;
+FILE *fseries;
+char *series_file;
+
 /*
  * double startTime, endTime;
  */
@@ -247,6 +265,7 @@ int main(int argc, char *argv[])
     double singleAspect;
     double singleAlbedo;
     double singleLinke;
+    int k;
 #ifdef PARALLEL
     timer = time(NULL);
     printTimeDiff("Start");
@@ -261,7 +280,8 @@ int main(int argc, char *argv[])
 	    *lin, *albedo, *longin, *alb, *latin, *coefbh, *coefdh,
 	    *incidout, *beam_rad, *insol_time, *diff_rad, *refl_rad,
 	    *glob_rad, *day, *step, *declin, *ltime, *dist, *horizon,
-	    *horizonstep, *numPartitions, *civilTime, *threads;
+	    *horizonstep, *numPartitions, *civilTime, *threads,
+	    *end_day, *day_step;
     }
     parm;
 #endif
@@ -273,14 +293,14 @@ int main(int argc, char *argv[])
 	    *lin, *albedo, *longin, *alb, *latin, *coefbh, *coefdh,
 	    *incidout, *beam_rad, *insol_time, *diff_rad, *refl_rad,
 	    *glob_rad, *day, *step, *declin, *ltime, *dist, *horizon,
-	    *horizonstep, *numPartitions, *civilTime;
+	    *horizonstep, *numPartitions, *civilTime, *end_day, *day_step;
     }
     parm;
 #endif 
 
     struct
     {
-	struct Flag *noshade, *saveMemory;
+	struct Flag *noshade, *saveMemory, *accumulate;
     }
     flag;
 
@@ -497,6 +517,23 @@ int main(int argc, char *argv[])
     parm.day->options = "1-365";
     parm.day->guisection = _("Time");
 
+    parm.end_day = G_define_option();
+    parm.end_day->key = "end_day";
+    parm.end_day->type = TYPE_INTEGER;
+    parm.end_day->required = NO;
+    parm.end_day->description =
+	_("No. of the last day of the year (1-365) to compute all days from 'day' to 'end_day' in one run");
+    parm.end_day->options = "1-365";
+    parm.end_day->guisection = _("Time");
+
+    parm.day_step = G_define_option();
+    parm.day_step->key = "day_step";
+    parm.day_step->type = TYPE_INTEGER;
+    parm.day_step->answer = "1";
+    parm.day_step->required = NO;
+    parm.day_step->description = _("Step in days between 'day' and 'end_day'");
+    parm.day_step->guisection = _("Time");
+
     parm.step = G_define_option();
     parm.step->key = "step";
     parm.step->type = TYPE_DOUBLE;
@@ -518,8 +555,9 @@ int main(int argc, char *argv[])
     parm.ltime->type = TYPE_DOUBLE;
     /*          parm.ltime->answer = TIME; */
     parm.ltime->required = NO;
+    parm.ltime->multiple = YES;
     parm.ltime->description =
-	_("Local (solar) time (to be set for mode 1 only) [decimal hours]");
+	_("Local (solar) time(s) (to be set for mode 1 only) [decimal hours]");
     parm.ltime->options = "0-24";
     parm.ltime->guisection = _("Time");
 
@@ -581,6 +619,11 @@ int main(int argc, char *argv[])
     flag.saveMemory->description =
 	_("Use the low-memory version of the program");
 
+    flag.accumulate = G_define_flag();
+    flag.accumulate->key = 'a';
+    flag.accumulate->description =
+	_("Sum the irradiation of all days into one map instead of one map per day (mode 2 only)");
+
 
     if (G_parser(argc, argv))
 	exit(EXIT_FAILURE);
@@ -669,6 +712,16 @@ int main(int argc, char *argv[])
 
     sscanf(parm.day->answer, "%d", &day);
 
+    end_day = day;
+    if (parm.end_day->answer != NULL) {
+	sscanf(parm.end_day->answer, "%d", &end_day);
+	if (end_day < day)
+	    G_fatal_error(_("'end_day' must not be smaller than 'day'"));
+    }
+    if (sscanf(parm.day_step->answer, "%d", &day_step) != 1 || day_step < 1)
+	G_fatal_error(_("Invalid day step"));
+    ndays = (end_day - day) / day_step + 1;
+
     if (sscanf(parm.step->answer, "%lf", &step) != 1)
 	G_fatal_error(_("Error reading time step size"));
     if (step <= 0.0 || step > 24.0)
@@ -687,6 +740,13 @@ int main(int argc, char *argv[])
 	G_fatal_error(_("If you use the horizon option you must also set the 'horizonstep' parameter."));
     }
 
+    /* with a horizon step but no horizon maps, the horizons are computed
+     * here once instead of tracing the shadow for each sun position */
+    computeHorizons = useShadow() && horizon == NULL &&
+	parm.horizonstep->answer != NULL;
+    if (computeHorizons)
+	setUseHorizonData(TRUE);
+
     ttime = parm.ltime->answer;
     if (parm.ltime->answer != NULL) {
 	if (insol_time != NULL)
@@ -694,6 +754,14 @@ int main(int argc, char *argv[])
 
 	G_message(_("Mode 1: instantaneous solar incidence angle & irradiance using a set local time"));
 	sscanf(parm.ltime->answer, "%lf", &timo);
+
+	time_decimals = 0;
+	for (ntimes = 0; parm.ltime->answers[ntimes]; ntimes++) {
+	    size_t dec = G_get_num_decimals(parm.ltime->answers[ntimes]);
+
+	    if (dec > time_decimals)
+		time_decimals = dec;
+	}
     }
     else {
 	if (incidout != NULL)
@@ -702,6 +770,14 @@ int main(int argc, char *argv[])
 	G_message(_("Mode 2: integrated daily irradiation for a given day of the year"));
     }
 
+    nslices = ndays * ntimes;
+    accumulate = flag.accumulate->answer;
+    if (accumulate && ttime != NULL)
+	G_fatal_error(_("The -a flag can only be used in mode 2"));
+    series = (nslices > 1 && !accumulate);
+    if (nslices > 1)
+	G_message(_("Computing %d days and %d time(s) in one pass"), ndays, ntimes);
+
     /*      
      * if (parm.startTime->answer != NULL) sscanf(parm.startTime->answer, "%lf", &startTime);
      * if (parm.endTime->answer != NULL) sscanf(parm.endTime->answer, "%lf", &endTime);
@@ -762,7 +838,7 @@ int main(int argc, char *argv[])
 	    /* If you calculate shadows on the fly, the number of partitions
 	     * must be one.
 	     */
-	    G_fatal_error(_("If you use -s and no horizon rasters, numpartitions must be =1"));
+	    G_fatal_error(_("If you use shadows without horizon rasters or horizon_step, numpartitions must be =1"));
 	}
     }
 
@@ -776,18 +852,20 @@ int main(int argc, char *argv[])
     if (saveMemory && useShadow() && (!useHorizonData()))
 	G_fatal_error(
 	    _("If you want to save memory and to use shadows, "
-	      "you must use pre-calculated horizons."));
+	      "you must use pre-calculated horizons or horizon_step."));
 
     if (parm.declin->answer == NULL)
 	declination = com_declin(day);
     else {
+	if (ndays > 1)
+	    G_fatal_error(_("The declination can not be set for several days"));
 	sscanf(parm.declin->answer, "%lf", &declin);
 	declination = -declin;
     }
 
     if (ttime != 0) {
 	/* Shadow for just one time during the day */
-	if (horizon == NULL) {
+	if (!useHorizonData()) {
 	    arrayNumInt = 1;
 	}
 	else if (useHorizonData()) {
@@ -855,10 +933,42 @@ int main(int argc, char *argv[])
     if ((G_projection() == PROJECTION_LL))
 	ll_correction = TRUE;
 
+    /* the days and times to compute, set up in init_slices() */
+    slices = (struct TimeSlice *)G_calloc(nslices, sizeof(struct TimeSlice));
+    if (ttime != NULL) {
+	for (k = 0; k < nslices; k++)
+	    sscanf(parm.ltime->answers[k % ntimes], "%lf", &slices[k].time);
+    }
+
+    /* position of each output in a row of the series buffer */
+    nactive = 0;
+    out_index[0] = incidout != NULL ? nactive++ : -1;
+    out_index[1] = beam_rad != NULL ? nactive++ : -1;
+    out_index[2] = insol_time != NULL ? nactive++ : -1;
+    out_index[3] = diff_rad != NULL ? nactive++ : -1;
+    out_index[4] = refl_rad != NULL ? nactive++ : -1;
+    out_index[5] = glob_rad != NULL ? nactive++ : -1;
+
+    if (computeHorizons) {
+	double ew_m = gridGeom.stepx, ns_m = gridGeom.stepy;
+
+	if (ll_correction) {
+	    ew_m *= DEGREEINMETERS * cos(deg2rad * 0.5 * (ymin + ymax));
+	    ns_m *= DEGREEINMETERS;
+	}
+	compute_horizons(elevin, m, n, ew_m, ns_m, arrayNumInt,
+			 getHorizonInterval(), saveMemory);
+    }
+
     G_debug(3, "calculate() starts...");
     calculate(singleSlope, singleAspect, singleAlbedo, singleLinke, gridGeom);
     G_debug(3, "OUTGR() starts...");
-    OUTGR();
+    if (series)
+	OUTGR_series();
+    else
+	OUTGR();
+    if (computeHorizons)
+	close_horizons();
 #ifdef PARALLEL
     printTimeDiff("M4");
 #endif
@@ -876,6 +986,7 @@ int INPUT_part(int offset, double *zmax)
 	NULL;
     FCELL *rast1 = NULL, *rast2 = NULL;
     static FCELL **horizonbuf;
+    static unsigned char *horizonrow;
     unsigned char *horizonpointer;
     int fd1 = -1, fd2 = -1, fd3 = -1, fd4 = -1, fd5 = -1, fd6 = -1,
 	fd7 = -1, row, row_rev;
@@ -1046,8 +1157,12 @@ int INPUT_part(int offset, double *zmax)
 		(unsigned char *)G_calloc(arrayNumInt *
 					  numRows * n, sizeof(char));
 
-	    horizonbuf = (FCELL **) G_calloc(arrayNumInt, sizeof(FCELL *) );
-	    fd_shad = (int *)G_calloc(arrayNumInt, sizeof(int));
+	    if (horizon != NULL) {
+		horizonbuf = (FCELL **) G_calloc(arrayNumInt, sizeof(FCELL *) );
+		fd_shad = (int *)G_calloc(arrayNumInt, sizeof(int));
+	    }
+	    else
+		horizonrow = (unsigned char *)G_malloc(n);
 // 	    horizonarray =
 // 		(unsigned char *)G_malloc(sizeof(char) * arrayNumInt *
 // 					  numRows * n);
@@ -1071,7 +1186,7 @@ int INPUT_part(int offset, double *zmax)
 	 */
         decimals = G_get_num_decimals(str_step);
         angle_deg = 0;
-        for (i = 0; i < arrayNumInt; i++) {
+        for (i = 0; i < arrayNumInt && horizon != NULL; i++) {
             horizonbuf[i] = Rast_allocate_f_buf();
             shad_filename = G_generate_basename(horizon, angle_deg, 
                                                 3, decimals);
@@ -1099,9 +1214,18 @@ int INPUT_part(int offset, double *zmax)
 
 		row_rev = m - row - 1;
 		rowrevoffset = row_rev - offset;
-		Rast_get_f_row(fd_shad[i], horizonbuf[i], row);
 		horizonpointer =
 		    horizonarray + (ssize_t) arrayNumInt *n * rowrevoffset;
+		if (horizon == NULL) {
+		    /* computed in compute_horizons(), already scaled */
+		    get_horizon_row(i, row, horizonrow);
+		    for (j = 0; j < n; j++) {
+			horizonpointer[i] = horizonrow[j];
+			horizonpointer += arrayNumInt;
+		    }
+		    continue;
+		}
+		Rast_get_f_row(fd_shad[i], horizonbuf[i], row);
 		for (j = 0; j < n; j++) {
 
 		    horizonpointer[i] = (char)(rint(SCALING_FACTOR *
@@ -1238,7 +1362,7 @@ int INPUT_part(int offset, double *zmax)
     }
 
 
-    if (useHorizonData()) {
+    if (useHorizonData() && horizon != NULL) {
 	for (i = 0; i < arrayNumInt; i++) {
 	    Rast_close(fd_shad[i]);
 	    G_free(horizonbuf[i]);
@@ -1423,6 +1547,80 @@ int OUTGR(void)
     return 1;
 }
 
+/* split the temporary file written by calculate() into one map per
+ * day, time and output, names get the day and time as suffix */
+int OUTGR_series(void)
+{
+    const char *names[NOUTPUTS] = { incidout, beam_rad, insol_time,
+	diff_rad, refl_rad, glob_rad
+    };
+    FCELL *cell;
+    int fd, i, iarc, j, k, out;
+    size_t rowsize;
+    off_t offset;
+    char *day_name, *name;
+
+    if (m != Rast_window_rows())
+	G_fatal_error("OOPS: rows changed from %d to %d", m, Rast_window_rows());
+    if (n != Rast_window_cols())
+	G_fatal_error("OOPS: cols changed from %d to %d", n, Rast_window_cols());
+
+    cell = Rast_allocate_f_buf();
+    rowsize = (size_t)nslices * nactive * n;
+
+    for (k = 0; k < nslices; k++) {
+	for (out = 0; out < NOUTPUTS; out++) {
+	    if (names[out] == NULL)
+		continue;
+
+	    if (ndays > 1)
+		day_name = G_generate_basename(names[out], slices[k].day, 3, 0);
+	    else
+		day_name = G_store(names[out]);
+	    if (ntimes > 1) {
+		name = G_generate_basename(day_name, slices[k].time, 2,
+					   time_decimals);
+		G_free(day_name);
+	    }
+	    else
+		name = day_name;
+
+	    G_verbose_message(_("Writing raster map <%s>..."), name);
+	    fd = Rast_open_fp_new(name);
+
+	    for (iarc = 0; iarc < m; iarc++) {
+		i = m - iarc - 1;
+		offset = ((off_t)i * rowsize +
+			  ((size_t)k * nactive + out_index[out]) * n) *
+			 sizeof(float);
+		G_fseek(fseries, offset, SEEK_SET);
+		if (fread(rowbuf, sizeof(float), n, fseries) != (size_t)n)
+		    G_fatal_error(_("Unable to read from temporary file <%s>"),
+				  series_file);
+
+		for (j = 0; j < n; j++) {
+		    if (rowbuf[j] == UNDEFZ)
+			Rast_set_f_null_value(cell + j, 1);
+		    else
+			cell[j] = (FCELL) rowbuf[j];
+		}
+		Rast_put_f_row(fd, cell);
+	    }
+
+	    Rast_close(fd);
+	    Rast_write_history(name, &hist);
+	    G_free(name);
+	}
+    }
+
+    fclose(fseries);
+    remove(series_file);
+    G_free(rowbuf);
+    G_free(cell);
+
+    return 1;
+}
+
 
 /**********************************************************/
 
@@ -1779,24 +1977,77 @@ void cube(jmin, imin)
 }
 
 
+/* sun geometry of all days and times, the terrain dependent part of
+ * the computation is shared by all of them */
+void init_slices(void)
+{
+    int iday, itime, k, no_of_day;
+    double decl, dayRad, t;
+
+    for (iday = 0; iday < ndays; iday++) {
+	no_of_day = day + iday * day_step;
+	/* a user given declination is only accepted for a single day */
+	decl = (ndays == 1 ? declination : com_declin(no_of_day));
+
+	for (itime = 0; itime < ntimes; itime++) {
+	    k = iday * ntimes + itime;
+	    slices[k].day = no_of_day;
+	    slices[k].sindecl = sin(decl);
+	    slices[k].cosdecl = cos(decl);
+	    slices[k].G_norm_extra = com_sol_const(no_of_day);
+
+	    slices[k].timeOffset = 0.;
+	    if (useCivilTime()) {
+		/* We need to calculate the deviation of the local solar time
+		 * from the "local clock time". */
+		dayRad = 2. * M_PI * no_of_day / 365.25;
+		slices[k].timeOffset =
+		    +0.128 * sin(dayRad - 0.04887) + 0.165 * sin(2 * dayRad +
+								 0.34383);
+
+		/* Time offset due to timezone as input by user */
+		slices[k].timeOffset += civilTime;
+	    }
+
+	    if (ttime != NULL) {
+		t = (slices[k].time - 12) * 15;
+		if (t < 0)
+		    t += 360;
+		slices[k].timeAngle = M_PI * t / 180;
+	    }
+	}
+    }
+}
+
+/* store the value of slice k for cell j, i: in the row buffer for a
+ * series of maps, summed up with -a or as the single result */
+static void store_value(float **arr, int out, int k, int j, int i,
+			double value)
+{
+    if (series)
+	rowbuf[((size_t)k * nactive + out_index[out]) * n + i] = (float)value;
+    else if (accumulate && k > 0)
+	arr[j][i] += (float)value;
+    else
+	arr[j][i] = (float)value;
+}
+
 /*////////////////////////////////////////////////////////////////////// */
 
 void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 	       double singleLinke, struct GridGeometry gridGeom)
 {
-    int i, j, l;
+    int i, j, k, l;
 
     /*                      double energy; */
     int someRadiation;
     int numRows;
     int arrayOffset;
     double lum, q1;
-    double dayRad;
     double latid_l, cos_u, cos_v, sin_u, sin_v;
     double sin_phi_l, tan_lam_l;
     double zmax;
     double longitTime = 0.;
-    double locTimeOffset;
     double latitude, longitude;
     double coslat;
 
@@ -1891,7 +2142,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 // 		globrad[j][i] = UNDEFZ;
 // 	}
 //     }
-    if (incidout != NULL) {
+    if (incidout != NULL && !series) {
 	lumcl = (float **)G_calloc((m), sizeof(float *));
 	for (l = 0; l < m; l++) {
 	    lumcl[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1902,7 +2153,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 	}
     }
 
-    if (beam_rad != NULL) {
+    if (beam_rad != NULL && !series) {
 	beam = (float **)G_calloc((m), sizeof(float *));
 	for (l = 0; l < m; l++) {
 	    beam[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1914,7 +2165,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 	}
     }
 
-    if (insol_time != NULL) {
+    if (insol_time != NULL && !series) {
 	insol = (float **)G_calloc((m), sizeof(float *));
 	for (l = 0; l < m; l++) {
 	    insol[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1926,7 +2177,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 	}
     }
 
-    if (diff_rad != NULL) {
+    if (diff_rad != NULL && !series) {
 	diff = (float **)G_calloc((m), sizeof(float *));
 	for (l = 0; l < m; l++) {
 	    diff[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1938,7 +2189,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 	}
     }
 
-    if (refl_rad != NULL) {
+    if (refl_rad != NULL && !series) {
 	refl = (float **)G_calloc((m), sizeof(float *));
 	for (l = 0; l < m; l++) {
 	    refl[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1950,7 +2201,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 	}
     }
 
-    if (glob_rad != NULL) {
+    if (glob_rad != NULL && !series) {
 	globrad = (float **)G_calloc((m), sizeof(float *));
 	for (l = 0; l < m; l++) {
 	    globrad[l] = (float *)G_calloc((n), sizeof(float *));
@@ -1963,25 +2214,24 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
     }
 
 
-    sunRadVar.G_norm_extra = com_sol_const(day);
+    /* declination, extraterrestrial irradiance and civil time offset
+     * of all days and times, the time offset is added to longitTime
+     * per slice */
+    init_slices();
+    sunRadVar.G_norm_extra = slices[0].G_norm_extra;
+    setTimeOffset(0.);
 
     numRows = m / numPartitions;
 
-    if (useCivilTime()) {
-	/* We need to calculate the deviation of the local solar time from the 
-	 * "local clock time". */
-	dayRad = 2. * M_PI * day / 365.25;
-	locTimeOffset =
-	    +0.128 * sin(dayRad - 0.04887) + 0.165 * sin(2 * dayRad +
-							 0.34383);
-
-	/* Time offset due to timezone as input by user */
-
-	locTimeOffset += civilTime;
-	setTimeOffset(locTimeOffset);
-    }
-    else {
-	setTimeOffset(0.);
+    if (series) {
+	/* one row of all slices and outputs, written to a temporary
+	 * file after each row and split into maps in OUTGR_series() */
+	rowbuf = (float *)G_malloc((size_t)nslices * nactive * n *
+				   sizeof(float));
+	series_file = G_tempfile();
+	if (!(fseries = fopen(series_file, "w+b")))
+	    G_fatal_error(_("Unable to open temporary file <%s>"),
+			  series_file);
     }
 #ifdef PARALLEL
     printTimeDiff("M2");
@@ -1990,6 +2240,11 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
     for (j = 0; j < m; j++) {
 	G_percent(j, m - 1, 2);
 
+	if (series) {
+	    for (l = 0; l < nslices * nactive * n; l++)
+		rowbuf[l] = UNDEFZ;
+	}
+
 	if (j % (numRows) == 0) {
 	    INPUT_part(j, &zmax);
 	    arrayOffset = 0;
@@ -1997,7 +2252,7 @@ void calculate(double singleSlope, double singleAspect, double singleAlbedo,
 	}
 	sunVarGeom.zmax = zmax;
         shadowoffset_base = (j % (numRows)) * n * arrayNumInt;
-  #pragma omp parallel firstprivate(q1,tan_lam_l,z1,i,shadowoffset,longitTime,coslat,coslatsq,func,latitude,longitude,sin_phi_l,latid_l,sin_u,cos_u,sin_v,cos_v,lum, gridGeom,sunGeom,sunVarGeom,sunSlopeGeom,sunRadVar, elevin,aspin,slopein,civiltime,linkein,albedo,latin,coefbh,coefdh,incidout,longin,horizon,beam_rad,insol_time,diff_rad,refl_rad,glob_rad,mapset,per,decimals,str_step )
+  #pragma omp parallel firstprivate(q1,tan_lam_l,z1,i,k,shadowoffset,longitTime,coslat,coslatsq,func,latitude,longitude,sin_phi_l,latid_l,sin_u,cos_u,sin_v,cos_v,lum, gridGeom,sunGeom,sunVarGeom,sunSlopeGeom,sunRadVar, elevin,aspin,slopein,civiltime,linkein,albedo,latin,coefbh,coefdh,incidout,longin,horizon,beam_rad,insol_time,diff_rad,refl_rad,glob_rad,mapset,per,decimals,str_step )
 {
       #pragma omp for schedule(dynamic) 
 	for (i = 0; i < n; i++) {  
@@ -2098,9 +2353,6 @@ if (i >= n || arrayOffset >= m)
  		cos_v = cos(M_PI / 2 + sunSlopeGeom.aspect);
  		sin_v = sin(M_PI / 2 + sunSlopeGeom.aspect);
  
- 		if (ttime != NULL)
- 		    sunGeom.timeAngle = tim;
- 
  		gridGeom.sinlat = sin(-latitude);
  		gridGeom.coslat = cos(-latitude);
  
@@ -2113,62 +2365,76 @@ if (i >= n || arrayOffset >= m)
  		    gridGeom.coslat * sin_u;
  		tan_lam_l = -cos_u * cos_v / q1;
  		sunSlopeGeom.longit_l = atan(tan_lam_l);
- 		sunSlopeGeom.lum_C31_l = cos(latid_l) * sunGeom.cosdecl;
- 		sunSlopeGeom.lum_C33_l = sin_phi_l * sunGeom.sindecl;
- 
- 		if ((incidout != NULL) || someRadiation) {
-  		    com_par_const(longitTime, &sunGeom, &gridGeom);
- 		    sunrise_min = AMIN1(sunrise_min, sunGeom.sunrise_time);
- 		    sunrise_max = AMAX1(sunrise_max, sunGeom.sunrise_time);
- 		    sunset_min = AMIN1(sunset_min, sunGeom.sunset_time);
- 		    sunset_max = AMAX1(sunset_max, sunGeom.sunset_time);
- 
- 		}
- 
- 		if (incidout != NULL) {
-  		    com_par(&sunGeom, &sunVarGeom, &gridGeom, latitude,
-  			    longitude);
-  		    lum =
-  			lumcline2(&sunGeom, &sunVarGeom, &sunSlopeGeom,
-  				  &gridGeom, horizonarray + shadowoffset);
- 		    if (lum > 0.) {
- 			lum = rad2deg * asin(lum);
- 			lumcl[j][i] = (float)lum;
- 		    }
- 		    else lumcl[j][i] = UNDEFZ;
- 		}
- 
- 		double Pbeam_e = 0.;
-                 double Pdiff_e = 0.;
-                 double Prefl_e = 0.;
-                 double Pinsol_t = 0.;
- 		
- 		if (someRadiation) {
-  		    joules2(&sunGeom, &sunVarGeom, &sunSlopeGeom, &sunRadVar,
-  			    &gridGeom, horizonarray + shadowoffset, latitude,
-  			    longitude,                                        
-                          &Pbeam_e,
-                          &Pdiff_e,
-                          &Prefl_e,
-                          &Pinsol_t
-                             );
- 		    if (beam_rad != NULL)
- 			beam[j][i] = (float)Pbeam_e;
- 		    if (insol_time != NULL)
- 			insol[j][i] = (float)Pinsol_t;
- 		    /*  G_debug(3,"\n %f",insol[j][i]); */
- 		    if (diff_rad != NULL)
- 			diff[j][i] = (float)Pdiff_e;
- 		    if (refl_rad != NULL)
- 			refl[j][i] = (float)Prefl_e;
- 		    if (glob_rad != NULL)
- 			globrad[j][i] = (float)(Pbeam_e + Pdiff_e + Prefl_e);
- 		}
+
+		/* terrain and position above are the same for all days and
+		 * times, only the sun geometry changes */
+		for (k = 0; k < nslices; k++) {
+		    sunGeom.sindecl = slices[k].sindecl;
+		    sunGeom.cosdecl = slices[k].cosdecl;
+		    sunRadVar.G_norm_extra = slices[k].G_norm_extra;
+		    sunVarGeom.zp = sunVarGeom.z_orig;
+		    if (ttime != NULL)
+			sunGeom.timeAngle = slices[k].timeAngle;
+
+		    sunSlopeGeom.lum_C31_l = cos(latid_l) * sunGeom.cosdecl;
+		    sunSlopeGeom.lum_C33_l = sin_phi_l * sunGeom.sindecl;
+
+		    if ((incidout != NULL) || someRadiation) {
+			com_par_const(longitTime + slices[k].timeOffset,
+				      &sunGeom, &gridGeom);
+			sunrise_min = AMIN1(sunrise_min, sunGeom.sunrise_time);
+			sunrise_max = AMAX1(sunrise_max, sunGeom.sunrise_time);
+			sunset_min = AMIN1(sunset_min, sunGeom.sunset_time);
+			sunset_max = AMAX1(sunset_max, sunGeom.sunset_time);
+		    }
+
+		    if (incidout != NULL) {
+			com_par(&sunGeom, &sunVarGeom, &gridGeom, latitude,
+				longitude);
+			lum =
+			    lumcline2(&sunGeom, &sunVarGeom, &sunSlopeGeom,
+				      &gridGeom, horizonarray + shadowoffset);
+			if (lum > 0.)
+			    lum = rad2deg * asin(lum);
+			else
+			    lum = UNDEFZ;
+			store_value(lumcl, 0, k, j, i, lum);
+		    }
+
+		    double Pbeam_e = 0.;
+		    double Pdiff_e = 0.;
+		    double Prefl_e = 0.;
+		    double Pinsol_t = 0.;
+
+		    if (someRadiation) {
+			joules2(&sunGeom, &sunVarGeom, &sunSlopeGeom, &sunRadVar,
+				&gridGeom, horizonarray + shadowoffset, latitude,
+				longitude, &Pbeam_e, &Pdiff_e, &Prefl_e,
+				&Pinsol_t);
+			if (beam_rad != NULL)
+			    store_value(beam, 1, k, j, i, Pbeam_e);
+			if (insol_time != NULL)
+			    store_value(insol, 2, k, j, i, Pinsol_t);
+			if (diff_rad != NULL)
+			    store_value(diff, 3, k, j, i, Pdiff_e);
+			if (refl_rad != NULL)
+			    store_value(refl, 4, k, j, i, Prefl_e);
+			if (glob_rad != NULL)
+			    store_value(globrad, 5, k, j, i,
+					Pbeam_e + Pdiff_e + Prefl_e);
+		    }
+		}
  
  	    }			/* undefs */
  	    //shadowoffset += arrayNumInt;
 	}
     }
+	if (series) {
+	    if (fwrite(rowbuf, sizeof(float), (size_t)nslices * nactive * n,
+		       fseries) != (size_t)nslices * nactive * n)
+		G_fatal_error(_("Unable to write to temporary file <%s>"),
+			      series_file);
+	}
         arrayOffset++;
 }
 #ifdef PARALLEL
@@ -2201,26 +2467,42 @@ if (i >= n || arrayOffset >= m)
     Rast_append_format_history(
 	&hist,
 	" ----------------------------------------------------------------");
-    Rast_append_format_history(
-	&hist,
-	" Day [1-365]:                              %d",
-	day);
-
-    if (ttime != NULL)
+    if (ndays > 1)
+	Rast_append_format_history(
+	    &hist,
+	    " Days [1-365]:                             %d - %d, step %d%s",
+	    day, slices[nslices - 1].day, day_step,
+	    accumulate ? ", summed" : "");
+    else
 	Rast_append_format_history(
 	    &hist,
-	    " Local (solar) time (decimal hr.):         %.4f", timo);
+	    " Day [1-365]:                              %d",
+	    day);
+
+    if (ttime != NULL) {
+	if (ntimes > 1)
+	    Rast_append_format_history(
+		&hist,
+		" Local (solar) times (decimal hr.):        %d times",
+		ntimes);
+	else
+	    Rast_append_format_history(
+		&hist,
+		" Local (solar) time (decimal hr.):         %.4f", timo);
+    }
 
     Rast_append_format_history(
 	&hist,
 	" Solar constant (W/m^2):                   1367");
-    Rast_append_format_history(
-	&hist,
-	" Extraterrestrial irradiance (W/m^2):      %f",
-	sunRadVar.G_norm_extra);
-    Rast_append_format_history(
-	&hist,
-	" Declination (rad):                        %f", -declination);
+    if (ndays == 1) {
+	Rast_append_format_history(
+	    &hist,
+	    " Extraterrestrial irradiance (W/m^2):      %f",
+	    sunRadVar.G_norm_extra);
+	Rast_append_format_history(
+	    &hist,
+	    " Declination (rad):                        %f", -declination);
+    }
 
     Rast_append_format_history(
 	&hist,
@@ -107,3 +107,15 @@ struct GridGeometry
     double coslat;
 
 };
+
+/* One day (and in mode 1 one time) of a multi-day/multi-time run */
+struct TimeSlice
+{
+    int day;
+    double time;		/* local (solar) time, mode 1 only */
+    double timeAngle;
+    double sindecl;
+    double cosdecl;
+    double G_norm_extra;
+    double timeOffset;		/* civil time offset of the day */
+};
@@ -16,8 +16,12 @@
  *****************************************************************************/
 #include <stdlib.h>
 #include <unistd.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include <grass/gis.h>
 #include <grass/raster.h>
+#include <grass/kdtree.h>
 #include "local_proto.h"
 #include <grass/glocale.h>
 
@@ -31,28 +35,70 @@ struct Point
 {
     double north, east;
     double z;
-    double dist;
 };
 struct Point *points = NULL;
-struct Point *list;
 
+/* nearest points search of one thread */
+struct search
+{
+    int *uid;
+    double *dist;
+};
+
+/* interpolates one row, the nsearch nearest points of each cell are
+ * found in the k-d tree */
+static void interpolate_row(struct kdtree *kdt, struct search *s,
+			    struct Cell_head *window, double north,
+			    CELL *mask, CELL *cell)
+{
+    int col, n, found;
+    double c[2], dist, sum1, sum2;
+
+    c[1] = north;
+    c[0] = window->west - window->ew_res / 2.0;
+    for (col = 0; col < window->cols; col++) {
+	c[0] += window->ew_res;
+	/* don't interpolate outside of the mask */
+	if (mask && mask[col] == 0) {
+	    cell[col] = 0;
+	    continue;
+	}
+	found = kdtree_knn(kdt, c, s->uid, s->dist, nsearch, NULL);
+
+	/* interpolate */
+	sum1 = 0.0;
+	sum2 = 0.0;
+	for (n = 0; n < found; n++) {
+	    /* kdtree_knn() gives squared distances */
+	    if ((dist = s->dist[n])) {
+		sum1 += points[s->uid[n]].z / dist;
+		sum2 += 1.0 / dist;
+	    }
+	    else {
+		sum1 = points[s->uid[n]].z;
+		sum2 = 1.0;
+		break;
+	    }
+	}
+	cell[col] = (CELL) (sum1 / sum2 + 0.5);
+    }
+}
 
 int main(int argc, char *argv[])
 {
     int fd, maskfd;
-    CELL *cell, *mask;
+    CELL **cell, **mask;
     struct Cell_head window;
-    int row, col;
-    double north, east;
-    double dx, dy;
-    double maxdist, dist;
-    double sum1, sum2;
-    int i, n, max;
+    int row, row0, nchunk;
+    int i, t, nthreads;
+    double c[2];
+    struct kdtree *kdt;
+    struct search *search;
     struct GModule *module;
     struct History history;
     struct
     {
-	struct Option *input, *npoints, *output;
+	struct Option *input, *npoints, *output, *threads;
     } parm;
     int cell_type;
 
@@ -78,9 +124,28 @@ int main(int argc, char *argv[])
     parm.npoints->description = _("Number of interpolation points");
     parm.npoints->answer = "12";
 
+    parm.threads = G_define_option();
+    parm.threads->key = "threads";
+    parm.threads->type = TYPE_INTEGER;
+    parm.threads->required = NO;
+    parm.threads->description = _("Number of threads for parallel computing");
+    parm.threads->answer = "1";
+
     if (G_parser(argc, argv))
 	exit(EXIT_FAILURE);
 
+    nthreads = atoi(parm.threads->answer);
+    if (nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than 0"), parm.threads->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+    nthreads = 1;
+#endif
+
     /* Make sure that the current projection is not lat/long */
     if ((G_projection() == PROJECTION_LL))
 	G_fatal_error(_("Lat/long databases not supported by r.surf.idw2. Use r.surf.idw instead!"));
@@ -90,8 +155,6 @@ int main(int argc, char *argv[])
 	G_fatal_error(_("%s=%s - illegal number of interpolation points"),
 		      parm.npoints->key, parm.npoints->answer);
 
-    list = (struct Point *)G_calloc(search_points, sizeof(struct Point));
-
     /* read the elevation points from the input raster map */
     read_cell(parm.input->answer);
 
@@ -99,15 +162,31 @@ int main(int argc, char *argv[])
 	G_fatal_error(_("%s: no data points found"), G_program_name());
     nsearch = npoints < search_points ? npoints : search_points;
 
+    /* index the points once */
+    G_message(_("Building spatial index..."));
+    kdt = kdtree_create(2, NULL);
+    for (i = 0; i < npoints; i++) {
+	G_percent(i, npoints, 4);
+	c[0] = points[i].east;
+	c[1] = points[i].north;
+	kdtree_insert(kdt, c, i, 0);
+    }
+    G_percent(npoints, npoints, 4);
+    kdtree_optimize(kdt, 2);
+
     /* get the window, allocate buffers, etc. */
     G_get_set_window(&window);
 
-    cell = Rast_allocate_c_buf();
-
-    if ((maskfd = Rast_maskfd()) >= 0)
-	mask = Rast_allocate_c_buf();
-    else
-	mask = NULL;
+    maskfd = Rast_maskfd();
+    cell = G_malloc(nthreads * sizeof(CELL *));
+    mask = G_malloc(nthreads * sizeof(CELL *));
+    search = G_malloc(nthreads * sizeof(struct search));
+    for (t = 0; t < nthreads; t++) {
+	cell[t] = Rast_allocate_c_buf();
+	mask[t] = maskfd >= 0 ? Rast_allocate_c_buf() : NULL;
+	search[t].uid = G_malloc(nsearch * sizeof(int));
+	search[t].dist = G_malloc(nsearch * sizeof(double));
+    }
 
     fd = Rast_open_c_new(parm.output->answer);
 
@@ -118,75 +197,42 @@ int main(int argc, char *argv[])
     G_message(_("Interpolating raster map <%s>... %d rows... "),
 	      parm.output->answer, window.rows);
 
-    north = window.north - window.ns_res / 2.0;
-    for (row = 0; row < window.rows; row++) {
-	G_percent(row, window.rows, 2);
-
-	if (mask)
-	    Rast_get_c_row(maskfd, mask, row);
-
-	north += window.ns_res;
-	east = window.west - window.ew_res / 2.0;
-	for (col = 0; col < window.cols; col++) {
-	    east += window.ew_res;
-	    /* don't interpolate outside of the mask */
-	    if (mask && mask[col] == 0) {
-		cell[col] = 0;
-		continue;
-	    }
-	    /* fill list with first nsearch points */
-	    for (i = 0; i < nsearch; i++) {
-		dy = points[i].north - north;
-		dx = points[i].east - east;
-		list[i].dist = dy * dy + dx * dx;
-		list[i].z = points[i].z;
-	    }
-	    /* find the maximum distance */
-	    maxdist = list[max = 0].dist;
-	    for (n = 1; n < nsearch; n++) {
-		if (maxdist < list[n].dist)
-		    maxdist = list[max = n].dist;
-	    }
-	    /* go thru rest of the points now */
-	    for (; i < npoints; i++) {
-		dy = points[i].north - north;
-		dx = points[i].east - east;
-		dist = dy * dy + dx * dx;
-
-		if (dist < maxdist) {
-		    /* replace the largest dist */
-		    list[max].z = points[i].z;
-		    list[max].dist = dist;
-		    maxdist = list[max = 0].dist;
-		    for (n = 1; n < nsearch; n++) {
-			if (maxdist < list[n].dist)
-			    maxdist = list[max = n].dist;
-		    }
-		}
-	    }
-
-	    /* interpolate */
-	    sum1 = 0.0;
-	    sum2 = 0.0;
-	    for (n = 0; n < nsearch; n++) {
-		if ((dist = list[n].dist)) {
-		    sum1 += list[n].z / dist;
-		    sum2 += 1.0 / dist;
-		}
-		else {
-		    sum1 = list[n].z;
-		    sum2 = 1.0;
-		    break;
-		}
-	    }
-	    cell[col] = (CELL) (sum1 / sum2 + 0.5);
+    /* a chunk of rows is interpolated in parallel, one row per thread,
+     * and written in order */
+    for (row0 = 0; row0 < window.rows; row0 += nthreads) {
+	G_percent(row0, window.rows, 2);
+	nchunk = window.rows - row0 < nthreads ? window.rows - row0 : nthreads;
+
+	if (maskfd >= 0)
+	    for (t = 0; t < nchunk; t++)
+		Rast_get_c_row(maskfd, mask[t], row0 + t);
+
+#pragma omp parallel for schedule(static, 1) private(row)
+	for (t = 0; t < nchunk; t++) {
+	    row = row0 + t;
+	    /* same northing of the rows as in read_cell() */
+	    interpolate_row(kdt, &search[t], &window,
+			    window.north + (row + 0.5) * window.ns_res,
+			    mask[t], cell[t]);
 	}
 
-	Rast_put_row(fd, cell, CELL_TYPE);
+	for (t = 0; t < nchunk; t++)
+	    Rast_put_row(fd, cell[t], CELL_TYPE);
+    }
+    G_percent(window.rows, window.rows, 2);
+
+    kdtree_destroy(kdt);
+    for (t = 0; t < nthreads; t++) {
+	G_free(cell[t]);
+	if (mask[t])
+	    G_free(mask[t]);
+	G_free(search[t].uid);
+	G_free(search[t].dist);
     }
-
-    G_free(points);
     G_free(cell);
+    G_free(mask);
+    G_free(search);
+    G_free(points);
     Rast_close(fd);
 
     /* writing history file */
@@ -24,11 +24,29 @@
 #include <grass/glocale.h>
 
 /*- Parameters and global variables -----------------------------------------*/
+
+/* mergeable quantile sketch, see tdigest.c */
+struct centroid
+{
+    double mean;
+    double weight;
+};
+
+typedef struct
+{
+    double compression;
+    int n_cent, max_cent;  /* merged centroids */
+    int n_buf, max_buf;    /* buffered values, stored after the centroids */
+    struct centroid *c;
+    double total;
+    double min, max;
+} tdigest;
+
 typedef struct
 {
     int zone;
     char *cat;
-    int null_cells;
+    long null_cells;
     double sum;
     double sum2;
     double sum3;
@@ -61,16 +79,18 @@ typedef struct
     double quartile_75;
     double *perc;
     double mode;
-    int occurrences;
+    long occurrences;
 
     /* need for processing */
-    int n;
-    int size;
+    long n;
+    long size;
 
     RASTER_MAP_TYPE map_type;
     DCELL *array;
+    long n_array;
+    tdigest *sketch;
     void *nextp;
-    int n_alloc;
+    long n_alloc;
 } univar_stat;
 
 typedef struct
@@ -78,31 +98,44 @@ typedef struct
     CELL min, max, n_zones;
     struct Categories cats;
     char *sep;
-    int *len;
-    int n_alloc;
+    long *len;
+    long n_alloc;
 } zone_type;
 
 /* command line options are the same for raster and raster3d maps */
 typedef struct
 {
     struct Option *inputfile, *zonefile, *percentile, *tolerance, *output_file, *separator;
-    struct Flag *shell_style, *extended, *table;
+    struct Option *compression, *threads;
+    struct Flag *shell_style, *extended, *table, *approx;
     int n_perc;
-    int *index_perc;
+    long *index_perc;
     double *quant_perc;
     double *perc;
     double tol;
+    double compr;
+    int nprocs;
 } param_type;
 
 extern param_type param;
 extern zone_type zone_info;
 
 /* fn prototypes */
-void heapsort_double(double *data, int n);
+void heapsort_double(double *data, long n);
 void heapsort_float(float *data, int n);
 void heapsort_int(int *data, int n);
 
-int compute_stats(univar_stat *, double, int);
+void compute_stats(univar_stat *, double);
+void merge_univar_stats(univar_stat *, univar_stat *);
+void finish_univar_stats(univar_stat *);
+
+/* tdigest.c */
+tdigest *tdigest_create(double);
+void tdigest_free(tdigest *);
+void tdigest_add(tdigest *, double);
+void tdigest_merge(tdigest *, const tdigest *);
+void tdigest_compress(tdigest *);
+double tdigest_quantile(tdigest *, double);
 
 /* int print_stats(univar_stat *); */
 int print_stats_table(univar_stat *);
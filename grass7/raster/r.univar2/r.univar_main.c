@@ -15,10 +15,15 @@
  *   This program is a replacement for the r.univar shell script
  */
 
-#include <assert.h>
 #include <string.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include "globals.h"
 
+/* number of rows read at once */
+#define CHUNK_ROWS 64
+
 param_type param;
 zone_type zone_info;
 
@@ -62,6 +67,25 @@ void set_params()
         _("Tolerance to consider float number equal to another when computing the mode");
     param.tolerance->guisection = _("Extended");
 
+    param.compression = G_define_option();
+    param.compression->key = "compression";
+    param.compression->type = TYPE_DOUBLE;
+    param.compression->required = NO;
+    param.compression->multiple = NO;
+    param.compression->answer = "100";
+    param.compression->description =
+        _("Accuracy of approximate percentiles (higher is more accurate but needs more memory)");
+    param.compression->guisection = _("Extended");
+
+    param.threads = G_define_option();
+    param.threads->key = "threads";
+    param.threads->type = TYPE_INTEGER;
+    param.threads->required = NO;
+    param.threads->multiple = NO;
+    param.threads->answer = "1";
+    param.threads->description =
+        _("Number of threads for parallel computing");
+
     param.separator = G_define_standard_option(G_OPT_F_SEP);
     param.separator->guisection = _("Formatting");
 
@@ -76,6 +100,12 @@ void set_params()
     param.extended->description = _("Calculate extended statistics");
     param.extended->guisection = _("Extended");
 
+    param.approx = G_define_flag();
+    param.approx->key = 'a';
+    param.approx->description =
+        _("Approximate percentiles with bounded memory (no mode, requires -e)");
+    param.approx->guisection = _("Extended");
+
     param.table = G_define_flag();
     param.table->key = 't';
     param.table->description = _("Table output format instead of standard output format");
@@ -85,7 +115,7 @@ void set_params()
 }
 
 static int open_raster(const char *infile);
-static univar_stat *univar_stat_with_percentiles();
+static univar_stat *univar_stat_with_percentiles(int n_maps);
 static void process_raster(univar_stat * stats,
                            int fd, int fdz,
                            const struct Cell_head *region);
@@ -104,7 +134,7 @@ void init_zones(int fdz, const struct Cell_head *region)
     CELL *zptr;
 
     zone_info.n_alloc = 0;
-    zone_info.len = (int *) G_calloc(zone_info.n_zones, sizeof(int));
+    zone_info.len = (long *) G_calloc(zone_info.n_zones, sizeof(long));
 
     zoneraster_row = Rast_allocate_c_buf();
     G_message("Reading the zones map.");
@@ -161,6 +191,7 @@ int main(int argc, char *argv[])
 
     /* Define the different options */
     set_params();
+    G_option_requires(param.approx, param.extended, NULL);
 
     if (G_parser(argc, argv))
         exit(EXIT_FAILURE);
@@ -215,41 +246,41 @@ int main(int argc, char *argv[])
 
     sscanf(param.tolerance->answers[0], "%lf", &param.tol);
 
+    sscanf(param.compression->answer, "%lf", &param.compr);
+    if (param.compr < 10)
+        G_fatal_error(_("<%s> must be at least 10"), param.compression->key);
+
+    param.nprocs = atoi(param.threads->answer);
+    if (param.nprocs < 1)
+        G_fatal_error(_("<%s> must be >= 1"), param.threads->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(param.nprocs);
+#else
+    if (param.nprocs != 1)
+        G_warning(_("r.univar2 was compiled without OpenMP support, using one thread"));
+    param.nprocs = 1;
+#endif
+
     /* count the input rasters given */
     for (p = (char **)param.inputfile->answers, rasters = 0;
          *p; p++, rasters++) ;
 
-    /* process all input rasters */
-    int map_type = param.extended->answer ? -2 : -1;
-
-    stats = ((map_type == -1)
-             ? create_univar_stat_struct(-1, 0)
-             : 0);
+    /* values of all input rasters are stored as DCELL,
+     * map types may differ also for extended stats */
+    stats = univar_stat_with_percentiles(rasters);
 
+    /* process all input rasters */
     for (p = param.inputfile->answers; *p; p++) {
         fd = open_raster(*p);
 
-        if (map_type != -1) {
-            /* NB: map_type must match when doing extended stats */
-            int this_type = Rast_get_map_type(fd);
-
-            assert(this_type > -1);
-            if (map_type < -1) {
-                /* extended stats */
-                assert(stats == 0);
-                map_type = this_type;
-                stats = univar_stat_with_percentiles(map_type);
-            }
-            else if (this_type != map_type) {
-                G_fatal_error(_("Raster <%s> type mismatch"), *p);
-            }
-        }
         process_raster(stats, fd, fdz, &region);
 
         /* close input raster */
         Rast_close(fd);
     }
 
+    finish_univar_stats(stats);
+
     /* close zoning raster */
     if (z)
         Rast_close(fdz);
@@ -281,7 +312,7 @@ static int open_raster(const char *infile)
     return fd;
 }
 
-static univar_stat *univar_stat_with_percentiles()
+static univar_stat *univar_stat_with_percentiles(int n_maps)
 {
     univar_stat *stats;
     unsigned int z, p, n_perc=0;
@@ -293,7 +324,7 @@ static univar_stat *univar_stat_with_percentiles()
     /* allocate memory */
     G_debug(3, "Allocate memory for percentile, n_perc=%d", n_perc);
     param.n_perc = n_perc;
-    param.index_perc = (int *) G_calloc(n_perc + 1, sizeof(int));
+    param.index_perc = (long *) G_calloc(n_perc + 1, sizeof(long));
     param.quant_perc = (double *) G_calloc(n_perc + 1, sizeof(double));
     param.perc = (double *) G_calloc(n_perc + 1, sizeof(double));
     for (p = 0; p < n_perc; p++) {
@@ -303,79 +334,159 @@ static univar_stat *univar_stat_with_percentiles()
 
     stats = create_univar_stat_struct();
     for (z = 0; z < n_zones; z++) {
-        stats[z].size = zone_info.len[z];
+        stats[z].size = zone_info.len[z] * n_maps;
         stats[z].zone = z + zone_info.min;
         stats[z].cat = Rast_get_c_cat(&stats[z].zone, &(zone_info.cats));
         stats[z].perc = (double *) G_calloc(n_perc, sizeof(double));
+
+        /* exact extended stats: keep all values of all maps,
+         * threads fill the array concurrently */
+        if (param.extended->answer && !param.approx->answer &&
+            stats[z].size > 0) {
+            stats[z].n_alloc = stats[z].size;
+            stats[z].array = (DCELL *) G_malloc(stats[z].n_alloc *
+                                                sizeof(DCELL));
+        }
     }
     return stats;
 }
 
-static void
-process_raster(univar_stat * stats, int fd, int fdz, const struct Cell_head *region)
+/* read CHUNK_ROWS rows of input and zones starting at row0 */
+static void read_chunk(int fd, int fdz, void *raster_buf, CELL *zone_buf,
+                       int row0, int rows, int cols,
+                       RASTER_MAP_TYPE map_type)
 {
-    /* use G_window_rows(), G_window_cols() here? */
-    const unsigned int rows = region->rows;
-    const unsigned int cols = region->cols;
+    const size_t value_sz = Rast_cell_size(map_type);
+    int row;
 
-    const RASTER_MAP_TYPE map_type = Rast_get_map_type(fd);
+    for (row = row0; row < rows && row < row0 + CHUNK_ROWS; row++) {
+        Rast_get_row(fd, G_incr_void_ptr(raster_buf,
+                     (size_t)(row - row0) * cols * value_sz),
+                     row, map_type);
+        Rast_get_c_row(fdz, zone_buf + (size_t)(row - row0) * cols, row);
+    }
+}
+
+static void process_row(univar_stat * stats, univar_stat * tstats,
+                        const void *raster_row, const CELL *zoneraster_row,
+                        int cols, RASTER_MAP_TYPE map_type)
+{
     const size_t value_sz = Rast_cell_size(map_type);
-    unsigned int row;
-    void *raster_row;
-    CELL *zoneraster_row;
+    const void *ptr = raster_row;
+    const CELL *zptr = zoneraster_row;
+    int col;
 
-    raster_row = Rast_allocate_buf(map_type);
-    zoneraster_row = Rast_allocate_c_buf();
+    for (col = 0; col < cols; col++) {
+        double val;
+        int zone = 0;
 
-    for (row = 0; row < rows; row++) {
-        void *ptr;
-        CELL *zptr;
-        unsigned int col;
+        /* can't do stats with NULL cells in input map */
+        if (Rast_is_c_null_value(zptr) ||
+            Rast_is_null_value(ptr, map_type)) {
+            ptr = G_incr_void_ptr(ptr, value_sz);
+            zptr++;
+            continue;
+        }
+        zone = *zptr - zone_info.min;
 
-        Rast_get_row(fd, raster_row, row, map_type);
-        Rast_get_c_row(fdz, zoneraster_row, row);
-        zptr = zoneraster_row;
+        val = ((map_type == DCELL_TYPE) ? *((DCELL *) ptr)
+               : (map_type == FCELL_TYPE) ? *((FCELL *) ptr)
+               : *((CELL *) ptr));
 
-        ptr = raster_row;
+        compute_stats(&tstats[zone], val);
 
-        for (col = 0; col < cols; col++) {
-            double val;
-            int zone = 0;
+        if (stats[zone].array != NULL) {
+            long i;
 
-            if (Rast_is_c_null_value(zptr)) {
-                ptr = G_incr_void_ptr(ptr, value_sz);
-                zptr++;
-                continue;
-            }
-            zone = *zptr - zone_info.min;
-            /* count all including NULL cells in input map */
-            /*stats[zone].size++;
-             G _debug(3, "Col: %u, zone: %d", col, zone); */
+#pragma omp atomic capture
+            i = stats[zone].n_array++;
 
-            /* can't do stats with NULL cells in input map */
-            if (Rast_is_null_value(ptr, map_type)) {
-                ptr = G_incr_void_ptr(ptr, value_sz);
-                zptr++;
-                continue;
-            }
+            stats[zone].array[i] = val;
+        }
+        else if (param.extended->answer) {
+            /* sketches are per thread, merged afterwards */
+            if (tstats[zone].sketch == NULL)
+                tstats[zone].sketch = tdigest_create(param.compr);
+            tdigest_add(tstats[zone].sketch, val);
+        }
 
-            if (param.extended->answer && stats[zone].array == NULL){
-                stats[zone].n_alloc = zone_info.len[zone] + 1;
-                stats[zone].array = (DCELL *) G_calloc(stats[zone].n_alloc,
-                                                       sizeof(DCELL));
-            }
+        ptr = G_incr_void_ptr(ptr, value_sz);
+        zptr++;
+    }
+}
 
-            val = ((map_type == DCELL_TYPE) ? *((DCELL *) ptr)
-                   : (map_type == FCELL_TYPE) ? *((FCELL *) ptr)
-                   : *((CELL *) ptr));
+/* Rows are read in chunks by one thread while the other threads
+ * process the previous chunk. Each thread accumulates into its own
+ * univar_stat structs, which are merged at the end. */
+static void
+process_raster(univar_stat * stats, int fd, int fdz, const struct Cell_head *region)
+{
+    /* use G_window_rows(), G_window_cols() here? */
+    const int rows = region->rows;
+    const int cols = region->cols;
+    const int n_chunks = (rows + CHUNK_ROWS - 1) / CHUNK_ROWS;
 
-            compute_stats(&stats[zone], val, zone_info.len[zone]);
+    const RASTER_MAP_TYPE map_type = Rast_get_map_type(fd);
+    const size_t value_sz = Rast_cell_size(map_type);
+    void *raster_buf[2];
+    CELL *zone_buf[2];
+    univar_stat **tstats;
+    int i, t;
+
+    for (i = 0; i < 2; i++) {
+        raster_buf[i] = G_malloc((size_t)CHUNK_ROWS * cols * value_sz);
+        zone_buf[i] = G_malloc((size_t)CHUNK_ROWS * cols * sizeof(CELL));
+    }
+    tstats = G_malloc(param.nprocs * sizeof(univar_stat *));
+    for (t = 0; t < param.nprocs; t++)
+        tstats[t] = create_univar_stat_struct();
+
+    if (n_chunks > 0)
+        read_chunk(fd, fdz, raster_buf[0], zone_buf[0], 0, rows, cols,
+                   map_type);
+
+#pragma omp parallel
+    {
+        univar_stat *my_stats = tstats[0];
+        int chunk, row;
+
+#if defined(_OPENMP)
+        my_stats = tstats[omp_get_thread_num()];
+#endif
+
+        for (chunk = 0; chunk < n_chunks; chunk++) {
+            int cur = chunk % 2;
+            int row0 = chunk * CHUNK_ROWS;
+            int nrows = rows - row0 < CHUNK_ROWS ? rows - row0 : CHUNK_ROWS;
+
+#pragma omp single nowait
+            {
+                if (chunk + 1 < n_chunks)
+                    read_chunk(fd, fdz, raster_buf[1 - cur], zone_buf[1 - cur],
+                               row0 + CHUNK_ROWS, rows, cols, map_type);
+                G_percent(row0, rows, 2);
+            }
 
-            ptr = G_incr_void_ptr(ptr, value_sz);
-            zptr++;
+#pragma omp for schedule(dynamic)
+            for (row = 0; row < nrows; row++) {
+                process_row(stats, my_stats,
+                            G_incr_void_ptr(raster_buf[cur],
+                                            (size_t)row * cols * value_sz),
+                            zone_buf[cur] + (size_t)row * cols,
+                            cols, map_type);
+            }
         }
-        G_percent(row, rows, 2);
     }
     G_percent(rows, rows, 2);
+
+    for (t = 0; t < param.nprocs; t++) {
+        merge_univar_stats(stats, tstats[t]);
+        free_univar_stat_struct(tstats[t]);
+    }
+    G_free(tstats);
+    for (i = 0; i < 2; i++) {
+        G_free(raster_buf[i]);
+        G_free(zone_buf[i]);
+    }
     return;
 }
@@ -12,7 +12,7 @@
 #include "globals.h"
 static void downheap_int(int *array, int n, int k);
 static void downheap_float(float *array, int n, int k);
-static void downheap_double(double *array, int n, int k);
+static void downheap_double(double *array, long n, long k);
 
 /* *************************************************************** */
 /* *************************************************************** */
@@ -64,9 +64,9 @@ void downheap_float(float *array, int n, int k)
 /* *************************************************************** */
 /* *************************************************************** */
 /* *************************************************************** */
-void downheap_double(double *array, int n, int k)
+void downheap_double(double *array, long n, long k)
 {
-    int j;
+    long j;
     double v;
 
     v = array[k];
@@ -132,9 +132,9 @@ void heapsort_float(float *array, int n)
 /* *************************************************************** */
 /* ****** heapsort for double arrays of size n ******************* */
 /* *************************************************************** */
-void heapsort_double(double *array, int n)
+void heapsort_double(double *array, long n)
 {
-    int k;
+    long k;
     double t;
 
     --n;
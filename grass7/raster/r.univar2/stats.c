@@ -72,6 +72,9 @@ univar_stat *create_univar_stat_struct()
         stats[z].size = 0;
         stats[z].map_type = 0;
         stats[z].array = NULL;
+        stats[z].n_array = 0;
+        stats[z].sketch = NULL;
+        stats[z].perc = NULL;
         stats[z].nextp = NULL;
         stats[z].n_alloc = 0;
     }
@@ -85,12 +88,19 @@ univar_stat *create_univar_stat_struct()
 /* *************************************************************** */
 void free_univar_stat_struct(univar_stat * stats)
 {
-    /*int z, n_zones = zone_info.n_zones;
+    int z, n_zones = zone_info.n_zones;
+
+    if (n_zones == 0)
+        n_zones = 1;
 
     for (z = 0; z < n_zones; z++){
         if (stats[z].perc != NULL)
-            G_free(&stats[z].perc);
-    } */
+            G_free(stats[z].perc);
+        if (stats[z].array != NULL)
+            G_free(stats[z].array);
+        tdigest_free(stats[z].sketch);
+    }
+    G_free(stats);
 
     return;
 }
@@ -121,11 +131,11 @@ void index_combinations(int n, int **indexes)
 }
 
 
-void sort_mode_double(double *array, int n, double tol,
-                      double *mode, int *occurrences)
+void sort_mode_double(double *array, long n, double tol,
+                      double *mode, long *occurrences)
 {
     int previous = array[0];
-    int i = 1, counter = 1;
+    long i = 1, counter = 1;
     *mode = (double) array[0];
     *occurrences = 1;
 
@@ -180,22 +190,23 @@ void mode_double(double *array, int n, double tol,
 
 
 int stats_extend(univar_stat *stat){
-    int p, qind_25, qind_75;
-    int n = stat->n;
+    int p;
+    long qind_25, qind_75;
+    long n = stat->n;
+
+    heapsort_double(stat->array, n);
 
     for (p = 0; p < param.n_perc; p++) {
-        param.index_perc[p] = (int)(n * 1e-2 * param.perc[p] - 0.5);
+        param.index_perc[p] = (long)(n * 1e-2 * param.perc[p] - 0.5);
         stat->perc[p] = stat->array[param.index_perc[p]];
     }
-    qind_25 = (int)(n * 0.25 - 0.5);
-    qind_75 = (int)(n * 0.75 - 0.5);
-
-    heapsort_double(stat->array, n);
+    qind_25 = (long)(n * 0.25 - 0.5);
+    qind_75 = (long)(n * 0.75 - 0.5);
 
     stat->quartile_25 = stat->array[qind_25];
     /*               odd ?     odd                              : even   */
     stat->median = ((n % 2)?
-                    (stat->array[(int)(n/2)]) :
+                    (stat->array[n/2]) :
                     (stat->array[n/2 - 1] + stat->array[n/2]) / 2.0);
     stat->quartile_75 = stat->array[qind_75];
 
@@ -210,6 +221,23 @@ int stats_extend(univar_stat *stat){
 }
 
 
+/* extended statistics from the quantile sketch, the mode is not available */
+int stats_sketch(univar_stat *stat){
+    int p;
+
+    for (p = 0; p < param.n_perc; p++)
+        stat->perc[p] = tdigest_quantile(stat->sketch, 1e-2 * param.perc[p]);
+
+    stat->quartile_25 = tdigest_quantile(stat->sketch, 0.25);
+    stat->median = tdigest_quantile(stat->sketch, 0.5);
+    stat->quartile_75 = tdigest_quantile(stat->sketch, 0.75);
+
+    tdigest_free(stat->sketch);
+    stat->sketch = NULL;
+    return 0;
+}
+
+
 int stats_general(univar_stat *s){
     double n = s->n;
 
@@ -247,7 +275,9 @@ int stats_general(univar_stat *s){
 }
 
 
-int compute_stats(univar_stat *stat, double val, int len){
+/* accumulate one value, values for the extended statistics are
+ * collected by the caller */
+void compute_stats(univar_stat *stat, double val){
     stat->sum += val;
     stat->sum2 += val * val;
     stat->sum3 += val * val * val;
@@ -256,23 +286,59 @@ int compute_stats(univar_stat *stat, double val, int len){
     stat->min = (isnan(stat->min) || val < stat->min)? val: stat->min;
     stat->max = (isnan(stat->max) || val > stat->max)? val: stat->max;
 
-    if (stat->array != NULL)
-        G_debug(3, "Compute_stats, zone: %d, val=%f, %d/%d, n_alloc:%d", stat->zone, val, stat->n, stat->size, stat->n_alloc);
-        stat->array[stat->n] = val;
-
     stat->n++;
+}
 
 
-    if (stat->n == stat->size){
-        G_debug(3, "    Finish the zone: %d, sum=%f", stat->zone, stat->sum);
-        /* finish this zone */
-        stats_general(stat);
-        if (stat->array != NULL){
-            stats_extend(stat);
-            return 1;
+/* add the per-thread statistics in src to dst, src is reset */
+void merge_univar_stats(univar_stat *dst, univar_stat *src){
+    int z, n_zones = zone_info.n_zones;
+
+    for (z = 0; z < n_zones; z++) {
+        univar_stat *d = &dst[z], *s = &src[z];
+
+        if (s->n == 0)
+            continue;
+
+        d->sum += s->sum;
+        d->sum2 += s->sum2;
+        d->sum3 += s->sum3;
+        d->sum4 += s->sum4;
+        d->sum_abs += s->sum_abs;
+        d->min = (isnan(d->min) || s->min < d->min)? s->min: d->min;
+        d->max = (isnan(d->max) || s->max > d->max)? s->max: d->max;
+        d->n += s->n;
+
+        if (s->sketch != NULL) {
+            if (d->sketch == NULL)
+                d->sketch = tdigest_create(param.compr);
+            tdigest_merge(d->sketch, s->sketch);
+            tdigest_free(s->sketch);
+            s->sketch = NULL;
         }
+
+        s->sum = s->sum2 = s->sum3 = s->sum4 = s->sum_abs = 0.0;
+        s->min = s->max = 0.0 / 0.0;
+        s->n = 0;
+    }
+}
+
+
+/* finish all zones once all input maps are processed */
+void finish_univar_stats(univar_stat *stats){
+    int z, n_zones = zone_info.n_zones;
+
+    for (z = 0; z < n_zones; z++) {
+        if (stats[z].n == 0)
+            continue;
+
+        G_debug(3, "    Finish the zone: %d, sum=%f", stats[z].zone, stats[z].sum);
+        stats_general(&stats[z]);
+        if (stats[z].array != NULL)
+            stats_extend(&stats[z]);
+        else if (stats[z].sketch != NULL)
+            stats_sketch(&stats[z]);
     }
-    return 0;
 }
 
 
@@ -331,8 +397,11 @@ void print_cols_table(){
             }
         }
 
-        fprintf(stdout, "%smode", zone_info.sep);
-        fprintf(stdout, "%soccurrences", zone_info.sep);
+        /* the mode is not computed from the sketch */
+        if (!param.approx->answer) {
+            fprintf(stdout, "%smode", zone_info.sep);
+            fprintf(stdout, "%soccurrences", zone_info.sep);
+        }
     }
     fprintf(stdout, "\n");
     return;
@@ -347,11 +416,11 @@ int print_row(univar_stat *stat, char *sep){
     /* zone label */
     fprintf(stdout,"%s%s", sep, stat->cat);
     /* zone all_cells */
-    fprintf(stdout,"%s%d", sep, stat->size);
+    fprintf(stdout,"%s%ld", sep, stat->size);
     /* non-null cells */
-    fprintf(stdout, "%s%d", sep, stat->n);
+    fprintf(stdout, "%s%ld", sep, stat->n);
     /* null cells */
-    fprintf(stdout, "%s%d", sep, stat->null_cells);
+    fprintf(stdout, "%s%ld", sep, stat->null_cells);
 
 
     sprintf(sum_str, "%.15g", stat->sum);
@@ -391,8 +460,10 @@ int print_row(univar_stat *stat, char *sep){
             fprintf(stdout, "%s%g", sep, stat->perc[i]);
         }
 
-        fprintf(stdout, "%s%g", sep, stat->mode);
-        fprintf(stdout, "%s%d", sep, stat->occurrences);
+        if (!param.approx->answer) {
+            fprintf(stdout, "%s%g", sep, stat->mode);
+            fprintf(stdout, "%s%ld", sep, stat->occurrences);
+        }
     }
     fprintf(stdout, "\n");
     return 0;
@@ -0,0 +1,201 @@
+/*
+ *  Mergeable quantile sketch (merging t-digest) for r.univar2
+ *
+ *   Copyright (C) 2018 by the GRASS Development Team
+ *
+ *      This program is free software under the GNU General Public
+ *      License (>=v2). Read the file COPYING that comes with GRASS
+ *      for details.
+ *
+ *  Reference:
+ *  Dunning, T. and Ertl, O. (2019): Computing extremely accurate
+ *  quantiles using t-digests. arXiv:1902.04023
+ *
+ *  Values are collected in a buffer. When the buffer is full, buffer
+ *  and centroids are sorted and merged into new centroids, such that
+ *  each centroid covers at most one unit of the scale function
+ *  k(q) = compression / (2 pi) * asin(2q - 1).
+ *  The number of centroids is bounded by compression + 2, independent
+ *  of the number of values added. Centroids close to the tails are
+ *  small, thus extreme percentiles are more accurate than the median.
+ */
+
+#include <string.h>
+#include "globals.h"
+
+static int cmp_centroid(const void *a, const void *b)
+{
+    const struct centroid *ca = a, *cb = b;
+
+    if (ca->mean < cb->mean)
+        return -1;
+    if (ca->mean > cb->mean)
+        return 1;
+    return 0;
+}
+
+tdigest *tdigest_create(double compression)
+{
+    tdigest *td;
+
+    if (compression < 10)
+        compression = 10;
+
+    td = G_malloc(sizeof(tdigest));
+    td->compression = compression;
+    td->n_cent = 0;
+    td->n_buf = 0;
+    td->max_cent = (int)compression + 10;
+    td->max_buf = 2 * (int)compression;
+    td->c = G_malloc((td->max_cent + td->max_buf) * sizeof(struct centroid));
+    td->total = 0;
+    td->min = td->max = 0.0 / 0.0;
+
+    return td;
+}
+
+void tdigest_free(tdigest *td)
+{
+    if (!td)
+        return;
+    G_free(td->c);
+    G_free(td);
+}
+
+/* upper bound in q for a centroid starting at q0 */
+static double q_limit(const tdigest *td, double q0)
+{
+    double k = asin(2 * q0 - 1) + 2 * M_PI / td->compression;
+
+    if (k >= M_PI / 2)
+        return 1.0;
+
+    return (sin(k) + 1) / 2;
+}
+
+/* merge buffered values into the centroids */
+void tdigest_compress(tdigest *td)
+{
+    int i, n, out;
+    double wsofar, qmax, w;
+    struct centroid cur;
+
+    if (td->n_buf == 0)
+        return;
+
+    n = td->n_cent + td->n_buf;
+    qsort(td->c, n, sizeof(struct centroid), cmp_centroid);
+
+    wsofar = 0;
+    qmax = q_limit(td, 0);
+    cur = td->c[0];
+    out = 0;
+    for (i = 1; i < n; i++) {
+        w = cur.weight + td->c[i].weight;
+        if ((wsofar + w) / td->total <= qmax) {
+            cur.mean += (td->c[i].mean - cur.mean) * td->c[i].weight / w;
+            cur.weight = w;
+        }
+        else {
+            wsofar += cur.weight;
+            td->c[out++] = cur;
+            qmax = q_limit(td, wsofar / td->total);
+            cur = td->c[i];
+        }
+    }
+    td->c[out++] = cur;
+
+    td->n_cent = out;
+    td->n_buf = 0;
+}
+
+static void add_centroid(tdigest *td, double mean, double weight)
+{
+    if (td->n_buf >= td->max_buf)
+        tdigest_compress(td);
+
+    td->c[td->n_cent + td->n_buf].mean = mean;
+    td->c[td->n_cent + td->n_buf].weight = weight;
+    td->n_buf++;
+    td->total += weight;
+}
+
+void tdigest_add(tdigest *td, double val)
+{
+    if (isnan(td->min) || val < td->min)
+        td->min = val;
+    if (isnan(td->max) || val > td->max)
+        td->max = val;
+
+    add_centroid(td, val, 1);
+}
+
+/* merge src into dst, src is not modified */
+void tdigest_merge(tdigest *dst, const tdigest *src)
+{
+    int i;
+
+    if (!src || src->total == 0)
+        return;
+
+    for (i = 0; i < src->n_cent + src->n_buf; i++)
+        add_centroid(dst, src->c[i].mean, src->c[i].weight);
+
+    if (isnan(dst->min) || src->min < dst->min)
+        dst->min = src->min;
+    if (isnan(dst->max) || src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* estimate quantile q, 0 <= q <= 1 */
+double tdigest_quantile(tdigest *td, double q)
+{
+    int i, n;
+    double target, cum, left, right;
+    struct centroid *c;
+
+    tdigest_compress(td);
+
+    n = td->n_cent;
+    c = td->c;
+    if (n == 0)
+        return 0.0 / 0.0;
+
+    if (td->total == n) {
+        /* no values merged: exact, as for sorted values */
+        i = (int)(n * q - 0.5);
+        if (i < 0)
+            i = 0;
+        if (i > n - 1)
+            i = n - 1;
+        return c[i].mean;
+    }
+
+    target = q * td->total;
+
+    /* between min and the center of the first centroid */
+    if (target < c[0].weight / 2) {
+        if (c[0].weight == 1)
+            return td->min;
+        return td->min + (c[0].mean - td->min) * target / (c[0].weight / 2);
+    }
+
+    /* between the centers of two centroids */
+    cum = 0;
+    for (i = 0; i < n - 1; i++) {
+        left = cum + c[i].weight / 2;
+        right = cum + c[i].weight + c[i + 1].weight / 2;
+        if (target < right) {
+            return c[i].mean + (c[i + 1].mean - c[i].mean) *
+                   (target - left) / (right - left);
+        }
+        cum += c[i].weight;
+    }
+
+    /* between the center of the last centroid and max */
+    left = td->total - c[n - 1].weight / 2;
+    if (c[n - 1].weight == 1 || target >= td->total)
+        return td->max;
+    return c[n - 1].mean + (td->max - c[n - 1].mean) *
+           (target - left) / (c[n - 1].weight / 2);
+}
@@ -1,8 +1,12 @@
 #ifndef __LOCAL_PROTO_H__
+#define __LOCAL_PROTO_H__
 
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Triangulation_3.h>
 #include <CGAL/Delaunay_triangulation_3.h>
+#ifdef CGAL_LINKED_WITH_TBB
+#include <CGAL/Delaunay_triangulation_cell_base_3.h>
+#endif
 
 typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
 
@@ -10,9 +14,19 @@ typedef CGAL::Triangulation_3<K>           Triangulation;
 typedef CGAL::Delaunay_triangulation_3<K>  DelaunayTriangulation;
 typedef Triangulation::Point          Point;
 
+#ifdef CGAL_LINKED_WITH_TBB
+/* concurrent data structure, points are inserted by several threads */
+typedef CGAL::Triangulation_data_structure_3<
+    CGAL::Triangulation_vertex_base_3<K>,
+    CGAL::Delaunay_triangulation_cell_base_3<K>,
+    CGAL::Parallel_tag>                    ParallelTds;
+typedef CGAL::Delaunay_triangulation_3<K, ParallelTds> ParallelDelaunayTriangulation;
+#endif
+
 /* read.cpp */
 int read_points(struct Map_info *, int, std::vector<Point>&);
 
 /* write.cpp */
-void write_lines(struct Map_info *, int, const Triangulation *);
+template <class Tr>
+void write_lines(struct Map_info *, int, const Tr &);
 #endif
@@ -21,6 +21,9 @@
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Triangulation_3.h>
 #include <CGAL/Delaunay_triangulation_3.h>
+#ifdef CGAL_LINKED_WITH_TBB
+#include <tbb/global_control.h>
+#endif
 
 extern "C" {
 #include <grass/vector.h>
@@ -29,25 +32,47 @@ extern "C" {
 
 #include "local_proto.h"
 
+/* checks the number of vertices, reports and writes the triangulation */
+template <class Tr>
+static void write_ten(struct Map_info *Out, int type, const Tr &T,
+                      unsigned int npoints)
+{
+    unsigned int nvertices;
+
+    nvertices = T.number_of_vertices();
+    if (nvertices != npoints)
+        G_fatal_error(_("Invalid number of vertices %d (%d)"), 
+                      nvertices, npoints);
+    
+    G_message(_("Number of vertices: %d"), nvertices);
+    G_message(_("Number of edges: %lu"), T.number_of_finite_edges());
+    G_message(_("Number of triangles: %lu"), T.number_of_finite_facets());
+    G_message(_("Number of tetrahedrons: %lu"), T.number_of_finite_cells());
+    
+    G_message(_("Writing output features..."));
+
+    write_lines(Out, type, T);
+}
+
 int main(int argc, char *argv[])
 {
     int type;  /* line or face */
     int field;
-    unsigned int npoints, nvertices;
+    int nthreads;
+    unsigned int npoints;
     
     struct GModule *module;
     
     struct {
-        struct Option *input, *field, *output;
+        struct Option *input, *field, *output, *threads;
     } opt;
     struct {
-        struct Flag *line, *plain;
+        struct Flag *line, *plain, *notopo;
     } flag;
     
     struct Map_info In, Out;
     
     std::vector<Point> points;
-    Triangulation *T;
     
     G_gisinit(argv[0]);
     
@@ -63,6 +88,13 @@ int main(int argc, char *argv[])
 
     opt.output = G_define_standard_option(G_OPT_V_OUTPUT);
 
+    opt.threads = G_define_option();
+    opt.threads->key = "threads";
+    opt.threads->type = TYPE_INTEGER;
+    opt.threads->required = NO;
+    opt.threads->answer = "1";
+    opt.threads->description = _("Number of threads for Delaunay triangulation");
+
     flag.plain = G_define_flag();
     flag.plain->key = 'p';
     flag.plain->description =
@@ -73,6 +105,8 @@ int main(int argc, char *argv[])
     flag.line->description =
 	_("Output triangulation as a graph (lines), not faces");
 
+    flag.notopo = G_define_standard_flag(G_FLG_V_TOPO);
+
     if (G_parser(argc, argv)) {
         exit(EXIT_FAILURE);
     }
@@ -82,6 +116,16 @@ int main(int argc, char *argv[])
     else
 	type = GV_FACE;
 
+    nthreads = atoi(opt.threads->answer);
+    if (nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than 0"), opt.threads->key);
+#ifndef CGAL_LINKED_WITH_TBB
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without TBB support, using one thread"),
+		  G_program_name());
+    nthreads = 1;
+#endif
+
     /* open input map */
     Vect_open_old2(&In, opt.input->answer, "", opt.field->answer);
     Vect_set_error_handler_io(&In, &Out);
@@ -100,28 +144,41 @@ int main(int argc, char *argv[])
     npoints = read_points(&In, field, points);
     Vect_close(&In);
     
-    /* do 3D triangulation */
+    /* do 3D triangulation, the points are sorted along a space
+     * filling curve by the insertion of the range */
     G_message(_("Creating TEN..."));
-    if (!flag.plain->answer)
-        T = reinterpret_cast<Triangulation *>(new DelaunayTriangulation(points.begin(), points.end()));
-    else
-        T = new Triangulation(points.begin(), points.end());
-    
-    nvertices = T->number_of_vertices();
-    if (nvertices != npoints)
-        G_fatal_error(_("Invalid number of vertices %d (%d)"), 
-                      nvertices, npoints);
-    
-    G_message(_("Number of vertices: %d"), nvertices);
-    G_message(_("Number of edges: %lu"), T->number_of_finite_edges());
-    G_message(_("Number of triangles: %lu"), T->number_of_finite_facets());
-    G_message(_("Number of tetrahedrons: %lu"), T->number_of_finite_cells());
-    
-    G_message(_("Writing output features..."));
+    if (flag.plain->answer) {
+        Triangulation T(points.begin(), points.end());
 
-    write_lines(&Out, type, T);
+        write_ten(&Out, type, T, npoints);
+    }
+#ifdef CGAL_LINKED_WITH_TBB
+    else if (nthreads > 1 && npoints > 0) {
+        /* the points are inserted concurrently, the cells of a grid
+         * over their bounding box are locked by the threads */
+        tbb::global_control control(tbb::global_control::max_allowed_parallelism,
+                                    nthreads);
+        CGAL::Bbox_3 bbox = points[0].bbox();
+
+        for (std::vector<Point>::const_iterator it = points.begin();
+             it != points.end(); ++it)
+            bbox += it->bbox();
+        ParallelDelaunayTriangulation::Lock_data_structure locking_ds(bbox, 50);
+        ParallelDelaunayTriangulation T(points.begin(), points.end(), K(),
+                                        &locking_ds);
+
+        write_ten(&Out, type, T, npoints);
+    }
+#endif
+    else {
+        DelaunayTriangulation T(points.begin(), points.end());
+
+        write_ten(&Out, type, T, npoints);
+    }
+    points.clear();
 
-    Vect_build(&Out);
+    if (!flag.notopo->answer)
+        Vect_build(&Out);
     Vect_close(&Out);
 
     exit(EXIT_SUCCESS);
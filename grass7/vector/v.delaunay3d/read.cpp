@@ -19,6 +19,10 @@ int read_points(struct Map_info *Map, int field, std::vector<Point>& OutPoints)
     
     Points = Vect_new_line_struct();
 
+    /* avoid reallocations of the vector if the number is known */
+    if (Vect_level(Map) >= 2)
+        OutPoints.reserve(Vect_get_num_primitives(Map, GV_POINTS));
+
     /* set constraints */
     Vect_set_constraint_type(Map, GV_POINTS);
     if (field > 0)
@@ -10,64 +10,91 @@ extern "C" {
 
 #include "local_proto.h"
 
-void write_lines(struct Map_info *Out, int type, const Triangulation *T)
+/* sets the vertices of a line, Points has room for n vertices */
+static void set_line(struct line_pnts *Points, const Point **pt, int n)
 {
-    int line;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        Points->x[i] = pt[i]->x();
+        Points->y[i] = pt[i]->y();
+        Points->z[i] = pt[i]->z();
+    }
+    Points->n_points = n;
+}
+
+/* writes the finite edges or facets of the triangulation; the line and
+ * category structures are allocated once and only the coordinates and
+ * the category are replaced for each feature */
+template <class Tr>
+void write_lines(struct Map_info *Out, int type, const Tr &T)
+{
+    int line, n, k;
+    long nlines;
+    const Point *pt[3];
     struct line_pnts *Points;
     struct line_cats *Cats;
     
     Points = Vect_new_line_struct();
     Cats = Vect_new_cats_struct();
+
+    n = type == GV_LINE ? 2 : 3;
+    for (k = 0; k < n; k++)
+        Vect_append_point(Points, 0, 0, 0);
+    Vect_cat_set(Cats, 1, 1);
     
     line = 1;
     if (type == GV_LINE) {
-        Triangulation::Finite_edges_iterator eit;
-        Point pt1, pt2;
+        typename Tr::Finite_edges_iterator eit;
         
         /* write edges as lines */
-        for (eit = T->finite_edges_begin(); eit != T->finite_edges_end(); ++eit) {
-            pt1 = eit->first->vertex(eit->second)->point();
-            pt2 = eit->first->vertex(eit->third)->point();
-            G_debug(3, "edge: %f %f %f | %f %f %f", pt1.x(), pt1.y(), pt1.z(),
-                    pt2.x(), pt2.y(), pt2.z());
-            
-            Vect_reset_line(Points);
-            Vect_append_point(Points, pt1.x(), pt1.y(), pt1.z());
-            Vect_append_point(Points, pt2.x(), pt2.y(), pt2.z());
+        nlines = T.number_of_finite_edges();
+        for (eit = T.finite_edges_begin(); eit != T.finite_edges_end(); ++eit) {
+            G_percent(line - 1, nlines, 5);
+            pt[0] = &eit->first->vertex(eit->second)->point();
+            pt[1] = &eit->first->vertex(eit->third)->point();
+            G_debug(3, "edge: %f %f %f | %f %f %f",
+                    pt[0]->x(), pt[0]->y(), pt[0]->z(),
+                    pt[1]->x(), pt[1]->y(), pt[1]->z());
             
-            Vect_reset_cats(Cats);
-            Vect_cat_set(Cats, 1, line++);
+            set_line(Points, pt, n);
+            Cats->cat[0] = line++;
             
             Vect_write_line(Out, type, Points, Cats);
         }
     }
     else {
-        int k;
-        Triangulation::Finite_facets_iterator fit;
-        Point pt1, pt2, pt3;
+        typename Tr::Finite_facets_iterator fit;
         
-        /* write edges as lines */
-        for (fit = T->finite_facets_begin(); fit != T->finite_facets_end(); ++fit) {
-            k = 1;
-            pt1 = fit->first->vertex((fit->second + (k++)) % 4)->point();
-            pt2 = fit->first->vertex((fit->second + (k++)) % 4)->point();
-            pt3 = fit->first->vertex((fit->second + (k++)) % 4)->point();
+        /* write facets as faces */
+        nlines = T.number_of_finite_facets();
+        for (fit = T.finite_facets_begin(); fit != T.finite_facets_end(); ++fit) {
+            G_percent(line - 1, nlines, 5);
+            for (k = 0; k < n; k++)
+                pt[k] = &fit->first->vertex((fit->second + k + 1) % 4)->point();
 
-            G_debug(3, "facet: %f %f %f | %f %f %f | %f %f %f", pt1.x(), pt1.y(), pt1.z(),
-                    pt2.x(), pt2.y(), pt2.z(), pt3.x(), pt3.y(), pt3.z());
+            G_debug(3, "facet: %f %f %f | %f %f %f | %f %f %f",
+                    pt[0]->x(), pt[0]->y(), pt[0]->z(),
+                    pt[1]->x(), pt[1]->y(), pt[1]->z(),
+                    pt[2]->x(), pt[2]->y(), pt[2]->z());
 
-            Vect_reset_line(Points);
-            Vect_append_point(Points, pt1.x(), pt1.y(), pt1.z());
-            Vect_append_point(Points, pt2.x(), pt2.y(), pt2.z());
-            Vect_append_point(Points, pt3.x(), pt3.y(), pt3.z());
-
-            Vect_reset_cats(Cats);
-            Vect_cat_set(Cats, 1, line++);
+            set_line(Points, pt, n);
+            Cats->cat[0] = line++;
             
             Vect_write_line(Out, type, Points, Cats);
         }
     }
+    G_percent(1, 1, 1);
     
     Vect_destroy_line_struct(Points);
     Vect_destroy_cats_struct(Cats);
 }
+
+template void write_lines<Triangulation>(struct Map_info *, int,
+                                         const Triangulation &);
+template void write_lines<DelaunayTriangulation>(struct Map_info *, int,
+                                                 const DelaunayTriangulation &);
+#ifdef CGAL_LINKED_WITH_TBB
+template void write_lines<ParallelDelaunayTriangulation>(struct Map_info *, int,
+                                                         const ParallelDelaunayTriangulation &);
+#endif
@@ -26,60 +26,111 @@
  */
 #define TEMP_DECS 50
 
+/**
+ * The statistics of an annealing run.
+ */
+struct anneal_stats
+{
+    unsigned int better;	/**< moves decreasing the energy */
+    unsigned int worse;		/**< accepted moves increasing the energy */
+    unsigned int ignored;	/**< rejected moves */
+    unsigned int overlaps_created;
+    unsigned int overlaps_removed;
+};
+
 static double calc_label_overlap(label_t * label, int cc, int nc);
-static void do_label_overlap(label_t * label, int cc, int nc);
+static void do_label_overlap(label_t * label, int cc, int nc,
+			     struct anneal_stats *stats);
 
 /**
- * This is just a variable used to show statistics in the end.
+ * This function returns a random number in [0, 1) from the given state.
+ * Each cluster of labels has its own state, so that clusters can be
+ * annealed concurrently and rand() is not shared between threads.
  */
-static unsigned int overlaps_created = 0;
+static double random_uniform(uint64_t * state)
+{
+    /* xorshift64* */
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
 
 /**
- * This is just a variable used to show statistics in the end.
+ * This function returns a non-zero random state for the given seed.
  */
-static unsigned int overlaps_removed = 0;
+static uint64_t random_seed(uint64_t seed)
+{
+    /* splitmix64 */
+    seed += 0x9E3779B97F4A7C15ULL;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+    seed ^= seed >> 31;
+    return seed ? seed : 1;
+}
+
+static int find_root(int *parent, int i)
+{
+    while (parent[i] != i) {
+	parent[i] = parent[parent[i]];
+	i = parent[i];
+    }
+    return i;
+}
+
+static int *cluster_size;
+
+static int cluster_compare(const void *a, const void *b)
+{
+    int ca = *(const int *)a, cb = *(const int *)b;
+
+    if (cluster_size[ca] != cluster_size[cb])
+	return cluster_size[cb] - cluster_size[ca];
+    return ca - cb;
+}
 
 /**
- * This funxtion does the actual sumulated annealing process. Each round 30 x
- * n (the number of labels) a label is picked at random, and placed in a random
- * new position. Then the dE is calculated, and if dE is > 0 the new position is
- * reversed with the probablility 1 - e^(-dE / T).
- @param labels The array of all labels.
- @param n_labels The size of the labels array.
- @params The commandline parameters.
+ * This function anneals one cluster of labels. The labels of a cluster only
+ * overlap with labels of the same cluster, thus the energy of the other
+ * clusters is not changed. Each round 30 x n (the number of labels in the
+ * cluster) a label is picked at random, and placed in a random new
+ * position. Then the dE is calculated, and if dE is > 0 the new position
+ * is reversed with the probablility 1 - e^(-dE / T).
+ * @param labels The array of all labels.
+ * @param members The indices of the labels of the cluster.
+ * @param n_labels The size of the members array.
+ * @param state The random state of the cluster.
+ * @param stats The statistics to update.
  */
-void simulate_annealing(label_t * labels, int n_labels, struct params *p)
+static void anneal_cluster(label_t * labels, const int *members, int n_labels,
+			   uint64_t * state, struct anneal_stats *stats)
 {
     /* The temperature of the system */
     double T;
 
     /* The change in energy */
     double dE;
+    unsigned int t;
 
     T = -1.0 / log(1.0 / 3.0);
-    unsigned int t, tot_better = 0, tot_worse = 0, tot_ign = 0;
-
-    fprintf(stderr, "Optimizing label positions: ...");
     for (t = 0; t < TEMP_DECS; t++) {
 	int i;
 	unsigned int successes = 0, consec_successes = 0;
 
 	for (i = 0; i < (n_labels * 30); i++) {
-	    int l, c, cc, r;
+	    int l, c, cc;
 	    label_t *lp;
 
 	    /* pick a random label */
-	    r = rand();
-	    l = (int)((double)(n_labels) * (r / (RAND_MAX + 1.0)));
-	    lp = &labels[l];
+	    l = (int)((double)(n_labels) * random_uniform(state));
+	    lp = &labels[members[l]];
 	    /* skip labels without sufficient number of candidates */
 	    if (lp->n_candidates < 2)
 		continue;
 
 	    cc = lp->current_candidate;
 	    /*and a random new candidate place */
-	    c = (int)((double)(lp->n_candidates) *
-		      (rand() / (RAND_MAX + 1.0)));
+	    c = (int)((double)(lp->n_candidates) * random_uniform(state));
 	    if (c == cc) {
 		if (c == 0)
 		    c++;
@@ -93,28 +144,28 @@ void simulate_annealing(label_t * labels, int n_labels, struct params *p)
 	    /* if dE < 0 accept */
 	    if (dE < 0.0) {
 		lp->current_score = lp->candidates[c].score;
-		do_label_overlap(lp, cc, c);
+		do_label_overlap(lp, cc, c, stats);
 		lp->current_candidate = c;
 		successes++;
 		consec_successes++;
-		tot_better++;
+		stats->better++;
 	    }
 	    /* else apply with probability p=e^(-dE/T) */
 	    else {
 		double dp, dr;
 
 		dp = pow(M_E, -dE / T);
-		dr = (double)rand() / RAND_MAX;
+		dr = random_uniform(state);
 		if (dr <= dp) {
-		    do_label_overlap(lp, cc, c);
+		    do_label_overlap(lp, cc, c, stats);
 		    lp->current_score += lp->candidates[c].score;
 		    lp->current_candidate = c;
 		    successes++;
 		    consec_successes++;
-		    tot_worse++;
+		    stats->worse++;
 		}
 		else {
-		    tot_ign++;
+		    stats->ignored++;
 		    consec_successes = 0;
 		}
 	    }
@@ -124,14 +175,121 @@ void simulate_annealing(label_t * labels, int n_labels, struct params *p)
 		break;
 	    }
 	}
-	G_percent(t, TEMP_DECS, 1);
 	/* we have found an optimal solution */
 	if (successes == 0) {
 	    break;
 	}
 	T -= 0.1 * T;
     }
-    G_percent(TEMP_DECS, TEMP_DECS, 1);
+}
+
+/**
+ * This function does the actual sumulated annealing process. The labels
+ * are split into clusters, the connected components of the graph of
+ * overlapping candidates, and each cluster is annealed on its own (see
+ * anneal_cluster()). The clusters are annealed concurrently, the largest
+ * ones first.
+ @param labels The array of all labels.
+ @param n_labels The size of the labels array.
+ @params The commandline parameters.
+ */
+void simulate_annealing(label_t * labels, int n_labels, struct params *p)
+{
+    int i, n_clusters, done;
+    int *parent, *cluster_of, *first, *members, *order;
+    uint64_t seed;
+    struct anneal_stats total;
+
+    fprintf(stderr, "Optimizing label positions: ...");
+
+    /* connected components of the overlap graph */
+    parent = G_malloc(n_labels * sizeof(int));
+    for (i = 0; i < n_labels; i++)
+	parent[i] = i;
+    for (i = 0; i < n_labels; i++) {
+	int j, k;
+
+	for (j = 0; j < labels[i].n_candidates; j++) {
+	    label_candidate_t *c = &labels[i].candidates[j];
+
+	    for (k = 0; k < c->n_intersections; k++) {
+		int a = find_root(parent, i);
+		int b = find_root(parent, (int)(c->intersections[k].label -
+						labels));
+
+		if (a != b)
+		    parent[a < b ? b : a] = a < b ? a : b;
+	    }
+	}
+    }
+
+    /* the labels of each cluster, in label order */
+    cluster_of = G_malloc(n_labels * sizeof(int));
+    n_clusters = 0;
+    for (i = 0; i < n_labels; i++) {
+	int r = find_root(parent, i);
+
+	/* roots are the smallest label of their cluster */
+	cluster_of[i] = r == i ? n_clusters++ : cluster_of[r];
+    }
+    G_free(parent);
+
+    first = G_calloc(n_clusters + 1, sizeof(int));
+    for (i = 0; i < n_labels; i++)
+	first[cluster_of[i] + 1]++;
+    for (i = 0; i < n_clusters; i++)
+	first[i + 1] += first[i];
+    members = G_malloc(n_labels * sizeof(int));
+    for (i = 0; i < n_labels; i++)
+	members[first[cluster_of[i]]++] = i;
+    for (i = n_clusters; i > 0; i--)
+	first[i] = first[i - 1];
+    first[0] = 0;
+    G_free(cluster_of);
+
+    cluster_size = G_malloc(n_clusters * sizeof(int));
+    order = G_malloc(n_clusters * sizeof(int));
+    for (i = 0; i < n_clusters; i++) {
+	cluster_size[i] = first[i + 1] - first[i];
+	order[i] = i;
+    }
+    qsort(order, n_clusters, sizeof(int), cluster_compare);
+    G_debug(1, "%d label clusters, largest %d labels", n_clusters,
+	    n_clusters > 0 ? cluster_size[order[0]] : 0);
+    G_free(cluster_size);
+
+    seed = ((uint64_t) rand() << 32) ^ (uint64_t) rand();
+    memset(&total, 0, sizeof(total));
+    done = 0;
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (i = 0; i < n_clusters; i++) {
+	int c = order[i];
+	uint64_t state = random_seed(seed + c);
+	struct anneal_stats stats;
+
+	memset(&stats, 0, sizeof(stats));
+	anneal_cluster(labels, &members[first[c]], first[c + 1] - first[c],
+		       &state, &stats);
+
+#pragma omp critical
+	{
+	    total.better += stats.better;
+	    total.worse += stats.worse;
+	    total.ignored += stats.ignored;
+	    total.overlaps_created += stats.overlaps_created;
+	    total.overlaps_removed += stats.overlaps_removed;
+	    G_percent(done++, n_clusters, 1);
+	}
+    }
+    G_percent(1, 1, 1);
+    G_debug(1, "moves: %u better, %u worse, %u ignored; "
+	    "overlaps: %u created, %u removed", total.better, total.worse,
+	    total.ignored, total.overlaps_created, total.overlaps_removed);
+
+    G_free(first);
+    G_free(members);
+    G_free(order);
 }
 
 /**
@@ -182,8 +340,10 @@ static double calc_label_overlap(label_t * label, int cc, int nc)
  * @param label The label to move
  * @param cc The current candidate
  * @param nc The new potential candidate location
+ * @param stats The statistics to update
  */
-static void do_label_overlap(label_t * label, int cc, int nc)
+static void do_label_overlap(label_t * label, int cc, int nc,
+			     struct anneal_stats *stats)
 {
     int i;
 
@@ -198,7 +358,7 @@ static void do_label_overlap(label_t * label, int cc, int nc)
 	    ol->current_score -= LABEL_OVERLAP_WEIGHT;
 	    label->current_score -= LABEL_OVERLAP_WEIGHT;
 	    /* ol->candidates[oc].score -= LABEL_OVERLAP_WEIGHT; */
-	    overlaps_removed++;
+	    stats->overlaps_removed++;
 	}
     }
 
@@ -213,7 +373,7 @@ static void do_label_overlap(label_t * label, int cc, int nc)
 	    ol->current_score += LABEL_OVERLAP_WEIGHT;
 	    label->current_score += LABEL_OVERLAP_WEIGHT;
 	    /* ol->candidates[oc]->score += 40; */
-	    overlaps_created++;
+	    stats->overlaps_created++;
 	}
     }
 }
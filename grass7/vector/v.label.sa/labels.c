@@ -7,6 +7,8 @@
 static int label_skyline(FT_Face face, const char *charset, label_t * label);
 static struct line_pnts *box_trans_rot(struct bound_box * bb, label_point_t * p,
 				       double angle);
+static void box_corners(struct bound_box * bb, label_point_t * p,
+			double angle, double *x, double *y);
 static void label_point_candidates(label_t * label);
 static void label_line_candidates(label_t * label);
 static int candidate_compare(const void *a, const void *b);
@@ -19,7 +21,8 @@ static double min_dist_2_lines(struct line_pnts *skyline,
 			       struct line_pnts *swathline,
 			       label_point_t * p);
 static int box_overlap(struct bound_box * a, struct bound_box * b);
-static int box_overlap2(struct line_pnts *a, struct line_pnts *b);
+static int box_overlap2(const double *ax, const double *ay,
+			const double *bx, const double *by);
 
 /**
  * The font size in map units. A global variable because I'm lazy :P
@@ -811,32 +814,56 @@ static struct line_pnts *box_trans_rot(struct bound_box * bb, label_point_t * p,
 				       double angle)
 {
     struct line_pnts *Points;
-    double x0, y0, x1, y1, x2, y2;
+    double x[5], y[5];
+    int i;
 
     Points = Vect_new_line_struct();
+    box_corners(bb, p, angle, x, y);
+    for (i = 0; i < 5; i++)
+	Vect_append_point(Points, x[i], y[i], 0);
+
+    return Points;
+}
+
+/**
+ * This function computes the corners of the rotated and translated label
+ * bounding box, as box_trans_rot() does, without allocating a polygon.
+ * @param bb The bounding box to translate and rotate.
+ * @param p The point to translate the bounding box to
+ * @param angle The angle (in radians) to rotate the label counter-clockwise
+ * @param x The 5 X coordinates of the closed polygon
+ * @param y The 5 Y coordinates of the closed polygon
+ */
+static void box_corners(struct bound_box * bb, label_point_t * p,
+			double angle, double *x, double *y)
+{
+    double x0, y0, x1, y1, x2, y2;
 
     /* Lower Left, no rotation needed */
     x0 = p->x + bb->W;
     y0 = p->y + bb->S;
-    Vect_append_point(Points, x0, y0, 0);
+    x[0] = x0;
+    y[0] = y0;
     /* Lower Right */
     x1 = (bb->E - bb->W) * cos(angle);
     y1 = (bb->E - bb->W) * sin(angle);
-    Vect_append_point(Points, x0 + x1, y0 + y1, 0);
+    x[1] = x0 + x1;
+    y[1] = y0 + y1;
 
     /* Upper Right */
     x2 = (bb->N - bb->S) * sin(angle);
     y2 = (bb->N - bb->S) * cos(angle);
     /* First translate to LR, and then translate like UL */
-    Vect_append_point(Points, x0 + x1 - x2, y0 + y1 + y2, 0);
+    x[2] = x0 + x1 - x2;
+    y[2] = y0 + y1 + y2;
 
     /* Upper Left */
-    Vect_append_point(Points, x0 - x2, y0 + y2, 0);
+    x[3] = x0 - x2;
+    y[3] = y0 + y2;
 
     /* close polygon */
-    Vect_append_point(Points, x0, y0, 0);
-
-    return Points;
+    x[4] = x0;
+    y[4] = y0;
 }
 
 /**
@@ -1138,95 +1165,344 @@ static double min_dist_2_lines(struct line_pnts *skyline,
 }
 
 /**
- * This function finds label -label overlaps.
+ * The extent of a label candidate, used to find the candidates that may
+ * overlap.
+ */
+struct cand_box
+{
+    double W, E, S, N;	/**< The extent of the (rotated) label box */
+    int label;		/**< The index of the label */
+    int candidate;	/**< The index of the candidate */
+};
+
+/**
+ * A pair of overlapping candidates, indices into the cand_box array.
+ */
+struct cand_pair
+{
+    int a, b;
+};
+
+/**
+ * A uniform grid over the candidate extents. Each cell holds the indices of
+ * the candidates whose extent touches it, cell i from first[i] to
+ * first[i + 1].
+ */
+struct cand_grid
+{
+    double W, S;	/**< The lower left corner of the grid */
+    double res;		/**< The size of a cell */
+    int cols, rows;
+    int *first;
+    int *cand;
+};
+
+static int grid_col(const struct cand_grid *g, double x)
+{
+    int col = (int)((x - g->W) / g->res);
+
+    return col < 0 ? 0 : (col >= g->cols ? g->cols - 1 : col);
+}
+
+static int grid_row(const struct cand_grid *g, double y)
+{
+    int row = (int)((y - g->S) / g->res);
+
+    return row < 0 ? 0 : (row >= g->rows ? g->rows - 1 : row);
+}
+
+/**
+ * This function puts the candidates to the cells of a grid, which has about
+ * the size of a candidate as cell size.
+ * @param g The grid to build
+ * @param boxes The extents of all candidates
+ * @param n The size of the boxes array
+ */
+static void grid_build(struct cand_grid *g, const struct cand_box *boxes,
+		       int n)
+{
+    int i, row, col;
+    double E, N, size = 0.0;
+    size_t ncells;
+
+    g->W = boxes[0].W;
+    g->S = boxes[0].S;
+    E = boxes[0].E;
+    N = boxes[0].N;
+    for (i = 0; i < n; i++) {
+	if (boxes[i].W < g->W)
+	    g->W = boxes[i].W;
+	if (boxes[i].S < g->S)
+	    g->S = boxes[i].S;
+	if (boxes[i].E > E)
+	    E = boxes[i].E;
+	if (boxes[i].N > N)
+	    N = boxes[i].N;
+	size += (boxes[i].E - boxes[i].W) + (boxes[i].N - boxes[i].S);
+    }
+    g->res = size / (2.0 * n);
+    if (!(g->res > 0.0))
+	g->res = 1.0;
+    /* not much more cells than candidates */
+    while ((E - g->W) / g->res * ((N - g->S) / g->res) > 4.0 * n)
+	g->res *= 2.0;
+    g->cols = (int)((E - g->W) / g->res) + 1;
+    g->rows = (int)((N - g->S) / g->res) + 1;
+    ncells = (size_t)g->cols * g->rows;
+
+    g->first = G_calloc(ncells + 1, sizeof(int));
+    for (i = 0; i < n; i++)
+	for (row = grid_row(g, boxes[i].S); row <= grid_row(g, boxes[i].N);
+	     row++)
+	    for (col = grid_col(g, boxes[i].W);
+		 col <= grid_col(g, boxes[i].E); col++)
+		g->first[(size_t)row * g->cols + col + 1]++;
+    for (i = 0; i < (int)ncells; i++)
+	g->first[i + 1] += g->first[i];
+
+    g->cand = G_malloc(g->first[ncells] * sizeof(int));
+    for (i = 0; i < n; i++)
+	for (row = grid_row(g, boxes[i].S); row <= grid_row(g, boxes[i].N);
+	     row++)
+	    for (col = grid_col(g, boxes[i].W);
+		 col <= grid_col(g, boxes[i].E); col++)
+		g->cand[g->first[(size_t)row * g->cols + col]++] = i;
+    /* the counters now point to the next cell */
+    for (i = (int)ncells; i > 0; i--)
+	g->first[i] = g->first[i - 1];
+    g->first[0] = 0;
+}
+
+/**
+ * This function checks if two label candidates overlap, in the same way
+ * for all candidate pairs as the original pairwise search did.
+ */
+static int candidate_overlap(label_t * la, label_candidate_t * ca,
+			     label_t * lb, label_candidate_t * cb)
+{
+    if ((ca->rotation == 0) && (cb->rotation == 0)) {
+	struct bound_box a, b;
+
+	a.N = la->bb.N + ca->point.y;
+	a.E = la->bb.E + ca->point.x;
+	a.W = la->bb.W + ca->point.x;
+	a.S = la->bb.S + ca->point.y;
+
+	b.N = lb->bb.N + cb->point.y;
+	b.E = lb->bb.E + cb->point.x;
+	b.W = lb->bb.W + cb->point.x;
+	b.S = lb->bb.S + cb->point.y;
+	return box_overlap(&a, &b);
+    }
+    else {
+	double ax[5], ay[5], bx[5], by[5];
+
+	box_corners(&la->bb, &ca->point, ca->rotation, ax, ay);
+	box_corners(&lb->bb, &cb->point, cb->rotation, bx, by);
+	return box_overlap2(ax, ay, bx, by);
+    }
+}
+
+/**
+ * This function finds label -label overlaps. The candidates are put in a
+ * uniform grid, and only the candidates sharing a cell are compared, each
+ * pair in the cell holding the lower left corner of the intersection of
+ * their extents.
  * @param labels The array of labels
  * @param n_labels The size of the array
  */
 void label_candidate_overlap(label_t * labels, int n_labels)
 {
-    int i;
+    int i, t, n_cands, nthreads;
+    int *cand_first;
+    struct cand_box *boxes;
+    struct cand_grid grid;
+    struct cand_pair **pairs;
+    int *n_pairs, *alloc_pairs;
 
     fprintf(stderr, "Finding label overlap: ...");
+
+    cand_first = G_malloc((n_labels + 1) * sizeof(int));
+    cand_first[0] = 0;
+    for (i = 0; i < n_labels; i++)
+	cand_first[i + 1] = cand_first[i] + labels[i].n_candidates;
+    n_cands = cand_first[n_labels];
+    if (n_cands == 0) {
+	G_free(cand_first);
+	G_percent(n_labels, n_labels, 1);
+	return;
+    }
+
+    /* the extents of the candidates */
+    boxes = G_malloc(n_cands * sizeof(struct cand_box));
+#pragma omp parallel for schedule(dynamic, 64)
     for (i = 0; i < n_labels; i++) {
-	int j;
+	int j, k;
 
 	for (j = 0; j < labels[i].n_candidates; j++) {
-	    int k;
-
-	    for (k = i + 1; k < n_labels; k++) {
-		int l;
-
-		for (l = 0; l < labels[k].n_candidates; l++) {
-		    int overlap = 0;
-
-		    if ((labels[i].candidates[j].rotation == 0) &&
-			(labels[k].candidates[l].rotation == 0)) {
-			struct bound_box a, b;
-
-			a.N =
-			    labels[i].bb.N + labels[i].candidates[j].point.y;
-			a.E =
-			    labels[i].bb.E + labels[i].candidates[j].point.x;
-			a.W =
-			    labels[i].bb.W + labels[i].candidates[j].point.x;
-			a.S =
-			    labels[i].bb.S + labels[i].candidates[j].point.y;
-
-			b.N =
-			    labels[k].bb.N + labels[k].candidates[l].point.y;
-			b.E =
-			    labels[k].bb.E + labels[k].candidates[l].point.x;
-			b.W =
-			    labels[k].bb.W + labels[k].candidates[l].point.x;
-			b.S =
-			    labels[k].bb.S + labels[k].candidates[l].point.y;
-			overlap = box_overlap(&a, &b);
-		    }
-		    else {
-			struct line_pnts *a = NULL, *b = NULL;
-
-			a = box_trans_rot(&labels[i].bb,
-					  &labels[i].candidates[j].point,
-					  labels[i].candidates[j].rotation);
-			b = box_trans_rot(&labels[k].bb,
-					  &labels[k].candidates[l].point,
-					  labels[k].candidates[l].rotation);
-			overlap = box_overlap2(a, b);
-			Vect_destroy_line_struct(a);
-			Vect_destroy_line_struct(b);
-		    }
-		    if (overlap) {
-			int n;
-			label_intersection_t *li;
-
-			n = ++(labels[i].candidates[j].n_intersections);
-			li = G_realloc(labels[i].candidates[j].intersections,
-				     n * sizeof(label_intersection_t));
-			if (li == NULL)
-			    G_fatal_error("\nUnable to allocate memory\n");
-			li[n - 1].label = &labels[k];
-			li[n - 1].candidate = l;
-			if ((labels[k].current_candidate == l) &&
-			    (labels[i].current_candidate == j)) {
-			    labels[i].current_score += LABEL_OVERLAP_WEIGHT;
-			    labels[k].current_score += LABEL_OVERLAP_WEIGHT;
+	    label_candidate_t *c = &labels[i].candidates[j];
+	    struct cand_box *b = &boxes[cand_first[i] + j];
+
+	    b->label = i;
+	    b->candidate = j;
+	    if (c->rotation == 0) {
+		b->N = labels[i].bb.N + c->point.y;
+		b->E = labels[i].bb.E + c->point.x;
+		b->W = labels[i].bb.W + c->point.x;
+		b->S = labels[i].bb.S + c->point.y;
+	    }
+	    else {
+		double x[5], y[5];
+
+		box_corners(&labels[i].bb, &c->point, c->rotation, x, y);
+		b->W = b->E = x[0];
+		b->S = b->N = y[0];
+		for (k = 1; k < 4; k++) {
+		    if (x[k] < b->W)
+			b->W = x[k];
+		    if (x[k] > b->E)
+			b->E = x[k];
+		    if (y[k] < b->S)
+			b->S = y[k];
+		    if (y[k] > b->N)
+			b->N = y[k];
+		}
+	    }
+	}
+    }
+    grid_build(&grid, boxes, n_cands);
+
+#if defined(_OPENMP)
+    nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+    pairs = G_calloc(nthreads, sizeof(struct cand_pair *));
+    n_pairs = G_calloc(nthreads, sizeof(int));
+    alloc_pairs = G_calloc(nthreads, sizeof(int));
+
+    /* the overlapping candidates of different labels, each thread
+     * collects its own pairs */
+#pragma omp parallel private(t)
+    {
+#if defined(_OPENMP)
+	t = omp_get_thread_num();
+#else
+	t = 0;
+#endif
+
+#pragma omp for schedule(dynamic, 64)
+	for (i = 0; i < n_labels; i++) {
+	    int a;
+
+	    if (t == 0)
+		G_percent(i, n_labels, 1);
+
+	    for (a = cand_first[i]; a < cand_first[i + 1]; a++) {
+		const struct cand_box *ba = &boxes[a];
+		int row, col, k;
+		double x, y;
+
+		for (row = grid_row(&grid, ba->S);
+		     row <= grid_row(&grid, ba->N); row++) {
+		    for (col = grid_col(&grid, ba->W);
+			 col <= grid_col(&grid, ba->E); col++) {
+			size_t cell = (size_t)row * grid.cols + col;
+
+			for (k = grid.first[cell]; k < grid.first[cell + 1];
+			     k++) {
+			    const struct cand_box *bb = &boxes[grid.cand[k]];
+
+			    if (bb->label <= i)
+				continue;
+			    if (bb->W > ba->E || ba->W > bb->E ||
+				bb->S > ba->N || ba->S > bb->N)
+				continue;
+			    /* count the pair in one cell only */
+			    x = ba->W > bb->W ? ba->W : bb->W;
+			    y = ba->S > bb->S ? ba->S : bb->S;
+			    if (grid_row(&grid, y) != row ||
+				grid_col(&grid, x) != col)
+				continue;
+			    if (!candidate_overlap
+				(&labels[i], &labels[i].candidates[ba->candidate],
+				 &labels[bb->label],
+				 &labels[bb->label].candidates[bb->candidate]))
+				continue;
+
+			    if (n_pairs[t] == alloc_pairs[t]) {
+				alloc_pairs[t] = alloc_pairs[t] * 2 + 1024;
+				pairs[t] = G_realloc(pairs[t],
+						     alloc_pairs[t] *
+						     sizeof(struct cand_pair));
+			    }
+			    pairs[t][n_pairs[t]].a = a;
+			    pairs[t][n_pairs[t]].b = grid.cand[k];
+			    n_pairs[t]++;
 			}
-			labels[i].candidates[j].intersections = li;
-			n = ++(labels[k].candidates[l].n_intersections);
-			li = G_realloc(labels[k].candidates[l].intersections,
-				     n * sizeof(label_intersection_t));
-			if (li == NULL)
-			    G_fatal_error("\nUnable to allocate memory\n");
-			li[n - 1].label = &labels[i];
-			li[n - 1].candidate = j;
-
-			labels[k].candidates[l].intersections = li;
 		    }
 		}
 	    }
 	}
-	G_percent(i, n_labels, 1);
     }
+    G_free(grid.first);
+    G_free(grid.cand);
+
+    /* allocate the intersection lists once */
+    for (t = 0; t < nthreads; t++) {
+	int k;
+
+	for (k = 0; k < n_pairs[t]; k++) {
+	    struct cand_box *ba = &boxes[pairs[t][k].a];
+	    struct cand_box *bb = &boxes[pairs[t][k].b];
+
+	    labels[ba->label].candidates[ba->candidate].n_intersections++;
+	    labels[bb->label].candidates[bb->candidate].n_intersections++;
+	}
+    }
+    for (i = 0; i < n_labels; i++) {
+	int j;
+
+	for (j = 0; j < labels[i].n_candidates; j++) {
+	    label_candidate_t *c = &labels[i].candidates[j];
+
+	    c->intersections = c->n_intersections > 0 ?
+		G_malloc(c->n_intersections * sizeof(label_intersection_t)) :
+		NULL;
+	    c->n_intersections = 0;
+	}
+    }
+
+    for (t = 0; t < nthreads; t++) {
+	int k;
+
+	for (k = 0; k < n_pairs[t]; k++) {
+	    struct cand_box *ba = &boxes[pairs[t][k].a];
+	    struct cand_box *bb = &boxes[pairs[t][k].b];
+	    label_t *la = &labels[ba->label], *lb = &labels[bb->label];
+	    label_candidate_t *ca = &la->candidates[ba->candidate];
+	    label_candidate_t *cb = &lb->candidates[bb->candidate];
+
+	    ca->intersections[ca->n_intersections].label = lb;
+	    ca->intersections[ca->n_intersections].candidate = bb->candidate;
+	    ca->n_intersections++;
+	    cb->intersections[cb->n_intersections].label = la;
+	    cb->intersections[cb->n_intersections].candidate = ba->candidate;
+	    cb->n_intersections++;
+
+	    if ((lb->current_candidate == bb->candidate) &&
+		(la->current_candidate == ba->candidate)) {
+		la->current_score += LABEL_OVERLAP_WEIGHT;
+		lb->current_score += LABEL_OVERLAP_WEIGHT;
+	    }
+	}
+	G_free(pairs[t]);
+    }
+    G_free(pairs);
+    G_free(n_pairs);
+    G_free(alloc_pairs);
+    G_free(boxes);
+    G_free(cand_first);
     G_percent(n_labels, n_labels, 1);
 }
 
@@ -1255,25 +1531,28 @@ static int box_overlap(struct bound_box * a, struct bound_box * b)
 
 /**
  * This function checks if two rotated boxes overlap. The boxes are stored
- * as polygons and the function assumes that each box has exactly 4 sides.
- * @param a Bounding box A
- * @param b Bounding box B
+ * as closed polygons of 5 points, as given by box_corners().
+ * @param ax The X coordinates of box A
+ * @param ay The Y coordinates of box A
+ * @param bx The X coordinates of box B
+ * @param by The Y coordinates of box B
  * @return returns 1 if the given boxes overlap. 0 if not.
  */
-static int box_overlap2(struct line_pnts *a, struct line_pnts *b)
+static int box_overlap2(const double *ax, const double *ay,
+			const double *bx, const double *by)
 {
     int i, r = 0;
 
-    for (i = 0; i < (a->n_points - 1); i++) {
+    for (i = 0; i < 4; i++) {
 	int j;
 
-	for (j = 0; j < (b->n_points - 1); j++) {
+	for (j = 0; j < 4; j++) {
 	    double d[6];
 
-	    r += Vect_segment_intersection(a->x[i], a->y[i], 0,
-					   a->x[i + 1], a->y[i + 1], 0,
-					   b->x[j], b->y[j], 0,
-					   b->x[j + 1], a->y[j + 1], 0,
+	    r += Vect_segment_intersection(ax[i], ay[i], 0,
+					   ax[i + 1], ay[i + 1], 0,
+					   bx[j], by[j], 0,
+					   bx[j + 1], by[j + 1], 0,
 					   &d[0], &d[1], &d[2],
 					   &d[3], &d[4], &d[5], 0);
 	}
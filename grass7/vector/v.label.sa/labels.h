@@ -7,8 +7,12 @@
 #define _LABELS_H
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include <grass/gis.h>
 #include <grass/display.h>
 #include <grass/raster.h>
@@ -124,6 +128,7 @@ struct params
     struct Option *opaque;
     struct Option *bocolor;
     struct Option *bowidth;
+    struct Option *threads;
 
     /*    struct Option */
     /*      struct Option *where; *//* later */
@@ -144,7 +149,8 @@ label_t *labels_init(struct params *p, int *n_labels);
 void label_candidates(label_t * labels, int n_labels);
 
 /**
- * This function checks for all possible label overlap situations
+ * This function checks for all possible label overlap situations. Only
+ * candidates close to each other are compared, using a grid.
  * @param labels The array of labels to check
  * @param n_labels The size of the labels array
  */
@@ -152,7 +158,8 @@ void label_candidate_overlap(label_t * labels, int n_labels);
 
 /**
  * This function performs the actual annealing function. See documentation for
- * more information on simulated Annealing.
+ * more information on simulated Annealing. Clusters of labels which do not
+ * overlap each other are annealed independently, in parallel.
  * @param labels The labels to perform annealing on
  * @param n_labels The size of the labels array
  * @param p The program parametrs.
@@ -26,7 +26,7 @@ int main(int argc, char *argv[])
 {
     struct params p;
     label_t *labels;
-    int n_labels, i;
+    int n_labels, i, nthreads;
     struct GModule *module;
     FILE *labelf;
 
@@ -156,9 +156,28 @@ int main(int argc, char *argv[])
     p.bowidth->answer = "0";
     p.bowidth->guisection = _("Colors");
 
+    p.threads = G_define_option();
+    p.threads->key = "threads";
+    p.threads->type = TYPE_INTEGER;
+    p.threads->required = NO;
+    p.threads->answer = "1";
+    p.threads->description = _("Number of threads for parallel computing");
+
     if (G_parser(argc, argv))
 	exit(EXIT_FAILURE);
 
+    nthreads = atoi(p.threads->answer);
+    if (nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than 0"), p.threads->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+    nthreads = 1;
+#endif
+
     /* initialize labels (get text from database, and get features) */
     labels = labels_init(&p, &n_labels);
     /* start algorithm */
@@ -25,3 +25,7 @@ struct marea
     int count_neg;	/* count of negatives */
     int weight;		/* 0 = all weights 0, 1 = at least one weight > 0 */
 };
+
+/* solve.c */
+int mass_solve(struct lcell *, int, int, struct marea *, int, int, double,
+	       int, int, int);
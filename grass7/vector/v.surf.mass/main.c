@@ -23,12 +23,36 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 #include "globals.h"
 
 /* activate to use the original algorithm of Tobler 1979
 #define TOBLER_STRICT
 */
 
+/* the cells are held in memory if they fit, else in a segment file */
+static SEGMENT out_seg;
+static struct lcell *grid = NULL;
+static int grid_cols;
+
+static void get_lcell(struct lcell *c, int row, int col)
+{
+    if (grid)
+	*c = grid[(size_t)row * grid_cols + col];
+    else
+	Segment_get(&out_seg, c, row, col);
+}
+
+static void put_lcell(struct lcell *c, int row, int col)
+{
+    if (grid)
+	grid[(size_t)row * grid_cols + col] = *c;
+    else
+	Segment_put(&out_seg, c, row, col);
+}
+
 int main(int argc, char *argv[])
 {
     const char *mapset, *column;
@@ -36,13 +60,12 @@ int main(int argc, char *argv[])
     int r1, r2, c1, c2;
     int nsize, rlo, rhi;
 
-    SEGMENT out_seg;
     int srows, scols;
     int w_fd, out_fd, have_weights;
     DCELL *drastbuf;
     double seg_size;
     int seg_mb, segments_in_memory;
-    int doit, iter, maxiter;
+    int doit, iter, maxiter, nthreads;
     double threshold, maxadj;
     int negative = 0;
 
@@ -67,7 +90,7 @@ int main(int argc, char *argv[])
 
     struct GModule *module;
     struct Option *in_opt, *w_opt, *out_opt, *dfield_opt, *col_opt,
-	*memory_opt, *iter_opt, *threshold_opt;
+	*memory_opt, *iter_opt, *threshold_opt, *threads_opt;
 	/* border condition */
     struct Flag *withz_flag; /* allow negative */
 
@@ -133,6 +156,13 @@ int main(int argc, char *argv[])
     memory_opt->answer = "300";
     memory_opt->description = _("Maximum memory to be used for raster output (in MB)");
 
+    threads_opt = G_define_option();
+    threads_opt->key = "threads";
+    threads_opt->type = TYPE_INTEGER;
+    threads_opt->required = NO;
+    threads_opt->answer = "1";
+    threads_opt->description = _("Number of threads for parallel computing");
+
     withz_flag = G_define_flag();
     withz_flag->key = 'z';
     withz_flag->description = _("Use centroid z coordinates for approximation (3D vector maps only)");
@@ -145,6 +175,18 @@ int main(int argc, char *argv[])
 
     maxiter = atoi(iter_opt->answer);
     threshold = atof(threshold_opt->answer);
+
+    nthreads = atoi(threads_opt->answer);
+    if (nthreads < 1)
+	G_fatal_error(_("<%s> must be greater than 0"), threads_opt->key);
+#if defined(_OPENMP)
+    omp_set_num_threads(nthreads);
+#else
+    if (nthreads > 1)
+	G_warning(_("%s was compiled without OpenMP support, using one thread"),
+		  G_program_name());
+    nthreads = 1;
+#endif
     
     /* boundary condition:
      * ignore outside or treat outside as zero */
@@ -218,9 +260,19 @@ int main(int argc, char *argv[])
     /* initialize */
     G_message(_("Initializing..."));
 
-    if (Segment_open(&out_seg, G_tempfile(),
-		     nrows, ncols, srows, scols,
-		     sizeof(struct lcell), segments_in_memory) != 1)
+#ifndef TOBLER_STRICT
+    /* all cells and the coarse grids of the solver fit into memory */
+    if ((double)nrows * ncols * sizeof(struct lcell) * 4 / 3 <=
+	(double)seg_mb * (1 << 20)) {
+	G_verbose_message(_("Holding all cells in memory"));
+	grid = G_malloc((size_t)nrows * ncols * sizeof(struct lcell));
+	grid_cols = ncols;
+    }
+#endif
+
+    if (!grid && Segment_open(&out_seg, G_tempfile(),
+			      nrows, ncols, srows, scols,
+			      sizeof(struct lcell), segments_in_memory) != 1)
 	G_fatal_error(_("Can not create temporary file"));
 
     Points = Vect_new_line_struct();
@@ -373,7 +425,7 @@ int main(int argc, char *argv[])
 		    }
 		}
 	    }
-	    Segment_put(&out_seg, &thiscell, row, col);
+	    put_lcell(&thiscell, row, col);
 	}
     }
     G_percent(row, nrows, 2);
@@ -446,7 +498,7 @@ int main(int argc, char *argv[])
 		    }
 		}
 		if (inside) {
-		    Segment_get(&out_seg, &thiscell, row, col);
+		    get_lcell(&thiscell, row, col);
 		    if (!Rast_is_d_null_value(&thiscell.weight)) {
 			thiscell.area = i;
 			ap = &areas[thiscell.area];
@@ -458,7 +510,7 @@ int main(int argc, char *argv[])
 			}
 			if (ap->weight == 0)
 			    ap->weight = thiscell.weight != 0.0;
-			Segment_put(&out_seg, &thiscell, row, col);
+			put_lcell(&thiscell, row, col);
 		    }
 		}
 	    }
@@ -478,7 +530,7 @@ int main(int argc, char *argv[])
 	G_percent(row, nrows, 2);
 	for (col = 0; col < ncols; col++) {
 
-	    Segment_get(&out_seg, &thiscell, row, col);
+	    get_lcell(&thiscell, row, col);
 	    if (areas[thiscell.area].count > 0 &&
 	        !Rast_is_d_null_value(&thiscell.interp)) {
 
@@ -498,7 +550,7 @@ int main(int argc, char *argv[])
 	    }
 	    if (areas[thiscell.area].count == 0)
 		thiscell.interp = outside_val;
-	    Segment_put(&out_seg, &thiscell, row, col);
+	    put_lcell(&thiscell, row, col);
 	}
     }
     G_percent(row, nrows, 2);
@@ -509,6 +561,11 @@ int main(int argc, char *argv[])
     nsize = 1;
     rlo = -nsize;
     rhi = nsize + 1;
+    if (grid) {
+	mass_solve(grid, nrows, ncols, areas, nareas, maxiter, threshold,
+		   have_weights, negative, nthreads);
+	doit = 0;
+    }
     while (doit) {
 	int l_row = -1, l_col = -1;
 	maxadj = 0;
@@ -756,14 +813,17 @@ int main(int argc, char *argv[])
     for (row = 0; row < nrows; row++) {
 	G_percent(row, nrows, 2);
 	for (col = 0; col < ncols; col++) {
-	    Segment_get(&out_seg, &thiscell, row, col);
+	    get_lcell(&thiscell, row, col);
 	    drastbuf[col] = thiscell.interp;
 	}
 	Rast_put_d_row(out_fd, drastbuf);
     }
     G_percent(row, nrows, 2);
 
-    Segment_close(&out_seg);
+    if (grid)
+	G_free(grid);
+    else
+	Segment_close(&out_seg);
 
     Rast_close(out_fd);
     Rast_short_history(out_opt->answer, "raster", &history);
@@ -0,0 +1,407 @@
+
+/**********************************************************************
+ *
+ * In-memory solver of the mass-preserving interpolation
+ *
+ * The cells are held in one array. An iteration moves each cell towards
+ * the average of its neighbours and scales the cells to the mass of their
+ * area, as the iterations on the segment file do. The adjustments are
+ * computed from the values of the previous iteration, thus all rows are
+ * done in parallel, and the area sums are accumulated per thread.
+ * In-place Gauss-Seidel sweeps would need fewer iterations, but they
+ * converge to a different surface because of the mass scaling.
+ *
+ * Before the full grid, the same problem is solved on a pyramid of
+ * coarser grids of 2x2 cells, the coarsest first. The result of a grid
+ * is the start surface of the next finer one, which removes the large
+ * scale differences that would need many iterations on the full grid.
+ *
+ **********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#include "globals.h"
+
+/* min number of rows and columns of a coarse grid */
+#define MIN_LEVEL 16
+#define MAX_LEVELS 32
+
+struct level
+{
+    int rows, cols;
+    struct lcell *cells;
+    int *count;		/* number of cells of each area */
+};
+
+struct solver
+{
+    struct marea *areas;
+    int nareas;
+    int negative;
+    int nthreads;
+    double *tsum;	/* area sums of each thread */
+    double *tmax;	/* largest squared adjustment of each thread */
+    int *trow, *tcol;	/* and its cell */
+};
+
+static int thread_num(void)
+{
+#if defined(_OPENMP)
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static int is_set(struct lcell *c)
+{
+    return c->area > 0 && !Rast_is_d_null_value(&c->interp);
+}
+
+/* adjustment of a cell to the average of its neighbours */
+static void smooth_cell(struct solver *s, struct level *l, int row, int col)
+{
+    struct lcell *c, *ngbr;
+    int nrow, ncol, count = 0;
+    double value = .0;
+
+    c = &l->cells[(size_t)row * l->cols + col];
+    c->adj = 0;
+    if (!is_set(c))
+	return;
+
+    for (nrow = row - 1; nrow <= row + 1; nrow++) {
+	if (nrow < 0 || nrow >= l->rows)
+	    continue;
+	ngbr = &l->cells[(size_t)nrow * l->cols];
+	for (ncol = col - 1; ncol <= col + 1; ncol++) {
+	    if (ncol < 0 || ncol >= l->cols || (nrow == row && ncol == col))
+		continue;
+	    if (!Rast_is_d_null_value(&ngbr[ncol].interp)) {
+		value += ngbr[ncol].interp;
+		count++;
+	    }
+	}
+    }
+    if (count == 0)
+	return;
+
+    value /= count;
+    value -= c->interp;
+    if (!s->negative) {
+	if (s->areas[c->area].value == 0)
+	    value = 0;
+	if (c->interp + value < 0)
+	    value = -c->interp;
+    }
+    c->adj = value;
+}
+
+static void smooth(struct solver *s, struct level *l)
+{
+    int row, col;
+
+#pragma omp parallel for schedule(static) private(col)
+    for (row = 0; row < l->rows; row++) {
+	for (col = 0; col < l->cols; col++)
+	    smooth_cell(s, l, row, col);
+    }
+}
+
+/* sums of the cells of each area in areas[].interp */
+static void area_sums(struct solver *s, struct level *l)
+{
+    int i, t, row, col;
+    size_t n = s->nareas + 1;
+
+    memset(s->tsum, 0, s->nthreads * n * sizeof(double));
+
+#pragma omp parallel private(row, col)
+    {
+	double *tsum = s->tsum + thread_num() * n;
+	struct lcell *c;
+
+#pragma omp for schedule(static)
+	for (row = 0; row < l->rows; row++) {
+	    c = &l->cells[(size_t)row * l->cols];
+	    for (col = 0; col < l->cols; col++) {
+		if (is_set(&c[col]))
+		    tsum[c[col].area] += c[col].interp + c[col].adj;
+	    }
+	}
+    }
+
+    for (i = 0; i <= s->nareas; i++) {
+	s->areas[i].interp = .0;
+	for (t = 0; t < s->nthreads; t++)
+	    s->areas[i].interp += s->tsum[t * n + i];
+    }
+}
+
+/* scales the cells to the mass of their area, returns the largest
+ * squared adjustment of the iteration, adj being the smoothing */
+static double scale(struct solver *s, struct level *l, int *l_row, int *l_col)
+{
+    int t, row, col;
+    double maxadj;
+
+    area_sums(s, l);
+    for (t = 0; t < s->nthreads; t++) {
+	s->tmax[t] = 0;
+	s->trow[t] = s->tcol[t] = -1;
+    }
+
+#pragma omp parallel private(row, col)
+    {
+	int t = thread_num();
+	struct lcell *c;
+	struct marea *ap;
+	double value, interp;
+
+#pragma omp for schedule(static)
+	for (row = 0; row < l->rows; row++) {
+	    c = &l->cells[(size_t)row * l->cols];
+	    for (col = 0; col < l->cols; col++, c++) {
+		if (!is_set(c))
+		    continue;
+
+		/* multiplication with area scale factor */
+		value = 1;
+		ap = &s->areas[c->area];
+		if (ap->interp != 0)
+		    value = ap->value / ap->interp;
+
+		if (ap->interp == 0 && ap->value != 0)
+		    interp = ap->value / l->count[c->area];
+		else
+		    interp = value * (c->interp + c->adj);
+
+		if (s->negative || interp >= 0) {
+		    value = c->interp - interp;
+		    c->interp = interp;
+
+		    if (s->tmax[t] < value * value) {
+			s->tmax[t] = value * value;
+			s->trow[t] = row;
+			s->tcol[t] = col;
+		    }
+		}
+	    }
+	}
+    }
+
+    /* the threads have consecutive rows, keep the first largest one */
+    maxadj = s->tmax[0];
+    *l_row = s->trow[0];
+    *l_col = s->tcol[0];
+    for (t = 1; t < s->nthreads; t++) {
+	if (maxadj < s->tmax[t]) {
+	    maxadj = s->tmax[t];
+	    *l_row = s->trow[t];
+	    *l_col = s->tcol[t];
+	}
+    }
+
+    return maxadj;
+}
+
+/* multiplies the cells with their weight, keeping the area masses */
+static void apply_weights(struct solver *s, struct level *l)
+{
+    int row, col;
+
+#pragma omp parallel for schedule(static) private(col)
+    for (row = 0; row < l->rows; row++) {
+	struct lcell *c = &l->cells[(size_t)row * l->cols];
+
+	for (col = 0; col < l->cols; col++, c++) {
+	    c->adj = 0;
+	    if (is_set(c))
+		c->interp *= c->weight;
+	}
+    }
+
+    area_sums(s, l);
+
+#pragma omp parallel for schedule(static) private(col)
+    for (row = 0; row < l->rows; row++) {
+	struct lcell *c = &l->cells[(size_t)row * l->cols];
+	struct marea *ap;
+
+	for (col = 0; col < l->cols; col++, c++) {
+	    if (!is_set(c))
+		continue;
+	    ap = &s->areas[c->area];
+	    if (ap->interp != 0)
+		c->interp *= ap->value / ap->interp;
+	}
+    }
+}
+
+/* a coarse cell gets the area of most of its 2x2 cells, the first one
+ * if there is a tie, and the average value of its area */
+static void coarsen(struct solver *s, struct level *f, struct level *l)
+{
+    int row, col, i, j, n, best, nbest, cnt;
+    int area[4];
+    struct lcell *c, *child;
+
+    l->rows = (f->rows + 1) / 2;
+    l->cols = (f->cols + 1) / 2;
+    l->cells = G_malloc((size_t)l->rows * l->cols * sizeof(struct lcell));
+    l->count = G_calloc(s->nareas + 1, sizeof(int));
+
+    for (row = 0; row < l->rows; row++) {
+	for (col = 0; col < l->cols; col++) {
+	    c = &l->cells[(size_t)row * l->cols + col];
+	    c->area = 0;
+	    Rast_set_d_null_value(&c->interp, 1);
+	    c->adj = 0;
+	    c->weight = 1;
+
+	    n = 0;
+	    for (i = 2 * row; i < 2 * row + 2 && i < f->rows; i++) {
+		for (j = 2 * col; j < 2 * col + 2 && j < f->cols; j++) {
+		    child = &f->cells[(size_t)i * f->cols + j];
+		    if (is_set(child))
+			area[n++] = child->area;
+		}
+	    }
+
+	    nbest = 0;
+	    best = 0;
+	    for (i = 0; i < n; i++) {
+		cnt = 0;
+		for (j = i; j < n; j++)
+		    cnt += area[j] == area[i];
+		if (cnt > nbest) {
+		    nbest = cnt;
+		    best = area[i];
+		}
+	    }
+	    if (best > 0) {
+		c->area = best;
+		l->count[best]++;
+	    }
+	}
+    }
+
+    for (i = 0; i < l->rows * l->cols; i++) {
+	c = &l->cells[i];
+	if (c->area > 0)
+	    c->interp = s->areas[c->area].value / l->count[c->area];
+    }
+}
+
+/* the cells of the finer grid take the value of their coarse cell */
+static void prolong(struct level *l, struct level *f)
+{
+    int row, col;
+
+#pragma omp parallel for schedule(static) private(col)
+    for (row = 0; row < f->rows; row++) {
+	struct lcell *c = &f->cells[(size_t)row * f->cols];
+	struct lcell *p = &l->cells[(size_t)(row / 2) * l->cols];
+
+	for (col = 0; col < f->cols; col++, c++) {
+	    if (!is_set(c))
+		continue;
+	    c->interp = p[col / 2].interp;
+	    c->adj = 0;
+	}
+    }
+}
+
+/* interpolates the cells held in memory, returns the number of
+ * iterations on the full grid */
+int mass_solve(struct lcell *cells, int nrows, int ncols,
+	       struct marea *areas, int nareas, int maxiter,
+	       double threshold, int have_weights, int negative,
+	       int nthreads)
+{
+    struct solver s;
+    struct level level[MAX_LEVELS];
+    int i, k, nlevels, iter, doit;
+    int l_row, l_col;
+    double maxadj;
+
+    s.areas = areas;
+    s.nareas = nareas;
+    s.negative = negative;
+    s.nthreads = nthreads;
+    s.tsum = G_malloc(nthreads * (nareas + 1) * sizeof(double));
+    s.tmax = G_malloc(nthreads * sizeof(double));
+    s.trow = G_malloc(nthreads * sizeof(int));
+    s.tcol = G_malloc(nthreads * sizeof(int));
+
+    level[0].rows = nrows;
+    level[0].cols = ncols;
+    level[0].cells = cells;
+    level[0].count = G_malloc((nareas + 1) * sizeof(int));
+    for (i = 0; i <= nareas; i++)
+	level[0].count[i] = areas[i].count;
+
+    nlevels = 1;
+    while (nlevels < MAX_LEVELS && level[nlevels - 1].rows / 2 >= MIN_LEVEL &&
+	   level[nlevels - 1].cols / 2 >= MIN_LEVEL) {
+	coarsen(&s, &level[nlevels - 1], &level[nlevels]);
+	nlevels++;
+    }
+
+    /* coarse to fine, a coarse cell holds the mass of 4^k cells */
+    for (k = nlevels - 1; k > 0; k--) {
+	for (iter = 1; iter <= maxiter; iter++) {
+	    smooth(&s, &level[k]);
+	    maxadj = scale(&s, &level[k], &l_row, &l_col);
+	    if (maxadj < threshold * pow(16, k))
+		break;
+	}
+	G_verbose_message(_("Coarse grid %d x %d: %d iterations"),
+			  level[k].rows, level[k].cols,
+			  iter > maxiter ? maxiter : iter);
+
+	prolong(&level[k], &level[k - 1]);
+	scale(&s, &level[k - 1], &l_row, &l_col);
+
+	G_free(level[k].cells);
+	G_free(level[k].count);
+    }
+
+    doit = 1;
+    iter = 0;
+    while (doit) {
+	G_percent(iter, maxiter, 1);
+	iter++;
+
+	if (have_weights && iter > 1 && iter == maxiter)
+	    apply_weights(&s, &level[0]);
+
+	smooth(&s, &level[0]);
+	maxadj = scale(&s, &level[0], &l_row, &l_col);
+
+	G_verbose_message(_("Largest squared adjustment: %g"), maxadj);
+	G_verbose_message(_("Largest row, col: %d %d"), l_row, l_col);
+	if (iter >= maxiter)
+	    doit = 0;
+	if (maxadj < threshold) {
+	    if (have_weights)
+		maxiter = iter + 1;
+	    else
+		doit = 0;
+	    G_verbose_message(_("Interpolation converged after %d iterations"),
+			      iter);
+	}
+    }
+
+    G_free(level[0].count);
+    G_free(s.tsum);
+    G_free(s.tmax);
+    G_free(s.trow);
+    G_free(s.tcol);
+
+    return iter;
+}